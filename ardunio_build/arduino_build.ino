@@ -14,6 +14,7 @@
 #include <Watchdog.h>
 #include <USBHost_t36.h>
 #include <Mouse.h>
+#include <Keyboard.h>
 #include <SPI.h>
 #include <Wire.h>
 #include <Adafruit_GFX.h>
@@ -57,11 +58,20 @@ Adafruit_SSD1306 display(SCREEN_WIDTH, SCREEN_HEIGHT, &Wire, OLED_RESET);
 #define HEARTBEAT_LED_PIN 6
 
 // -------------------------------------------------------------
-// USB Host and Mouse
+// USB Host, Hubs and Mice
 // -------------------------------------------------------------
+// Two hub drivers cover a hub plus one nested hub (or a combo receiver that
+// enumerates as a hub). Each HID interface behind them needs its own parser.
 USBHost myusb;
+USBHub hub1(myusb);
+USBHub hub2(myusb);
 USBHIDParser hid1(myusb);
+USBHIDParser hid2(myusb);
+USBHIDParser hid3(myusb);
+USBHIDParser hid4(myusb);
 MouseController mouse1(myusb);
+MouseController mouse2(myusb);
+KeyboardController keyboard1(myusb);
 
 // -------------------------------------------------------------
 // Watchdog Setup
@@ -74,12 +84,14 @@ Watchdog watchdog;
 #define DEBUG_MODE 1
 #define NETWORK_DEBUG_MODE 1
 #define MOUSE_DEBUG_MODE 0
+#define KEYBOARD_DEBUG_MODE 0
 #define SMOOTH_MOUSE_MOVEMENT_OVERRIDE_EXISTING 1
 #define EXTERNAL_SERIAL 1
 #define ENABLE_WATCHDOG 0
 #define MAX_MOVE_SPEED 3
 #define MOUSE_MOVE_INTERVAL 1
 #define WAIT_FOR_SERIAL 0
+#define LOOP_PROFILE 0 // 1: DWT stage timing served on CMD_DEBUG (profiling builds only)
 
 // -------------------------------------------------------------
 // Mouse Packet Ring Buffer
@@ -97,12 +109,44 @@ typedef struct __attribute__((packed))
 #define N_MOUSE_PACKETS 16
 const uint32_t minIntervalMs = MAX_MOVE_SPEED;
 
-DMAMEM __attribute__((aligned(32))) static MousePacket mouse_ring[N_MOUSE_PACKETS];
-static volatile uint8_t mouse_ring_head = 0;
-static volatile uint8_t mouse_ring_tail = 0;
+// -------------------------------------------------------------
+// Host Device Routing Table
+// -------------------------------------------------------------
+// One entry per pointing device behind the hub. Every device gets its own
+// packet ring so a slow or idle device never holds up another one; the
+// composer merges all rings into the single report sent to the PC.
+struct HostRoute {
+  MouseController *mouse;
+  const char *name;
+  bool connected;
+  uint16_t vid;
+  uint16_t pid;
+  uint8_t buttons;
+  uint32_t detachedAt;   // millis() of the last unplug, 0 if never
+  uint32_t attachedAt;   // millis() of the last plug, cleared by the first packet
+  MousePacket ring[N_MOUSE_PACKETS];
+  volatile uint8_t head;
+  volatile uint8_t tail;
+  uint32_t packets;
+  uint32_t overflows;
+};
 
-// Store a mouse packet into the ring buffer
-static inline void storeMousePacket(int dx, int dy, int wheel, int hwheel, uint8_t btns) {
+#define N_HOST_ROUTES 2
+DMAMEM __attribute__((aligned(32))) static HostRoute hostRoutes[N_HOST_ROUTES];
+static MouseController *const routeMice[N_HOST_ROUTES] = {&mouse1, &mouse2};
+static const char *const routeNames[N_HOST_ROUTES] = {"Mouse1:", "Mouse2:"};
+
+void initHostRoutes() {
+  for (int i = 0; i < N_HOST_ROUTES; i++) {
+    HostRoute &r = hostRoutes[i];
+    memset(&r, 0, sizeof(r));
+    r.mouse = routeMice[i];
+    r.name = routeNames[i];
+  }
+}
+
+// Store a mouse packet into the route's ring buffer
+static inline void storeMousePacket(HostRoute &r, int dx, int dy, int wheel, int hwheel, uint8_t btns) {
   MousePacket pkt;
   pkt.millis_stamp = millis();
   pkt.dx = dx;
@@ -110,20 +154,62 @@ static inline void storeMousePacket(int dx, int dy, int wheel, int hwheel, uint8
   pkt.wheel = wheel;
   pkt.hwheel = hwheel;
   pkt.buttons = btns;
-  mouse_ring[mouse_ring_head] = pkt;
-  mouse_ring_head = (mouse_ring_head + 1) % N_MOUSE_PACKETS;
+  r.ring[r.head] = pkt;
+  r.head = (r.head + 1) % N_MOUSE_PACKETS;
+  r.packets++;
+  // If the buffer is full, advance the tail to discard the oldest packet
+  if (r.head == r.tail) {
+    r.tail = (r.tail + 1) % N_MOUSE_PACKETS;
+    r.overflows++;
+  }
+}
+
+// Retrieve the next mouse packet from the route's ring buffer
+static inline bool getNextMousePacket(HostRoute &r, MousePacket &pkt) {
+  if (r.tail == r.head)
+    return false; // Buffer empty
+  pkt = r.ring[r.tail];
+  r.tail = (r.tail + 1) % N_MOUSE_PACKETS;
+  return true;
+}
+
+// -------------------------------------------------------------
+// Keyboard Event Ring Buffer
+// -------------------------------------------------------------
+// Filled from the USBHost_t36 raw key callbacks, drained by the keyboard
+// composer on the next loop pass, same as the mouse packet rings.
+typedef struct __attribute__((packed))
+{
+  uint32_t micros_stamp;
+  uint8_t keycode;   // HID usage, or RAW_MODIFIER_BASE + bit for modifiers
+  uint8_t pressed;
+} KeyPacket;
+
+#define N_KEY_PACKETS 32
+#define RAW_MODIFIER_BASE 103   // USBHost_t36 reports modifier bit n as 103 + n
+
+DMAMEM __attribute__((aligned(32))) static KeyPacket key_ring[N_KEY_PACKETS];
+static volatile uint8_t key_ring_head = 0;
+static volatile uint8_t key_ring_tail = 0;
+
+static inline void storeKeyPacket(uint8_t keycode, bool pressed) {
+  KeyPacket pkt;
+  pkt.micros_stamp = micros();
+  pkt.keycode = keycode;
+  pkt.pressed = pressed;
+  key_ring[key_ring_head] = pkt;
+  key_ring_head = (key_ring_head + 1) % N_KEY_PACKETS;
   // If the buffer is full, advance the tail to discard the oldest packet
-  if (mouse_ring_head == mouse_ring_tail) {
-    mouse_ring_tail = (mouse_ring_tail + 1) % N_MOUSE_PACKETS;
+  if (key_ring_head == key_ring_tail) {
+    key_ring_tail = (key_ring_tail + 1) % N_KEY_PACKETS;
   }
 }
 
-// Retrieve the next mouse packet from the ring buffer
-static inline bool getNextMousePacket(MousePacket &pkt) {
-  if (mouse_ring_tail == mouse_ring_head)
+static inline bool getNextKeyPacket(KeyPacket &pkt) {
+  if (key_ring_tail == key_ring_head)
     return false; // Buffer empty
-  pkt = mouse_ring[mouse_ring_tail];
-  mouse_ring_tail = (mouse_ring_tail + 1) % N_MOUSE_PACKETS;
+  pkt = key_ring[key_ring_tail];
+  key_ring_tail = (key_ring_tail + 1) % N_KEY_PACKETS;
   return true;
 }
 
@@ -210,8 +296,13 @@ void handleConnect(const cmd_head_t *header, IPAddress remoteIP, uint16_t remote
 void sendAckResponse(const cmd_head_t *header, IPAddress remoteIP, uint16_t remotePort);
 void handleMonitorCommand(const uint8_t *data, int size, IPAddress remoteIP, uint16_t remotePort);
 void handleMaskCommand(const uint8_t *data, int size);
+void handleKeyboardCommand(const uint8_t *data, int size);
+void composeKeyboardReport();
 void handleEthernetInitialization();
 void handleHeartbeatLED();
+#if LOOP_PROFILE
+void handleStatsCommand(const cmd_head_t *header, IPAddress remoteIP, uint16_t remotePort);
+#endif
 
 // -------------------------------------------------------------
 // Serial Utilities
@@ -240,6 +331,85 @@ void _endSerial() {
 #endif
 }
 
+// -------------------------------------------------------------
+// Loop Profiler
+// -------------------------------------------------------------
+// Each loop() stage is timed with the DWT cycle counter. A run longer than the
+// stage budget counts as an overrun; the loop itself is held to the 1 ms USB
+// frame. Stages nest: handleMouse includes its own USB task pass. CMD_DEBUG
+// returns the table; the new window starts once the loop pass that served it
+// is over, so the stages still open then are not counted in it.
+#if LOOP_PROFILE
+enum ProfStage {
+  PROF_LOOP,
+  PROF_USB_TASK,
+  PROF_HANDLE_MOUSE,
+  PROF_MOVE_UPDATE,
+  PROF_UDP_PARSE,
+  PROF_PROCESS_PACKET,
+  PROF_DISPLAY,
+  N_PROF_STAGES
+};
+
+struct StageStats {
+  const char *name;
+  uint32_t budgetUs;
+  uint32_t count;
+  uint32_t minCycles;
+  uint32_t maxCycles;
+  uint64_t totalCycles;
+  uint32_t overruns;
+};
+
+static StageStats profStages[N_PROF_STAGES] = {
+  {"loop",     1000, 0, UINT32_MAX, 0, 0, 0},
+  {"usbTask",   100, 0, UINT32_MAX, 0, 0, 0},
+  {"mouse",     200, 0, UINT32_MAX, 0, 0, 0},
+  {"moveUpd",    50, 0, UINT32_MAX, 0, 0, 0},
+  {"udpParse",   50, 0, UINT32_MAX, 0, 0, 0},
+  {"packet",    200, 0, UINT32_MAX, 0, 0, 0},
+  {"display",  1000, 0, UINT32_MAX, 0, 0, 0},
+};
+static uint32_t profWindowStart = 0;
+static bool profResetPending = false;
+
+void profInit() {
+  ARM_DEMCR |= ARM_DEMCR_TRCENA;
+  ARM_DWT_CTRL |= ARM_DWT_CTRL_CYCCNTENA;
+  profWindowStart = millis();
+}
+
+void profReset() {
+  for (int i = 0; i < N_PROF_STAGES; i++) {
+    StageStats &st = profStages[i];
+    st.count = 0;
+    st.minCycles = UINT32_MAX;
+    st.maxCycles = 0;
+    st.totalCycles = 0;
+    st.overruns = 0;
+  }
+  profWindowStart = millis();
+  profResetPending = false;
+}
+
+static inline void profRecord(ProfStage stage, uint32_t cycles) {
+  StageStats &st = profStages[stage];
+  st.count++;
+  st.totalCycles += cycles;
+  if (cycles < st.minCycles) st.minCycles = cycles;
+  if (cycles > st.maxCycles) st.maxCycles = cycles;
+  if (cycles > st.budgetUs * (F_CPU_ACTUAL / 1000000)) st.overruns++;
+}
+
+#define PROF_START(var)        uint32_t var = ARM_DWT_CYCCNT
+#define PROF_STOP(stage, var)  profRecord(stage, ARM_DWT_CYCCNT - (var))
+#define PROF_STAGE(stage, ...) do { PROF_START(_profT0); __VA_ARGS__; PROF_STOP(stage, _profT0); } while (0)
+#else
+#define PROF_START(var)
+#define PROF_STOP(stage, var)
+#define PROF_STAGE(stage, ...) do { __VA_ARGS__; } while (0)
+#endif
+
 // -------------------------------------------------------------
 // Soft Restart Utility
 // -------------------------------------------------------------
@@ -303,6 +473,7 @@ void writeDisplay(const char *header, const char *message, int section) {
   }
   strncpy(prevDisplay[section], newDisplay, sizeof(prevDisplay[section]));
 
+  PROF_START(t0);
   int y = section * 16;
   display.fillRect(0, y, SCREEN_WIDTH, 16, SSD1306_BLACK);
   display.setCursor(0, y);
@@ -310,6 +481,7 @@ void writeDisplay(const char *header, const char *message, int section) {
   display.setTextColor(SSD1306_WHITE);
   display.print(newDisplay);
   display.display();
+  PROF_STOP(PROF_DISPLAY, t0);
 }
 
 // -------------------------------------------------------------
@@ -370,11 +542,72 @@ void sendMonitorEvent(const char *eventString) {
 // -------------------------------------------------------------
 // Mouse Handling (USB Host -> Device)
 // -------------------------------------------------------------
-void handleMouse() {
-  myusb.Task(); // Refresh USB data
+void updateHostRoutes() {
+  for (int i = 0; i < N_HOST_ROUTES; i++) {
+    HostRoute &r = hostRoutes[i];
+    bool connected = *r.mouse;
+    if (connected == r.connected)
+      continue;
+    r.connected = connected;
+    r.head = r.tail = 0;
+    r.buttons = 0; // Buttons held on an unplugged device are released on the next pass
+    if (connected) {
+      r.vid = r.mouse->idVendor();
+      r.pid = r.mouse->idProduct();
+      r.attachedAt = millis();
+      char idStr[16];
+      snprintf(idStr, sizeof(idStr), "%04X:%04X", r.vid, r.pid);
+      writeDisplay(r.name, idStr, 0);
+    } else {
+      r.detachedAt = millis();
+      r.attachedAt = 0;
+      writeDisplay(r.name, "Disconnected", 0);
+    }
+#if MOUSE_DEBUG_MODE
+    char debugStr[64];
+    snprintf(debugStr, sizeof(debugStr), "%s %s %04X:%04X", r.name,
+             connected ? "attached" : "detached", r.vid, r.pid);
+    _writeSerial(debugStr);
+#endif
+  }
+
+  mouseConnected = false;
+  for (int i = 0; i < N_HOST_ROUTES; i++)
+    mouseConnected |= hostRoutes[i].connected;
+}
 
-  // Read current button states
-  uint8_t btns = mouse1.getButtons();
+void handleMouse() {
+  PROF_STAGE(PROF_USB_TASK, myusb.Task()); // Refresh USB data
+  updateHostRoutes();
+
+  // Pull whatever each device has reported since the last pass
+  uint8_t btns = 0;
+  for (int i = 0; i < N_HOST_ROUTES; i++) {
+    HostRoute &r = hostRoutes[i];
+    if (!r.connected)
+      continue;
+    if (r.mouse->available()) {
+#if MOUSE_DEBUG_MODE
+      if (r.attachedAt) {
+        char debugStr[96];
+        snprintf(debugStr, sizeof(debugStr), "%s first report %lu ms after plug (%lu ms after unplug)",
+                 r.name, millis() - r.attachedAt, r.detachedAt ? millis() - r.detachedAt : 0UL);
+        _writeSerial(debugStr);
+      }
+#endif
+      r.attachedAt = 0;
+      r.buttons = r.mouse->getButtons();
+      int dx = r.mouse->getMouseX();
+      int dy = r.mouse->getMouseY();
+      int wheel = r.mouse->getWheel();
+      int hwheel = r.mouse->getWheelH();
+      if (dx != 0 || dy != 0 || wheel != 0 || hwheel != 0) {
+        storeMousePacket(r, dx, dy, wheel, hwheel, r.buttons);
+      }
+      r.mouse->mouseDataClear(); // Clear USB host buffer
+    }
+    btns |= r.buttons;
+  }
 
   // Apply masking (existing code)
   if (maskLeftButton)   btns &= ~0x01;
@@ -401,19 +634,314 @@ void handleMouse() {
     }
     mouse_buttons_prev = btns;
   }
+}
+
+// -------------------------------------------------------------
+// Host Motion Composer
+// -------------------------------------------------------------
+// Sums the queued motion of every routed device into one output report per
+// pass. Whatever does not fit in the 8-bit report fields carries over.
+static int32_t composeCarryX = 0;
+static int32_t composeCarryY = 0;
+static int32_t composeCarryWheel = 0;
+static int32_t composeCarryHWheel = 0;
+
+static inline int8_t takeClamped(int32_t &v) {
+  int32_t out = (v > 127) ? 127 : (v < -127 ? -127 : v);
+  v -= out;
+  return (int8_t)out;
+}
+
+void composeHostMotion() {
+#if MOUSE_DEBUG_MODE
+  uint32_t now = millis();
+#endif
+  MousePacket p;
+  for (int i = 0; i < N_HOST_ROUTES; i++) {
+    HostRoute &r = hostRoutes[i];
+    while (getNextMousePacket(r, p)) {
+      composeCarryX += p.dx;
+      composeCarryY += p.dy;
+      composeCarryWheel += p.wheel;
+      composeCarryHWheel += p.hwheel;
+#if MOUSE_DEBUG_MODE
+      uint32_t latency = now - p.millis_stamp;
+      char debugStr[128];
+      snprintf(debugStr, sizeof(debugStr),
+               "Captured %s => dx=%d dy=%d wheel=%d hwheel=%d btn=0x%02X (Latency: %u ms)",
+               r.name, p.dx, p.dy, p.wheel, p.hwheel, p.buttons, (unsigned int)latency);
+      _writeSerial(debugStr);
+#endif
+    }
+  }
+
+  if (maskMovement) {
+    composeCarryX = composeCarryY = 0;
+  }
+  if (composeCarryX == 0 && composeCarryY == 0 && composeCarryWheel == 0 && composeCarryHWheel == 0)
+    return;
+
+  int8_t x = takeClamped(composeCarryX);
+  int8_t y = takeClamped(composeCarryY);
+  int8_t wheel = takeClamped(composeCarryWheel);
+  int8_t hwheel = takeClamped(composeCarryHWheel);
+  Mouse.move(x, y, wheel, hwheel);
+}
+
+// -------------------------------------------------------------
+// Keyboard Proxy and Injection (USB Host -> Device)
+// -------------------------------------------------------------
+// Physical keys and the last cmd_keyboard_all state are kept as 256-bit usage
+// sets and OR-merged into one 6KRO boot report. Like mouse buttons, a change
+// on either side goes out on the same loop pass it is seen.
+struct LatencyStats {
+  uint32_t count;
+  uint32_t minUs;
+  uint32_t maxUs;
+  uint64_t totalUs;
+};
+
+static uint32_t hostKeyBits[8];
+static uint32_t injectKeyBits[8];
+static uint8_t hostModifiers = 0;
+static uint8_t injectModifiers = 0;
+static bool injectDirty = false;
+static bool keyboardAttached = false;
+static uint32_t injectStampUs = 0;
+static LatencyStats hostKeyLatency = {0, UINT32_MAX, 0, 0};
+static LatencyStats injectKeyLatency = {0, UINT32_MAX, 0, 0};
+
+static inline void recordLatency(LatencyStats &st, uint32_t us) {
+  st.count++;
+  st.totalUs += us;
+  if (us < st.minUs) st.minUs = us;
+  if (us > st.maxUs) st.maxUs = us;
+}
+
+static inline void setKeyBit(uint32_t *bits, uint8_t usage, bool on) {
+  if (on) bits[usage >> 5] |= (1UL << (usage & 31));
+  else    bits[usage >> 5] &= ~(1UL << (usage & 31));
+}
+
+void onRawKeyPress(uint8_t keycode) {
+  storeKeyPacket(keycode, true);
+}
+
+void onRawKeyRelease(uint8_t keycode) {
+  storeKeyPacket(keycode, false);
+}
+
+void composeKeyboardReport() {
+  bool changed = injectDirty;
+  uint32_t oldestHostStamp = 0;
+  bool haveHost = false;
+  KeyPacket p;
+
+  // The PC-side keyboard never goes away, so an unplugged keyboard must not
+  // leave its keys held there. Injected keys are kept.
+  bool attached = keyboard1;
+  if (attached != keyboardAttached) {
+    keyboardAttached = attached;
+    if (!attached) {
+      memset(hostKeyBits, 0, sizeof(hostKeyBits));
+      hostModifiers = 0;
+      key_ring_tail = key_ring_head;
+      changed = true;
+    }
+  }
+
+  while (getNextKeyPacket(p)) {
+    if (p.keycode >= RAW_MODIFIER_BASE && p.keycode < RAW_MODIFIER_BASE + 8) {
+      uint8_t bit = 1 << (p.keycode - RAW_MODIFIER_BASE);
+      hostModifiers = p.pressed ? (hostModifiers | bit) : (hostModifiers & ~bit);
+    } else {
+      setKeyBit(hostKeyBits, p.keycode, p.pressed);
+    }
+    if (!haveHost) {
+      oldestHostStamp = p.micros_stamp;
+      haveHost = true;
+    }
+    changed = true;
+  }
+  if (!changed)
+    return;
+
+  uint8_t keys[6] = {0};
+  int n = 0;
+  bool rollover = false;
+  for (int usage = 4; usage < 256; usage++) {
+    uint32_t merged = hostKeyBits[usage >> 5] | injectKeyBits[usage >> 5];
+    if (!(merged & (1UL << (usage & 31))))
+      continue;
+    if (n == 6) {
+      rollover = true;
+      break;
+    }
+    keys[n++] = usage;
+  }
+  if (rollover) {
+    for (int i = 0; i < 6; i++) keys[i] = 0x01; // ErrorRollOver
+  }
+
+  Keyboard.set_modifier(hostModifiers | injectModifiers);
+  Keyboard.set_key1(keys[0]);
+  Keyboard.set_key2(keys[1]);
+  Keyboard.set_key3(keys[2]);
+  Keyboard.set_key4(keys[3]);
+  Keyboard.set_key5(keys[4]);
+  Keyboard.set_key6(keys[5]);
+  Keyboard.send_now();
+
+  uint32_t nowUs = micros();
+  if (haveHost) recordLatency(hostKeyLatency, nowUs - oldestHostStamp);
+  if (injectDirty) recordLatency(injectKeyLatency, nowUs - injectStampUs);
+  injectDirty = false;
+}
+
+void handleKeyboardCommand(const uint8_t *data, int size) {
+  if (size < (int)(sizeof(cmd_head_t) + sizeof(soft_keyboard_t))) {
+#if NETWORK_DEBUG_MODE
+    _writeSerial("Invalid keyboard command: packet too small");
+#endif
+    return;
+  }
+  const soft_keyboard_t *kb = reinterpret_cast<const soft_keyboard_t *>(data + sizeof(cmd_head_t));
+  memset(injectKeyBits, 0, sizeof(injectKeyBits));
+  for (unsigned i = 0; i < sizeof(kb->button); i++) {
+    uint8_t usage = (uint8_t)kb->button[i];
+    if (usage >= 4)
+      setKeyBit(injectKeyBits, usage, true);
+  }
+  injectModifiers = (uint8_t)kb->ctrl;
+  injectStampUs = micros();
+  injectDirty = true;
+}
+
+void printKeyboardLatency() {
+#if KEYBOARD_DEBUG_MODE
+  static uint32_t lastPrint = 0;
+  uint32_t now = millis();
+  if (now - lastPrint < 5000)
+    return;
+  lastPrint = now;
+  const LatencyStats *all[2] = {&hostKeyLatency, &injectKeyLatency};
+  const char *names[2] = {"host", "inject"};
+  for (int i = 0; i < 2; i++) {
+    const LatencyStats &st = *all[i];
+    if (st.count == 0)
+      continue;
+    char debugStr[96];
+    snprintf(debugStr, sizeof(debugStr), "Key->report %s: n=%lu min=%luus avg=%luus max=%luus",
+             names[i], st.count, st.minUs, (uint32_t)(st.totalUs / st.count), st.maxUs);
+    _writeSerial(debugStr);
+  }
+#endif
+}
+
+// -------------------------------------------------------------
+// Control Forwarding (PC -> Physical Device)
+// -------------------------------------------------------------
+// The Teensy core answers the PC's control requests itself and only surfaces
+// the keyboard LED state, so that is what gets replayed on the physical device
+// as SET_REPORT(Output). Requests are queued and issued one per loop() pass so
+// the IN report path never waits on EP0.
+enum CtrlKind : uint8_t {
+  CTRL_SET_REPORT = 0,
+  CTRL_OUT_REPORT,
+  CTRL_KIND_COUNT
+};
 
-  // Handle movement (buffered)
-  int dx = mouse1.getMouseX();
-  int dy = mouse1.getMouseY();
-  int wheel = mouse1.getWheel();
-  int hwheel = mouse1.getWheelH();
+struct CtrlRequest {
+  uint8_t kind;
+  uint8_t reportId;
+  uint8_t reportType;
+  uint8_t len;
+  uint32_t stampUs;
+  uint8_t data[8];
+};
+
+struct CtrlStats {
+  uint32_t submitted;
+  uint32_t issued;
+  uint32_t failed;
+  uint32_t dropped;
+  uint32_t overBudget;
+  uint32_t maxUs;
+};
+
+#define N_CTRL_REQUESTS 8
+#define CTRL_HOST_INTERFACE 0
+static const uint32_t ctrlBudgetUs[CTRL_KIND_COUNT] = {
+  8000, // CTRL_SET_REPORT
+  2000  // CTRL_OUT_REPORT (keyboard LEDs)
+};
+
+static CtrlRequest ctrlRing[N_CTRL_REQUESTS];
+static volatile uint8_t ctrlHead = 0;
+static volatile uint8_t ctrlTail = 0;
+static CtrlStats ctrlStats[CTRL_KIND_COUNT];
+DMAMEM __attribute__((aligned(32))) static uint8_t ctrlXferBuf[8];
+static uint32_t ctrlLastIssueUs = 0;
+static uint8_t lastKeyboardLeds = 0;
+
+bool submitControlRequest(const CtrlRequest &req) {
+  uint8_t next = (ctrlHead + 1) % N_CTRL_REQUESTS;
+  if (next == ctrlTail) {
+    ctrlStats[req.kind].dropped++;
+    return false;
+  }
+  ctrlRing[ctrlHead] = req;
+  ctrlHead = next;
+  ctrlStats[req.kind].submitted++;
+  return true;
+}
 
-  if (dx != 0 || dy != 0 || wheel != 0 || hwheel != 0) {
-    storeMousePacket(dx, dy, wheel, hwheel, btns);
+// Detect PC-side requests the Teensy core has already consumed
+void pollDeviceControlRequests() {
+  uint8_t leds = keyboard_leds;
+  if (leds != lastKeyboardLeds) {
+    lastKeyboardLeds = leds;
+    CtrlRequest req = {};
+    req.kind = CTRL_OUT_REPORT;
+    req.reportType = 2; // Output
+    req.len = 1;
+    req.data[0] = leds;
+    req.stampUs = micros();
+    submitControlRequest(req);
   }
+}
 
-  mouse1.mouseDataClear(); // Clear USB host buffer
+void serviceControlForwarding() {
+  pollDeviceControlRequests();
+  if (ctrlTail == ctrlHead || !(mouseConnected || keyboard1))
+    return;
+
+  // USBHIDParser has a single control setup slot; give the previous transfer a frame
+  uint32_t nowUs = micros();
+  if (nowUs - ctrlLastIssueUs < 1000)
+    return;
+
+  const CtrlRequest &req = ctrlRing[ctrlTail];
+  bool ok;
+  if (req.kind == CTRL_OUT_REPORT && keyboard1) {
+    // The keyboard driver knows which interface owns the LEDs
+    keyboard1.LEDS(req.data[0]);
+    ok = true;
+  } else {
+    memcpy(ctrlXferBuf, req.data, req.len);
+    ok = hid1.sendControlPacket(0x21, 0x09, (req.reportType << 8) | req.reportId,
+                                CTRL_HOST_INTERFACE, req.len, ctrlXferBuf);
+  }
+  CtrlStats &st = ctrlStats[req.kind];
+  uint32_t latency = nowUs - req.stampUs;
+  if (ok) st.issued++;
+  else    st.failed++;
+  if (latency > st.maxUs) st.maxUs = latency;
+  if (latency > ctrlBudgetUs[req.kind]) st.overBudget++;
+  ctrlLastIssueUs = nowUs;
+  ctrlTail = (ctrlTail + 1) % N_CTRL_REQUESTS;
 }
+
 // -------------------------------------------------------------
 // Non-blocking Mouse Movement State
 // -------------------------------------------------------------
@@ -526,9 +1054,11 @@ enum Command : uint32_t
   CMD_MOUSE_WHEEL = 0xFFEEAD38,
   CMD_BEZIER_MOVE = 0x5A4538A2,
   CMD_MONITOR = 0x27388020,
+  CMD_DEBUG = 0x27382021,
   CMD_MASK_MOUSE = 0x23234343,
   CMD_UNMASK_ALL = 0x23344343,
   CMD_SHOW_PIC = 0x12334883,
+  CMD_KEYBOARD_ALL = 0x123C2C2F,
   CMD_REBOOT = 0xAA8855AA
 };
 
@@ -628,6 +1158,11 @@ void processPacket(const uint8_t *data, int size, IPAddress remoteIP, uint16_t r
         sendAckResponse(header, remoteIP, remotePort);
         break;
       }
+#if LOOP_PROFILE
+    case CMD_DEBUG:
+      handleStatsCommand(header, remoteIP, remotePort);
+      break;
+#endif
     case CMD_MASK_MOUSE: {
         handleMaskCommand(data, size);
         sendAckResponse(header, remoteIP, remotePort);
@@ -637,6 +1172,11 @@ void processPacket(const uint8_t *data, int size, IPAddress remoteIP, uint16_t r
       maskLeftButton = maskRightButton = maskMiddleButton = maskMovement = false;
       sendAckResponse(header, remoteIP, remotePort);
       break;
+    case CMD_KEYBOARD_ALL: {
+        handleKeyboardCommand(data, size);
+        sendAckResponse(header, remoteIP, remotePort);
+        break;
+      }
     case CMD_SHOW_PIC: {
         handleLCDImageCommand(data, size);
         sendAckResponse(header, remoteIP, remotePort);
@@ -733,6 +1273,39 @@ void handleMaskCommand(const uint8_t *data, int size) {
 #endif
 }
 
+#if LOOP_PROFILE
+// Replies with the loop profile since the last request, one text line per
+// stage after the usual header. loop() starts the next window.
+void handleStatsCommand(const cmd_head_t *header, IPAddress remoteIP, uint16_t remotePort) {
+  char text[N_PROF_STAGES * 80 + 64];
+  uint32_t now = millis();
+  int len = snprintf(text, sizeof(text), "window %lu ms, %lu MHz, cycles min/avg/max\n",
+                     now - profWindowStart, F_CPU_ACTUAL / 1000000);
+  for (int i = 0; i < N_PROF_STAGES; i++) {
+    StageStats &st = profStages[i];
+    if (st.count == 0)
+      continue;
+    len += snprintf(text + len, sizeof(text) - len, "%-8s n=%lu %lu/%lu/%lu over=%lu (>%lu us)\n",
+                    st.name, st.count, st.minCycles, (uint32_t)(st.totalCycles / st.count),
+                    st.maxCycles, st.overruns, st.budgetUs);
+  }
+  profResetPending = true;
+#if NETWORK_DEBUG_MODE
+  _writeSerial(text);
+#endif
+
+  cmd_head_t resp;
+  resp.mac = header->mac;
+  resp.rand = 0;
+  resp.indexpts = transactionIndex++;
+  resp.cmd = header->cmd;
+  Udp.beginPacket(remoteIP, remotePort);
+  Udp.write((uint8_t *)&resp, sizeof(resp));
+  Udp.write((uint8_t *)text, len);
+  Udp.endPacket();
+}
+#endif
+
 // -------------------------------------------------------------
 // Ethernet Initialization Helper
 // -------------------------------------------------------------
@@ -796,6 +1369,9 @@ void setup() {
   display.display();
   delay(500);
   writeDisplay("Log:", "Display OK", 0);
+  initHostRoutes();
+  keyboard1.attachRawPress(onRawKeyPress);
+  keyboard1.attachRawRelease(onRawKeyRelease);
   myusb.begin();
   _writeSerial("USB Host initialized");
   writeDisplay("Mouse:", "Disconnected", 0);
@@ -808,6 +1384,10 @@ void setup() {
   _writeSerial(uuidStr);
   Mouse.begin();
   _writeSerial("Mouse started");
+  Keyboard.begin();
+#if LOOP_PROFILE
+  profInit();
+#endif
   writeDisplay("Service", "Offline", 3);
   lastActivityTime = now;
   reset_time = now;
@@ -818,35 +1398,20 @@ void setup() {
 // loop()
 // -------------------------------------------------------------
 void loop() {
+  PROF_START(loopT0);
   uint32_t now = millis();
   static uint32_t lastUSBCheck = 0;
   if (now - lastUSBCheck >= 1) { // Check USB every 1ms to prevent over polling
     lastUSBCheck = now;
-    myusb.Task();
+    PROF_STAGE(PROF_USB_TASK, myusb.Task());
   }
-  handleMouse();
+  PROF_STAGE(PROF_HANDLE_MOUSE, handleMouse());
+  serviceControlForwarding();
   updateAutoMouseMove();
-  updateMouseMovementState();
-  static uint32_t lastMousePacketCheck = 0;
-  if (now - lastMousePacketCheck >= 10) {
-    lastMousePacketCheck += 10;
-#if MOUSE_DEBUG_MODE
-    MousePacket p;
-    while (getNextMousePacket(p)) {
-      uint32_t latency = now - p.millis_stamp;
-      char debugStr[128];
-      snprintf(debugStr, sizeof(debugStr),
-               "Captured host mouse => dx=%d dy=%d wheel=%d hwheel=%d btn=0x%02X (Latency: %u ms)",
-               p.dx, p.dy, p.wheel, p.hwheel, p.buttons, (unsigned int)latency);
-      _writeSerial(debugStr);
-    }
-#else
-    MousePacket p;
-    while (getNextMousePacket(p)) {
-      /* do nothing */
-    }
-#endif
-  }
+  PROF_STAGE(PROF_MOVE_UPDATE, updateMouseMovementState());
+  composeHostMotion();
+  composeKeyboardReport();
+  printKeyboardLatency();
 
   // Ethernet link check
   if (ethernetInitialized) {
@@ -871,7 +1436,10 @@ void loop() {
 
   if (ethernetInitialized && ethernetConnected) {
     int packetSize;
-    while ((packetSize = Udp.parsePacket()) > 0) {
+    for (;;) {
+      PROF_STAGE(PROF_UDP_PARSE, packetSize = Udp.parsePacket());
+      if (packetSize <= 0)
+        break;
 #if NETWORK_DEBUG_MODE
       char debugStr[64];
       snprintf(debugStr, sizeof(debugStr), "Received packet: %d bytes", packetSize);
@@ -888,10 +1456,11 @@ void loop() {
     if (now - lastPacketProcessTime >= 10) {
       lastPacketProcessTime = now;
       if (tail != head) {
-        processPacket(ethernetBuffer[tail].data,
-                      ethernetBuffer[tail].size,
-                      ethernetBuffer[tail].remoteIP,
-                      ethernetBuffer[tail].remotePort);
+        PROF_STAGE(PROF_PROCESS_PACKET,
+                   processPacket(ethernetBuffer[tail].data,
+                                 ethernetBuffer[tail].size,
+                                 ethernetBuffer[tail].remoteIP,
+                                 ethernetBuffer[tail].remotePort));
         tail = (tail + 1) % N_NET_PACKETS;
       }
     }
@@ -905,5 +1474,10 @@ void loop() {
     reset_time = now;
     watchdog.reset();
   }
+#endif
+  PROF_STOP(PROF_LOOP, loopT0);
+#if LOOP_PROFILE
+  if (profResetPending)
+    profReset();
 #endif
 }
\ No newline at end of file
@@ -0,0 +1,92 @@
+#include "cmd_wheel.h"
+#include "hot_path.h"
+#include <stddef.h>
+#include <string.h>
+
+#if (CW_SLOTS & (CW_SLOTS - 1)) != 0
+#error "CW_SLOTS must be a power of two"
+#endif
+
+void cw_init(cw_wheel_t *w, uint64_t now_us) {
+    memset(w, 0, sizeof(*w));
+    for (int i = CW_ENTRIES - 1; i >= 0; i--) {
+        w->pool[i].next = w->free;
+        w->free = &w->pool[i];
+    }
+    w->tick = now_us / CW_TICK_US;
+}
+
+HOT_PATH bool cw_add(cw_wheel_t *w, const kp_mouse_t *m) {
+    cw_entry_t *e = w->free;
+    if (!e) {
+        w->stats.full++;
+        return false;
+    }
+    w->free = e->next;
+    e->m = *m;
+
+    // Already due: the bucket the next advance looks at first
+    uint64_t tick = m->at_us / CW_TICK_US;
+    if (tick < w->tick) tick = w->tick;
+
+    // Buckets stay sorted, equal times in the order they were added
+    cw_entry_t **p = &w->slot[tick & (CW_SLOTS - 1)];
+    while (*p && (*p)->m.at_us <= m->at_us) p = &(*p)->next;
+    e->next = *p;
+    *p = e;
+
+    w->count++;
+    w->stats.scheduled++;
+    if (w->count > w->stats.high_water) w->stats.high_water = w->count;
+    return true;
+}
+
+static HOT_PATH void cw_release(cw_wheel_t *w, cw_entry_t **link, uint64_t now_us, cw_release_fn fn, void *ctx) {
+    cw_entry_t *e = *link;
+    *link = e->next;
+    w->count--;
+    w->stats.released++;
+    fn(ctx, &e->m, now_us);
+    e->next = w->free;
+    w->free = e;
+}
+
+HOT_PATH bool cw_advance(cw_wheel_t *w, uint64_t now_us, cw_release_fn fn, void *ctx) {
+    uint64_t target = now_us / CW_TICK_US;
+    bool ran = false;
+
+    if (w->count && target - w->tick >= CW_SLOTS) {
+        // More than a turn since the last advance: buckets no longer come
+        // due in index order, so take the earliest head each time
+        for (;;) {
+            cw_entry_t **first = NULL;
+            for (int i = 0; i < CW_SLOTS; i++) {
+                if (w->slot[i] && (!first || w->slot[i]->m.at_us < (*first)->m.at_us)) first = &w->slot[i];
+            }
+            if (!first || (*first)->m.at_us > now_us) break;
+            cw_release(w, first, now_us, fn, ctx);
+            ran = true;
+        }
+    } else if (w->count) {
+        for (uint64_t t = w->tick; t <= target; t++) {
+            cw_entry_t **head = &w->slot[t & (CW_SLOTS - 1)];
+            while (*head && (*head)->m.at_us <= now_us) {
+                cw_release(w, head, now_us, fn, ctx);
+                ran = true;
+            }
+        }
+    }
+    // The current tick's bucket can still hold commands due later in it
+    w->tick = target;
+    return ran;
+}
+
+HOT_PATH bool cw_next(const cw_wheel_t *w, uint64_t *at_us) {
+    const cw_entry_t *first = NULL;
+    if (!w->count) return false;
+    for (int i = 0; i < CW_SLOTS; i++) {
+        if (w->slot[i] && (!first || w->slot[i]->m.at_us < first->m.at_us)) first = w->slot[i];
+    }
+    *at_us = first->m.at_us;
+    return true;
+}
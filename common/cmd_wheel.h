@@ -0,0 +1,81 @@
+/**
+ * @file cmd_wheel.h
+ * @brief Timer wheel holding KMBox commands until their execute-at time.
+ *
+ * A hashed wheel of CW_SLOTS buckets, CW_TICK_US wide, over a fixed pool of
+ * entries: adding a command is a bucket index and a short sorted insert,
+ * and each advance only looks at the buckets whose tick has passed.
+ * Commands further out than one turn stay in their bucket until the turn
+ * they are due in. Times are the device's 64-bit microsecond clock.
+ *
+ * Not thread-safe: one wheel per core, added to and advanced from that
+ * core only.
+ */
+#ifndef CMD_WHEEL_H
+#define CMD_WHEEL_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "kmbox_proto.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifndef CW_TICK_US
+#define CW_TICK_US   125   // One high-speed microframe: finer than any report interval
+#endif
+#ifndef CW_SLOTS
+#define CW_SLOTS     64    // Power of two: 8 ms per turn at the default tick
+#endif
+#ifndef CW_ENTRIES
+#define CW_ENTRIES   64    // Commands that can be waiting at once
+#endif
+
+typedef struct cw_entry {
+    struct cw_entry *next;
+    kp_mouse_t       m;    // m.at_us is the due time
+} cw_entry_t;
+
+typedef struct {
+    uint32_t scheduled;
+    uint32_t released;
+    uint32_t full;         // Refused: every entry in use
+    uint32_t high_water;
+} cw_stats_t;
+
+typedef struct {
+    cw_entry_t *slot[CW_SLOTS];
+    cw_entry_t *free;
+    uint64_t    tick;      // Next tick to process
+    uint32_t    count;
+    cw_entry_t  pool[CW_ENTRIES];
+    cw_stats_t  stats;
+} cw_wheel_t;
+
+// Called for each command as it comes due, in due order. now_us is the time
+// of the advance, so now_us - m->at_us is how late the release is.
+typedef void (*cw_release_fn)(void *ctx, const kp_mouse_t *m, uint64_t now_us);
+
+void cw_init(cw_wheel_t *w, uint64_t now_us);
+
+// Hold m until m->at_us. Commands already due come out on the next advance.
+// Returns false if the pool is exhausted.
+bool cw_add(cw_wheel_t *w, const kp_mouse_t *m);
+
+// Release everything due at now_us. Returns true if anything came out.
+bool cw_advance(cw_wheel_t *w, uint64_t now_us, cw_release_fn fn, void *ctx);
+
+// Earliest execute-at time waiting, false if the wheel is empty. Looks at
+// every bucket head, so it is for arming a wake-up, not for every pass.
+bool cw_next(const cw_wheel_t *w, uint64_t *at_us);
+
+static inline uint32_t cw_count(const cw_wheel_t *w) {
+    return w->count;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // CMD_WHEEL_H
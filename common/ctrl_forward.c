@@ -0,0 +1,192 @@
+#include "ctrl_forward.h"
+#include <string.h>
+
+#define CF_MASK (CF_QUEUE_DEPTH - 1)
+
+typedef struct {
+    bool     valid;
+    uint8_t  itf;
+    uint8_t  report_id;
+    uint8_t  report_type;
+    uint16_t len;
+    uint8_t  data[CF_MAX_PAYLOAD];
+} cf_cache_slot_t;
+
+static cf_request_t cf_ring[CF_QUEUE_DEPTH];
+static volatile uint32_t cf_head = 0;  // Written by producer only
+static volatile uint32_t cf_tail = 0;  // Written by consumer only
+
+static cf_kind_stats_t cf_kind_stats[CF_KIND_COUNT];
+static cf_cache_slot_t cf_cache[CF_CACHE_SLOTS];
+static uint8_t cf_cache_victim = 0;
+
+// Default budgets: LED/OUT reports inside two frames, settings well inside the
+// 50 ms a host allows for a control transfer, GET_REPORT refreshes are only
+// worth doing if they land before the PC is likely to ask again.
+static uint32_t cf_budgets[CF_KIND_COUNT] = {
+    8000,   // CF_KIND_SET_REPORT
+    4000,   // CF_KIND_GET_REPORT
+    10000,  // CF_KIND_SET_IDLE
+    10000,  // CF_KIND_SET_PROTOCOL
+    2000,   // CF_KIND_OUT_REPORT
+};
+
+void cf_init(void) {
+    cf_head = 0;
+    cf_tail = 0;
+    memset(cf_kind_stats, 0, sizeof(cf_kind_stats));
+    memset(cf_cache, 0, sizeof(cf_cache));
+    cf_cache_victim = 0;
+}
+
+bool cf_submit(const cf_request_t *req) {
+    if (req->kind >= CF_KIND_COUNT) return false;
+    uint32_t head = cf_head;
+    uint32_t tail = __atomic_load_n(&cf_tail, __ATOMIC_ACQUIRE);
+    if (head - tail >= CF_QUEUE_DEPTH) {
+        cf_kind_stats[req->kind].dropped++;
+        return false;
+    }
+    cf_ring[head & CF_MASK] = *req;
+    if (cf_ring[head & CF_MASK].len > CF_MAX_PAYLOAD)
+        cf_ring[head & CF_MASK].len = CF_MAX_PAYLOAD;
+    __atomic_store_n(&cf_head, head + 1, __ATOMIC_RELEASE);
+    cf_kind_stats[req->kind].submitted++;
+    return true;
+}
+
+static bool cf_same_key(const cf_request_t *a, const cf_request_t *b) {
+    return a->kind == b->kind && a->itf == b->itf && a->report_id == b->report_id &&
+           a->report_type == b->report_type;
+}
+
+bool cf_take(cf_request_t *out, uint32_t now_us) {
+    uint32_t tail = cf_tail;
+    uint32_t head = __atomic_load_n(&cf_head, __ATOMIC_ACQUIRE);
+
+    while (tail != head) {
+        const cf_request_t *req = &cf_ring[tail & CF_MASK];
+        bool superseded = false;
+        for (uint32_t i = tail + 1; i != head; i++) {
+            if (cf_same_key(req, &cf_ring[i & CF_MASK])) {
+                superseded = true;
+                break;
+            }
+        }
+        if (superseded) {
+            cf_kind_stats[req->kind].coalesced++;
+        } else if (req->kind == CF_KIND_GET_REPORT &&
+                   (uint32_t)(now_us - req->stamp_us) > cf_budgets[CF_KIND_GET_REPORT]) {
+            // The PC already got the cached copy; a late refresh is not worth the bus time
+            cf_kind_stats[req->kind].dropped++;
+        } else {
+            *out = *req;
+            __atomic_store_n(&cf_tail, tail + 1, __ATOMIC_RELEASE);
+            return true;
+        }
+        tail++;
+        __atomic_store_n(&cf_tail, tail, __ATOMIC_RELEASE);
+    }
+    return false;
+}
+
+void cf_complete(const cf_request_t *req, bool ok, uint32_t now_us) {
+    if (req->kind >= CF_KIND_COUNT) return;
+    cf_kind_stats_t *st = &cf_kind_stats[req->kind];
+    uint32_t latency = now_us - req->stamp_us;
+    if (ok) st->completed++;
+    else    st->failed++;
+    st->last_us = latency;
+    if (latency > st->max_us) st->max_us = latency;
+    if (latency > cf_budgets[req->kind]) st->over_budget++;
+}
+
+uint32_t cf_budget_us(cf_kind_t kind) {
+    return (kind < CF_KIND_COUNT) ? cf_budgets[kind] : 0;
+}
+
+void cf_set_budget_us(cf_kind_t kind, uint32_t budget_us) {
+    if (kind < CF_KIND_COUNT) cf_budgets[kind] = budget_us;
+}
+
+void cf_build_setup(const cf_request_t *req, uint8_t setup[8]) {
+    uint8_t  bRequest = CF_HID_SET_REPORT;
+    uint8_t  bmRequestType = 0x21;  // Host-to-device, class, interface
+    uint16_t wValue = (uint16_t)((req->report_type << 8) | req->report_id);
+    uint16_t wLength = req->len;
+
+    switch (req->kind) {
+        case CF_KIND_GET_REPORT:
+            bmRequestType = 0xA1;
+            bRequest = CF_HID_GET_REPORT;
+            break;
+        case CF_KIND_SET_IDLE:
+            bRequest = CF_HID_SET_IDLE;
+            wValue = (uint16_t)((req->value << 8) | req->report_id);
+            wLength = 0;
+            break;
+        case CF_KIND_SET_PROTOCOL:
+            bRequest = CF_HID_SET_PROTOCOL;
+            wValue = req->value;
+            wLength = 0;
+            break;
+        case CF_KIND_OUT_REPORT:
+            // Devices without an interrupt OUT endpoint take output reports on EP0
+            wValue = (uint16_t)((2 << 8) | req->report_id);
+            break;
+        default:
+            break;
+    }
+
+    setup[0] = bmRequestType;
+    setup[1] = bRequest;
+    setup[2] = (uint8_t)(wValue & 0xFF);
+    setup[3] = (uint8_t)(wValue >> 8);
+    setup[4] = req->itf;
+    setup[5] = 0;
+    setup[6] = (uint8_t)(wLength & 0xFF);
+    setup[7] = (uint8_t)(wLength >> 8);
+}
+
+static cf_cache_slot_t *cf_cache_find(uint8_t itf, uint8_t report_id, uint8_t report_type) {
+    for (int i = 0; i < CF_CACHE_SLOTS; i++) {
+        cf_cache_slot_t *s = &cf_cache[i];
+        if (s->valid && s->itf == itf && s->report_id == report_id && s->report_type == report_type)
+            return s;
+    }
+    return NULL;
+}
+
+void cf_cache_store(uint8_t itf, uint8_t report_id, uint8_t report_type,
+                    const uint8_t *data, uint16_t len) {
+    cf_cache_slot_t *s = cf_cache_find(itf, report_id, report_type);
+    if (!s) {
+        s = &cf_cache[cf_cache_victim];
+        cf_cache_victim = (uint8_t)((cf_cache_victim + 1) % CF_CACHE_SLOTS);
+    }
+    if (len > CF_MAX_PAYLOAD) len = CF_MAX_PAYLOAD;
+    s->valid = false;
+    s->itf = itf;
+    s->report_id = report_id;
+    s->report_type = report_type;
+    s->len = len;
+    memcpy(s->data, data, len);
+    s->valid = true;
+}
+
+uint16_t cf_cache_load(uint8_t itf, uint8_t report_id, uint8_t report_type,
+                       uint8_t *buf, uint16_t maxlen) {
+    cf_cache_slot_t *s = cf_cache_find(itf, report_id, report_type);
+    if (!s) return 0;
+    uint16_t n = (s->len < maxlen) ? s->len : maxlen;
+    memcpy(buf, s->data, n);
+    return n;
+}
+
+const cf_kind_stats_t *cf_stats(cf_kind_t kind) {
+    return (kind < CF_KIND_COUNT) ? &cf_kind_stats[kind] : NULL;
+}
+
+uint32_t cf_pending(void) {
+    return __atomic_load_n(&cf_head, __ATOMIC_ACQUIRE) - __atomic_load_n(&cf_tail, __ATOMIC_ACQUIRE);
+}
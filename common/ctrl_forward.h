@@ -0,0 +1,92 @@
+/**
+ * @file ctrl_forward.h
+ * @brief PC -> physical device control and OUT report forwarding queue.
+ *
+ * The device-side USB stack submits SET_REPORT / SET_IDLE / SET_PROTOCOL /
+ * GET_REPORT requests and interrupt OUT reports from its callbacks; the
+ * host-side pump takes them one at a time and replays them on the physical
+ * device asynchronously, so the IN report path never waits on a control
+ * transfer. Single producer, single consumer, no locks.
+ */
+#ifndef CTRL_FORWARD_H
+#define CTRL_FORWARD_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define CF_QUEUE_DEPTH   16   // Must be a power of two
+#define CF_MAX_PAYLOAD   64   // Largest report we forward (full-speed EP0 / interrupt MPS)
+#define CF_CACHE_SLOTS   8    // Feature/input reports kept for GET_REPORT
+
+// HID class requests (HID 1.11, 7.2)
+#define CF_HID_GET_REPORT    0x01
+#define CF_HID_SET_REPORT    0x09
+#define CF_HID_SET_IDLE      0x0A
+#define CF_HID_SET_PROTOCOL  0x0B
+
+typedef enum {
+    CF_KIND_SET_REPORT = 0,
+    CF_KIND_GET_REPORT,
+    CF_KIND_SET_IDLE,
+    CF_KIND_SET_PROTOCOL,
+    CF_KIND_OUT_REPORT,
+    CF_KIND_COUNT
+} cf_kind_t;
+
+typedef struct {
+    uint8_t  kind;         // cf_kind_t
+    uint8_t  itf;          // Interface number on the physical device
+    uint8_t  report_id;
+    uint8_t  report_type;  // 1 = input, 2 = output, 3 = feature
+    uint16_t value;        // Idle rate (SET_IDLE) or protocol (SET_PROTOCOL)
+    uint16_t len;
+    uint32_t stamp_us;     // Time the PC issued the request
+    uint8_t  data[CF_MAX_PAYLOAD];
+} cf_request_t;
+
+typedef struct {
+    uint32_t submitted;
+    uint32_t completed;
+    uint32_t failed;
+    uint32_t dropped;      // Queue full or stale refresh
+    uint32_t coalesced;    // Superseded by a newer request with the same key
+    uint32_t over_budget;
+    uint32_t last_us;
+    uint32_t max_us;
+} cf_kind_stats_t;
+
+void cf_init(void);
+
+// Producer side (device stack callbacks). Returns false if the queue is full.
+bool cf_submit(const cf_request_t *req);
+
+// Consumer side (host pump). Skips requests superseded by a newer one with the
+// same (kind, itf, report_id) and stale GET_REPORT refreshes.
+bool cf_take(cf_request_t *out, uint32_t now_us);
+void cf_complete(const cf_request_t *req, bool ok, uint32_t now_us);
+
+// Latency budget from PC request to physical device completion.
+uint32_t cf_budget_us(cf_kind_t kind);
+void cf_set_budget_us(cf_kind_t kind, uint32_t budget_us);
+
+// Fill the 8-byte SETUP packet for a control-type request.
+void cf_build_setup(const cf_request_t *req, uint8_t setup[8]);
+
+// GET_REPORT is answered from this cache immediately and refreshed in the background.
+void cf_cache_store(uint8_t itf, uint8_t report_id, uint8_t report_type,
+                    const uint8_t *data, uint16_t len);
+uint16_t cf_cache_load(uint8_t itf, uint8_t report_id, uint8_t report_type,
+                       uint8_t *buf, uint16_t maxlen);
+
+const cf_kind_stats_t *cf_stats(cf_kind_t kind);
+uint32_t cf_pending(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // CTRL_FORWARD_H
@@ -0,0 +1,78 @@
+#include "desc_cache.h"
+#include <string.h>
+
+static uint16_t dc_clamp(uint16_t len, uint16_t max) {
+    return (len > max) ? max : len;
+}
+
+void dc_begin(dc_record_t *rec, const uint8_t *device, uint16_t len) {
+    memset(rec, 0, sizeof(*rec));
+    rec->hdr.magic = DC_MAGIC;
+    rec->hdr.version = DC_VERSION;
+    memcpy(rec->device, device, dc_clamp(len, DC_DEVICE_LEN));
+
+    // idVendor, idProduct, bcdDevice (USB 2.0, 9.6.1)
+    rec->hdr.vid = (uint16_t)(rec->device[8] | (rec->device[9] << 8));
+    rec->hdr.pid = (uint16_t)(rec->device[10] | (rec->device[11] << 8));
+    rec->hdr.bcd_device = (uint16_t)(rec->device[12] | (rec->device[13] << 8));
+}
+
+void dc_set_config(dc_record_t *rec, const uint8_t *data, uint16_t len) {
+    rec->hdr.config_len = dc_clamp(len, DC_CONFIG_MAX);
+    memcpy(rec->config, data, rec->hdr.config_len);
+}
+
+void dc_set_report(dc_record_t *rec, const uint8_t *data, uint16_t len) {
+    rec->hdr.report_len = dc_clamp(len, DC_REPORT_MAX);
+    memcpy(rec->report, data, rec->hdr.report_len);
+}
+
+void dc_set_string(dc_record_t *rec, dc_string_t which, const uint8_t *data, uint16_t len) {
+    if ((unsigned)which >= DC_STRINGS) return;
+    rec->hdr.string_len[which] = dc_clamp(len, DC_STRING_MAX);
+    memcpy(rec->strings[which], data, rec->hdr.string_len[which]);
+}
+
+uint32_t dc_crc32(uint32_t crc, const void *data, uint32_t len) {
+    const uint8_t *p = (const uint8_t *)data;
+    crc = ~crc;
+    while (len--) {
+        crc ^= *p++;
+        for (int k = 0; k < 8; k++)
+            crc = (crc >> 1) ^ (0xEDB88320u & (0u - (crc & 1u)));
+    }
+    return ~crc;
+}
+
+static uint32_t dc_record_crc(const dc_record_t *rec) {
+    dc_header_t hdr = rec->hdr;
+    hdr.crc = 0;
+    uint32_t crc = dc_crc32(0, &hdr, sizeof(hdr));
+    return dc_crc32(crc, (const uint8_t *)rec + sizeof(dc_header_t), sizeof(*rec) - sizeof(dc_header_t));
+}
+
+void dc_seal(dc_record_t *rec, uint32_t sequence) {
+    rec->hdr.sequence = sequence;
+    rec->hdr.crc = dc_record_crc(rec);
+}
+
+bool dc_valid(const dc_record_t *rec) {
+    if (rec->hdr.magic != DC_MAGIC || rec->hdr.version != DC_VERSION) return false;
+    if (rec->hdr.config_len > DC_CONFIG_MAX || rec->hdr.report_len > DC_REPORT_MAX) return false;
+    for (int i = 0; i < DC_STRINGS; i++) {
+        if (rec->hdr.string_len[i] > DC_STRING_MAX) return false;
+    }
+    return rec->hdr.crc == dc_record_crc(rec);
+}
+
+bool dc_key_matches(const dc_record_t *rec, uint16_t vid, uint16_t pid, uint16_t bcd_device) {
+    return rec->hdr.vid == vid && rec->hdr.pid == pid && rec->hdr.bcd_device == bcd_device;
+}
+
+bool dc_same_content(const dc_record_t *a, const dc_record_t *b) {
+    // Unused tails are zeroed by dc_begin(), so whole-buffer compares are safe
+    if (a->hdr.config_len != b->hdr.config_len || a->hdr.report_len != b->hdr.report_len) return false;
+    if (memcmp(a->hdr.string_len, b->hdr.string_len, sizeof(a->hdr.string_len)) != 0) return false;
+    return memcmp((const uint8_t *)a + sizeof(dc_header_t), (const uint8_t *)b + sizeof(dc_header_t),
+                  sizeof(*a) - sizeof(dc_header_t)) == 0;
+}
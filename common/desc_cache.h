@@ -0,0 +1,80 @@
+/**
+ * @file desc_cache.h
+ * @brief Persistent record of a cloned device's descriptors.
+ *
+ * One record holds everything the device side needs to present a clone
+ * (device, configuration, HID report and the three identity strings) so it
+ * can come up on the PC at power-up, before the physical device has been
+ * enumerated. Records are keyed by VID/PID/bcdDevice and sealed with a
+ * CRC-32; the platform decides where they live in flash.
+ */
+#ifndef DESC_CACHE_H
+#define DESC_CACHE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define DC_MAGIC        0x31375253u  // "SR71"
+#define DC_VERSION      1
+#define DC_DEVICE_LEN   18
+#define DC_CONFIG_MAX   512
+#define DC_REPORT_MAX   512
+#define DC_STRING_MAX   128          // Raw UTF-16LE string descriptor, header included
+#define DC_STRINGS      3            // Manufacturer, product, serial
+
+typedef enum {
+    DC_STRING_MANUFACTURER = 0,
+    DC_STRING_PRODUCT,
+    DC_STRING_SERIAL
+} dc_string_t;
+
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t vid;
+    uint16_t pid;
+    uint16_t bcd_device;
+    uint32_t sequence;                // Newest record has the highest sequence
+    uint16_t config_len;
+    uint16_t report_len;
+    uint16_t string_len[DC_STRINGS];
+    uint16_t reserved;
+    uint32_t crc;                     // CRC-32 of the record with this field zeroed
+} dc_header_t;
+
+typedef struct {
+    dc_header_t hdr;
+    uint8_t     device[DC_DEVICE_LEN];
+    uint8_t     config[DC_CONFIG_MAX];
+    uint8_t     report[DC_REPORT_MAX];
+    uint8_t     strings[DC_STRINGS][DC_STRING_MAX];
+} dc_record_t;
+
+// Start a record from a device descriptor; the key is taken from it.
+void dc_begin(dc_record_t *rec, const uint8_t *device, uint16_t len);
+void dc_set_config(dc_record_t *rec, const uint8_t *data, uint16_t len);
+void dc_set_report(dc_record_t *rec, const uint8_t *data, uint16_t len);
+void dc_set_string(dc_record_t *rec, dc_string_t which, const uint8_t *data, uint16_t len);
+
+// Stamp the sequence number and CRC. Call before writing the record out.
+void dc_seal(dc_record_t *rec, uint32_t sequence);
+
+// Magic, version, lengths and CRC all check out.
+bool dc_valid(const dc_record_t *rec);
+
+bool dc_key_matches(const dc_record_t *rec, uint16_t vid, uint16_t pid, uint16_t bcd_device);
+
+// Same descriptors, ignoring sequence and CRC. Used to skip needless flash writes.
+bool dc_same_content(const dc_record_t *a, const dc_record_t *b);
+
+uint32_t dc_crc32(uint32_t crc, const void *data, uint32_t len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // DESC_CACHE_H
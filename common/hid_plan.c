@@ -0,0 +1,339 @@
+#include "hid_plan.h"
+#include "hot_path.h"
+#include <string.h>
+
+// Short item types and tags (HID 1.11, 6.2.2)
+#define HP_TYPE_MAIN    0
+#define HP_TYPE_GLOBAL  1
+#define HP_TYPE_LOCAL   2
+
+#define HP_MAIN_INPUT       0x8
+#define HP_MAIN_OUTPUT      0x9
+#define HP_MAIN_COLLECTION  0xA
+#define HP_MAIN_FEATURE     0xB
+#define HP_MAIN_END         0xC
+
+#define HP_GLOBAL_USAGE_PAGE    0x0
+#define HP_GLOBAL_LOGICAL_MIN   0x1
+#define HP_GLOBAL_LOGICAL_MAX   0x2
+#define HP_GLOBAL_REPORT_SIZE   0x7
+#define HP_GLOBAL_REPORT_ID     0x8
+#define HP_GLOBAL_REPORT_COUNT  0x9
+#define HP_GLOBAL_PUSH          0xA
+#define HP_GLOBAL_POP           0xB
+
+#define HP_LOCAL_USAGE      0x0
+#define HP_LOCAL_USAGE_MIN  0x1
+#define HP_LOCAL_USAGE_MAX  0x2
+
+#define HP_PAGE_DESKTOP  0x01
+#define HP_PAGE_BUTTON   0x09
+#define HP_USAGE_X       0x30
+#define HP_USAGE_HAT     0x39
+
+typedef struct {
+    uint16_t usage_page;
+    int32_t  logical_min;
+    int32_t  logical_max;
+    uint32_t logical_max_u;  // Same item read unsigned, for 0..255 style ranges
+    uint32_t report_size;
+    uint32_t report_count;
+    uint8_t  report_id;
+} hp_globals_t;
+
+typedef struct {
+    uint32_t usages[HP_MAX_USAGES];  // Extended (page << 16 | id) when a 4-byte usage was given
+    uint8_t  usage_count;
+    uint32_t usage_min;
+    uint32_t usage_max;
+    bool     has_range;
+} hp_locals_t;
+
+static uint32_t hp_item_unsigned(const uint8_t *p, uint8_t size) {
+    uint32_t v = 0;
+    for (uint8_t i = 0; i < size; i++) v |= (uint32_t)p[i] << (8 * i);
+    return v;
+}
+
+static int32_t hp_item_signed(const uint8_t *p, uint8_t size) {
+    uint32_t v = hp_item_unsigned(p, size);
+    if (size == 1) return (int8_t)v;
+    if (size == 2) return (int16_t)v;
+    return (int32_t)v;
+}
+
+static hp_report_plan_t *hp_report_for(hp_plan_t *plan, uint8_t report_id) {
+    uint8_t idx = plan->index_by_id[report_id];
+    if (idx) return &plan->reports[idx - 1];
+    if (plan->report_count >= HP_MAX_REPORTS) return NULL;
+
+    hp_report_plan_t *rp = &plan->reports[plan->report_count++];
+    memset(rp, 0, sizeof(*rp));
+    rp->report_id = report_id;
+    plan->index_by_id[report_id] = plan->report_count;
+    return rp;
+}
+
+static uint32_t hp_local_usage(const hp_locals_t *l, uint32_t i) {
+    if (l->usage_count) return l->usages[i < l->usage_count ? i : l->usage_count - 1u];
+    if (l->has_range) {
+        uint32_t u = l->usage_min + i;
+        return (u > l->usage_max) ? l->usage_max : u;
+    }
+    return 0;
+}
+
+static void hp_add_input(hp_plan_t *plan, uint32_t *bits, const hp_globals_t *g,
+                         const hp_locals_t *l, uint32_t flags) {
+    hp_report_plan_t *rp = hp_report_for(plan, g->report_id);
+    if (!rp) return;
+    uint32_t *pos = &bits[plan->index_by_id[g->report_id] - 1];
+
+    bool constant = (flags & 0x01) != 0;
+    bool variable = (flags & 0x02) != 0;
+    if (!constant && variable && g->report_size > 0 && g->report_size <= 32) {
+        int32_t lmin = g->logical_min;
+        int32_t lmax = (g->logical_max < lmin) ? (int32_t)g->logical_max_u : g->logical_max;
+
+        for (uint32_t i = 0; i < g->report_count; i++) {
+            uint32_t usage = hp_local_usage(l, i);
+            uint16_t page = (usage > 0xFFFF) ? (uint16_t)(usage >> 16) : g->usage_page;
+            uint16_t id = (uint16_t)(usage & 0xFFFF);
+            uint32_t off = *pos + i * g->report_size;
+            if (off > 0xFFFF) break;
+
+            if (page == HP_PAGE_DESKTOP && id >= HP_USAGE_X && id <= HP_USAGE_HAT) {
+                uint8_t a = (uint8_t)(id - HP_USAGE_X);
+                if (rp->axis_present & (1u << a)) continue;
+                rp->axes[a].bit_offset = (uint16_t)off;
+                rp->axes[a].bit_size = (uint8_t)g->report_size;
+                rp->axes[a].is_signed = lmin < 0;
+                rp->axes[a].logical_min = lmin;
+                rp->axes[a].logical_max = lmax;
+                rp->axis_present |= (uint16_t)(1u << a);
+                if (flags & 0x04) rp->axis_relative |= (uint16_t)(1u << a);
+            } else if (page == HP_PAGE_BUTTON && g->report_size == 1 && id >= 1 && id <= HP_MAX_BUTTONS) {
+                uint8_t b = (uint8_t)(id - 1);
+                if (rp->button_present & (1u << b)) continue;
+                rp->button_bit[b] = (uint16_t)off;
+                rp->button_present |= 1u << b;
+            }
+        }
+    }
+    *pos += g->report_size * g->report_count;
+}
+
+bool hp_compile(hp_plan_t *plan, const uint8_t *desc, uint16_t desc_len) {
+    hp_globals_t g;
+    hp_globals_t stack[HP_STACK_DEPTH];
+    uint8_t depth = 0;
+    hp_locals_t l;
+    uint32_t bits[HP_MAX_REPORTS] = {0};
+
+    memset(plan, 0, sizeof(*plan));
+    memset(&g, 0, sizeof(g));
+    memset(&l, 0, sizeof(l));
+
+    uint16_t i = 0;
+    while (i < desc_len) {
+        uint8_t prefix = desc[i];
+        if (prefix == 0xFE) {
+            // Long item: skip it, nothing in the input path uses them
+            if (i + 1 >= desc_len) break;
+            i = (uint16_t)(i + 3 + desc[i + 1]);
+            continue;
+        }
+
+        uint8_t size = prefix & 0x03;
+        if (size == 3) size = 4;
+        uint8_t type = (prefix >> 2) & 0x03;
+        uint8_t tag = (prefix >> 4) & 0x0F;
+        if (i + 1 + size > desc_len) break;
+        const uint8_t *data = &desc[i + 1];
+        uint32_t u = hp_item_unsigned(data, size);
+
+        if (type == HP_TYPE_MAIN) {
+            if (tag == HP_MAIN_INPUT) hp_add_input(plan, bits, &g, &l, u);
+            memset(&l, 0, sizeof(l));
+        } else if (type == HP_TYPE_GLOBAL) {
+            switch (tag) {
+                case HP_GLOBAL_USAGE_PAGE:   g.usage_page = (uint16_t)u; break;
+                case HP_GLOBAL_LOGICAL_MIN:  g.logical_min = hp_item_signed(data, size); break;
+                case HP_GLOBAL_LOGICAL_MAX:
+                    g.logical_max = hp_item_signed(data, size);
+                    g.logical_max_u = u;
+                    break;
+                case HP_GLOBAL_REPORT_SIZE:  g.report_size = u; break;
+                case HP_GLOBAL_REPORT_COUNT: g.report_count = u; break;
+                case HP_GLOBAL_REPORT_ID:
+                    g.report_id = (uint8_t)u;
+                    plan->uses_report_id = true;
+                    break;
+                case HP_GLOBAL_PUSH:
+                    if (depth < HP_STACK_DEPTH) stack[depth++] = g;
+                    break;
+                case HP_GLOBAL_POP:
+                    if (depth > 0) g = stack[--depth];
+                    break;
+                default:
+                    break;
+            }
+        } else if (type == HP_TYPE_LOCAL) {
+            // A 4-byte usage carries its own page in the high half
+            uint32_t usage = (size == 4) ? u : (u & 0xFFFF);
+            switch (tag) {
+                case HP_LOCAL_USAGE:
+                    if (l.usage_count < HP_MAX_USAGES) l.usages[l.usage_count++] = usage;
+                    break;
+                case HP_LOCAL_USAGE_MIN:
+                    l.usage_min = usage;
+                    l.has_range = true;
+                    break;
+                case HP_LOCAL_USAGE_MAX:
+                    l.usage_max = usage;
+                    break;
+                default:
+                    break;
+            }
+        }
+        i = (uint16_t)(i + 1 + size);
+    }
+
+    for (uint8_t r = 0; r < plan->report_count; r++) {
+        plan->reports[r].size_bytes = (uint16_t)((bits[r] + 7) / 8);
+        plan->axis_any |= plan->reports[r].axis_present;
+        plan->button_any |= plan->reports[r].button_present;
+    }
+    plan->valid = plan->report_count > 0;
+    return plan->valid;
+}
+
+static HOT_PATH void hp_put_bits(uint8_t *buf, uint16_t len, uint16_t bit_off, uint8_t nbits, uint32_t v) {
+    while (nbits) {
+        uint16_t byte = bit_off >> 3;
+        uint8_t shift = bit_off & 7;
+        uint8_t take = (uint8_t)(8 - shift);
+        if (take > nbits) take = nbits;
+        if (byte >= len) return;
+        uint8_t mask = (uint8_t)(((1u << take) - 1u) << shift);
+        buf[byte] = (uint8_t)((buf[byte] & ~mask) | ((v << shift) & mask));
+        v >>= take;
+        bit_off = (uint16_t)(bit_off + take);
+        nbits = (uint8_t)(nbits - take);
+    }
+}
+
+static HOT_PATH int32_t hp_scale(const hp_field_t *f, uint8_t axis, int32_t v) {
+    if (axis == HP_AXIS_HAT) {
+        // Out-of-range is the hat's null state
+        if (v < 0 || v > f->logical_max - f->logical_min) return f->logical_max + 1;
+        return f->logical_min + v;
+    }
+    if (v < HP_AXIS_MIN) v = HP_AXIS_MIN;
+    if (v > HP_AXIS_MAX) v = HP_AXIS_MAX;
+    int64_t span = (int64_t)f->logical_max - f->logical_min;
+    return (int32_t)(f->logical_min + ((int64_t)(v - HP_AXIS_MIN) * span) / (HP_AXIS_MAX - HP_AXIS_MIN));
+}
+
+HOT_PATH bool hp_apply(const hp_plan_t *plan, const hp_override_t *ovr, uint8_t *report, uint16_t len) {
+    if (!plan->valid) return false;
+
+    uint8_t report_id = 0;
+    if (plan->uses_report_id) {
+        if (len == 0) return false;
+        report_id = report[0];
+        report++;
+        len--;
+    }
+    uint8_t idx = plan->index_by_id[report_id];
+    if (!idx) return false;
+    const hp_report_plan_t *rp = &plan->reports[idx - 1];
+
+    uint16_t axes = ovr->axis_mask & rp->axis_present;
+    while (axes) {
+        uint8_t a = (uint8_t)__builtin_ctz(axes);
+        axes &= (uint16_t)(axes - 1);
+        const hp_field_t *f = &rp->axes[a];
+        hp_put_bits(report, len, f->bit_offset, f->bit_size, (uint32_t)hp_scale(f, a, ovr->axis[a]));
+    }
+
+    uint32_t buttons = ovr->button_mask & rp->button_present;
+    while (buttons) {
+        uint8_t b = (uint8_t)__builtin_ctz(buttons);
+        buttons &= buttons - 1;
+        hp_put_bits(report, len, rp->button_bit[b], 1, (ovr->buttons >> b) & 1u);
+    }
+    return true;
+}
+
+HOT_PATH bool hp_override_active(const hp_plan_t *plan, const hp_override_t *ovr) {
+    return plan->valid &&
+           ((ovr->axis_mask & plan->axis_any) != 0 || (ovr->button_mask & plan->button_any) != 0);
+}
+
+static HOT_PATH int32_t hp_get_field(const uint8_t *buf, uint16_t len, const hp_field_t *f) {
+    uint32_t v = 0;
+    for (uint8_t i = 0; i < f->bit_size; i++) {
+        uint16_t bit = (uint16_t)(f->bit_offset + i);
+        if ((bit >> 3) >= len) break;
+        v |= (uint32_t)((buf[bit >> 3] >> (bit & 7)) & 1u) << i;
+    }
+    if (f->is_signed && f->bit_size < 32 && ((v >> (f->bit_size - 1)) & 1u)) v |= ~0u << f->bit_size;
+    return (int32_t)v;
+}
+
+static HOT_PATH bool hp_rest(const hp_plan_t *plan, uint8_t *report, uint16_t len, bool buttons) {
+    if (!plan->valid || len == 0) return false;
+    uint8_t idx = plan->index_by_id[plan->uses_report_id ? report[0] : 0];
+    if (!idx) return false;
+
+    const hp_report_plan_t *rp = &plan->reports[idx - 1];
+    hp_override_t ovr;
+    memset(&ovr, 0, sizeof(ovr));
+    ovr.axis_mask = rp->axis_relative;
+    ovr.button_mask = buttons ? rp->button_present : 0;
+    return hp_apply(plan, &ovr, report, len);
+}
+
+bool hp_release(const hp_plan_t *plan, uint8_t *report, uint16_t len) {
+    return hp_rest(plan, report, len, true);
+}
+
+HOT_PATH bool hp_idle(const hp_plan_t *plan, uint8_t *report, uint16_t len) {
+    return hp_rest(plan, report, len, false);
+}
+
+HOT_PATH bool hp_add_delta(const hp_plan_t *plan, hp_delta_t *d, uint8_t *report, uint16_t len) {
+    if (!plan->valid) return false;
+
+    uint8_t report_id = 0;
+    if (plan->uses_report_id) {
+        if (len == 0) return false;
+        report_id = report[0];
+        report++;
+        len--;
+    }
+    uint8_t idx = plan->index_by_id[report_id];
+    if (!idx) return false;
+    const hp_report_plan_t *rp = &plan->reports[idx - 1];
+
+    bool added = false;
+    uint16_t axes = d->axis_mask & rp->axis_relative;
+    while (axes) {
+        uint8_t a = (uint8_t)__builtin_ctz(axes);
+        axes &= (uint16_t)(axes - 1);
+        const hp_field_t *f = &rp->axes[a];
+
+        int32_t cur = hp_get_field(report, len, f);
+        int64_t want = (int64_t)cur + d->axis[a];
+        if (want < f->logical_min) want = f->logical_min;
+        if (want > f->logical_max) want = f->logical_max;
+        if (want == cur) continue;
+
+        hp_put_bits(report, len, f->bit_offset, f->bit_size, (uint32_t)want);
+        d->axis[a] -= (int32_t)(want - cur);
+        if (d->axis[a] == 0) d->axis_mask &= (uint16_t)~(1u << a);
+        added = true;
+    }
+    return added;
+}
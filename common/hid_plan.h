@@ -0,0 +1,116 @@
+/**
+ * @file hid_plan.h
+ * @brief Compiled HID report-field plan for generic report passthrough.
+ *
+ * The report descriptor is walked once when a device mounts and reduced to a
+ * small table per report ID: where each overridable axis and button lives
+ * (bit offset, size, logical range). Patching a live report is then a table
+ * lookup plus one bit write per active override, so the per-report cost does
+ * not depend on how complicated the descriptor is.
+ */
+#ifndef HID_PLAN_H
+#define HID_PLAN_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define HP_MAX_REPORTS   8    // Input report IDs tracked per interface
+#define HP_MAX_BUTTONS   32   // Button page usages 1..32
+#define HP_MAX_USAGES    16   // Local usages remembered per main item
+#define HP_STACK_DEPTH   4    // Push/Pop nesting
+
+// Generic Desktop usages 0x30..0x39, in usage order
+typedef enum {
+    HP_AXIS_X = 0,
+    HP_AXIS_Y,
+    HP_AXIS_Z,
+    HP_AXIS_RX,
+    HP_AXIS_RY,
+    HP_AXIS_RZ,
+    HP_AXIS_SLIDER,
+    HP_AXIS_DIAL,
+    HP_AXIS_WHEEL,
+    HP_AXIS_HAT,
+    HP_AXIS_COUNT
+} hp_axis_t;
+
+#define HP_AXIS_MIN    (-32767)  // Normalized override range, scaled to the field's logical range
+#define HP_AXIS_MAX    32767
+#define HP_HAT_NULL    (-1)      // Hat override value for "centered"
+
+typedef struct {
+    uint16_t bit_offset;   // From the first byte after the report ID
+    uint8_t  bit_size;     // 0 = not present in this report
+    uint8_t  is_signed;
+    int32_t  logical_min;
+    int32_t  logical_max;
+} hp_field_t;
+
+typedef struct {
+    uint8_t    report_id;
+    uint16_t   size_bytes;      // Payload length, report ID excluded
+    uint16_t   axis_present;    // Bit per hp_axis_t
+    uint16_t   axis_relative;   // Subset of axis_present reported as deltas
+    uint32_t   button_present;  // Bit per button (bit 0 = button 1)
+    hp_field_t axes[HP_AXIS_COUNT];
+    uint16_t   button_bit[HP_MAX_BUTTONS];
+} hp_report_plan_t;
+
+typedef struct {
+    bool             valid;
+    bool             uses_report_id;
+    uint8_t          report_count;
+    uint16_t         axis_any;          // Union of reports[].axis_present
+    uint32_t         button_any;        // Union of reports[].button_present
+    uint8_t          index_by_id[256];  // report ID -> reports[] index + 1, 0 = unknown
+    hp_report_plan_t reports[HP_MAX_REPORTS];
+} hp_plan_t;
+
+// Relative motion still to be delivered (network injection). Moves larger
+// than a field can carry are spread over the following reports.
+typedef struct {
+    uint16_t axis_mask;            // Bit per hp_axis_t with motion left
+    int32_t  axis[HP_AXIS_COUNT];  // In the field's own units (counts)
+} hp_delta_t;
+
+typedef struct {
+    uint16_t axis_mask;            // Bit per hp_axis_t that is overridden
+    int32_t  axis[HP_AXIS_COUNT];  // HP_AXIS_MIN..HP_AXIS_MAX; hat is 0..7 or HP_HAT_NULL
+    uint32_t button_mask;          // Buttons that are overridden
+    uint32_t buttons;              // Their values
+} hp_override_t;
+
+// Walk a report descriptor and build the plan. Returns false if nothing usable was found.
+bool hp_compile(hp_plan_t *plan, const uint8_t *desc, uint16_t desc_len);
+
+// Patch an input report in place. `report` starts with the report ID when the
+// plan uses IDs. Returns false if the report is unknown to the plan.
+bool hp_apply(const hp_plan_t *plan, const hp_override_t *ovr, uint8_t *report, uint16_t len);
+
+// True if any override is active that this plan could apply.
+bool hp_override_active(const hp_plan_t *plan, const hp_override_t *ovr);
+
+// Turn a copy of the last report into its "let go" state: buttons up and
+// relative axes zero, absolute axes left where they were. Sent to the PC when
+// the physical device disappears so nothing stays held.
+bool hp_release(const hp_plan_t *plan, uint8_t *report, uint16_t len);
+
+// Turn a copy of the last report into one that says nothing new: relative
+// axes zero, buttons and absolute axes as they were. Basis for reports sent
+// when there is injected input but the device itself is quiet.
+bool hp_idle(const hp_plan_t *plan, uint8_t *report, uint16_t len);
+
+// Add as much of d as the report's relative fields can hold, clamped to
+// their logical range, and take what was used out of d. Returns true if the
+// report changed.
+bool hp_add_delta(const hp_plan_t *plan, hp_delta_t *d, uint8_t *report, uint16_t len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // HID_PLAN_H
@@ -0,0 +1,34 @@
+/**
+ * @file hot_path.h
+ * @brief Placement tags for code that runs once per forwarded report.
+ *
+ * Targets that execute from slow memory define HOT_PATH_SECTION (and
+ * optionally HOT_PATH_IRQ_SECTION) on the command line to move these
+ * functions somewhere faster. On the RP2040 that is SRAM instead of XIP
+ * flash, where a cache miss stalls for several microseconds. The i.MX RT
+ * build defines HOT_PATH_ITCM instead, which picks the ITCM bank of its
+ * MCUXpresso managed linker script (copied from flash by the startup code).
+ * Everywhere else the tags expand to nothing.
+ */
+#ifndef HOT_PATH_H
+#define HOT_PATH_H
+
+// The section name has a '$' in it, which does not survive the IDE's makefiles
+#if defined(HOT_PATH_ITCM) && !defined(HOT_PATH_SECTION)
+#define HOT_PATH_SECTION ".ramfunc.$SRAM_ITC"
+#endif
+
+#ifdef HOT_PATH_SECTION
+#define HOT_PATH __attribute__((section(HOT_PATH_SECTION)))
+#else
+#define HOT_PATH
+#endif
+
+// Small interrupt handlers; falls back to HOT_PATH
+#ifdef HOT_PATH_IRQ_SECTION
+#define HOT_PATH_IRQ __attribute__((section(HOT_PATH_IRQ_SECTION)))
+#else
+#define HOT_PATH_IRQ HOT_PATH
+#endif
+
+#endif // HOT_PATH_H
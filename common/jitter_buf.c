@@ -0,0 +1,125 @@
+#include "jitter_buf.h"
+#include "hot_path.h"
+#include <string.h>
+
+#if (JB_DEPTH & (JB_DEPTH - 1)) != 0
+#error "JB_DEPTH must be a power of two"
+#endif
+
+static inline bool jb_before(uint32_t a, uint32_t b) {
+    return (int32_t)(a - b) < 0;
+}
+
+void jb_init(jb_t *jb, uint32_t max_delay_us) {
+    memset(jb, 0, sizeof(*jb));
+    jb->max_delay_us = max_delay_us < JB_MAX_DELAY_US ? max_delay_us : JB_MAX_DELAY_US;
+}
+
+static HOT_PATH void jb_release(jb_t *jb, uint32_t now_us, jb_release_fn fn, void *ctx) {
+    jb_entry_t *e = &jb->q[jb->head];
+    jb->head = (jb->head + 1u) & (JB_DEPTH - 1u);
+    jb->count--;
+    if (e->m.kind == KP_MOUSE_MOVE) {
+        uint32_t held = now_us - e->arrival_us;
+        jb->stats.played++;
+        jb->stats.delay_sum_us += held;
+        if (held > jb->stats.delay_max_us) jb->stats.delay_max_us = held;
+    }
+    fn(ctx, &e->m);
+}
+
+static HOT_PATH void jb_enqueue(jb_t *jb, const kp_mouse_t *m, uint32_t now_us, uint32_t play_us,
+                                jb_release_fn fn, void *ctx) {
+    if (jb->count == JB_DEPTH) {
+        jb->stats.overruns++;
+        jb_release(jb, now_us, fn, ctx);
+    }
+    jb_entry_t *e = &jb->q[(jb->head + jb->count) & (JB_DEPTH - 1u)];
+    e->m = *m;
+    e->arrival_us = now_us;
+    e->play_us = play_us;
+    jb->count++;
+}
+
+// Running interval and jitter estimates. Returns false if the gap since the
+// last move is a pause rather than part of the stream.
+static HOT_PATH bool jb_estimate(jb_t *jb, uint32_t now_us) {
+    bool had_last = jb->primed;
+    uint32_t d = now_us - jb->last_arrival_us;
+    jb->primed = true;
+    jb->last_arrival_us = now_us;
+    if (!had_last || d > JB_GAP_MAX_US) return false;
+
+    uint32_t interval = jb_interval_us(jb);
+    if (interval == 0) {
+        jb->interval_q4 = d << 4;
+        return true;
+    }
+    if (d > JB_GAP_MULT * interval) return false;
+
+    uint32_t dev = d > interval ? d - interval : interval - d;
+    jb->interval_q4 += d - (jb->interval_q4 >> 4);
+    jb->jitter_q4 += dev - (jb->jitter_q4 >> 4);
+    return true;
+}
+
+// Picked up when playout (re)starts, so the cadence never jumps mid-stream
+static void jb_retarget(jb_t *jb) {
+    uint32_t d = JB_JITTER_MULT * jb_jitter_us(jb);
+    jb->delay_us = d < jb->max_delay_us ? d : jb->max_delay_us;
+}
+
+HOT_PATH void jb_push(jb_t *jb, const kp_mouse_t *m, uint32_t now_us, jb_release_fn fn, void *ctx) {
+    if (!jb_enabled(jb)) {
+        fn(ctx, m);
+        return;
+    }
+
+    if (m->kind != KP_MOUSE_MOVE) {
+        // Rides along with the move before it
+        if (jb->count == 0) {
+            fn(ctx, m);
+        } else {
+            jb_enqueue(jb, m, now_us, jb->last_play_us, fn, ctx);
+        }
+        return;
+    }
+
+    uint32_t play;
+    if (!jb_estimate(jb, now_us)) {
+        if (jb->stats.played) jb->stats.restarts++;
+        jb_retarget(jb);
+        play = now_us + jb->delay_us;
+    } else {
+        play = jb->last_play_us + jb_interval_us(jb);
+        if (jb_before(play, now_us)) {
+            // Its slot has gone by: start over from here at the current target
+            jb->stats.underruns++;
+            jb_retarget(jb);
+            play = now_us + jb->delay_us;
+        } else if (play - now_us > jb->delay_us + (jb_interval_us(jb) >> 4)) {
+            // Held longer than the target: run slightly fast to drain it
+            play -= jb_interval_us(jb) >> 4;
+        }
+        if (play - now_us > jb->max_delay_us) {
+            jb->stats.overruns++;
+            play = now_us + jb->max_delay_us;
+        }
+    }
+    jb_enqueue(jb, m, now_us, play, fn, ctx);
+    jb->last_play_us = play;
+    jb_poll(jb, now_us, fn, ctx);
+}
+
+HOT_PATH bool jb_poll(jb_t *jb, uint32_t now_us, jb_release_fn fn, void *ctx) {
+    bool ran = false;
+    while (jb->count && !jb_before(now_us, jb->q[jb->head].play_us)) {
+        jb_release(jb, now_us, fn, ctx);
+        ran = true;
+    }
+    return ran;
+}
+
+void jb_flush(jb_t *jb, uint32_t now_us, jb_release_fn fn, void *ctx) {
+    while (jb->count) jb_release(jb, now_us, fn, ctx);
+}
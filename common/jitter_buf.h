@@ -0,0 +1,97 @@
+/**
+ * @file jitter_buf.h
+ * @brief Adaptive playout buffer for streamed relative mouse motion.
+ *
+ * Clients that stream small moves at a fixed rate without timestamps lose
+ * their cadence to bursty arrival. The buffer estimates the stream's
+ * interval and inter-arrival jitter (RFC 3550 style running averages) and
+ * plays moves back one interval apart, each held at most max_delay_us after
+ * it arrived. The target delay follows the jitter and is picked up each
+ * time playout restarts: after a pause in the stream, or an underrun where a
+ * move arrived after the slot it should have filled.
+ *
+ * Other commands (buttons, wheel) keep their order: they play in the slot of
+ * the move queued before them, or at once if nothing is queued.
+ *
+ * Times are 32-bit microseconds compared modulo 2^32. Not thread-safe.
+ */
+#ifndef JITTER_BUF_H
+#define JITTER_BUF_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "kmbox_proto.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define JB_DEPTH         16     // Power of two
+#define JB_MAX_DELAY_US  2000   // Hard bound on the delay a client can ask for
+#define JB_JITTER_MULT   3      // Target delay in jitter estimates
+#define JB_GAP_MULT      4      // A gap this many intervals long starts a new stream
+#define JB_GAP_MAX_US    50000  // ... and so does any gap this long
+
+typedef struct {
+    kp_mouse_t m;
+    uint32_t   arrival_us;
+    uint32_t   play_us;
+} jb_entry_t;
+
+typedef struct {
+    uint32_t played;
+    uint32_t underruns;     // A move came after its slot: playout restarted
+    uint32_t overruns;      // Released early: buffer full or past max_delay_us
+    uint32_t restarts;      // New stream after a pause
+    uint64_t delay_sum_us;  // Added delay over the moves played
+    uint32_t delay_max_us;
+} jb_stats_t;
+
+typedef struct {
+    uint32_t   max_delay_us;   // 0 = off, everything passes straight through
+    jb_entry_t q[JB_DEPTH];
+    uint32_t   head;
+    uint32_t   count;
+    bool       primed;         // An arrival interval has been seen
+    uint32_t   last_arrival_us;
+    uint32_t   last_play_us;
+    uint32_t   interval_q4;    // Mean inter-arrival time x16
+    uint32_t   jitter_q4;      // Mean deviation from it x16
+    uint32_t   delay_us;       // Current target delay
+    jb_stats_t stats;
+} jb_t;
+
+typedef void (*jb_release_fn)(void *ctx, const kp_mouse_t *m);
+
+// max_delay_us is clamped to JB_MAX_DELAY_US; 0 turns the buffer off.
+// Queued commands are dropped, so flush first when reconfiguring.
+void jb_init(jb_t *jb, uint32_t max_delay_us);
+
+static inline bool jb_enabled(const jb_t *jb) {
+    return jb->max_delay_us != 0;
+}
+
+// Queue a command that arrived at now_us. Anything that has to go out
+// early to make room, or the command itself when the buffer has no reason
+// to hold it, is released through fn.
+void jb_push(jb_t *jb, const kp_mouse_t *m, uint32_t now_us, jb_release_fn fn, void *ctx);
+
+// Release everything whose slot has come. Returns true if anything did.
+bool jb_poll(jb_t *jb, uint32_t now_us, jb_release_fn fn, void *ctx);
+
+// Release everything now, in order
+void jb_flush(jb_t *jb, uint32_t now_us, jb_release_fn fn, void *ctx);
+
+static inline uint32_t jb_interval_us(const jb_t *jb) {
+    return jb->interval_q4 >> 4;
+}
+
+static inline uint32_t jb_jitter_us(const jb_t *jb) {
+    return jb->jitter_q4 >> 4;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // JITTER_BUF_H
@@ -0,0 +1,260 @@
+#include "kmbox_proto.h"
+#include "hot_path.h"
+#include <string.h>
+
+// Header field offsets
+#define KP_OFF_MAC    0
+#define KP_OFF_RAND   4
+#define KP_OFF_INDEX  8
+#define KP_OFF_CMD    12
+
+// Soft-mouse body offsets
+#define KP_OFF_BUTTON 0
+#define KP_OFF_X      4
+#define KP_OFF_Y      8
+#define KP_OFF_WHEEL  12
+#define KP_OFF_POINT  16
+
+// Execute-at trailer offsets
+#define KP_OFF_AT_MAGIC 0
+#define KP_OFF_AT_LATE  4
+#define KP_OFF_AT_US    8
+
+static inline uint32_t kp_le32(const uint8_t *p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static inline void kp_put32(uint8_t *p, uint32_t v) {
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+    p[2] = (uint8_t)(v >> 16);
+    p[3] = (uint8_t)(v >> 24);
+}
+
+static inline uint64_t kp_le64(const uint8_t *p) {
+    return (uint64_t)kp_le32(p) | ((uint64_t)kp_le32(p + 4) << 32);
+}
+
+static inline void kp_put64(uint8_t *p, uint64_t v) {
+    kp_put32(p, (uint32_t)v);
+    kp_put32(p + 4, (uint32_t)(v >> 32));
+}
+
+void kp_init(kp_session_t *s, uint32_t uuid, const kp_handlers_t *h) {
+    memset(s, 0, sizeof(*s));
+    s->uuid = uuid;
+    if (h) s->h = *h;
+}
+
+static HOT_PATH bool kp_mouse(kp_session_t *s, uint32_t cmd, const uint8_t *body, uint16_t body_len) {
+    kp_mouse_t m;
+    memset(&m, 0, sizeof(m));
+    m.buttons = (uint8_t)(kp_le32(body + KP_OFF_BUTTON) & KP_MASK_BUTTONS);
+    m.x = (int32_t)kp_le32(body + KP_OFF_X);
+    m.y = (int32_t)kp_le32(body + KP_OFF_Y);
+
+    switch (cmd) {
+        case KP_CMD_MOUSE_MOVE:
+            m.kind = KP_MOUSE_MOVE;
+            break;
+        case KP_CMD_MOUSE_LEFT:
+        case KP_CMD_MOUSE_MIDDLE:
+        case KP_CMD_MOUSE_RIGHT:
+            m.kind = KP_MOUSE_BUTTONS;
+            m.x = m.y = 0;
+            break;
+        case KP_CMD_MOUSE_WHEEL:
+            m.kind = KP_MOUSE_WHEEL;
+            m.x = m.y = 0;
+            m.wheel = (int32_t)kp_le32(body + KP_OFF_WHEEL);
+            break;
+        case KP_CMD_MOUSE_AUTOMOVE:
+            m.kind = KP_MOUSE_AUTOMOVE;
+            m.duration_ms = kp_le32(body + KP_OFF_POINT);
+            break;
+        default:  // KP_CMD_BEZIER_MOVE
+            m.kind = KP_MOUSE_BEZIER;
+            m.duration_ms = kp_le32(body + KP_OFF_POINT);
+            for (int i = 0; i < 4; i++) m.ctrl[i] = (int32_t)kp_le32(body + KP_OFF_POINT + 4 * (i + 1));
+            break;
+    }
+
+    // Stock clients stop at the soft-mouse body; anything after it that
+    // does not start with the magic is ignored as before
+    const uint8_t *at = body + KP_MOUSE_LEN;
+    if (body_len >= KP_MOUSE_LEN + KP_AT_LEN && kp_le32(at + KP_OFF_AT_MAGIC) == KP_AT_MAGIC) {
+        m.at_us = kp_le64(at + KP_OFF_AT_US);
+        m.late = at[KP_OFF_AT_LATE] <= KP_LATE_COMPRESS ? at[KP_OFF_AT_LATE] : KP_LATE_RUN;
+        if (m.at_us) s->stats.scheduled++;
+    }
+    s->buttons = m.buttons;
+    return s->h.mouse && s->h.mouse(s->h.ctx, &m);
+}
+
+static bool kp_keyboard(kp_session_t *s, const uint8_t *body) {
+    kp_keyboard_t k;
+    k.modifiers = body[0];
+    memcpy(k.keys, body + 2, sizeof(k.keys));
+    return s->h.keyboard && s->h.keyboard(s->h.ctx, &k);
+}
+
+HOT_PATH uint16_t kp_handle(kp_session_t *s, const uint8_t *pkt, uint16_t len, uint8_t *reply, uint16_t reply_cap) {
+    s->stats.rx++;
+    if (len < KP_HEAD_LEN || reply_cap < KP_HEAD_LEN) {
+        s->stats.malformed++;
+        return 0;
+    }
+
+    uint32_t mac = kp_le32(pkt + KP_OFF_MAC);
+    uint32_t cmd = kp_le32(pkt + KP_OFF_CMD);
+    const uint8_t *body = pkt + KP_HEAD_LEN;
+    uint16_t body_len = (uint16_t)(len - KP_HEAD_LEN);
+
+    // A box only answers the client holding its id; everyone else times out
+    if (s->uuid && mac != s->uuid) {
+        s->stats.rejected++;
+        return 0;
+    }
+    if (cmd == KP_CMD_CONNECT) {
+        s->connected = true;
+    } else if (!s->connected) {
+        s->stats.rejected++;
+        return 0;
+    }
+
+    bool handled = true;
+    uint16_t reply_len = KP_HEAD_LEN;
+    switch (cmd) {
+        case KP_CMD_CONNECT:
+            break;
+        case KP_CMD_MOUSE_MOVE:
+        case KP_CMD_MOUSE_LEFT:
+        case KP_CMD_MOUSE_MIDDLE:
+        case KP_CMD_MOUSE_RIGHT:
+        case KP_CMD_MOUSE_WHEEL:
+        case KP_CMD_MOUSE_AUTOMOVE:
+        case KP_CMD_BEZIER_MOVE:
+            if (body_len < KP_MOUSE_LEN) {
+                s->stats.malformed++;
+                return 0;
+            }
+            handled = kp_mouse(s, cmd, body, body_len);
+            break;
+        case KP_CMD_KEYBOARD_ALL:
+            if (body_len < KP_KEYBOARD_LEN) {
+                s->stats.malformed++;
+                return 0;
+            }
+            handled = kp_keyboard(s, body);
+            break;
+        case KP_CMD_MASK_MOUSE:
+            s->mask = kp_le32(pkt + KP_OFF_RAND);
+            handled = s->h.mask && s->h.mask(s->h.ctx, s->mask);
+            break;
+        case KP_CMD_UNMASK_ALL:
+            s->mask = 0;
+            handled = s->h.mask && s->h.mask(s->h.ctx, 0);
+            break;
+        case KP_CMD_REBOOT:
+            handled = s->h.reboot && s->h.reboot(s->h.ctx);
+            break;
+        case KP_CMD_TIME_SYNC:
+            if (body_len < KP_SYNC_LEN) {
+                s->stats.malformed++;
+                return 0;
+            }
+            // Without a clock the plain echo tells the client there is none
+            handled = s->h.now_us != NULL && reply_cap >= KP_HEAD_LEN + KP_SYNC_REPLY_LEN;
+            if (handled) {
+                kp_put64(reply + KP_HEAD_LEN + 8, s->h.now_us(s->h.ctx));
+                memcpy(reply + KP_HEAD_LEN, body, KP_SYNC_LEN);
+                reply_len = KP_HEAD_LEN + KP_SYNC_REPLY_LEN;
+                s->stats.syncs++;
+            }
+            break;
+        case KP_CMD_PLAYOUT:
+            handled = s->h.playout && s->h.playout(s->h.ctx, kp_le32(pkt + KP_OFF_RAND));
+            break;
+        case KP_CMD_SNAPSHOT:
+            handled = s->h.snapshot != NULL && reply_cap > KP_HEAD_LEN + KP_SNAP_HEAD_LEN;
+            if (handled) {
+                uint32_t offset = kp_le32(pkt + KP_OFF_RAND);
+                uint32_t total = 0;
+                uint16_t cap = (uint16_t)(reply_cap - KP_HEAD_LEN - KP_SNAP_HEAD_LEN);
+                if (cap > KP_SNAP_CHUNK) cap = KP_SNAP_CHUNK;
+                uint16_t n = s->h.snapshot(s->h.ctx, offset, &total,
+                                           reply + KP_HEAD_LEN + KP_SNAP_HEAD_LEN, cap);
+                kp_put32(reply + KP_HEAD_LEN, total);
+                kp_put32(reply + KP_HEAD_LEN + 4, offset);
+                reply_len = (uint16_t)(KP_HEAD_LEN + KP_SNAP_HEAD_LEN + n);
+            }
+            break;
+        case KP_CMD_MONITOR:
+        case KP_CMD_DEBUG:
+        case KP_CMD_SETCONFIG:
+        case KP_CMD_SHOWPIC:
+            handled = false;
+            break;
+        default:
+            s->stats.unknown++;
+            return 0;
+    }
+
+    s->stats.accepted++;
+    if (!handled) s->stats.unsupported++;
+
+    // Echo the header: the client checks cmd and index
+    memcpy(reply, pkt, KP_HEAD_LEN);
+    kp_put32(reply + KP_OFF_RAND, 0);
+    if (cmd == KP_CMD_TIME_SYNC && reply_len > KP_HEAD_LEN) {
+        // Send side as late as the protocol core can take it
+        kp_put64(reply + KP_HEAD_LEN + 16, s->h.now_us(s->h.ctx));
+    }
+    return reply_len;
+}
+
+uint16_t kp_build(uint8_t *out, uint16_t cap, uint32_t uuid, uint32_t index, uint32_t cmd,
+                  uint32_t rand, const uint8_t *body, uint16_t body_len) {
+    if ((uint32_t)KP_HEAD_LEN + body_len > cap) return 0;
+    kp_put32(out + KP_OFF_MAC, uuid);
+    kp_put32(out + KP_OFF_RAND, rand);
+    kp_put32(out + KP_OFF_INDEX, index);
+    kp_put32(out + KP_OFF_CMD, cmd);
+    if (body_len) memcpy(out + KP_HEAD_LEN, body, body_len);
+    return (uint16_t)(KP_HEAD_LEN + body_len);
+}
+
+void kp_build_mouse(uint8_t body[KP_MOUSE_LEN], const kp_mouse_t *m) {
+    memset(body, 0, KP_MOUSE_LEN);
+    kp_put32(body + KP_OFF_BUTTON, m->buttons);
+    kp_put32(body + KP_OFF_X, (uint32_t)m->x);
+    kp_put32(body + KP_OFF_Y, (uint32_t)m->y);
+    kp_put32(body + KP_OFF_WHEEL, (uint32_t)m->wheel);
+    kp_put32(body + KP_OFF_POINT, m->duration_ms);
+    for (int i = 0; i < 4; i++) kp_put32(body + KP_OFF_POINT + 4 * (i + 1), (uint32_t)m->ctrl[i]);
+}
+
+void kp_build_at(uint8_t out[KP_AT_LEN], uint64_t at_us, uint8_t late) {
+    memset(out, 0, KP_AT_LEN);
+    kp_put32(out + KP_OFF_AT_MAGIC, KP_AT_MAGIC);
+    out[KP_OFF_AT_LATE] = late;
+    kp_put64(out + KP_OFF_AT_US, at_us);
+}
+
+bool kp_parse_sync(const uint8_t *reply, uint16_t len, uint64_t *t1, uint64_t *t2, uint64_t *t3) {
+    if (len < KP_HEAD_LEN + KP_SYNC_REPLY_LEN || kp_le32(reply + KP_OFF_CMD) != KP_CMD_TIME_SYNC) return false;
+    *t1 = kp_le64(reply + KP_HEAD_LEN);
+    *t2 = kp_le64(reply + KP_HEAD_LEN + 8);
+    *t3 = kp_le64(reply + KP_HEAD_LEN + 16);
+    return true;
+}
+
+bool kp_parse_snapshot(const uint8_t *reply, uint16_t len, uint32_t *total, uint32_t *offset,
+                       const uint8_t **data, uint16_t *data_len) {
+    if (len < KP_HEAD_LEN + KP_SNAP_HEAD_LEN || kp_le32(reply + KP_OFF_CMD) != KP_CMD_SNAPSHOT) return false;
+    *total = kp_le32(reply + KP_HEAD_LEN);
+    *offset = kp_le32(reply + KP_HEAD_LEN + 4);
+    *data = reply + KP_HEAD_LEN + KP_SNAP_HEAD_LEN;
+    *data_len = (uint16_t)(len - KP_HEAD_LEN - KP_SNAP_HEAD_LEN);
+    return true;
+}
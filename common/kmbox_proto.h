@@ -0,0 +1,183 @@
+/**
+ * @file kmbox_proto.h
+ * @brief KMBox NET command protocol, independent of the transport.
+ *
+ * Each UDP datagram starts with a 16-byte header (client id, random, packet
+ * index, command) followed by a command-specific body, all little-endian as
+ * sent by the stock x86 client. The device answers every accepted command by
+ * echoing the header; the client matches cmd and index and treats silence as
+ * a timeout. Mouse commands carry the client's whole soft-mouse state, of
+ * which only the fields the command is about are used.
+ *
+ * Two extensions ride on top for clients that know about them. A mouse
+ * command may be followed by an execute-at trailer naming the device time
+ * it should reach the PC at, and KP_CMD_TIME_SYNC is a ping that returns the
+ * device clock so the client can work out the offset to its own.
+ * KP_CMD_PLAYOUT turns on a playout buffer for the session's streamed
+ * moves. KP_CMD_SNAPSHOT reads a diagnostic dump (the profile build's run
+ * times and trace) a chunk at a time. Stock clients send none of these and
+ * see no difference.
+ *
+ * The platform supplies the handlers and a transport that hands datagrams to
+ * kp_handle() and sends back whatever reply it produces.
+ */
+#ifndef KMBOX_PROTO_H
+#define KMBOX_PROTO_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define KP_DEFAULT_PORT   8888
+#define KP_HEAD_LEN       16
+#define KP_MOUSE_LEN      56   // button, x, y, wheel, point[10]
+#define KP_KEYBOARD_LEN   12   // ctrl, reserved, button[10]
+#define KP_AT_LEN         16   // magic, late policy, reserved[3], at_us
+#define KP_SYNC_LEN       8    // Client send time, opaque to the device
+#define KP_SYNC_REPLY_LEN 24   // Client time echoed, device receive, device send
+#define KP_SNAP_HEAD_LEN  8    // Snapshot size, offset of the chunk that follows
+#define KP_SNAP_CHUNK     1024 // Most data one snapshot reply carries
+
+// Commands (header cmd field)
+#define KP_CMD_CONNECT        0xaf3c2828u
+#define KP_CMD_MOUSE_MOVE     0xaede7345u
+#define KP_CMD_MOUSE_LEFT     0x9823ae8du
+#define KP_CMD_MOUSE_MIDDLE   0x97a3ae8du
+#define KP_CMD_MOUSE_RIGHT    0x238d8212u
+#define KP_CMD_MOUSE_WHEEL    0xffeead38u
+#define KP_CMD_MOUSE_AUTOMOVE 0xaede7346u
+#define KP_CMD_KEYBOARD_ALL   0x123c2c2fu
+#define KP_CMD_REBOOT         0xaa8855aau
+#define KP_CMD_BEZIER_MOVE    0xa238455au
+#define KP_CMD_MONITOR        0x27388020u
+#define KP_CMD_DEBUG          0x27382021u
+#define KP_CMD_MASK_MOUSE     0x23234343u
+#define KP_CMD_UNMASK_ALL     0x23344343u
+#define KP_CMD_SETCONFIG      0x1d3d3323u
+#define KP_CMD_SHOWPIC        0x12334883u
+#define KP_CMD_TIME_SYNC      0x5d71c0c0u   // Extension: device clock ping
+#define KP_CMD_PLAYOUT        0x5d71c0c1u   // Extension: rand = max playout delay in us, 0 = off
+#define KP_CMD_SNAPSHOT       0x5d71c0c2u   // Extension: rand = byte offset into the snapshot
+
+// First word of the execute-at trailer after a soft-mouse body
+#define KP_AT_MAGIC           0x74416b53u   // "SkAt"
+
+// Physical inputs blocked from the PC (cmd_mask_mouse carries them in the
+// header's rand field)
+#define KP_MASK_LEFT    (1u << 0)
+#define KP_MASK_RIGHT   (1u << 1)
+#define KP_MASK_MIDDLE  (1u << 2)
+#define KP_MASK_SIDE1   (1u << 3)
+#define KP_MASK_SIDE2   (1u << 4)
+#define KP_MASK_X       (1u << 5)
+#define KP_MASK_Y       (1u << 6)
+#define KP_MASK_WHEEL   (1u << 7)
+#define KP_MASK_BUTTONS 0x1Fu
+
+typedef enum {
+    KP_MOUSE_MOVE = 0,   // x, y relative
+    KP_MOUSE_BUTTONS,    // buttons is the new software button state
+    KP_MOUSE_WHEEL,      // wheel relative
+    KP_MOUSE_AUTOMOVE,   // x, y spread over duration_ms
+    KP_MOUSE_BEZIER      // x, y along ctrl[] over duration_ms
+} kp_mouse_kind_t;
+
+// What to do with a scheduled command whose time has already passed when
+// it can be released
+typedef enum {
+    KP_LATE_RUN = 0,       // Play it now, in order with the rest
+    KP_LATE_DROP,          // Discard it
+    KP_LATE_COMPRESS       // Fold it into the next report with everything else late
+} kp_late_t;
+
+typedef struct {
+    uint8_t  kind;         // kp_mouse_kind_t
+    uint8_t  buttons;      // Bit 0 left, 1 right, 2 middle, 3/4 side (HID button order)
+    int32_t  x;
+    int32_t  y;
+    int32_t  wheel;
+    uint32_t duration_ms;
+    int32_t  ctrl[4];      // Bezier control points x1, y1, x2, y2
+    uint64_t at_us;        // Device time to execute at, 0 = on arrival
+    uint8_t  late;         // kp_late_t, when at_us is set
+} kp_mouse_t;
+
+typedef struct {
+    uint8_t modifiers;     // HID modifier byte
+    uint8_t keys[10];      // HID usages, 0 = none
+} kp_keyboard_t;
+
+// Return false if the platform cannot act on the command; it is still
+// acknowledged (the client has no way to be told) but counted.
+typedef struct {
+    bool (*mouse)(void *ctx, const kp_mouse_t *m);
+    bool (*keyboard)(void *ctx, const kp_keyboard_t *k);
+    bool (*mask)(void *ctx, uint32_t mask);  // KP_MASK_* now in force, 0 = none
+    bool (*reboot)(void *ctx);               // Called before the reply is sent
+    uint64_t (*now_us)(void *ctx);           // Device clock for time sync; NULL = no sync
+    bool (*playout)(void *ctx, uint32_t max_delay_us);
+    // Copy up to cap bytes of the snapshot from offset into out and set
+    // total to its size; offset 0 takes a new one. NULL = none to read.
+    uint16_t (*snapshot)(void *ctx, uint32_t offset, uint32_t *total, uint8_t *out, uint16_t cap);
+    void *ctx;
+} kp_handlers_t;
+
+typedef struct {
+    uint32_t rx;
+    uint32_t accepted;
+    uint32_t rejected;     // Wrong client id or not connected
+    uint32_t malformed;    // Short header or body
+    uint32_t unknown;      // Command not in this protocol version
+    uint32_t unsupported;  // Handler missing or refused
+    uint32_t scheduled;    // Mouse commands carrying an execute-at time
+    uint32_t syncs;        // Time sync pings answered
+} kp_stats_t;
+
+typedef struct {
+    uint32_t      uuid;       // Id the client has to present; 0 accepts any
+    bool          connected;
+    uint32_t      mask;
+    uint8_t       buttons;    // Last software button state
+    kp_handlers_t h;
+    kp_stats_t    stats;
+} kp_session_t;
+
+void kp_init(kp_session_t *s, uint32_t uuid, const kp_handlers_t *h);
+
+// Decode one datagram and run its handler. Writes the acknowledgement into
+// reply and returns its length, or 0 if nothing should be sent back.
+uint16_t kp_handle(kp_session_t *s, const uint8_t *pkt, uint16_t len, uint8_t *reply, uint16_t reply_cap);
+
+// Client side: build a datagram for cmd with an optional body. Returns its
+// length, 0 if it does not fit. Used by the host tools and benches.
+uint16_t kp_build(uint8_t *out, uint16_t cap, uint32_t uuid, uint32_t index, uint32_t cmd,
+                  uint32_t rand, const uint8_t *body, uint16_t body_len);
+
+// Client side: soft-mouse body for the mouse commands.
+void kp_build_mouse(uint8_t body[KP_MOUSE_LEN], const kp_mouse_t *m);
+
+// Client side: execute-at trailer, appended after the soft-mouse body.
+void kp_build_at(uint8_t out[KP_AT_LEN], uint64_t at_us, uint8_t late);
+
+// Client side: unpack a KP_CMD_TIME_SYNC reply. With t4 the client's own
+// receive time, the device clock is ahead of the client's by
+// ((t2 - t1) + (t3 - t4)) / 2, good to half the path asymmetry; pick the
+// sample with the shortest (t4 - t1) - (t3 - t2). Returns false if the
+// device did not answer with its clock.
+bool kp_parse_sync(const uint8_t *reply, uint16_t len, uint64_t *t1, uint64_t *t2, uint64_t *t3);
+
+// Client side: unpack a KP_CMD_SNAPSHOT reply. Read from offset 0 and ask
+// for offset + data_len next until total; a snapshot taken meanwhile by
+// someone else shows up as a different total. Returns false if the device
+// has no snapshot to give.
+bool kp_parse_snapshot(const uint8_t *reply, uint16_t len, uint32_t *total, uint32_t *offset,
+                       const uint8_t **data, uint16_t *data_len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // KMBOX_PROTO_H
@@ -0,0 +1,202 @@
+#include "net_udp.h"
+#include "hot_path.h"
+#include <string.h>
+
+#define NU_ETHERTYPE_IPV4  0x0800
+#define NU_ETHERTYPE_ARP   0x0806
+#define NU_ARP_LEN         28
+#define NU_ARP_REQUEST     1
+#define NU_ARP_REPLY       2
+#define NU_IP_PROTO_UDP    17
+#define NU_IP_TTL          64
+
+static inline uint16_t nu_be16(const uint8_t *p) {
+    return (uint16_t)((p[0] << 8) | p[1]);
+}
+
+static inline void nu_put16(uint8_t *p, uint16_t v) {
+    p[0] = (uint8_t)(v >> 8);
+    p[1] = (uint8_t)v;
+}
+
+// One's-complement sum, folded by the caller
+static HOT_PATH uint32_t nu_sum(uint32_t sum, const uint8_t *p, uint16_t len) {
+    while (len > 1) {
+        sum += nu_be16(p);
+        p += 2;
+        len -= 2;
+    }
+    if (len) sum += (uint32_t)p[0] << 8;
+    return sum;
+}
+
+static inline uint16_t nu_fold(uint32_t sum) {
+    while (sum >> 16) sum = (sum & 0xFFFF) + (sum >> 16);
+    return (uint16_t)~sum;
+}
+
+static HOT_PATH uint16_t nu_udp_checksum(const uint8_t *src_ip, const uint8_t *dst_ip, const uint8_t *udp, uint16_t udp_len) {
+    uint32_t sum = nu_sum(0, src_ip, 4);
+    sum = nu_sum(sum, dst_ip, 4);
+    sum += NU_IP_PROTO_UDP + udp_len;
+    sum = nu_sum(sum, udp, udp_len);
+    uint16_t c = nu_fold(sum);
+    return c ? c : 0xFFFF;  // 0 means "no checksum" in IPv4
+}
+
+void nu_init(nu_iface_t *nif, const uint8_t mac[6], const uint8_t ip[4], uint16_t port,
+             nu_datagram_fn on_datagram, void *ctx) {
+    memset(nif, 0, sizeof(*nif));
+    memcpy(nif->mac, mac, 6);
+    memcpy(nif->ip, ip, 4);
+    nif->port = port;
+    nif->on_datagram = on_datagram;
+    nif->ctx = ctx;
+}
+
+// Fill in the Ethernet/IPv4/UDP headers around a payload already at
+// out + NU_UDP_OFFSET
+static HOT_PATH uint16_t nu_frame_udp(uint8_t *out, const nu_peer_t *src, const nu_peer_t *dst,
+                                      uint16_t ip_id, uint16_t len) {
+    uint8_t *eth = out;
+    uint8_t *ip = out + NU_ETH_HLEN;
+    uint8_t *udp = ip + NU_IP_HLEN;
+    uint16_t udp_len = (uint16_t)(NU_UDP_HLEN + len);
+
+    memcpy(eth, dst->mac, 6);
+    memcpy(eth + 6, src->mac, 6);
+    nu_put16(eth + 12, NU_ETHERTYPE_IPV4);
+
+    ip[0] = 0x45;
+    ip[1] = 0;
+    nu_put16(ip + 2, (uint16_t)(NU_IP_HLEN + udp_len));
+    nu_put16(ip + 4, ip_id);
+    nu_put16(ip + 6, 0x4000);  // Don't fragment
+    ip[8] = NU_IP_TTL;
+    ip[9] = NU_IP_PROTO_UDP;
+    nu_put16(ip + 10, 0);
+    memcpy(ip + 12, src->ip, 4);
+    memcpy(ip + 16, dst->ip, 4);
+    nu_put16(ip + 10, nu_fold(nu_sum(0, ip, NU_IP_HLEN)));
+
+    nu_put16(udp, src->port);
+    nu_put16(udp + 2, dst->port);
+    nu_put16(udp + 4, udp_len);
+    nu_put16(udp + 6, 0);
+    nu_put16(udp + 6, nu_udp_checksum(src->ip, dst->ip, udp, udp_len));
+
+    return (uint16_t)(NU_UDP_OFFSET + len);
+}
+
+static uint16_t nu_arp(nu_iface_t *nif, const uint8_t *arp, uint8_t *out, uint16_t out_cap) {
+    if (nu_be16(arp) != 1 || nu_be16(arp + 2) != NU_ETHERTYPE_IPV4 || arp[4] != 6 || arp[5] != 4) {
+        nif->stats.ignored++;
+        return 0;
+    }
+    if (nu_be16(arp + 6) != NU_ARP_REQUEST || memcmp(arp + 24, nif->ip, 4) != 0) {
+        nif->stats.ignored++;
+        return 0;
+    }
+    if (out_cap < NU_ETH_HLEN + NU_ARP_LEN) return 0;
+
+    const uint8_t *sha = arp + 8;
+    const uint8_t *spa = arp + 14;
+    memcpy(out, sha, 6);
+    memcpy(out + 6, nif->mac, 6);
+    nu_put16(out + 12, NU_ETHERTYPE_ARP);
+
+    uint8_t *r = out + NU_ETH_HLEN;
+    memcpy(r, arp, 6);  // htype, ptype, hlen, plen
+    nu_put16(r + 6, NU_ARP_REPLY);
+    memcpy(r + 8, nif->mac, 6);
+    memcpy(r + 14, nif->ip, 4);
+    memcpy(r + 18, sha, 6);
+    memcpy(r + 24, spa, 4);
+    nif->stats.arp_replies++;
+    return NU_ETH_HLEN + NU_ARP_LEN;
+}
+
+HOT_PATH uint16_t nu_input(nu_iface_t *nif, const uint8_t *frame, uint16_t len, uint8_t *out, uint16_t out_cap) {
+    nif->stats.frames++;
+    if (len < NU_ETH_HLEN) {
+        nif->stats.bad++;
+        return 0;
+    }
+
+    static const uint8_t broadcast[6] = { 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF };
+    if (memcmp(frame, nif->mac, 6) != 0 && memcmp(frame, broadcast, 6) != 0) {
+        nif->stats.ignored++;
+        return 0;
+    }
+
+    uint16_t type = nu_be16(frame + 12);
+    const uint8_t *ip = frame + NU_ETH_HLEN;
+    uint16_t ip_avail = (uint16_t)(len - NU_ETH_HLEN);
+
+    if (type == NU_ETHERTYPE_ARP) {
+        if (ip_avail < NU_ARP_LEN) {
+            nif->stats.bad++;
+            return 0;
+        }
+        return nu_arp(nif, ip, out, out_cap);
+    }
+    if (type != NU_ETHERTYPE_IPV4) {
+        nif->stats.ignored++;
+        return 0;
+    }
+
+    if (ip_avail < NU_IP_HLEN || (ip[0] >> 4) != 4) {
+        nif->stats.bad++;
+        return 0;
+    }
+    uint16_t ihl = (uint16_t)((ip[0] & 0x0F) * 4);
+    uint16_t total = nu_be16(ip + 2);
+    // Short frames are padded to 60 bytes, so trust the IP length, not the frame's
+    if (ihl < NU_IP_HLEN || total < ihl + NU_UDP_HLEN || total > ip_avail ||
+        (nu_be16(ip + 6) & 0x3FFF) != 0 || nu_fold(nu_sum(0, ip, ihl)) != 0) {
+        nif->stats.bad++;
+        return 0;
+    }
+    if (ip[9] != NU_IP_PROTO_UDP || memcmp(ip + 16, nif->ip, 4) != 0) {
+        nif->stats.ignored++;
+        return 0;
+    }
+
+    const uint8_t *udp = ip + ihl;
+    uint16_t udp_len = nu_be16(udp + 4);
+    if (nu_be16(udp + 2) != nif->port) {
+        nif->stats.ignored++;
+        return 0;
+    }
+    // Over a correct datagram, checksum included, the sum folds to zero (returned as 0xFFFF)
+    if (udp_len < NU_UDP_HLEN || udp_len > total - ihl ||
+        (nu_be16(udp + 6) != 0 && nu_udp_checksum(ip + 12, ip + 16, udp, udp_len) != 0xFFFF)) {
+        nif->stats.bad++;
+        return 0;
+    }
+    nif->stats.udp_rx++;
+
+    nu_peer_t from;
+    memcpy(from.mac, frame + 6, 6);
+    memcpy(from.ip, ip + 12, 4);
+    from.port = nu_be16(udp);
+
+    if (!nif->on_datagram || out_cap <= NU_UDP_OFFSET) return 0;
+    uint16_t n = nif->on_datagram(nif->ctx, &from, udp + NU_UDP_HLEN, (uint16_t)(udp_len - NU_UDP_HLEN),
+                                  out + NU_UDP_OFFSET, (uint16_t)(out_cap - NU_UDP_OFFSET));
+    if (n == 0) return 0;
+
+    nu_peer_t self;
+    memcpy(self.mac, nif->mac, 6);
+    memcpy(self.ip, nif->ip, 4);
+    self.port = nif->port;
+    nif->stats.udp_tx++;
+    return nu_frame_udp(out, &self, &from, nif->ip_id++, n);
+}
+
+uint16_t nu_build_udp(uint8_t *out, uint16_t out_cap, const nu_peer_t *src, const nu_peer_t *dst,
+                      uint16_t ip_id, const uint8_t *payload, uint16_t len) {
+    if ((uint32_t)NU_UDP_OFFSET + len > out_cap) return 0;
+    memcpy(out + NU_UDP_OFFSET, payload, len);
+    return nu_frame_udp(out, src, dst, ip_id, len);
+}
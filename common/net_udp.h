@@ -0,0 +1,73 @@
+/**
+ * @file net_udp.h
+ * @brief Minimal Ethernet responder: ARP for our address and one UDP port.
+ *
+ * Works on raw Ethernet frames so it can sit directly on a MAC (W5500
+ * MACRAW, a TAP device, a test harness) without an IP stack. Each received
+ * frame is answered in place: an ARP reply, or the UDP reply the datagram
+ * handler wrote, addressed back to the sender's MAC/IP/port. Nothing is
+ * queued and no ARP cache is kept. IPv4 only, no fragments, no options on
+ * transmit.
+ */
+#ifndef NET_UDP_H
+#define NET_UDP_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define NU_ETH_HLEN     14
+#define NU_IP_HLEN      20
+#define NU_UDP_HLEN     8
+#define NU_UDP_OFFSET   (NU_ETH_HLEN + NU_IP_HLEN + NU_UDP_HLEN)  // Payload of a frame we build
+#define NU_FRAME_MAX    1514
+
+typedef struct {
+    uint8_t  mac[6];
+    uint8_t  ip[4];
+    uint16_t port;
+} nu_peer_t;
+
+// Write a reply of at most reply_cap bytes and return its length, 0 for none
+typedef uint16_t (*nu_datagram_fn)(void *ctx, const nu_peer_t *from, const uint8_t *data, uint16_t len,
+                                   uint8_t *reply, uint16_t reply_cap);
+
+typedef struct {
+    uint32_t frames;
+    uint32_t arp_replies;
+    uint32_t udp_rx;
+    uint32_t udp_tx;
+    uint32_t ignored;     // Not ARP/IPv4/UDP for us
+    uint32_t bad;         // Truncated, fragmented or failed checksum
+} nu_stats_t;
+
+typedef struct {
+    uint8_t        mac[6];
+    uint8_t        ip[4];
+    uint16_t       port;
+    nu_datagram_fn on_datagram;
+    void          *ctx;
+    uint16_t       ip_id;
+    nu_stats_t     stats;
+} nu_iface_t;
+
+void nu_init(nu_iface_t *nif, const uint8_t mac[6], const uint8_t ip[4], uint16_t port,
+             nu_datagram_fn on_datagram, void *ctx);
+
+// Handle one received frame. Builds the answer in out (which may not alias
+// frame) and returns its length, 0 if there is nothing to send.
+uint16_t nu_input(nu_iface_t *nif, const uint8_t *frame, uint16_t len, uint8_t *out, uint16_t out_cap);
+
+// Build a UDP frame from src to dst around payload, computing both
+// checksums. Returns its length, 0 if it does not fit. For clients and tests.
+uint16_t nu_build_udp(uint8_t *out, uint16_t out_cap, const nu_peer_t *src, const nu_peer_t *dst,
+                      uint16_t ip_id, const uint8_t *payload, uint16_t len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // NET_UDP_H
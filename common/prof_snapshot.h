@@ -0,0 +1,134 @@
+/**
+ * @file prof_snapshot.h
+ * @brief Layout of the profile snapshot a profile build serves over
+ * KP_CMD_SNAPSHOT.
+ *
+ * The snapshot is one byte stream, read in chunks by offset:
+ *
+ *   prof_snap_header_t
+ *   prof_snap_entry_t x entries   run time per thread and per interrupt
+ *   TraceX dump, trace_size bytes  header, object registry, event buffer
+ *
+ * The run-time table covers the window since the previous snapshot and is
+ * cleared by taking one. The trace dump is the same memory image ThreadX
+ * builds with TX_ENABLE_EVENT_TRACE, so TraceX opens it as is once cut out
+ * of the stream; its pointers are device addresses, relative to the base
+ * address in its header. Everything is little-endian; times and time stamps
+ * are in CPU cycles at cpu_hz.
+ *
+ * The firmware fills these in place and the host tools read them straight
+ * from the dump, so every field sits at its natural alignment and the sizes
+ * are checked below.
+ */
+#ifndef PROF_SNAPSHOT_H
+#define PROF_SNAPSHOT_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define PROF_SNAP_MAGIC    0x464f5250u   // "PROF"
+#define PROF_SNAP_VERSION  1
+#define PROF_NAME_LEN      24
+
+// Entry kinds
+#define PROF_KIND_THREAD   1
+#define PROF_KIND_ISR      2
+#define PROF_KIND_IDLE     3   // Scheduler with nothing ready
+#define PROF_KIND_INIT     4   // Before the first thread ran
+
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t entries;
+    uint32_t cpu_hz;
+    uint32_t trace_size;
+    uint64_t window_cycles;    // Time the run-time table covers
+} prof_snap_header_t;
+
+typedef struct {
+    uint8_t  kind;             // PROF_KIND_*
+    uint8_t  priority;         // Thread priority
+    int16_t  irq;              // ISR: IRQ number, -1 for SysTick
+    uint32_t id;               // Thread: TX_THREAD address, as in the trace
+    uint64_t cycles;           // Run time in the window, nested ISRs excluded
+    uint32_t count;            // Times switched in, or interrupts taken
+    uint32_t max_cycles;       // Longest single run
+    uint64_t wait_cycles;      // Thread: sum of dispatch latencies
+    uint32_t waits;
+    uint32_t wait_max_cycles;
+    char     name[PROF_NAME_LEN];
+} prof_snap_entry_t;
+
+// ThreadX trace layout (tx_trace.h), which only exists in a kernel built
+// with TX_ENABLE_EVENT_TRACE. ULONG is 32 bits on the device, hence the
+// fixed-size fields.
+#define PROF_TRACE_VALID          0x54585442u   // "TXTB"
+#define PROF_TRACE_NAME_LEN       32
+#define PROF_TRACE_OBJECT_THREAD  1
+
+// Event ids
+#define PROF_TRACE_THREAD_RESUME  1
+#define PROF_TRACE_ISR_ENTER      3
+#define PROF_TRACE_ISR_EXIT       4
+#define PROF_TRACE_RUNNING        6
+#define PROF_TRACE_USER_EVENT     4096
+
+// Events the firmware adds as TraceX user events, info fields in brackets
+#define PROF_EV_IDLE              (PROF_TRACE_USER_EVENT + 0)   // Scheduler found nothing ready
+#define PROF_EV_HOST_REPORT       (PROF_TRACE_USER_EVENT + 1)   // Mouse report in from USB (length, id)
+#define PROF_EV_PC_REPORT         (PROF_TRACE_USER_EVENT + 2)   // Report handed to the PC side (length)
+#define PROF_EV_NET_CMD           (PROF_TRACE_USER_EVENT + 3)   // KMBox mouse command queued (kind, x, y)
+
+// Thread pointer of an event logged outside a thread
+#define PROF_TRACE_IN_ISR         0xFFFFFFFFu
+#define PROF_TRACE_IN_INIT        0xF0F0F0F0u
+
+typedef struct {
+    uint32_t id;               // PROF_TRACE_VALID
+    uint32_t timer_valid_mask;
+    uint32_t base;             // Device address of this header
+    uint32_t registry_start;
+    uint16_t reserved1;
+    uint16_t name_size;        // PROF_TRACE_NAME_LEN
+    uint32_t registry_end;
+    uint32_t buffer_start;
+    uint32_t buffer_end;
+    uint32_t buffer_current;   // Next entry written: the oldest once wrapped
+    uint32_t reserved2;        // 0xAAAAAAAA, 0xBBBBBBBB, 0xCCCCCCCC
+    uint32_t reserved3;
+    uint32_t reserved4;
+} prof_trace_header_t;
+
+typedef struct {
+    uint8_t  available;        // Non-zero: slot free
+    uint8_t  type;             // PROF_TRACE_OBJECT_*
+    uint8_t  reserved1;
+    uint8_t  reserved2;
+    uint32_t object;           // Device address, as events name it
+    uint32_t param1;           // Thread: stack start
+    uint32_t param2;           // Thread: stack size
+    uint8_t  name[PROF_TRACE_NAME_LEN];
+} prof_trace_object_t;
+
+typedef struct {
+    uint32_t thread;           // Running thread, or PROF_TRACE_IN_*
+    uint32_t priority;         // In an ISR: the interrupted thread
+    uint32_t event;            // 0 = never written
+    uint32_t time;
+    uint32_t info[4];
+} prof_trace_event_t;
+
+_Static_assert(sizeof(prof_snap_header_t) == 24, "snapshot header layout");
+_Static_assert(sizeof(prof_snap_entry_t) == 64, "snapshot entry layout");
+_Static_assert(sizeof(prof_trace_header_t) == 48, "TraceX header layout");
+_Static_assert(sizeof(prof_trace_object_t) == 48, "TraceX object layout");
+_Static_assert(sizeof(prof_trace_event_t) == 32, "TraceX event layout");
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // PROF_SNAPSHOT_H
@@ -0,0 +1,59 @@
+#include "sched_timer.h"
+#include "hot_path.h"
+#include <stddef.h>
+
+static inline bool sched_before(uint32_t a, uint32_t b) {
+    return (int32_t)(a - b) < 0;
+}
+
+void sched_init(sched_t *s) {
+    s->head = NULL;
+    s->fired = 0;
+}
+
+void sched_cancel(sched_t *s, sched_timer_t *t) {
+    if (!t->armed) return;
+    for (sched_timer_t **p = &s->head; *p; p = &(*p)->next) {
+        if (*p == t) {
+            *p = t->next;
+            break;
+        }
+    }
+    t->next = NULL;
+    t->armed = false;
+}
+
+void sched_at(sched_t *s, sched_timer_t *t, uint32_t due_us, sched_fn fn, void *ctx) {
+    sched_cancel(s, t);
+    t->due_us = due_us;
+    t->fn = fn;
+    t->ctx = ctx;
+
+    // After any timer due at the same time, so equal deadlines run in the
+    // order they were armed
+    sched_timer_t **p = &s->head;
+    while (*p && !sched_before(due_us, (*p)->due_us)) p = &(*p)->next;
+    t->next = *p;
+    *p = t;
+    t->armed = true;
+}
+
+HOT_PATH bool sched_run(sched_t *s, uint32_t now_us) {
+    bool ran = false;
+    while (s->head && !sched_before(now_us, s->head->due_us)) {
+        sched_timer_t *t = s->head;
+        s->head = t->next;
+        t->next = NULL;
+        t->armed = false;
+        s->fired++;
+        ran = true;
+        t->fn(t->ctx);
+    }
+    return ran;
+}
+
+HOT_PATH bool sched_next(const sched_t *s, uint32_t *due_us) {
+    if (!s->head) return false;
+    *due_us = s->head->due_us;
+    return true;
+}
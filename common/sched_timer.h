@@ -0,0 +1,64 @@
+/**
+ * @file sched_timer.h
+ * @brief One-shot timer continuations for a polled main loop.
+ *
+ * Anything that would otherwise sleep arms a timer with the function to
+ * run when the wait is over, and returns. The loop calls sched_run() every
+ * pass and can ask sched_next() how long it may idle. Timers are
+ * caller-owned structs kept in a list sorted by due time, so arming costs a
+ * short walk and no allocation. Times are 32-bit microseconds, compared
+ * modulo 2^32, so a timer can be up to ~35 minutes out.
+ *
+ * Not thread-safe: each scheduler belongs to one core, and its timers are
+ * armed and cancelled only from that core (callbacks included).
+ */
+#ifndef SCHED_TIMER_H
+#define SCHED_TIMER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef void (*sched_fn)(void *ctx);
+
+typedef struct sched_timer {
+    struct sched_timer *next;
+    uint32_t            due_us;
+    sched_fn            fn;
+    void               *ctx;
+    bool                armed;
+} sched_timer_t;
+
+typedef struct {
+    sched_timer_t *head;
+    uint32_t       fired;
+} sched_t;
+
+void sched_init(sched_t *s);
+
+// Arm t to call fn(ctx) once due_us is reached. Re-arming a pending timer
+// moves it.
+void sched_at(sched_t *s, sched_timer_t *t, uint32_t due_us, sched_fn fn, void *ctx);
+
+void sched_cancel(sched_t *s, sched_timer_t *t);
+
+static inline bool sched_pending(const sched_timer_t *t) {
+    return t->armed;
+}
+
+// Run every timer due at now_us, in due order. A callback may arm timers,
+// its own included; ones that come due at or before now_us run in this call.
+// Returns true if anything ran.
+bool sched_run(sched_t *s, uint32_t now_us);
+
+// Earliest due time, false if nothing is armed
+bool sched_next(const sched_t *s, uint32_t *due_us);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // SCHED_TIMER_H
@@ -0,0 +1,113 @@
+#include "serial_frame.h"
+#include "hot_path.h"
+#include <string.h>
+
+// CRC-16/CCITT-FALSE (poly 0x1021, init 0xFFFF), a nibble at a time: 32
+// bytes of table instead of 512, and cheap enough at UART byte rates
+static const uint16_t sf_crc_nibble[16] = {
+    0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50A5, 0x60C6, 0x70E7,
+    0x8108, 0x9129, 0xA14A, 0xB16B, 0xC18C, 0xD1AD, 0xE1CE, 0xF1EF,
+};
+
+HOT_PATH uint16_t sf_crc16(uint16_t crc, const uint8_t *data, uint32_t len) {
+    while (len--) {
+        uint8_t b = *data++;
+        crc = (uint16_t)((crc << 4) ^ sf_crc_nibble[(crc >> 12) ^ (b >> 4)]);
+        crc = (uint16_t)((crc << 4) ^ sf_crc_nibble[(crc >> 12) ^ (b & 0x0F)]);
+    }
+    return crc;
+}
+
+HOT_PATH uint16_t sf_encode(const uint8_t *payload, uint16_t len, uint8_t *out, uint16_t cap) {
+    if (len > SF_MAX_PAYLOAD || cap < SF_ENCODED_MAX(len)) return 0;
+
+    uint16_t crc = sf_crc16(0xFFFF, payload, len);
+    const uint8_t trailer[SF_CRC_LEN] = { (uint8_t)crc, (uint8_t)(crc >> 8) };
+
+    uint16_t code_at = 0;  // Where the current block's code byte goes
+    uint16_t o = 1;
+    uint8_t code = 1;
+    for (uint16_t i = 0; i < len + SF_CRC_LEN; i++) {
+        uint8_t b = i < len ? payload[i] : trailer[i - len];
+        if (b == 0) {
+            out[code_at] = code;
+            code_at = o++;
+            code = 1;
+            continue;
+        }
+        out[o++] = b;
+        if (++code == 0xFF) {
+            out[code_at] = code;
+            code_at = o++;
+            code = 1;
+        }
+    }
+    out[code_at] = code;
+    out[o++] = SF_DELIM;
+    return o;
+}
+
+void sf_decoder_init(sf_decoder_t *d) {
+    memset(d, 0, sizeof(*d));
+}
+
+static inline void sf_reset(sf_decoder_t *d) {
+    d->len = 0;
+    d->code = 0;
+    d->left = 0;
+    d->discard = false;
+}
+
+static HOT_PATH void sf_end(sf_decoder_t *d, sf_frame_fn fn, void *ctx) {
+    if (d->discard || d->code == 0) {
+        // Already counted, or an empty frame (idle delimiters)
+        sf_reset(d);
+        return;
+    }
+    if (d->left != 0 || d->len < SF_CRC_LEN) {
+        d->stats.malformed++;
+        sf_reset(d);
+        return;
+    }
+
+    uint16_t n = d->len - SF_CRC_LEN;
+    uint16_t crc = (uint16_t)(d->buf[n] | (d->buf[n + 1] << 8));
+    if (sf_crc16(0xFFFF, d->buf, n) != crc) {
+        d->stats.crc_errors++;
+    } else {
+        d->stats.frames++;
+        fn(ctx, d->buf, n);
+    }
+    sf_reset(d);
+}
+
+// Append one decoded byte; false once the frame is over length
+static inline bool sf_put(sf_decoder_t *d, uint8_t b) {
+    if (d->len >= sizeof(d->buf)) {
+        d->stats.too_long++;
+        d->discard = true;
+        return false;
+    }
+    d->buf[d->len++] = b;
+    return true;
+}
+
+HOT_PATH void sf_feed(sf_decoder_t *d, const uint8_t *data, uint32_t len, sf_frame_fn fn, void *ctx) {
+    d->stats.bytes += len;
+    for (uint32_t i = 0; i < len; i++) {
+        uint8_t b = data[i];
+        if (b == SF_DELIM) {
+            sf_end(d, fn, ctx);
+        } else if (d->discard) {
+            continue;
+        } else if (d->left == 0) {
+            // Block boundary: the previous block stood for a zero unless it
+            // was a full 254-byte run
+            if (d->code != 0 && d->code != 0xFF && !sf_put(d, 0)) continue;
+            d->code = b;
+            d->left = (uint8_t)(b - 1);
+        } else if (sf_put(d, b)) {
+            d->left--;
+        }
+    }
+}
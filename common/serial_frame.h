@@ -0,0 +1,71 @@
+/**
+ * @file serial_frame.h
+ * @brief COBS framing with a CRC-16 trailer for byte-stream transports.
+ *
+ * A frame on the wire is COBS(payload || crc16_le(payload)) followed by a
+ * single 0x00. COBS removes every zero from the encoded bytes, so the
+ * delimiter is unambiguous: a receiver that joins mid-stream or loses bytes
+ * resynchronises at the next zero. The cost is at most one byte per 254.
+ * The CRC is CRC-16/CCITT-FALSE over the payload only.
+ *
+ * The decoder is incremental. Bytes can be fed in any split, for example
+ * the two halves of a DMA ring, and each complete, CRC-clean payload is
+ * handed to a callback. No second pass is made over the data.
+ */
+#ifndef SERIAL_FRAME_H
+#define SERIAL_FRAME_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Largest payload accepted; longer frames are dropped whole. A KMBox mouse
+// command is 72 bytes, the keyboard command 28.
+#ifndef SF_MAX_PAYLOAD
+#define SF_MAX_PAYLOAD   256
+#endif
+
+#define SF_DELIM         0x00
+#define SF_CRC_LEN       2
+
+// Worst-case bytes on the wire for a payload of n bytes, delimiter included
+#define SF_ENCODED_MAX(n) ((n) + SF_CRC_LEN + ((n) + SF_CRC_LEN) / 254 + 2)
+
+typedef void (*sf_frame_fn)(void *ctx, const uint8_t *payload, uint16_t len);
+
+typedef struct {
+    uint32_t frames;       // Delivered
+    uint32_t crc_errors;
+    uint32_t too_long;     // Over SF_MAX_PAYLOAD
+    uint32_t malformed;    // COBS block overran the delimiter, or no room for the CRC
+    uint32_t bytes;
+} sf_stats_t;
+
+typedef struct {
+    uint8_t    buf[SF_MAX_PAYLOAD + SF_CRC_LEN];
+    uint16_t   len;
+    uint8_t    code;       // Current COBS block code
+    uint8_t    left;       // Data bytes still to come in this block
+    bool       discard;    // Drop everything up to the next delimiter
+    sf_stats_t stats;
+} sf_decoder_t;
+
+uint16_t sf_crc16(uint16_t crc, const uint8_t *data, uint32_t len);
+
+// Encode one frame into out. Returns the number of bytes to send, delimiter
+// included, or 0 if out is too small.
+uint16_t sf_encode(const uint8_t *payload, uint16_t len, uint8_t *out, uint16_t cap);
+
+void sf_decoder_init(sf_decoder_t *d);
+
+// Feed received bytes; fn is called once per good frame, from inside the call
+void sf_feed(sf_decoder_t *d, const uint8_t *data, uint32_t len, sf_frame_fn fn, void *ctx);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // SERIAL_FRAME_H
@@ -0,0 +1,60 @@
+#include "spsc_ring.h"
+#include "hot_path.h"
+#include <string.h>
+
+void spsc_init(spsc_ring_t *r, void *storage, uint32_t elem_size, uint32_t depth) {
+    r->buf = (uint8_t *)storage;
+    r->elem_size = elem_size;
+    r->mask = depth - 1u;
+    r->head = 0;
+    r->tail = 0;
+    r->dropped = 0;
+    r->high_water = 0;
+}
+
+HOT_PATH void *spsc_claim(spsc_ring_t *r) {
+    uint32_t head = r->head;
+    uint32_t tail = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+    if (head - tail > r->mask) {
+        r->dropped++;
+        return NULL;
+    }
+    return r->buf + (head & r->mask) * r->elem_size;
+}
+
+HOT_PATH void spsc_publish(spsc_ring_t *r) {
+    uint32_t head = r->head + 1u;
+    uint32_t depth = head - __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+    if (depth > r->high_water) r->high_water = depth;
+    __atomic_store_n(&r->head, head, __ATOMIC_RELEASE);
+}
+
+HOT_PATH bool spsc_push(spsc_ring_t *r, const void *elem) {
+    void *slot = spsc_claim(r);
+    if (!slot) return false;
+    memcpy(slot, elem, r->elem_size);
+    spsc_publish(r);
+    return true;
+}
+
+HOT_PATH const void *spsc_peek(spsc_ring_t *r) {
+    uint32_t tail = r->tail;
+    if (tail == __atomic_load_n(&r->head, __ATOMIC_ACQUIRE)) return NULL;
+    return r->buf + (tail & r->mask) * r->elem_size;
+}
+
+HOT_PATH void spsc_release(spsc_ring_t *r) {
+    __atomic_store_n(&r->tail, r->tail + 1u, __ATOMIC_RELEASE);
+}
+
+HOT_PATH bool spsc_pop(spsc_ring_t *r, void *out) {
+    const void *slot = spsc_peek(r);
+    if (!slot) return false;
+    memcpy(out, slot, r->elem_size);
+    spsc_release(r);
+    return true;
+}
+
+uint32_t spsc_count(const spsc_ring_t *r) {
+    return __atomic_load_n(&r->head, __ATOMIC_ACQUIRE) - __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+}
@@ -0,0 +1,51 @@
+/**
+ * @file spsc_ring.h
+ * @brief Lock-free single-producer / single-consumer ring of fixed-size slots.
+ *
+ * Meant for handing data between two execution contexts that never share a
+ * lock: the two RP2040 cores, an ISR and a thread, and so on. The producer
+ * only writes head and the consumer only writes tail; acquire/release on
+ * those two words is all the ordering needed. Slots can be filled and
+ * drained in place (claim/publish, peek/release) so large elements are not
+ * copied twice.
+ */
+#ifndef SPSC_RING_H
+#define SPSC_RING_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct {
+    uint8_t          *buf;
+    uint32_t          elem_size;
+    uint32_t          mask;        // depth - 1
+    volatile uint32_t head;        // Written by the producer only
+    volatile uint32_t tail;        // Written by the consumer only
+    uint32_t          dropped;     // Pushes refused because the ring was full
+    uint32_t          high_water;  // Deepest the ring has been
+} spsc_ring_t;
+
+// storage must hold depth * elem_size bytes; depth must be a power of two.
+void spsc_init(spsc_ring_t *r, void *storage, uint32_t elem_size, uint32_t depth);
+
+// Producer side
+bool  spsc_push(spsc_ring_t *r, const void *elem);
+void *spsc_claim(spsc_ring_t *r);   // Next free slot, or NULL when full
+void  spsc_publish(spsc_ring_t *r); // Hand the claimed slot to the consumer
+
+// Consumer side
+bool        spsc_pop(spsc_ring_t *r, void *out);
+const void *spsc_peek(spsc_ring_t *r);  // Oldest slot, or NULL when empty
+void        spsc_release(spsc_ring_t *r);
+
+uint32_t spsc_count(const spsc_ring_t *r);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // SPSC_RING_H
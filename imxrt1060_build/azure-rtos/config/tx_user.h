@@ -48,6 +48,14 @@
 
 //#define TX_ENABLE_EVENT_TRACE
 
+/* Profile build: the port's scheduler calls the _tx_execution_* hooks in
+ * source/rtos_profile.c on every context switch. Unlike
+ * TX_EXECUTION_PROFILE_ENABLE and TX_ENABLE_EVENT_TRACE it changes no kernel
+ * structure, so the prebuilt library links unchanged. */
+#ifdef SR71_PROFILE
+#define TX_ENABLE_EXECUTION_CHANGE_NOTIFY
+#endif
+
 //#define TX_BLOCK_POOL_ENABLE_PERFORMANCE_INFO
 
 //#define TX_BYTE_POOL_ENABLE_PERFORMANCE_INFO
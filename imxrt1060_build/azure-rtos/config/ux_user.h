@@ -15,6 +15,12 @@
 
 #define UX_PERIODIC_RATE (TX_TIMER_TICKS_PER_SECOND)
 
+/*
+ * The device HID class thread moves reports from hid_output's event queue
+ * to the interrupt IN endpoint, so it runs right behind it (port default 20).
+ */
+#define UX_THREAD_PRIORITY_CLASS 7
+
 #define UX_SLAVE_REQUEST_CONTROL_MAX_LENGTH      512
 #define UX_SLAVE_REQUEST_DATA_MAX_LENGTH         (1024 * 2)
 #define UX_HOST_CLASS_STORAGE_MEMORY_BUFFER_SIZE (1024 * 8)
@@ -44,14 +50,20 @@
  * but for simple HID devices like keyboard and mouse
  *  it can be reduced a lot.
  */
-#define UX_HOST_CLASS_HID_DECOMPRESSION_BUFFER 4096
+#define UX_HOST_CLASS_HID_DECOMPRESSION_BUFFER 1024
 
 /*
  * Defined, this value represents the maximum number of HID usages
  * for a HID device. Default is 2048 but for simple HID devices
  * like keyboard and mouse it can be reduced a lot.
  */
-#define UX_HOST_CLASS_HID_USAGES 2048
+#define UX_HOST_CLASS_HID_USAGES 256
+
+/*
+ * Keep low-water marks for the byte pools; mem_pools_report() prints them
+ * so the pool sizes in mem_pools.h can be set from what a device really uses.
+ */
+#define UX_ENABLE_MEMORY_STATISTICS
 
 /*
  * Defined, this value represents the maximum number of media for
@@ -8,6 +8,7 @@
 #include "fsl_common.h"
 
 #include "tx_api.h"
+#include "hot_path.h"
 
 /* the memory space after the heap is unused */
 #if defined(__CC_ARM) || defined(__ARMCC_VERSION)
@@ -62,7 +63,7 @@ VOID _tx_initialize_low_level(VOID)
     NVIC_SetPriority(SysTick_IRQn, 0x40);
 }
 
-VOID SysTick_Handler(VOID)
+HOT_PATH_IRQ VOID SysTick_Handler(VOID)
 {
     _tx_timer_interrupt();
 }
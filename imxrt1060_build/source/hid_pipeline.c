@@ -0,0 +1,550 @@
+#include "hid_pipeline.h"
+
+#include "ux_device_class_hid.h"
+#include "fsl_common.h"
+#include "fsl_debug_console.h"
+#include "usb_ctrl_forward.h"
+#include "net_control.h"
+#include "net_ptp.h"
+#include "hr_timer.h"
+#include "cmd_wheel.h"
+#include "hid_plan.h"
+#include "spsc_ring.h"
+#include "mem_pools.h"
+#include "rtos_profile.h"
+#include "hot_path.h"
+#include <string.h>
+
+#define HID_PIPE_EV_HOST    0x1u   /* Raw reports from the USBX callback */
+#define HID_PIPE_EV_READY   0x2u   /* Checked reports for the output thread */
+#define HID_PIPE_EV_NET     0x4u   /* Network commands queued */
+#define HID_PIPE_EV_DETACH  0x8u   /* Physical device gone */
+#define HID_PIPE_EV_TIMER   0x10u  /* hid_wake: a retry or a scheduled command is due */
+
+typedef struct
+{
+    uint32_t host_us;     /* USBX callback */
+    uint32_t ingest_us;   /* Handed to the output thread */
+    uint16_t len;         /* Report ID included when the plan uses IDs */
+    UCHAR    data[HID_PIPE_REPORT_MAX];
+} hid_pipe_report_t;
+
+typedef struct
+{
+    ULONG    count;
+    ULONG    over;        /* Above the hop's budget */
+    ULONG    max_us;
+    uint64_t sum_us;
+} hid_pipe_hop_t;
+
+static TX_THREAD            hid_ingest_thread;
+static TX_THREAD            hid_output_thread;
+static TX_EVENT_FLAGS_GROUP hid_pipe_events;
+
+/* Everything touched per report lives in DTCM */
+MEM_DTCM_BSS(static ULONG hid_ingest_stack[HID_INGEST_STACK_SIZE/sizeof(ULONG)]);
+MEM_DTCM_BSS(static ULONG hid_output_stack[HID_OUTPUT_STACK_SIZE/sizeof(ULONG)]);
+MEM_DTCM_BSS(static hid_pipe_report_t hid_raw_buf[HID_PIPE_RAW_DEPTH]);
+MEM_DTCM_BSS(static hid_pipe_report_t hid_out_buf[HID_PIPE_OUT_DEPTH]);
+static spsc_ring_t       hid_raw;   /* USBX HCD thread -> ingest */
+static spsc_ring_t       hid_out;   /* Ingest -> output */
+
+/* Compiled once, from the descriptor the PC enumerated; a reattached
+ * device has the identical one, so the threads never see it change */
+MEM_DTCM_BSS(static hp_plan_t hid_plan);
+
+/* Output thread only */
+MEM_DTCM_BSS(static UCHAR hid_last[HP_MAX_REPORTS + 1][HID_PIPE_REPORT_MAX]);  /* As the device sent them */
+static uint16_t      hid_last_len[HP_MAX_REPORTS + 1];
+static hp_delta_t    hid_delta;
+static hp_override_t hid_override;
+static bool          hid_override_changed;
+
+/* Commands with an execute-at time wait here, in the PTP timebase, and
+ * hid_wake brings the output thread back when the first one is due */
+MEM_DTCM_BSS(static cw_wheel_t hid_wheel);
+static hrt_timer_t   hid_wake;
+
+static struct
+{
+    ULONG    on_time;
+    ULONG    late;
+    ULONG    dropped;
+    ULONG    overflow;      /* Wheel full, run on arrival */
+    ULONG    err_max_us;    /* Release after the execute-at time, on-time ones */
+    uint64_t err_sum_us;
+    ULONG    late_max_us;
+} hid_sched;
+
+static struct
+{
+    hid_pipe_hop_t host;
+    hid_pipe_hop_t ingest;
+    hid_pipe_hop_t net;
+    hid_pipe_hop_t output;
+    ULONG          unknown;       /* Report ID the plan does not know */
+    ULONG          sent;
+    ULONG          send_failed;   /* PC not attached or its event queue full */
+    ULONG          synthesized;   /* Made up to carry network input */
+} hid_pipe_stats;
+
+static HOT_PATH VOID hid_pipe_hop(hid_pipe_hop_t *hop, uint32_t us, uint32_t budget_us)
+{
+    hop->count++;
+    hop->sum_us += us;
+    if (us > hop->max_us)
+        hop->max_us = us;
+    if (us > budget_us)
+        hop->over++;
+}
+
+static HOT_PATH uint8_t hid_pipe_slot(const UCHAR *data, uint16_t len)
+{
+    if (!hid_plan.valid)
+        return 0;
+    if (!hid_plan.uses_report_id)
+        return 1;
+    return len ? hid_plan.index_by_id[data[0]] : 0;
+}
+
+/******** Host side (USBX HCD thread) *********/
+/* Runs for every interrupt IN transfer the physical device completes; does
+ * no more than stamp and copy, so USBX gets its thread back at once */
+static HOT_PATH VOID hid_pipe_host_cb(UX_HOST_CLASS_HID_REPORT_CALLBACK *cb)
+{
+    hid_pipe_report_t *r = (hid_pipe_report_t *)spsc_claim(&hid_raw);
+    const UCHAR *buf = (const UCHAR *)cb->ux_host_class_hid_report_callback_buffer;
+    ULONG len = cb->ux_host_class_hid_report_callback_actual_length;
+    ULONG id = cb->ux_host_class_hid_report_callback_id;
+    ULONG off = 0;
+
+    if (r == NULL)
+        return;
+    r->host_us = hrt_now_us();
+
+    /* The plan wants the report ID in front; put it back if USBX took it off.
+     * A report one byte longer than its payload still carries it. */
+    if (hid_plan.uses_report_id)
+    {
+        uint8_t slot = hid_plan.index_by_id[id & 0xFF];
+        if (len == 0 || buf[0] != id || (slot && len <= hid_plan.reports[slot - 1].size_bytes))
+            r->data[off++] = (UCHAR)id;
+    }
+    if (len + off > HID_PIPE_REPORT_MAX)
+        len = HID_PIPE_REPORT_MAX - off;
+    memcpy(r->data + off, buf, len);
+    r->len = (uint16_t)(len + off);
+
+    spsc_publish(&hid_raw);
+    PROF_EVENT(PROF_EV_HOST_REPORT, len + off, id, 0);
+    tx_event_flags_set(&hid_pipe_events, HID_PIPE_EV_HOST, TX_OR);
+}
+
+/******** Ingest thread *********/
+static HOT_PATH VOID hid_ingest_entry(ULONG arg)
+{
+    const hid_pipe_report_t *raw;
+    hid_pipe_report_t *out;
+    ULONG flags;
+    (void)arg;
+
+    while (1)
+    {
+        bool ready = false;
+
+        tx_event_flags_get(&hid_pipe_events, HID_PIPE_EV_HOST, TX_OR_CLEAR, &flags, TX_WAIT_FOREVER);
+        while ((raw = (const hid_pipe_report_t *)spsc_peek(&hid_raw)) != NULL)
+        {
+            uint32_t now = hrt_now_us();
+            hid_pipe_hop(&hid_pipe_stats.host, now - raw->host_us, HID_BUDGET_HOST_US);
+
+            if (hid_plan.valid && hid_pipe_slot(raw->data, raw->len) == 0)
+            {
+                hid_pipe_stats.unknown++;
+            }
+            else if ((out = (hid_pipe_report_t *)spsc_claim(&hid_out)) != NULL)
+            {
+                out->host_us = raw->host_us;
+                out->len = raw->len;
+                memcpy(out->data, raw->data, raw->len);
+                out->ingest_us = hrt_now_us();
+                spsc_publish(&hid_out);
+                ready = true;
+            }
+            spsc_release(&hid_raw);
+        }
+        /* One wake-up for the whole burst: the threshold kept the output
+         * thread from running until now */
+        if (ready)
+            tx_event_flags_set(&hid_pipe_events, HID_PIPE_EV_READY, TX_OR);
+    }
+}
+
+/******** Output thread *********/
+static HOT_PATH bool hid_pipe_emit(const UCHAR *data, uint16_t len)
+{
+    UX_SLAVE_CLASS_HID *pc = ctrl_fwd_pc_hid_get();
+    UX_SLAVE_CLASS_HID_EVENT event;
+    ULONG off = hid_plan.uses_report_id ? 1 : 0;
+
+    if (pc == UX_NULL || len <= off)
+    {
+        hid_pipe_stats.send_failed++;
+        return false;
+    }
+    event.ux_device_class_hid_event_report_id = off ? data[0] : 0;
+    event.ux_device_class_hid_event_report_type = UX_DEVICE_CLASS_HID_REPORT_TYPE_INPUT;
+    event.ux_device_class_hid_event_length = len - off;
+    if (event.ux_device_class_hid_event_length > UX_DEVICE_CLASS_HID_EVENT_BUFFER_LENGTH)
+        event.ux_device_class_hid_event_length = UX_DEVICE_CLASS_HID_EVENT_BUFFER_LENGTH;
+    memcpy(event.ux_device_class_hid_event_buffer, data + off, event.ux_device_class_hid_event_length);
+
+    if (ux_device_class_hid_event_set(pc, &event) != UX_SUCCESS)
+    {
+        hid_pipe_stats.send_failed++;
+        return false;
+    }
+    hid_pipe_stats.sent++;
+    PROF_EVENT(PROF_EV_PC_REPORT, event.ux_device_class_hid_event_length, 0, 0);
+    return true;
+}
+
+/* Merge the network input into a report and queue it. data is modified. */
+static HOT_PATH bool hid_pipe_send(UCHAR *data, uint16_t len)
+{
+    hp_delta_t left = hid_delta;
+
+    if (hid_plan.valid)
+    {
+        if (left.axis_mask)
+            hp_add_delta(&hid_plan, &left, data, len);
+        if (hp_override_active(&hid_plan, &hid_override))
+            hp_apply(&hid_plan, &hid_override, data, len);
+    }
+    if (!hid_pipe_emit(data, len))
+        return false;
+    /* Only what went out is taken off the motion still owed */
+    hid_delta = left;
+    hid_override_changed = false;
+    return true;
+}
+
+/* One command into the motion owed and the button override */
+static HOT_PATH VOID hid_pipe_execute(const kp_mouse_t *m)
+{
+    int a;
+
+    switch (m->kind)
+    {
+    case KP_MOUSE_BUTTONS:
+        hid_override.button_mask = m->buttons & KP_MASK_BUTTONS;
+        hid_override.buttons = m->buttons;
+        hid_override_changed = true;
+        return;
+    case KP_MOUSE_WHEEL:
+        hid_delta.axis[HP_AXIS_WHEEL] += m->wheel;
+        break;
+    default:
+        hid_delta.axis[HP_AXIS_X] += m->x;
+        hid_delta.axis[HP_AXIS_Y] += m->y;
+        break;
+    }
+    for (a = 0; a < HP_AXIS_COUNT; a++)
+    {
+        if (hid_delta.axis[a])
+            hid_delta.axis_mask |= (uint16_t)(1u << a);
+        else
+            hid_delta.axis_mask &= (uint16_t)~(1u << a);
+    }
+}
+
+/* Motion sums into the next report here whichever way it is late, so
+ * KP_LATE_RUN and KP_LATE_COMPRESS come out the same */
+static HOT_PATH VOID hid_pipe_late(const kp_mouse_t *m, uint64_t now)
+{
+    uint32_t late = (uint32_t)(now - m->at_us);
+
+    hid_sched.late++;
+    if (late > hid_sched.late_max_us)
+        hid_sched.late_max_us = late;
+    if (m->late == KP_LATE_DROP)
+        hid_sched.dropped++;
+    else
+        hid_pipe_execute(m);
+}
+
+static HOT_PATH VOID hid_pipe_due(VOID *ctx, const kp_mouse_t *m, uint64_t now)
+{
+    uint32_t err = (uint32_t)(now - m->at_us);
+
+    (void)ctx;
+    if (err > HID_PIPE_LATE_SLACK_US)
+    {
+        hid_pipe_late(m, now);
+        return;
+    }
+    hid_sched.on_time++;
+    hid_sched.err_sum_us += err;
+    if (err > hid_sched.err_max_us)
+        hid_sched.err_max_us = err;
+    hid_pipe_execute(m);
+}
+
+static HOT_PATH uint64_t hid_pipe_ptp_us(VOID)
+{
+    return (uint64_t)(net_ptp_now_ns() / 1000);
+}
+
+static HOT_PATH VOID hid_pipe_take_net(VOID)
+{
+    net_cmd_t cmd;
+
+    while (net_control_cmd_get(&cmd))
+    {
+        const kp_mouse_t *m = &cmd.mouse;
+        uint64_t now;
+
+        hid_pipe_hop(&hid_pipe_stats.net, hrt_now_us() - cmd.arrival_us, HID_BUDGET_NET_US);
+        if (!m->at_us)
+        {
+            hid_pipe_execute(m);
+            continue;
+        }
+        /* net_control already refused anything too far ahead */
+        now = hid_pipe_ptp_us();
+        if (m->at_us <= now)
+            hid_pipe_late(m, now);
+        else if (!cw_add(&hid_wheel, m))
+        {
+            hid_sched.overflow++;
+            hid_pipe_execute(m);
+        }
+    }
+}
+
+/* Wake for whatever comes first: the next scheduled command, or the next
+ * try at motion the PC has not taken yet. Reports are only polled once a
+ * microframe, so trying sooner gains nothing; with no PC attached at all
+ * there is no hurry. */
+static HOT_PATH VOID hid_pipe_arm(VOID)
+{
+    uint32_t now = hrt_now_us();
+    uint32_t due = 0;
+    bool armed = false;
+    uint64_t at;
+
+    if (hid_delta.axis_mask || hid_override_changed)
+    {
+        due = now + (ctrl_fwd_pc_hid_get() ? HID_PIPE_RETRY_US : HID_PIPE_IDLE_RETRY_US);
+        armed = true;
+    }
+    if (cw_next(&hid_wheel, &at))
+    {
+        int64_t ahead = (int64_t)(at - hid_pipe_ptp_us());
+        uint32_t when = now + (ahead > 0 ? (uint32_t)ahead : 0);
+
+        if (!armed || (int32_t)(when - due) < 0)
+            due = when;
+        armed = true;
+    }
+    if (armed)
+        hrt_flags_at(&hid_wake, due, &hid_pipe_events, HID_PIPE_EV_TIMER);
+    else if (hrt_pending(&hid_wake))
+        hrt_cancel(&hid_wake);
+}
+
+/* Network input with no device report to ride on: repeat the last one with
+ * nothing new in it, or an all-idle one if the device has sent nothing */
+static HOT_PATH VOID hid_pipe_synthesize(VOID)
+{
+    UCHAR data[HID_PIPE_REPORT_MAX];
+    uint8_t s;
+
+    for (s = 1; s <= hid_plan.report_count; s++)
+    {
+        const hp_report_plan_t *rp = &hid_plan.reports[s - 1];
+        uint16_t len = hid_last_len[s];
+
+        if ((rp->axis_relative & hid_delta.axis_mask) == 0 &&
+            !(hid_override_changed && (rp->button_present & hid_override.button_mask)))
+            continue;
+
+        if (len)
+        {
+            memcpy(data, hid_last[s], len);
+            hp_idle(&hid_plan, data, len);
+        }
+        else
+        {
+            len = (uint16_t)(rp->size_bytes + (hid_plan.uses_report_id ? 1 : 0));
+            if (len > sizeof(data))
+                len = sizeof(data);
+            memset(data, 0, len);
+            if (hid_plan.uses_report_id)
+                data[0] = rp->report_id;
+        }
+        if (hid_pipe_send(data, len))
+            hid_pipe_stats.synthesized++;
+        return;
+    }
+    /* Nothing in the layout can carry it */
+    memset(&hid_delta, 0, sizeof(hid_delta));
+    hid_override_changed = false;
+}
+
+static VOID hid_pipe_release_all(VOID)
+{
+    UCHAR data[HID_PIPE_REPORT_MAX];
+    uint8_t s;
+
+    for (s = 1; s <= hid_plan.report_count; s++)
+    {
+        uint16_t len = hid_last_len[s];
+        if (len == 0)
+            continue;
+        memcpy(data, hid_last[s], len);
+        if (hp_release(&hid_plan, data, len))
+            hid_pipe_emit(data, len);
+    }
+}
+
+static HOT_PATH VOID hid_output_entry(ULONG arg)
+{
+    const hid_pipe_report_t *r;
+    UCHAR data[HID_PIPE_REPORT_MAX];
+    ULONG flags;
+    (void)arg;
+
+    while (1)
+    {
+        uint32_t woke;
+
+        tx_event_flags_get(&hid_pipe_events,
+                           HID_PIPE_EV_READY | HID_PIPE_EV_NET | HID_PIPE_EV_DETACH | HID_PIPE_EV_TIMER,
+                           TX_OR_CLEAR, &flags, TX_WAIT_FOREVER);
+        woke = hrt_now_us();
+
+        if (flags & HID_PIPE_EV_DETACH)
+            hid_pipe_release_all();
+        if (flags & HID_PIPE_EV_NET)
+            hid_pipe_take_net();
+        if (cw_count(&hid_wheel))
+            cw_advance(&hid_wheel, hid_pipe_ptp_us(), hid_pipe_due, NULL);
+
+        while ((r = (const hid_pipe_report_t *)spsc_peek(&hid_out)) != NULL)
+        {
+            uint16_t len = r->len;
+            uint8_t slot = hid_pipe_slot(r->data, len);
+
+            hid_pipe_hop(&hid_pipe_stats.ingest, woke - r->ingest_us, HID_BUDGET_INGEST_US);
+            memcpy(data, r->data, len);
+            spsc_release(&hid_out);
+
+            if (slot)
+            {
+                memcpy(hid_last[slot], data, len);
+                hid_last_len[slot] = len;
+            }
+            hid_pipe_send(data, len);
+        }
+        if (hid_plan.valid && (hid_delta.axis_mask || hid_override_changed))
+            hid_pipe_synthesize();
+        hid_pipe_arm();
+
+        hid_pipe_hop(&hid_pipe_stats.output, hrt_now_us() - woke, HID_BUDGET_OUTPUT_US);
+    }
+}
+
+/******** Public API *********/
+UINT hid_pipe_create(VOID)
+{
+    UINT status;
+
+    spsc_init(&hid_raw, hid_raw_buf, sizeof(hid_pipe_report_t), HID_PIPE_RAW_DEPTH);
+    spsc_init(&hid_out, hid_out_buf, sizeof(hid_pipe_report_t), HID_PIPE_OUT_DEPTH);
+    /* The PTP clock is not up yet; the first advance catches the wheel up */
+    cw_init(&hid_wheel, 0);
+
+    status = tx_event_flags_create(&hid_pipe_events, "hid_pipe");
+    if (status)
+        return status;
+
+    status = tx_thread_create(&hid_output_thread, "hid_output", hid_output_entry, 0,
+                              hid_output_stack, HID_OUTPUT_STACK_SIZE,
+                              HID_OUTPUT_PRIORITY, HID_OUTPUT_PRIORITY, TX_NO_TIME_SLICE, TX_AUTO_START);
+    if (status)
+        return status;
+
+    return tx_thread_create(&hid_ingest_thread, "hid_ingest", hid_ingest_entry, 0,
+                            hid_ingest_stack, HID_INGEST_STACK_SIZE,
+                            HID_INGEST_PRIORITY, HID_INGEST_THRESHOLD, TX_NO_TIME_SLICE, TX_AUTO_START);
+}
+
+UINT hid_pipe_attach(UX_HOST_CLASS_HID *hid, const UCHAR *report_desc, ULONG report_len)
+{
+    UX_HOST_CLASS_HID_REPORT_CALLBACK cb;
+    UINT status = UX_SUCCESS;
+    uint8_t i;
+
+    if (!hid_plan.valid && !hp_compile(&hid_plan, report_desc, (uint16_t)report_len))
+        PRINTF("[PIPE] No usable fields in the report descriptor, reports pass through unpatched\n");
+
+    /* Raw reports instead of the mouse client's decoded state, one
+     * registration per input report ID */
+    memset(&cb, 0, sizeof(cb));
+    cb.ux_host_class_hid_report_callback_flags = UX_HOST_CLASS_HID_REPORT_RAW;
+    cb.ux_host_class_hid_report_callback_function = hid_pipe_host_cb;
+    for (i = 0; i < (hid_plan.valid ? hid_plan.report_count : 1); i++)
+    {
+        cb.ux_host_class_hid_report_callback_id = hid_plan.valid ? hid_plan.reports[i].report_id : 0;
+        status = ux_host_class_hid_report_callback_register(hid, &cb);
+        if (status)
+            return status;
+    }
+
+    /* A device no HID client claimed has no periodic transfer running yet */
+    if (hid->ux_host_class_hid_interrupt_endpoint_status != UX_HOST_CLASS_HID_INTERRUPT_ENDPOINT_ACTIVE)
+        status = ux_host_class_hid_periodic_report_start(hid);
+    return status;
+}
+
+VOID hid_pipe_detach(VOID)
+{
+    tx_event_flags_set(&hid_pipe_events, HID_PIPE_EV_DETACH, TX_OR);
+}
+
+HOT_PATH VOID hid_pipe_net_notify(VOID)
+{
+    tx_event_flags_set(&hid_pipe_events, HID_PIPE_EV_NET, TX_OR);
+}
+
+static VOID hid_pipe_print_hop(const char *name, hid_pipe_hop_t *hop, uint32_t budget_us)
+{
+    if (hop->count == 0)
+        return;
+    PRINTF("[PIPE] %-14s avg %lu max %lu us, %lu of %lu over the %lu us budget\n", name,
+           (ULONG)(hop->sum_us / hop->count), hop->max_us, hop->over, hop->count, budget_us);
+    memset(hop, 0, sizeof(*hop));
+}
+
+VOID hid_pipe_print_stats(VOID)
+{
+    hid_pipe_print_hop("host->ingest", &hid_pipe_stats.host, HID_BUDGET_HOST_US);
+    hid_pipe_print_hop("ingest->output", &hid_pipe_stats.ingest, HID_BUDGET_INGEST_US);
+    hid_pipe_print_hop("net->output", &hid_pipe_stats.net, HID_BUDGET_NET_US);
+    hid_pipe_print_hop("output", &hid_pipe_stats.output, HID_BUDGET_OUTPUT_US);
+    PRINTF("[PIPE] %lu reports to the PC (%lu made up, %lu failed), %lu unknown, ring drops raw %lu out %lu\n",
+           hid_pipe_stats.sent, hid_pipe_stats.synthesized, hid_pipe_stats.send_failed,
+           hid_pipe_stats.unknown, hid_raw.dropped, hid_out.dropped);
+
+    if (hid_wheel.stats.scheduled == 0 && hid_sched.late == 0)
+        return;
+    PRINTF("[SCHED] %lu on time (release error avg %lu max %lu us), %lu late (max %lu us, %lu dropped), "
+           "%lu overflow, wheel high water %lu\n",
+           hid_sched.on_time, hid_sched.on_time ? (ULONG)(hid_sched.err_sum_us / hid_sched.on_time) : 0,
+           hid_sched.err_max_us, hid_sched.late, hid_sched.late_max_us, hid_sched.dropped,
+           hid_sched.overflow, (ULONG)hid_wheel.stats.high_water);
+    memset(&hid_sched, 0, sizeof(hid_sched));
+    hid_wheel.stats.high_water = hid_wheel.count;
+    hid_wheel.stats.scheduled = 0;
+}
@@ -0,0 +1,66 @@
+#ifndef HID_PIPELINE_H
+#define HID_PIPELINE_H
+
+#include "ux_api.h"
+#include "ux_host_class_hid.h"
+#include "tx_api.h"
+
+/* Report path threads. Every hop is a lock-free SPSC ring plus an event
+ * flag, so nothing on it ever waits for a lock:
+ *
+ *   USBX HCD thread (2)  host report callback: stamp, copy, EV_HOST
+ *        |  raw ring
+ *   hid_ingest (8/6)     check against the plan, publish, EV_READY
+ *        |  report ring                    net_server (10) -> net_cmds, EV_NET
+ *   hid_output (6)       merge network input, patch, queue for the PC;
+ *                        holds execute-at commands in a cmd_wheel, woken
+ *                        by an hr_timer when the first one is due
+ *        |  USBX HID event queue
+ *   USBX device class thread (UX_THREAD_PRIORITY_CLASS, 7)  interrupt IN
+ *
+ * Numbers are ThreadX priorities (lower runs first), ingest/threshold for
+ * the ingest thread: it cannot be preempted by the output thread, so a burst
+ * of host reports is handed over in one go rather than one context switch
+ * each. Everything else (IP 9, PTP 13, ctrl_fwd 18, the clone supervisor and
+ * USBX enumeration 20) sits below the report path.
+ *
+ * Worst-case budget per hop, checked by the [PIPE] stats: */
+#define HID_BUDGET_HOST_US     50   /* Host report callback -> ingest thread */
+#define HID_BUDGET_INGEST_US   50   /* Ingest publish -> output thread */
+#define HID_BUDGET_NET_US      100  /* Datagram handed over -> output thread */
+#define HID_BUDGET_OUTPUT_US   30   /* Output thread -> report queued for the PC */
+/* After that the report waits for the PC's next IN token: one bInterval at
+ * most (125 us for a high-speed mouse). */
+
+#define HID_INGEST_STACK_SIZE  (2048)
+#define HID_INGEST_PRIORITY    8
+#define HID_OUTPUT_STACK_SIZE  (2048)
+#define HID_OUTPUT_PRIORITY    6
+#define HID_INGEST_THRESHOLD   HID_OUTPUT_PRIORITY
+
+/* Output thread timing, on the hr_timer microsecond clock */
+#define HID_PIPE_RETRY_US       125     /* Motion the PC's queue had no room for: next microframe */
+#define HID_PIPE_IDLE_RETRY_US  10000   /* Same with no PC attached */
+#define HID_PIPE_LATE_SLACK_US  250     /* Scheduled command this far past its time follows its late policy */
+
+#define HID_PIPE_REPORT_MAX    64   /* Largest input report, report ID included */
+#define HID_PIPE_RAW_DEPTH     16   /* Power of two */
+#define HID_PIPE_OUT_DEPTH     16   /* Power of two */
+
+/* Create the ingest and output threads. Call from tx_application_define(). */
+UINT hid_pipe_create(VOID);
+
+/* Start forwarding from a host HID instance whose report descriptor is the
+ * one presented to the PC: compiles the report plan and takes the raw input
+ * reports over from the HID client. */
+UINT hid_pipe_attach(UX_HOST_CLASS_HID *hid, const UCHAR *report_desc, ULONG report_len);
+
+/* Physical device gone: the PC gets one report with everything let go. */
+VOID hid_pipe_detach(VOID);
+
+/* Network commands are waiting in net_control's queue. Any thread. */
+VOID hid_pipe_net_notify(VOID);
+
+VOID hid_pipe_print_stats(VOID);
+
+#endif /* HID_PIPELINE_H */
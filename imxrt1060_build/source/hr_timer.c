@@ -0,0 +1,164 @@
+#include "hr_timer.h"
+
+#include "fsl_common.h"
+#include "fsl_clock.h"
+#include "fsl_debug_console.h"
+#include "mem_pools.h"
+#include "hot_path.h"
+#include <string.h>
+
+/* Timer list, touched with interrupts masked only */
+MEM_DTCM_BSS(static sched_t hrt_sched);
+
+static struct
+{
+    ULONG    fired;
+    ULONG    late_max_us;   /* ISR entry after the due time */
+    uint64_t late_sum_us;
+} hrt_stats;
+
+/******** Counter *********/
+HOT_PATH uint32_t hrt_now_us(VOID)
+{
+    return HRT_GPT->CNT;
+}
+
+/* Load the compare with the earliest due time. The compare only fires on
+ * equality, so one the counter has passed (or is about to) pends the IRQ. */
+static HOT_PATH VOID hrt_program(VOID)
+{
+    uint32_t due;
+
+    if (!sched_next(&hrt_sched, &due))
+    {
+        HRT_GPT->IR = 0;
+        return;
+    }
+    HRT_GPT->SR = GPT_SR_OF1_MASK;
+    HRT_GPT->OCR[0] = due;
+    HRT_GPT->IR = GPT_IR_OF1IE_MASK;
+    if ((int32_t)(due - hrt_now_us()) < HRT_MIN_LEAD_US)
+        NVIC_SetPendingIRQ(HRT_IRQ);
+}
+
+HOT_PATH_IRQ void GPT2_IRQHandler(void)
+{
+    TX_INTERRUPT_SAVE_AREA
+
+    TX_DISABLE
+    HRT_GPT->SR = GPT_SR_OF1_MASK;
+    sched_run(&hrt_sched, hrt_now_us());
+    hrt_program();
+    TX_RESTORE
+    __DSB();
+}
+
+VOID hrt_init(VOID)
+{
+    uint32_t perclk = CLOCK_GetFreq(kCLOCK_PerClk);
+
+    CLOCK_EnableClock(kCLOCK_Gpt2);
+    CLOCK_EnableClock(kCLOCK_Gpt2S);
+
+    HRT_GPT->CR = 0;
+    HRT_GPT->CR = GPT_CR_SWR_MASK;
+    while (HRT_GPT->CR & GPT_CR_SWR_MASK)
+    {
+    }
+
+    /* PERCLK is 75 MHz in the RUN configuration, 66 MHz in the 528 MHz one:
+     * both divide to exactly 1 MHz */
+    HRT_GPT->PR = GPT_PR_PRESCALER(perclk / 1000000U - 1U);
+    HRT_GPT->IR = 0;
+    HRT_GPT->SR = 0x3FU;
+    HRT_GPT->CR = GPT_CR_CLKSRC(1) | GPT_CR_FRR_MASK | GPT_CR_ENMOD_MASK |
+                  GPT_CR_WAITEN_MASK | GPT_CR_DBGEN_MASK;
+    HRT_GPT->CR |= GPT_CR_EN_MASK;
+
+    sched_init(&hrt_sched);
+    NVIC_SetPriority(HRT_IRQ, HRT_IRQ_PRIORITY);
+    NVIC_EnableIRQ(HRT_IRQ);
+}
+
+/******** Timers *********/
+static HOT_PATH VOID hrt_fire(VOID *ctx)
+{
+    hrt_timer_t *t = (hrt_timer_t *)ctx;
+    uint32_t late = hrt_now_us() - t->timer.due_us;
+
+    hrt_stats.fired++;
+    hrt_stats.late_sum_us += late;
+    if (late > hrt_stats.late_max_us)
+        hrt_stats.late_max_us = late;
+    t->fn(t->ctx);
+}
+
+HOT_PATH VOID hrt_at(hrt_timer_t *t, uint32_t due_us, sched_fn fn, VOID *ctx)
+{
+    TX_INTERRUPT_SAVE_AREA
+
+    TX_DISABLE
+    t->fn = fn;
+    t->ctx = ctx;
+    sched_at(&hrt_sched, &t->timer, due_us, hrt_fire, t);
+    hrt_program();
+    TX_RESTORE
+}
+
+HOT_PATH VOID hrt_cancel(hrt_timer_t *t)
+{
+    TX_INTERRUPT_SAVE_AREA
+
+    TX_DISABLE
+    sched_cancel(&hrt_sched, &t->timer);
+    hrt_program();
+    TX_RESTORE
+}
+
+static HOT_PATH VOID hrt_set_flags(VOID *ctx)
+{
+    hrt_timer_t *t = (hrt_timer_t *)ctx;
+    tx_event_flags_set((TX_EVENT_FLAGS_GROUP *)t->object, t->flags, TX_OR);
+}
+
+static HOT_PATH VOID hrt_put_semaphore(VOID *ctx)
+{
+    hrt_timer_t *t = (hrt_timer_t *)ctx;
+    tx_semaphore_ceiling_put((TX_SEMAPHORE *)t->object, 1);
+}
+
+HOT_PATH VOID hrt_flags_at(hrt_timer_t *t, uint32_t due_us, TX_EVENT_FLAGS_GROUP *group, ULONG flags)
+{
+    t->object = group;
+    t->flags = flags;
+    hrt_at(t, due_us, hrt_set_flags, t);
+}
+
+VOID hrt_semaphore_at(hrt_timer_t *t, uint32_t due_us, TX_SEMAPHORE *sem)
+{
+    t->object = sem;
+    hrt_at(t, due_us, hrt_put_semaphore, t);
+}
+
+/* A semaphore of its own for the one wait, on the sleeping thread's stack */
+VOID hrt_sleep_until(uint32_t due_us)
+{
+    TX_SEMAPHORE sem;
+    hrt_timer_t t = {0};
+
+    if ((int32_t)(due_us - hrt_now_us()) <= 0)
+        return;
+    tx_semaphore_create(&sem, "hrt_sleep", 0);
+    hrt_semaphore_at(&t, due_us, &sem);
+    tx_semaphore_get(&sem, TX_WAIT_FOREVER);
+    tx_semaphore_delete(&sem);
+}
+
+VOID hrt_print_stats(VOID)
+{
+    if (hrt_stats.fired == 0)
+        return;
+    PRINTF("[HRT] %lu timers fired, late avg %lu max %lu us\n", hrt_stats.fired,
+           (ULONG)(hrt_stats.late_sum_us / hrt_stats.fired), hrt_stats.late_max_us);
+    memset(&hrt_stats, 0, sizeof(hrt_stats));
+}
@@ -0,0 +1,70 @@
+#ifndef HR_TIMER_H
+#define HR_TIMER_H
+
+#include "tx_api.h"
+#include "sched_timer.h"
+#include <stdint.h>
+
+/* Microsecond clock and one-shot timers next to the ThreadX tick.
+ *
+ * GPT2 divides PERCLK down to 1 MHz and runs free, so hrt_now_us() is one
+ * register read; it wraps every ~71 minutes, compare times modulo 2^32.
+ * Timers sit in a common/sched_timer list and output compare 1 is loaded
+ * with the earliest one only: there is no periodic interrupt, and nothing
+ * runs while no timer is armed. Callbacks run in the GPT2 ISR with
+ * interrupts masked, so they stay short and use only what ThreadX allows
+ * from an ISR (put a semaphore, set event flags, arm a timer).
+ *
+ * The 100 Hz ThreadX tick stays for the kernel library and the USBX and
+ * NetX Duo internal timeouts (UX_PERIODIC_RATE, NX_IP_PERIODIC_RATE). */
+
+#define HRT_GPT           GPT2
+#define HRT_IRQ           GPT2_IRQn
+#define HRT_IRQ_PRIORITY  4   /* Ahead of the USB controllers (5): a deadline is only worth its accuracy */
+#define HRT_MIN_LEAD_US   2   /* Closer than this, the compare could be passed before it is loaded */
+
+typedef struct
+{
+    sched_timer_t timer;
+    sched_fn      fn;
+    VOID         *ctx;
+    VOID         *object;   /* Event flags group or semaphore for the helpers below */
+    ULONG         flags;
+} hrt_timer_t;
+
+/* Start the counter and enable its interrupt. Call from main() before
+ * tx_kernel_enter(), while interrupts are still globally masked. */
+VOID hrt_init(VOID);
+
+uint32_t hrt_now_us(VOID);
+
+/* Call fn(ctx) from the GPT2 ISR at due_us; a time already passed fires
+ * at once. Re-arming a pending timer moves it. Any context. */
+VOID hrt_at(hrt_timer_t *t, uint32_t due_us, sched_fn fn, VOID *ctx);
+VOID hrt_cancel(hrt_timer_t *t);
+
+static inline bool hrt_pending(const hrt_timer_t *t)
+{
+    return sched_pending(&t->timer);
+}
+
+/* The deadline half of "wait for an event or a deadline": set flags in
+ * group at due_us. The waiter tells the two apart by the flags it got. */
+VOID hrt_flags_at(hrt_timer_t *t, uint32_t due_us, TX_EVENT_FLAGS_GROUP *group, ULONG flags);
+
+/* Same for a semaphore: put it (ceiling 1) at due_us. The waiter has to
+ * re-check what it waits for, a put of its own can race this one. */
+VOID hrt_semaphore_at(hrt_timer_t *t, uint32_t due_us, TX_SEMAPHORE *sem);
+
+/* Suspend the calling thread until due_us. Thread context only. */
+VOID hrt_sleep_until(uint32_t due_us);
+
+static inline VOID hrt_sleep_us(uint32_t us)
+{
+    hrt_sleep_until(hrt_now_us() + us);
+}
+
+/* [HRT] line: timers fired and how far after their due time. */
+VOID hrt_print_stats(VOID);
+
+#endif /* HR_TIMER_H */
@@ -0,0 +1,100 @@
+#include "irq_bench.h"
+
+#include "fsl_debug_console.h"
+#include "mem_pools.h"
+#include "hot_path.h"
+
+typedef struct
+{
+    uint32_t min;
+    uint32_t max;
+    uint32_t sum;
+} irq_bench_result_t;
+
+MEM_DTCM_BSS(static volatile uint32_t irq_bench_stamp);
+MEM_DTCM_BSS(static volatile uint32_t irq_bench_taken);
+
+/* Replaces the startup code's weak default: the flash-resident handler */
+void GPR_IRQ_IRQHandler(void)
+{
+    irq_bench_stamp = DWT->CYCCNT;
+    irq_bench_taken = 1;
+}
+
+static HOT_PATH_IRQ void irq_bench_itcm_handler(void)
+{
+    irq_bench_stamp = DWT->CYCCNT;
+    irq_bench_taken = 1;
+}
+
+static void irq_bench_measure(irq_bench_result_t *r, bool cold)
+{
+    uint32_t i;
+
+    r->min = UINT32_MAX;
+    r->max = 0;
+    r->sum = 0;
+    for (i = 0; i < IRQ_BENCH_RUNS; i++)
+    {
+        uint32_t start, cycles;
+
+        if (cold)
+        {
+            SCB_CleanInvalidateDCache();
+            SCB_InvalidateICache();
+        }
+        irq_bench_taken = 0;
+        start = DWT->CYCCNT;
+        NVIC_SetPendingIRQ(IRQ_BENCH_IRQ);
+        while (!irq_bench_taken)
+        {
+        }
+        cycles = irq_bench_stamp - start;
+        r->sum += cycles;
+        if (cycles < r->min)
+            r->min = cycles;
+        if (cycles > r->max)
+            r->max = cycles;
+    }
+}
+
+static void irq_bench_print(const char *label, const char *kind, const irq_bench_result_t *r)
+{
+    uint32_t mhz = SystemCoreClock / 1000000U;
+
+    PRINTF("[IRQ] %-26s %s min %3lu avg %3lu max %3lu cycles (max %lu ns)\n", label, kind,
+           r->min, r->sum / IRQ_BENCH_RUNS, r->max, r->max * 1000U / mhz);
+}
+
+void irq_bench_run(uint32_t *vectors)
+{
+    const char *label = vectors ? "DTCM vectors, ITCM handler" : "flash vectors and handler";
+    irq_bench_result_t warm, cold;
+    uint32_t saved = 0;
+
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+
+    if (vectors)
+    {
+        saved = vectors[16 + IRQ_BENCH_IRQ];
+        vectors[16 + IRQ_BENCH_IRQ] = (uint32_t)irq_bench_itcm_handler;
+        __DSB();
+    }
+
+    NVIC_SetPriority(IRQ_BENCH_IRQ, 0);
+    NVIC_ClearPendingIRQ(IRQ_BENCH_IRQ);
+    NVIC_EnableIRQ(IRQ_BENCH_IRQ);
+    __enable_irq();
+
+    irq_bench_measure(&warm, false);
+    irq_bench_measure(&cold, true);
+
+    __disable_irq();
+    NVIC_DisableIRQ(IRQ_BENCH_IRQ);
+    if (vectors)
+        vectors[16 + IRQ_BENCH_IRQ] = saved;
+
+    irq_bench_print(label, "warm", &warm);
+    irq_bench_print(label, "cold", &cold);
+}
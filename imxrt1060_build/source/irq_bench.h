@@ -0,0 +1,21 @@
+#ifndef IRQ_BENCH_H
+#define IRQ_BENCH_H
+
+#include "fsl_common.h"
+
+/* Interrupt entry latency at boot: DWT cycles from pending an otherwise
+ * unused IRQ to the first instruction of its handler, warm and with both
+ * caches emptied first (what a report arriving after a quiet spell sees). */
+
+#define IRQ_BENCH_IRQ   GPR_IRQ_IRQn   /* Software-pended, no peripheral behind it */
+#define IRQ_BENCH_RUNS  64
+
+/* vectors NULL: as linked, flash vector table and a flash handler (before).
+ * Otherwise the relocated table from mem_vectors_relocate(), with the
+ * handler swapped for one in ITCM (after). Call from main() before any
+ * other interrupt is enabled in the NVIC. It unmasks interrupts for the
+ * measurement and returns with PRIMASK set, whatever it was on entry;
+ * hrt_init() and prof_init() rely on that until tx_kernel_enter(). */
+void irq_bench_run(uint32_t *vectors);
+
+#endif /* IRQ_BENCH_H */
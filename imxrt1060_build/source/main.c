@@ -14,6 +14,14 @@
 #include "board.h"
 #include "pin_mux.h"
 #include "clock_config.h"
+#include "usb_ctrl_forward.h"
+#include "net_control.h"
+#include "hid_pipeline.h"
+#include "mem_pools.h"
+#include "irq_bench.h"
+#include "hr_timer.h"
+#include "rtos_profile.h"
+#include "hot_path.h"
 
 /* Fix missing USB request macros if not defined */
 /* Macros if missing */
@@ -50,24 +58,32 @@ UINT usbx_host_hcd_register(void);
 UINT usbx_device_controller_init(void);
 
 
-#define UX_APP_MEM_SIZE   (64*1024)
 #define UX_APP_STACK_SIZE  (4096)
+#define CLONE_STATS_TICKS  (5 * TX_TIMER_TICKS_PER_SECOND)
+#define CLONE_POLL_US      100000   /* Re-check for a HID instance between insertion events */
 
-__attribute__((aligned(8))) ULONG usbx_mem[UX_APP_MEM_SIZE/sizeof(ULONG)];
 ULONG app_stack[UX_APP_STACK_SIZE/sizeof(ULONG)];
 
 TX_THREAD app_thread;
 
 /***** Clone-related data *****/
-UCHAR hid_report_desc[512];
+/* Descriptor blocks from mem_pools; the PC-facing stack keeps using both */
+#define CLONE_REPORT_DESC_MAX  512   /* UX_SLAVE_REQUEST_CONTROL_MAX_LENGTH */
+UCHAR *hid_report_desc;
 ULONG hid_report_len;
 
-UCHAR device_framework[1024];
+UCHAR *device_framework;
 ULONG device_framework_len;
 
 UX_HOST_CLASS_HID *hid_class_inst = UX_NULL;
 UX_DEVICE *dev_inst = UX_NULL;
 
+/***** Reattach state *****/
+static TX_SEMAPHORE hid_attach_sem;
+static hrt_timer_t hid_poll_timer;
+static UX_HOST_CLASS_HID *volatile hid_rejected = UX_NULL;
+static uint32_t hid_detach_us;
+
 VOID *g_deviceHandle = NULL;
 
 /******** Host change callback *********/
@@ -80,49 +96,130 @@ UINT usbx_host_change_callback(ULONG event, UX_HOST_CLASS *host_class, VOID *ins
                dev->ux_device_descriptor.idVendor,
                dev->ux_device_descriptor.idProduct);
     }
+    else if ((event == UX_DEVICE_INSERTION) && (instance))
+    {
+        tx_semaphore_ceiling_put(&hid_attach_sem, 1);
+    }
+    else if ((event == UX_DEVICE_REMOVAL) && (instance))
+    {
+        /* The PC-facing device stays up; only the physical side goes away */
+        if (instance == (VOID *)hid_class_inst)
+        {
+            ctrl_fwd_detach();
+            hid_pipe_detach();
+            hid_class_inst = UX_NULL;
+            dev_inst = UX_NULL;
+            hid_detach_us = hrt_now_us();
+            PRINTF("HID device removed, PC side stays attached\n");
+            tx_semaphore_ceiling_put(&hid_attach_sem, 1);
+        }
+        else if (instance == (VOID *)hid_rejected)
+        {
+            hid_rejected = UX_NULL;
+        }
+    }
     return UX_SUCCESS;
 }
 
-/********* Main thread **********/
-void clone_thread(ULONG arg)
+/******** Wait for a live HID instance *********/
+/* Until the next insertion event, or CLONE_POLL_US at the most */
+static VOID wait_for_hid_event(void)
 {
-    UINT status;
+    hrt_semaphore_at(&hid_poll_timer, hrt_now_us() + CLONE_POLL_US, &hid_attach_sem);
+    tx_semaphore_get(&hid_attach_sem, TX_WAIT_FOREVER);
+    hrt_cancel(&hid_poll_timer);
+}
 
-    PRINTF("\nWaiting for HID mouse connection...\n");
+static UX_HOST_CLASS_HID *wait_for_hid_instance(void)
+{
+    UX_HOST_CLASS *hid_class;
+    UX_HOST_CLASS_HID *hid;
+    UINT status;
 
     while(1)
     {
-        UX_HOST_CLASS *hid_class;
         status = ux_host_stack_class_get(_ux_system_host_class_hid_name, &hid_class);
-        if(status) { tx_thread_sleep(10); continue; }
+        if(status) { wait_for_hid_event(); continue; }
 
-        status = ux_host_stack_class_instance_get(hid_class, 0, (VOID**)&hid_class_inst);
-        if(status) { tx_thread_sleep(10); continue; }
+        status = ux_host_stack_class_instance_get(hid_class, 0, (VOID**)&hid);
+        if(status) { wait_for_hid_event(); continue; }
 
-        if(hid_class_inst->ux_host_class_hid_state != UX_HOST_CLASS_INSTANCE_LIVE){
-            tx_thread_sleep(10); continue; }
+        if(hid->ux_host_class_hid_state != UX_HOST_CLASS_INSTANCE_LIVE || hid == hid_rejected){
+            wait_for_hid_event(); continue; }
 
-        break;
+        return hid;
     }
+}
+
+/******** Physical device reattach *********/
+/* The PC keeps the clone it enumerated. A replacement device is taken over
+ * only if its report descriptor is byte-identical to the one the PC has. */
+static VOID clone_reattach(void)
+{
+    UX_HOST_CLASS_HID *hid = wait_for_hid_instance();
+    UCHAR *reattach_report_desc = mem_desc_alloc();
+    ULONG len = 0;
+    UINT status;
+
+    if(reattach_report_desc == UX_NULL)
+        return;
+    status = ux_host_hid_report_descriptor_fetch(hid, reattach_report_desc, CLONE_REPORT_DESC_MAX, &len);
+    if(status == UX_SUCCESS && (len != hid_report_len ||
+       ux_utility_memory_compare(reattach_report_desc, hid_report_desc, len) != UX_SUCCESS))
+        status = UX_ERROR;
+    mem_desc_free(reattach_report_desc);
+    if(status != UX_SUCCESS)
+    {
+        PRINTF("Attached HID device has a different report layout, replug the PC side to clone it\n");
+        hid_rejected = hid;
+        return;
+    }
+
+    dev_inst = (UX_DEVICE*) hid->ux_host_class_hid_device;
+    hid_class_inst = hid;
+    ctrl_fwd_attach(dev_inst,
+        (UCHAR)hid->ux_host_class_hid_interface->ux_interface_descriptor.bInterfaceNumber);
+    status = hid_pipe_attach(hid, hid_report_desc, hid_report_len);
+    if(status) PRINTF("Report path attach failed 0x%x\n", status);
+    PRINTF("Compatible device reattached %lu ms after unplug\n",
+           (hrt_now_us() - hid_detach_us) / 1000U);
+}
+
+/********* Main thread **********/
+void clone_thread(ULONG arg)
+{
+    UINT status;
+
+    PRINTF("\nWaiting for HID mouse connection...\n");
 
+    hid_class_inst = wait_for_hid_instance();
 
     dev_inst = (UX_DEVICE*) hid_class_inst->ux_host_class_hid_device;
+    ctrl_fwd_attach(dev_inst,
+        (UCHAR)hid_class_inst->ux_host_class_hid_interface->ux_interface_descriptor.bInterfaceNumber);
 
     /* Fetch **raw** config descriptor as sent by device during enumeration */
-    static UCHAR cfg_desc_buffer[1024] __attribute__((aligned(4)));
+    UCHAR *cfg_desc_buffer = mem_desc_alloc();
     ULONG actual_length = 0;
     UINT wTotalLength;
 
+    hid_report_desc = mem_desc_alloc();
+    device_framework = mem_desc_alloc();
+    if(cfg_desc_buffer == UX_NULL || hid_report_desc == UX_NULL || device_framework == UX_NULL){
+        PRINTF("Descriptor blocks exhausted\n");
+        while(1);
+    }
+
     status = usbx_host_control_transfer(dev_inst,
         UX_REQUEST_IN | UX_REQUEST_TYPE_STANDARD | UX_REQUEST_TARGET_DEVICE,
         UX_GET_DESCRIPTOR, (UX_CONFIGURATION_DESCRIPTOR_ITEM << 8) | 0, 0,
         cfg_desc_buffer, 9, &actual_length);
-    if(status != UX_SUCCESS || actual_length < 9 || actual_length > sizeof(cfg_desc_buffer)){
+    if(status != UX_SUCCESS || actual_length < 9 || actual_length > MEM_DESC_BLOCK_SIZE){
         PRINTF("Config descriptor header fetch failed 0x%x (%lu bytes)\n", status, actual_length);
         while(1);
     }
     wTotalLength = (ULONG)(cfg_desc_buffer[2] | (cfg_desc_buffer[3]<<8));
-    if(wTotalLength > sizeof(cfg_desc_buffer)){
+    if(wTotalLength > MEM_DESC_BLOCK_SIZE - 18){
         PRINTF("Descriptor too big: %lu bytes!\n", wTotalLength);
         while(1);
     }
@@ -130,7 +227,7 @@ void clone_thread(ULONG arg)
         UX_REQUEST_IN | UX_REQUEST_TYPE_STANDARD | UX_REQUEST_TARGET_DEVICE,
         UX_GET_DESCRIPTOR, (UX_CONFIGURATION_DESCRIPTOR_ITEM << 8) | 0, 0,
         cfg_desc_buffer, wTotalLength, &actual_length);
-    if(status != UX_SUCCESS || actual_length < 9 || actual_length > sizeof(cfg_desc_buffer)){
+    if(status != UX_SUCCESS || actual_length < 9 || actual_length > MEM_DESC_BLOCK_SIZE){
         PRINTF("Config desc fetch failed 0x%x (%lu/%lu)\n", status, actual_length, wTotalLength);
         while(1);
     }
@@ -142,7 +239,7 @@ void clone_thread(ULONG arg)
 
     /* Fetch HID report descriptor using control transfer */
     ULONG actual_len = 0;
-    status = ux_host_hid_report_descriptor_fetch(hid_class_inst, hid_report_desc, sizeof(hid_report_desc), &actual_len);
+    status = ux_host_hid_report_descriptor_fetch(hid_class_inst, hid_report_desc, CLONE_REPORT_DESC_MAX, &actual_len);
     if(status){
         PRINTF("Error HID report desc get: %x\n", status);
         while(1);
@@ -156,6 +253,7 @@ void clone_thread(ULONG arg)
                            (UCHAR*)&dev_inst->ux_device_descriptor, 18);
     ux_utility_memory_copy(device_framework+18,
                            cfg_desc, cfg_len);
+    mem_desc_free(cfg_desc_buffer);
 
     PRINTF("Starting DEVICE on second port...\n");
 
@@ -171,6 +269,7 @@ void clone_thread(ULONG arg)
     ux_utility_memory_set(&hid_param, 0, sizeof(hid_param));
     hid_param.ux_device_class_hid_parameter_report_address = hid_report_desc;
     hid_param.ux_device_class_hid_parameter_report_length = hid_report_len;
+    ctrl_fwd_hid_parameter_init(&hid_param);
 
     status = ux_device_stack_class_register(_ux_system_slave_class_hid_name,
                                             ux_device_class_hid_entry,
@@ -180,21 +279,26 @@ void clone_thread(ULONG arg)
     usbx_device_controller_init();
 
     PRINTF("==== HID CLONE ready -- plug USB2 to PC ====\n");
+    mem_pools_report();
+    net_control_print_memory();
 
-    UX_HOST_CLASS_HID_MOUSE *mouse = (UX_HOST_CLASS_HID_MOUSE *)
-        hid_class_inst->ux_host_class_hid_client->ux_host_class_hid_client_local_instance;
-
-    ULONG btn; SLONG x,y;
+    status = hid_pipe_attach(hid_class_inst, hid_report_desc, hid_report_len);
+    if(status) PRINTF("Report path attach failed 0x%x\n", status);
 
+    /* Reports flow through hid_ingest/hid_output from here on; this thread
+     * only handles replugs and prints the stats */
     while(1)
     {
-    	UINT ret1 = _ux_host_class_hid_mouse_buttons_get(mouse, &btn);
-    	UINT ret2 = _ux_host_class_hid_mouse_position_get(mouse, &x, &y);
-    	if((ret1 == UX_SUCCESS) && (ret2 == UX_SUCCESS))
-    	    PRINTF("Buttons: %02lx Pos: %d,%d\n", btn,x,y);
-    	else
-    	    PRINTF("Mouse disconnected or error\n");
-
+        if(tx_semaphore_get(&hid_attach_sem, CLONE_STATS_TICKS) == TX_SUCCESS)
+        {
+            /* Physical side unplugged: wait for a compatible replacement */
+            if(hid_class_inst == UX_NULL)
+                clone_reattach();
+            continue;
+        }
+        hid_pipe_print_stats();
+        net_control_print_stats();
+        hrt_print_stats();
     }
 }
 
@@ -203,7 +307,10 @@ void tx_application_define(void *first_unused_memory)
 {
     UINT status;
 
-    ux_system_initialize(usbx_mem, sizeof(usbx_mem), UX_NULL, 0);
+    status = mem_pools_create();
+    if(status) while(1);
+
+    tx_semaphore_create(&hid_attach_sem, "hid_attach", 0);
 
     status = ux_host_stack_initialize(usbx_host_change_callback);
     if(status) while(1);
@@ -218,14 +325,40 @@ void tx_application_define(void *first_unused_memory)
     tx_thread_create(&app_thread, "clone_thread", clone_thread, 0,
                      app_stack, UX_APP_STACK_SIZE,
                      20,20,1,TX_AUTO_START);
+
+    ctrl_fwd_create();
+
+    status = hid_pipe_create();
+    if(status) PRINTF("Report path threads failed 0x%x\n", status);
+
+    status = net_control_create();
+    if(status) PRINTF("Network bring-up failed 0x%x, KMBox NET off\n", status);
 }
 
 int main(void)
 {
+    uint32_t *vectors;
+
     BOARD_ConfigMPU();
     BOARD_InitBootPins();
     BOARD_BootClockRUN();
     BOARD_InitDebugConsole();
+
+    /* Interrupt entry as linked, then with the vectors in DTCM and the
+     * handler in ITCM; the relocated table stays in use. Interrupts are
+     * masked from here until the kernel starts. */
+    irq_bench_run(NULL);
+    vectors = mem_vectors_relocate();
+    irq_bench_run(vectors);
+
+    /* Every thread stamps and schedules with it from the start */
+    hrt_init();
+
+#ifdef SR71_PROFILE
+    /* After the bench has put its handler back: the wrapper keeps what it finds */
+    prof_init(vectors);
+#endif
+
     NVIC_SetPriority(USB_OTG1_IRQn,5);
     NVIC_SetPriority(USB_OTG2_IRQn,5);
     NVIC_EnableIRQ(USB_OTG1_IRQn);
@@ -278,12 +411,12 @@ UINT usbx_device_controller_init(void)
 
 /************* ISR handlers **************/
 
-void USB_OTG1_IRQHandler(void)
+HOT_PATH_IRQ void USB_OTG1_IRQHandler(void)
 {
 	_ux_hcd_ehci_interrupt_handler();
 }
 
-void USB_OTG2_IRQHandler(void)
+HOT_PATH_IRQ void USB_OTG2_IRQHandler(void)
 {
     USB_DeviceEhciIsrFunction(g_deviceHandle);
     __DSB();
@@ -0,0 +1,180 @@
+#include "mem_pools.h"
+
+#include "ux_system.h"
+#include "fsl_common.h"
+#include "fsl_debug_console.h"
+
+/* Bank limits and per-bank section bounds from the MCUXpresso managed linker script */
+extern UCHAR __base_SRAM_DTC[], __top_SRAM_DTC[];
+extern UCHAR __base_SRAM_ITC[], __top_SRAM_ITC[];
+extern UCHAR __base_SRAM_OC[], __top_SRAM_OC[];
+extern UCHAR __base_NCACHE_REGION[], __top_NCACHE_REGION[];
+extern UCHAR __base_BOARD_SDRAM[], __top_BOARD_SDRAM[];
+extern UCHAR __start_data_SRAM_ITC[], __end_data_SRAM_ITC[];
+extern UCHAR __start_bss_SRAM_ITC[], __end_bss_SRAM_ITC[];
+extern UCHAR __start_data_SRAM_DTC[], __end_data_SRAM_DTC[];
+extern UCHAR __start_bss_SRAM_DTC[], __end_bss_SRAM_DTC[];
+extern UCHAR __start_data_SRAM_OC[], __end_data_SRAM_OC[];
+extern UCHAR __start_bss_SRAM_OC[], __end_bss_SRAM_OC[];
+extern UCHAR __start_data_NCACHE_REGION[], __end_data_NCACHE_REGION[];
+extern UCHAR __start_bss_NCACHE_REGION[], __end_bss_NCACHE_REGION[];
+
+/******** Pool memory *********/
+MEM_DTCM_BSS(static ULONG mem_usbx_regular[MEM_USBX_REGULAR_SIZE / sizeof(ULONG)]);
+AT_NONCACHEABLE_SECTION_ALIGN(static UCHAR mem_usbx_cache_safe[MEM_USBX_CACHE_SAFE_SIZE], 64);
+
+/* ThreadX keeps one pointer in front of every block */
+#define MEM_DESC_AREA_SIZE  (MEM_DESC_BLOCKS * (MEM_DESC_BLOCK_SIZE + sizeof(VOID *)))
+AT_NONCACHEABLE_SECTION_ALIGN(static UCHAR mem_desc_area[MEM_DESC_AREA_SIZE], 32);
+
+/* VTOR needs the table aligned to its size rounded up to a power of two */
+MEM_DTCM_BSS(static uint32_t mem_vectors[NUMBER_OF_INT_VECTORS] __attribute__((aligned(1024))));
+extern void (* const g_pfnVectors[])(void);
+
+static TX_BLOCK_POOL mem_desc_pool;
+static ULONG         mem_desc_min_free = MEM_DESC_BLOCKS;
+static ULONG         mem_desc_failed;
+
+UINT mem_pools_create(VOID)
+{
+    UINT status;
+
+    status = ux_system_initialize(mem_usbx_regular, sizeof(mem_usbx_regular),
+                                  mem_usbx_cache_safe, sizeof(mem_usbx_cache_safe));
+    if (status)
+        return status;
+
+    return tx_block_pool_create(&mem_desc_pool, "mem_desc", MEM_DESC_BLOCK_SIZE,
+                                mem_desc_area, sizeof(mem_desc_area));
+}
+
+/******** Descriptor blocks *********/
+UCHAR *mem_desc_alloc(VOID)
+{
+    VOID *block;
+
+    if (tx_block_allocate(&mem_desc_pool, &block, TX_NO_WAIT) != TX_SUCCESS)
+    {
+        mem_desc_failed++;
+        return UX_NULL;
+    }
+    if (mem_desc_pool.tx_block_pool_available < mem_desc_min_free)
+        mem_desc_min_free = mem_desc_pool.tx_block_pool_available;
+    return (UCHAR *)block;
+}
+
+VOID mem_desc_free(UCHAR *block)
+{
+    if (block != UX_NULL)
+        tx_block_release(block);
+}
+
+/******** Vector table *********/
+uint32_t *mem_vectors_relocate(VOID)
+{
+    uint32_t i;
+
+    for (i = 0; i < NUMBER_OF_INT_VECTORS; i++)
+        mem_vectors[i] = (uint32_t)g_pfnVectors[i];
+    __DSB();
+    SCB->VTOR = (uint32_t)mem_vectors;
+    __DSB();
+    __ISB();
+    return mem_vectors;
+}
+
+/******** Memory map report *********/
+const char *mem_region_name(const VOID *p)
+{
+    const UCHAR *a = (const UCHAR *)p;
+
+    if (a >= __base_SRAM_DTC && a < __top_SRAM_DTC)
+        return "DTCM";
+    if (a >= __base_NCACHE_REGION && a < __top_NCACHE_REGION)
+        return "NCACHE";
+    if (a >= __base_SRAM_OC && a < __top_SRAM_OC)
+        return "OCRAM";
+    if (a >= __base_SRAM_ITC && a < __top_SRAM_ITC)
+        return "ITCM";
+    if (a >= __base_BOARD_SDRAM && a < __top_BOARD_SDRAM)
+        return "SDRAM";
+    return "?";
+}
+
+static VOID mem_report_bank(const char *name, UCHAR *base, UCHAR *top,
+                            UCHAR *data_start, UCHAR *data_end, UCHAR *bss_start, UCHAR *bss_end)
+{
+    PRINTF("[MEM] %-6s 0x%08lx %4lu KB: data %6lu bss %6lu\n", name, (ULONG)base,
+           (ULONG)(top - base) / 1024U, (ULONG)(data_end - data_start), (ULONG)(bss_end - bss_start));
+}
+
+static VOID mem_report_usbx(const char *name, UINT index)
+{
+    UX_MEMORY_BYTE_POOL *pool = _ux_system->ux_system_memory_byte_pool[index];
+
+    if (pool == UX_NULL)
+        return;
+#ifdef UX_ENABLE_MEMORY_STATISTICS
+    PRINTF("[MEM] usbx %-10s %6lu B in %s, %6lu free, low water %6lu, peak %lu blocks\n", name,
+           pool->ux_byte_pool_size, mem_region_name(pool->ux_byte_pool_start),
+           pool->ux_byte_pool_available, (ULONG)pool->ux_byte_pool_min_free,
+           pool->ux_byte_pool_alloc_max_count);
+#else
+    PRINTF("[MEM] usbx %-10s %6lu B in %s, %6lu free\n", name,
+           pool->ux_byte_pool_size, mem_region_name(pool->ux_byte_pool_start),
+           pool->ux_byte_pool_available);
+#endif
+}
+
+/* GPR17 holds two bits per 32 KB bank: 1 OCRAM, 2 DTCM, 3 ITCM */
+static VOID mem_report_flexram(VOID)
+{
+    uint32_t cfg = IOMUXC_GPR->GPR17;
+    uint32_t itcm = 0, dtcm = 0, ocram = 0;
+    uint32_t b;
+
+    if ((IOMUXC_GPR->GPR16 & IOMUXC_GPR_GPR16_FLEXRAM_BANK_CFG_SEL_MASK) == 0)
+    {
+        PRINTF("[MEM] FlexRAM from fuses, linker expects ITCM %u DTCM %u OCRAM %u KB\n",
+               MEM_FLEXRAM_ITCM_BANKS * 32, MEM_FLEXRAM_DTCM_BANKS * 32, MEM_FLEXRAM_OCRAM_BANKS * 32);
+        return;
+    }
+    for (b = 0; b < 16; b++, cfg >>= 2)
+    {
+        switch (cfg & 3U)
+        {
+        case 1: ocram++; break;
+        case 2: dtcm++; break;
+        case 3: itcm++; break;
+        default: break;
+        }
+    }
+    PRINTF("[MEM] FlexRAM ITCM %lu DTCM %lu OCRAM %lu KB%s\n", itcm * 32, dtcm * 32, ocram * 32,
+           (itcm == MEM_FLEXRAM_ITCM_BANKS && dtcm == MEM_FLEXRAM_DTCM_BANKS &&
+            ocram == MEM_FLEXRAM_OCRAM_BANKS) ? "" : " -- DOES NOT MATCH THE LINKER SCRIPT");
+}
+
+VOID mem_pools_report(VOID)
+{
+    mem_report_flexram();
+    /* ITCM "data" is the HOT_PATH code */
+    mem_report_bank("ITCM", __base_SRAM_ITC, __top_SRAM_ITC,
+                    __start_data_SRAM_ITC, __end_data_SRAM_ITC, __start_bss_SRAM_ITC, __end_bss_SRAM_ITC);
+    mem_report_bank("DTCM", __base_SRAM_DTC, __top_SRAM_DTC,
+                    __start_data_SRAM_DTC, __end_data_SRAM_DTC, __start_bss_SRAM_DTC, __end_bss_SRAM_DTC);
+    mem_report_bank("OCRAM", __base_SRAM_OC, __top_SRAM_OC,
+                    __start_data_SRAM_OC, __end_data_SRAM_OC, __start_bss_SRAM_OC, __end_bss_SRAM_OC);
+    mem_report_bank("NCACHE", __base_NCACHE_REGION, __top_NCACHE_REGION,
+                    __start_data_NCACHE_REGION, __end_data_NCACHE_REGION,
+                    __start_bss_NCACHE_REGION, __end_bss_NCACHE_REGION);
+
+    /* Both pools are the same one if USBX was given no cache-safe memory */
+    mem_report_usbx("regular", UX_MEMORY_BYTE_POOL_REGULAR);
+    if (_ux_system->ux_system_memory_byte_pool[UX_MEMORY_BYTE_POOL_CACHE_SAFE] !=
+        _ux_system->ux_system_memory_byte_pool[UX_MEMORY_BYTE_POOL_REGULAR])
+        mem_report_usbx("cache-safe", UX_MEMORY_BYTE_POOL_CACHE_SAFE);
+
+    PRINTF("[MEM] desc blocks %u x %u B in %s, %lu free, low water %lu, %lu failed\n",
+           MEM_DESC_BLOCKS, MEM_DESC_BLOCK_SIZE, mem_region_name(mem_desc_area),
+           mem_desc_pool.tx_block_pool_available, mem_desc_min_free, mem_desc_failed);
+}
@@ -0,0 +1,60 @@
+#ifndef MEM_POOLS_H
+#define MEM_POOLS_H
+
+#include "ux_api.h"
+#include "tx_api.h"
+#include <stdint.h>
+
+/* Static memory, by what uses it:
+ *
+ *   USBX regular pool      DTCM    host/device stack structures, CPU only
+ *   USBX cache-safe pool   NCACHE  EHCI/DCD descriptors and transfer buffers
+ *   descriptor blocks      NCACHE  config/report descriptors the clone is built from
+ *
+ * USBX only allocates from its own byte pools, so those are sized here and
+ * their low-water mark is reported at boot; everything the application
+ * allocates itself comes from fixed-size ThreadX block pools. NCACHE is the
+ * OCRAM2 bank BOARD_ConfigMPU() maps non-cacheable, so DMA buffers there need
+ * no cache maintenance. */
+
+/* Place zero-initialised data in DTCM (the MCUXpresso managed linker script's
+ * per-bank .bss input section). Code goes to ITCM with HOT_PATH. */
+#define MEM_DTCM_BSS(var)  __attribute__((section(".bss.$SRAM_DTC"))) var
+
+/* FlexRAM split the linker script was generated for, in 32 KB banks. It is
+ * the RT1062 fuse default (FLEXRAM_BANK_CFG_SEL clear, fuses unburnt). */
+#define MEM_FLEXRAM_ITCM_BANKS    4
+#define MEM_FLEXRAM_DTCM_BANKS    4
+#define MEM_FLEXRAM_OCRAM_BANKS   8
+
+#ifndef MEM_USBX_REGULAR_SIZE
+#define MEM_USBX_REGULAR_SIZE     (24 * 1024)
+#endif
+#ifndef MEM_USBX_CACHE_SAFE_SIZE
+#define MEM_USBX_CACHE_SAFE_SIZE  (32 * 1024)
+#endif
+
+#define MEM_DESC_BLOCK_SIZE       1024   /* Largest descriptor the clone takes (config, wTotalLength) */
+#define MEM_DESC_BLOCKS           3      /* Framework, report descriptor, one in flight */
+
+/* Create the block pools and hand USBX its two byte pools. Call from
+ * tx_application_define() in place of ux_system_initialize(). */
+UINT mem_pools_create(VOID);
+
+/* One MEM_DESC_BLOCK_SIZE buffer, DMA-safe. UX_NULL when the pool is empty. */
+UCHAR *mem_desc_alloc(VOID);
+VOID mem_desc_free(UCHAR *block);
+
+/* Copy the vector table from flash into DTCM and point VTOR at it, so taking
+ * an interrupt never waits on FlexSPI. Call from main() before any IRQ is
+ * enabled. Returns the table for patching single entries. */
+uint32_t *mem_vectors_relocate(VOID);
+
+/* RAM bank an address is in: "DTCM", "ITCM", "OCRAM", "NCACHE", "SDRAM" or "?" */
+const char *mem_region_name(const VOID *p);
+
+/* Boot memory map: FlexRAM split, linker bank usage, USBX pool low-water
+ * marks and the block pools. */
+VOID mem_pools_report(VOID);
+
+#endif /* MEM_POOLS_H */
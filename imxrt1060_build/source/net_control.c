@@ -0,0 +1,332 @@
+#include "net_control.h"
+
+#include "fsl_common.h"
+#include "fsl_clock.h"
+#include "fsl_gpio.h"
+#include "fsl_iomuxc.h"
+#include "fsl_debug_console.h"
+#include "hr_timer.h"
+#include "net_ptp.h"
+#include "hid_pipeline.h"
+#include "mem_pools.h"
+#include "rtos_profile.h"
+#include "spsc_ring.h"
+#include "hot_path.h"
+#include <string.h>
+
+/* NetX Duo ENET driver from the MCUXpresso SDK port */
+extern VOID nx_driver_imx(NX_IP_DRIVER *driver_req_ptr);
+
+#define NET_POOL_SIZE  (NET_PACKET_COUNT * (NET_PACKET_PAYLOAD + sizeof(NX_PACKET)))
+
+/* ENET DMAs in and out of the pool, so it stays out of the data cache */
+AT_NONCACHEABLE_SECTION_ALIGN(static UCHAR net_pool_area[NET_POOL_SIZE], 64);
+
+static NX_PACKET_POOL net_pool;
+static NX_IP          net_ip;
+static NX_UDP_SOCKET  net_socket;
+static TX_THREAD      net_server_thread;
+/* Every command goes through these two threads: stacks in DTCM */
+MEM_DTCM_BSS(static ULONG net_ip_stack[NET_IP_STACK_SIZE/sizeof(ULONG)]);
+MEM_DTCM_BSS(static ULONG net_server_stack[NET_SERVER_STACK_SIZE/sizeof(ULONG)]);
+static ULONG          net_arp_cache[NET_ARP_CACHE_SIZE/sizeof(ULONG)];
+
+static kp_session_t net_kp;
+static uint32_t     net_arrival_us;
+static int64_t      net_arrival_ptp;
+static UINT         net_reboot = NX_FALSE;
+
+MEM_DTCM_BSS(static net_cmd_t net_cmd_buf[NET_CMD_DEPTH]);
+static spsc_ring_t net_cmds;
+
+static struct
+{
+    ULONG chained;     /* Datagram spread over several packets */
+    ULONG no_packet;   /* Pool empty, no room for the reply */
+    ULONG send_failed;
+    ULONG too_far;     /* Execute-at beyond NET_AT_MAX_AHEAD_US, refused */
+    /* MAC receive to hand-over, from the hardware stamps */
+    ULONG stamped;
+    ULONG stack_min_ns;
+    ULONG stack_max_ns;
+    uint64_t stack_sum_ns;
+} net_stats;
+
+/* 50 MHz RMII reference clock for the PHY */
+static const clock_enet_pll_config_t net_enet_pll = {
+    .enableClkOutput = true,
+    .enableClkOutput1 = false,
+    .enableClkOutput25M = false,
+    .loopDivider = 1,
+    .loopDivider1 = 1,
+    .src = 0
+};
+
+/******** Board *********/
+/* RMII pins, reference clock and the KSZ8081 reset on the EVK. GPIO1_IO09
+ * is shared with the user LED. */
+static VOID net_hw_setup(VOID)
+{
+    gpio_pin_config_t out = {kGPIO_DigitalOutput, 0, kGPIO_NoIntmode};
+
+    CLOCK_InitEnetPll(&net_enet_pll);
+    IOMUXC_EnableMode(IOMUXC_GPR, kIOMUXC_GPR_ENET1TxClkOutputDir, true);
+
+    IOMUXC_SetPinMux(IOMUXC_GPIO_AD_B0_09_GPIO1_IO09, 0U);
+    IOMUXC_SetPinMux(IOMUXC_GPIO_AD_B0_10_GPIO1_IO10, 0U);
+    IOMUXC_SetPinMux(IOMUXC_GPIO_B1_04_ENET_RX_DATA00, 0U);
+    IOMUXC_SetPinMux(IOMUXC_GPIO_B1_05_ENET_RX_DATA01, 0U);
+    IOMUXC_SetPinMux(IOMUXC_GPIO_B1_06_ENET_RX_EN, 0U);
+    IOMUXC_SetPinMux(IOMUXC_GPIO_B1_07_ENET_TX_DATA00, 0U);
+    IOMUXC_SetPinMux(IOMUXC_GPIO_B1_08_ENET_TX_DATA01, 0U);
+    IOMUXC_SetPinMux(IOMUXC_GPIO_B1_09_ENET_TX_EN, 0U);
+    IOMUXC_SetPinMux(IOMUXC_GPIO_B1_10_ENET_REF_CLK, 1U);
+    IOMUXC_SetPinMux(IOMUXC_GPIO_B1_11_ENET_RX_ER, 0U);
+    IOMUXC_SetPinMux(IOMUXC_GPIO_EMC_40_ENET_MDC, 0U);
+    IOMUXC_SetPinMux(IOMUXC_GPIO_EMC_41_ENET_MDIO, 0U);
+
+    IOMUXC_SetPinConfig(IOMUXC_GPIO_AD_B0_09_GPIO1_IO09, 0xB0A9U);
+    IOMUXC_SetPinConfig(IOMUXC_GPIO_AD_B0_10_GPIO1_IO10, 0xB0A9U);
+    IOMUXC_SetPinConfig(IOMUXC_GPIO_B1_04_ENET_RX_DATA00, 0xB0E9U);
+    IOMUXC_SetPinConfig(IOMUXC_GPIO_B1_05_ENET_RX_DATA01, 0xB0E9U);
+    IOMUXC_SetPinConfig(IOMUXC_GPIO_B1_06_ENET_RX_EN, 0xB0E9U);
+    IOMUXC_SetPinConfig(IOMUXC_GPIO_B1_07_ENET_TX_DATA00, 0xB0E9U);
+    IOMUXC_SetPinConfig(IOMUXC_GPIO_B1_08_ENET_TX_DATA01, 0xB0E9U);
+    IOMUXC_SetPinConfig(IOMUXC_GPIO_B1_09_ENET_TX_EN, 0xB0E9U);
+    IOMUXC_SetPinConfig(IOMUXC_GPIO_B1_10_ENET_REF_CLK, 0x31U);
+    IOMUXC_SetPinConfig(IOMUXC_GPIO_B1_11_ENET_RX_ER, 0xB0E9U);
+    IOMUXC_SetPinConfig(IOMUXC_GPIO_EMC_40_ENET_MDC, 0xB0E9U);
+    IOMUXC_SetPinConfig(IOMUXC_GPIO_EMC_41_ENET_MDIO, 0xB829U);
+
+    /* INT high at reset straps the PHY address; hold reset for 10 ms */
+    GPIO_PinInit(GPIO1, 9, &out);
+    GPIO_PinInit(GPIO1, 10, &out);
+    GPIO_PinWrite(GPIO1, 10, 1);
+    GPIO_PinWrite(GPIO1, 9, 0);
+    SDK_DelayAtLeastUs(10000, CLOCK_GetFreq(kCLOCK_CpuClk));
+    GPIO_PinWrite(GPIO1, 9, 1);
+}
+
+/******** KMBox handlers (server thread context) *********/
+/* Execute-at times and time sync are in the PTP timebase, so a client on
+ * the same PTP domain can schedule without the ping handshake */
+static uint64_t net_now_us(void *ctx)
+{
+    (void)ctx;
+    return (uint64_t)(net_ptp_now_ns() / 1000);
+}
+
+/* Decoded commands go on the queue; the datagram itself is not kept */
+static HOT_PATH bool net_mouse_cb(void *ctx, const kp_mouse_t *m)
+{
+    net_cmd_t *cmd;
+
+    if (m->at_us && m->at_us > net_now_us(ctx) + NET_AT_MAX_AHEAD_US)
+    {
+        net_stats.too_far++;
+        return false;
+    }
+    cmd = (net_cmd_t *)spsc_claim(&net_cmds);
+    if (cmd == NULL)
+        return false;
+    cmd->mouse = *m;
+    cmd->arrival_us = net_arrival_us;
+    cmd->rx_ptp_ns = net_arrival_ptp;
+    spsc_publish(&net_cmds);
+    PROF_EVENT(PROF_EV_NET_CMD, m->kind, (ULONG)m->x, (ULONG)m->y);
+    hid_pipe_net_notify();
+    return true;
+}
+
+static bool net_reboot_cb(void *ctx)
+{
+    (void)ctx;
+    net_reboot = NX_TRUE;   /* After the reply is out */
+    return true;
+}
+
+#ifdef SR71_PROFILE
+static uint16_t net_snapshot_cb(void *ctx, uint32_t offset, uint32_t *total, uint8_t *out, uint16_t cap)
+{
+    (void)ctx;
+    return prof_snapshot_read(offset, total, out, cap);
+}
+#endif
+
+static uint32_t net_uuid(VOID)
+{
+    return OCOTP->CFG0;
+}
+
+/******** Server *********/
+/* The datagram is parsed where the ENET driver put it, and the reply is
+ * built in the packet that carries it back, so no payload is copied. */
+static HOT_PATH VOID net_datagram(NX_PACKET *pkt)
+{
+    NX_PACKET *reply;
+    ULONG src_ip;
+    UINT src_port;
+    uint16_t n;
+
+    /* Every KMBox datagram fits one packet; a chain would need copying to parse */
+    if (pkt->nx_packet_next != NX_NULL)
+    {
+        net_stats.chained++;
+        nx_packet_release(pkt);
+        return;
+    }
+
+    if (nx_packet_allocate(&net_pool, &reply, NX_UDP_PACKET, NX_NO_WAIT) != NX_SUCCESS)
+    {
+        /* The client times out and resends */
+        net_stats.no_packet++;
+        nx_packet_release(pkt);
+        return;
+    }
+
+    nx_udp_source_extract(pkt, &src_ip, &src_port);
+    net_arrival_us = hrt_now_us();
+    net_arrival_ptp = net_ptp_rx_take_ns(pkt);
+    if (net_arrival_ptp)
+    {
+        ULONG ns = (ULONG)(net_ptp_now_ns() - net_arrival_ptp);
+        if (net_stats.stamped == 0 || ns < net_stats.stack_min_ns)
+            net_stats.stack_min_ns = ns;
+        if (ns > net_stats.stack_max_ns)
+            net_stats.stack_max_ns = ns;
+        net_stats.stack_sum_ns += ns;
+        net_stats.stamped++;
+    }
+    n = kp_handle(&net_kp, pkt->nx_packet_prepend_ptr, (uint16_t)pkt->nx_packet_length,
+                  reply->nx_packet_prepend_ptr,
+                  (uint16_t)(reply->nx_packet_data_end - reply->nx_packet_prepend_ptr));
+    nx_packet_release(pkt);
+
+    if (n == 0)
+    {
+        nx_packet_release(reply);
+        return;
+    }
+
+    reply->nx_packet_length = n;
+    reply->nx_packet_append_ptr = reply->nx_packet_prepend_ptr + n;
+    if (nx_udp_socket_send(&net_socket, reply, src_ip, src_port) != NX_SUCCESS)
+    {
+        net_stats.send_failed++;
+        nx_packet_release(reply);
+    }
+
+    if (net_reboot)
+    {
+        PRINTF("[NET] Reboot requested\n");
+        hrt_sleep_us(NET_REBOOT_DELAY_US);
+        NVIC_SystemReset();
+    }
+}
+
+static VOID net_server_entry(ULONG arg)
+{
+    NX_PACKET *pkt;
+    ULONG link;
+    (void)arg;
+
+    nx_ip_interface_status_check(&net_ip, 0, NX_IP_LINK_ENABLED, &link, NX_WAIT_FOREVER);
+    if (net_ptp_create(&net_ip, &net_pool) != NX_SUCCESS)
+        PRINTF("[NET] PTP client failed to start, commands carry no receive time\n");
+    PRINTF("[NET] KMBox NET on %lu.%lu.%lu.%lu:%u, UUID %08lX\n",
+           (NET_IP_ADDR >> 24) & 0xFF, (NET_IP_ADDR >> 16) & 0xFF, (NET_IP_ADDR >> 8) & 0xFF,
+           NET_IP_ADDR & 0xFF, KP_DEFAULT_PORT, net_kp.uuid);
+
+    while (1)
+    {
+        if (nx_udp_socket_receive(&net_socket, &pkt, NX_WAIT_FOREVER) == NX_SUCCESS)
+            net_datagram(pkt);
+    }
+}
+
+/******** Public API *********/
+UINT net_control_create(void)
+{
+    kp_handlers_t h;
+    UINT status;
+
+    net_hw_setup();
+    nx_system_initialize();
+
+    status = nx_packet_pool_create(&net_pool, "net_pool", NET_PACKET_PAYLOAD,
+                                   net_pool_area, sizeof(net_pool_area));
+    if (status)
+        return status;
+
+    status = nx_ip_create(&net_ip, "net_ip", NET_IP_ADDR, NET_IP_MASK, &net_pool, nx_driver_imx,
+                          net_ip_stack, NET_IP_STACK_SIZE, NET_IP_PRIORITY);
+    if (status)
+        return status;
+
+    status = nx_arp_enable(&net_ip, net_arp_cache, sizeof(net_arp_cache));
+    if (status)
+        return status;
+    status = nx_icmp_enable(&net_ip);
+    if (status)
+        return status;
+    status = nx_udp_enable(&net_ip);
+    if (status)
+        return status;
+    /* PTP listens on the 224.0.1.129 event and general groups */
+    status = nx_igmp_enable(&net_ip);
+    if (status)
+        return status;
+
+    /* A few datagrams of slack while the server thread is busy */
+    status = nx_udp_socket_create(&net_ip, &net_socket, "kmbox", NX_IP_NORMAL, NX_FRAGMENT_OKAY,
+                                  NX_IP_TIME_TO_LIVE, 8);
+    if (status)
+        return status;
+    status = nx_udp_socket_bind(&net_socket, KP_DEFAULT_PORT, TX_NO_WAIT);
+    if (status)
+        return status;
+
+    spsc_init(&net_cmds, net_cmd_buf, sizeof(net_cmd_t), NET_CMD_DEPTH);
+
+    memset(&h, 0, sizeof(h));
+    h.mouse = net_mouse_cb;
+    h.reboot = net_reboot_cb;
+    h.now_us = net_now_us;
+#ifdef SR71_PROFILE
+    h.snapshot = net_snapshot_cb;
+#endif
+    kp_init(&net_kp, net_uuid(), &h);
+
+    return tx_thread_create(&net_server_thread, "net_server", net_server_entry, 0,
+                            net_server_stack, NET_SERVER_STACK_SIZE,
+                            NET_SERVER_PRIORITY, NET_SERVER_PRIORITY, TX_NO_TIME_SLICE, TX_AUTO_START);
+}
+
+HOT_PATH bool net_control_cmd_get(net_cmd_t *cmd)
+{
+    return spsc_pop(&net_cmds, cmd);
+}
+
+VOID net_control_print_stats(VOID)
+{
+    PRINTF("[NET] rx %lu accepted %lu rejected %lu malformed %lu unsupported %lu, "
+           "queue drop %lu, chained %lu, no packet %lu, send failed %lu, too far ahead %lu\n",
+           net_kp.stats.rx, net_kp.stats.accepted, net_kp.stats.rejected, net_kp.stats.malformed,
+           net_kp.stats.unsupported, net_cmds.dropped, net_stats.chained, net_stats.no_packet,
+           net_stats.send_failed, net_stats.too_far);
+    if (net_stats.stamped)
+        PRINTF("[NET] MAC receive to command: min %lu avg %lu max %lu ns over %lu datagrams\n",
+               net_stats.stack_min_ns, (ULONG)(net_stats.stack_sum_ns / net_stats.stamped),
+               net_stats.stack_max_ns, net_stats.stamped);
+    net_ptp_print_stats();
+}
+
+VOID net_control_print_memory(VOID)
+{
+    ULONG total = 0, free_packets = 0, empty = 0, suspended = 0, invalid = 0;
+
+    if (nx_packet_pool_info_get(&net_pool, &total, &free_packets, &empty, &suspended, &invalid) != NX_SUCCESS)
+        return;
+    PRINTF("[MEM] net packets %lu x %u B in %s, %lu free, %lu empty requests\n",
+           total, NET_PACKET_PAYLOAD, mem_region_name(net_pool_area), free_packets, empty);
+}
@@ -0,0 +1,53 @@
+#ifndef NET_CONTROL_H
+#define NET_CONTROL_H
+
+#include "tx_api.h"
+#include "nx_api.h"
+#include "kmbox_proto.h"
+
+/* KMBox NET over the on-board ENET port: NetX Duo with a static address
+ * and one UDP server thread running the shared protocol core
+ * (common/kmbox_proto). Datagrams are parsed in the NX_PACKET the ENET
+ * driver received them into, and replies are written straight into the
+ * packet that goes back out. */
+
+#ifndef NET_IP_ADDR
+#define NET_IP_ADDR           IP_ADDRESS(192, 168, 1, 177)
+#endif
+#define NET_IP_MASK           0xFFFFFF00UL
+
+#define NET_PACKET_COUNT      24
+#define NET_PACKET_PAYLOAD    1536   /* A whole Ethernet frame, so no datagram ever chains */
+#define NET_IP_STACK_SIZE     (2048)
+#define NET_IP_PRIORITY       9      /* IP helper thread: runs the deferred ENET RX work, below the report path */
+#define NET_SERVER_STACK_SIZE (2048)
+#define NET_SERVER_PRIORITY   10     /* Right behind the IP thread: a datagram goes straight through */
+#define NET_ARP_CACHE_SIZE    (8 * sizeof(NX_ARP))
+
+#define NET_CMD_DEPTH         32     /* Power of two */
+#define NET_AT_MAX_AHEAD_US   1000000  /* Execute-at times further out are refused */
+#define NET_REBOOT_DELAY_US   1000   /* Lets the reply to a reboot command get out first */
+
+/* One decoded command on its way to the report path. mouse.at_us, when
+ * set, is the execute-at time in the PTP timebase (net_ptp_now_ns() / 1000). */
+typedef struct
+{
+    kp_mouse_t mouse;
+    uint32_t   arrival_us;   /* hrt_now_us() when the datagram was handed over */
+    int64_t    rx_ptp_ns;    /* MAC receive time in the PTP timebase, 0 if unstamped */
+} net_cmd_t;
+
+/* Bring up ENET, the IP instance and the server thread. Call from
+ * tx_application_define(). */
+UINT net_control_create(void);
+
+/* Consumer side of the command queue: one thread only. Returns false when
+ * it is empty. */
+bool net_control_cmd_get(net_cmd_t *cmd);
+
+VOID net_control_print_stats(VOID);
+
+/* Packet pool line for the boot memory map. */
+VOID net_control_print_memory(VOID);
+
+#endif /* NET_CONTROL_H */
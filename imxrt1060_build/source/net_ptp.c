@@ -0,0 +1,380 @@
+#include "net_ptp.h"
+
+#include "nxd_ptp_client.h"
+#include "fsl_common.h"
+#include "fsl_clock.h"
+#include "fsl_debug_console.h"
+#include "net_control.h"
+#include <stdlib.h>
+
+#define NSEC_PER_SEC  1000000000LL
+
+static NX_PTP_CLIENT   net_ptp_client;
+static NX_PACKET_POOL *net_ptp_pool;
+static TX_TIMER        net_ptp_rebase_timer;
+static ULONG           net_ptp_stack[NET_PTP_STACK_SIZE/sizeof(ULONG)];
+
+/* Free-running hardware time: ATVR counts nanoseconds and wraps every
+ * second, the seconds are kept here. Read at least once a second. */
+static uint64_t net_ptp_hw_sec;
+static ULONG    net_ptp_hw_last_ns;
+
+/* Disciplined clock: ptp = ref_ptp + (hw - ref_hw) * (1 + rate_ppb / 1e9) */
+static int64_t  net_ptp_ref_hw;
+static int64_t  net_ptp_ref_ptp;
+static int32_t  net_ptp_rate_ppb;
+static int64_t  net_ptp_last_adjust_hw;
+
+/* Receive stamps, one per pool packet, in hardware time */
+static int64_t  net_ptp_rx_hw[NET_PACKET_COUNT];
+static NX_PACKET *volatile net_ptp_tx_pending;
+
+static volatile bool net_ptp_sync;
+
+static struct
+{
+    ULONG   adjusts;
+    ULONG   sets;
+    ULONG   timeouts;
+    ULONG   rx_stamped;
+    ULONG   tx_stamped;
+    LONG    last_offset_ns;
+    LONG    worst_offset_ns;   /* Largest |offset| since the last print */
+} net_ptp_stats;
+
+/******** Hardware timebase *********/
+/* ENET 1588 timer from the IPG clock, wrapping at one second. A clock that
+ * is not a whole number of nanoseconds (6.67 ns at 150 MHz) uses the next
+ * increment up, one less every ATCOR ticks. */
+static VOID net_ptp_hw_init(VOID)
+{
+    uint32_t hz = CLOCK_GetFreq(kCLOCK_IpgClk);
+    uint32_t inc = (uint32_t)(NSEC_PER_SEC / hz);
+    uint32_t rem = (uint32_t)(NSEC_PER_SEC % hz);
+
+    CLOCK_EnableClock(kCLOCK_Enet);
+    ENET->ATCR = 0;
+    ENET->ATPER = ENET_ATPER_PERIOD((uint32_t)NSEC_PER_SEC);
+    if (rem)
+    {
+        /* inc + 1 runs (hz - rem) / hz of a nanosecond fast per tick */
+        ENET->ATINC = ENET_ATINC_INC(inc + 1) | ENET_ATINC_INC_CORR(inc);
+        ENET->ATCOR = ENET_ATCOR_COR((hz + (hz - rem) / 2) / (hz - rem));
+    }
+    else
+    {
+        ENET->ATINC = ENET_ATINC_INC(inc) | ENET_ATINC_INC_CORR(inc);
+        ENET->ATCOR = 0;
+    }
+    ENET->ATCR = ENET_ATCR_PEREN_MASK | ENET_ATCR_RESTART_MASK | ENET_ATCR_EN_MASK;
+
+    net_ptp_hw_sec = 0;
+    net_ptp_hw_last_ns = 0;
+}
+
+/* Interrupts off */
+static int64_t net_ptp_hw_now(VOID)
+{
+    ULONG ns;
+
+    ENET->ATCR |= ENET_ATCR_CAPTURE_MASK;
+    while (ENET->ATCR & ENET_ATCR_CAPTURE_MASK)
+    {
+    }
+    ns = ENET->ATVR;
+    if (ns < net_ptp_hw_last_ns)
+        net_ptp_hw_sec++;
+    net_ptp_hw_last_ns = ns;
+    return (int64_t)net_ptp_hw_sec * NSEC_PER_SEC + ns;
+}
+
+/* Descriptor stamp to full hardware time: it lies less than a second back */
+static int64_t net_ptp_hw_from_stamp(ULONG ts_ns)
+{
+    int64_t now = net_ptp_hw_now();
+    int64_t t = now - (int64_t)net_ptp_hw_last_ns + ts_ns;
+
+    if (ts_ns > net_ptp_hw_last_ns)
+        t -= NSEC_PER_SEC;
+    return t;
+}
+
+/******** Disciplined clock (interrupts off) *********/
+static int64_t net_ptp_map(int64_t hw)
+{
+    int64_t d = hw - net_ptp_ref_hw;
+    return net_ptp_ref_ptp + d + d * net_ptp_rate_ppb / NSEC_PER_SEC;
+}
+
+/* Keep hw - ref_hw small so the rate product cannot overflow */
+static VOID net_ptp_rebase(int64_t hw)
+{
+    net_ptp_ref_ptp = net_ptp_map(hw);
+    net_ptp_ref_hw = hw;
+}
+
+static int64_t net_ptp_to_ns(const NX_PTP_TIME *t)
+{
+    uint64_t sec = ((uint64_t)(ULONG)t->second_high << 32) | t->second_low;
+    return (int64_t)sec * NSEC_PER_SEC + t->nanosecond;
+}
+
+static VOID net_ptp_from_ns(int64_t ns, NX_PTP_TIME *t)
+{
+    uint64_t sec = (uint64_t)(ns / NSEC_PER_SEC);
+    t->second_high = (LONG)(sec >> 32);
+    t->second_low = (ULONG)sec;
+    t->nanosecond = (LONG)(ns % NSEC_PER_SEC);
+}
+
+/* The client hands over the offset still left after each Sync/Delay_Resp
+ * exchange. The phase error is removed at once; half the rate it implies
+ * goes into the trim, which settles without ringing on jittery links. */
+static VOID net_ptp_adjust(int64_t hw, LONG offset_ns)
+{
+    int64_t interval = hw - net_ptp_last_adjust_hw;
+
+    net_ptp_rebase(hw);
+    net_ptp_ref_ptp += offset_ns;
+
+    if (net_ptp_last_adjust_hw && interval > 0 && interval < 16 * NSEC_PER_SEC)
+    {
+        int64_t rate = net_ptp_rate_ppb + (int64_t)offset_ns * NSEC_PER_SEC / interval / 2;
+        if (rate > NET_PTP_MAX_RATE_PPB)
+            rate = NET_PTP_MAX_RATE_PPB;
+        else if (rate < -NET_PTP_MAX_RATE_PPB)
+            rate = -NET_PTP_MAX_RATE_PPB;
+        net_ptp_rate_ppb = (int32_t)rate;
+    }
+    net_ptp_last_adjust_hw = hw;
+}
+
+static VOID net_ptp_rebase_tick(ULONG arg)
+{
+    TX_INTERRUPT_SAVE_AREA
+    (void)arg;
+
+    TX_DISABLE
+    net_ptp_rebase(net_ptp_hw_now());
+    TX_RESTORE
+}
+
+/******** Packet stamps *********/
+static int net_ptp_slot(NX_PACKET *packet)
+{
+    ULONG block = net_ptp_pool->nx_packet_pool_size / net_ptp_pool->nx_packet_pool_total;
+    ULONG off = (ULONG)((CHAR *)packet - net_ptp_pool->nx_packet_pool_start);
+
+    if ((CHAR *)packet < net_ptp_pool->nx_packet_pool_start || off / block >= NET_PACKET_COUNT)
+        return -1;
+    return (int)(off / block);
+}
+
+VOID net_ptp_rx_timestamp(NX_PACKET *packet, ULONG ts_ns)
+{
+    TX_INTERRUPT_SAVE_AREA
+    int slot;
+
+    if (net_ptp_pool == NX_NULL)
+        return;
+    slot = net_ptp_slot(packet);
+    if (slot < 0)
+        return;
+    TX_DISABLE
+    net_ptp_rx_hw[slot] = net_ptp_hw_from_stamp(ts_ns);
+    TX_RESTORE
+    net_ptp_stats.rx_stamped++;
+}
+
+int64_t net_ptp_rx_take_ns(NX_PACKET *packet)
+{
+    TX_INTERRUPT_SAVE_AREA
+    int64_t t = 0;
+    int slot;
+
+    if (net_ptp_pool == NX_NULL)
+        return 0;
+    slot = net_ptp_slot(packet);
+    if (slot < 0)
+        return 0;
+    TX_DISABLE
+    if (net_ptp_rx_hw[slot])
+        t = net_ptp_map(net_ptp_rx_hw[slot]);
+    net_ptp_rx_hw[slot] = 0;
+    TX_RESTORE
+    return t;
+}
+
+bool net_ptp_tx_wanted(NX_PACKET *packet)
+{
+    return packet == net_ptp_tx_pending;
+}
+
+VOID net_ptp_tx_timestamp(NX_PACKET *packet, ULONG ts_ns)
+{
+    TX_INTERRUPT_SAVE_AREA
+    NX_PTP_TIME t;
+
+    if (packet != net_ptp_tx_pending)
+        return;
+    net_ptp_tx_pending = NX_NULL;
+
+    TX_DISABLE
+    net_ptp_from_ns(net_ptp_map(net_ptp_hw_from_stamp(ts_ns)), &t);
+    TX_RESTORE
+    net_ptp_stats.tx_stamped++;
+    nx_ptp_client_packet_timestamp_notify(&net_ptp_client, packet, &t);
+}
+
+/******** PTP client callbacks *********/
+static UINT net_ptp_clock_cb(NX_PTP_CLIENT *client, UINT operation, NX_PTP_TIME *time,
+                             NX_PACKET *packet, VOID *data)
+{
+    TX_INTERRUPT_SAVE_AREA
+    int64_t t;
+    (void)data;
+
+    switch (operation)
+    {
+    case NX_PTP_CLIENT_CLOCK_INIT:
+        net_ptp_hw_init();
+        break;
+
+    case NX_PTP_CLIENT_CLOCK_SET:
+        TX_DISABLE
+        net_ptp_ref_hw = net_ptp_hw_now();
+        net_ptp_ref_ptp = net_ptp_to_ns(time);
+        net_ptp_last_adjust_hw = 0;
+        TX_RESTORE
+        net_ptp_stats.sets++;
+        break;
+
+    case NX_PTP_CLIENT_CLOCK_GET:
+        TX_DISABLE
+        net_ptp_from_ns(net_ptp_map(net_ptp_hw_now()), time);
+        TX_RESTORE
+        break;
+
+    case NX_PTP_CLIENT_CLOCK_ADJUST:
+        TX_DISABLE
+        net_ptp_adjust(net_ptp_hw_now(), time->nanosecond);
+        TX_RESTORE
+        net_ptp_stats.adjusts++;
+        net_ptp_stats.last_offset_ns = time->nanosecond;
+        if (labs(time->nanosecond) > labs(net_ptp_stats.worst_offset_ns))
+            net_ptp_stats.worst_offset_ns = time->nanosecond;
+        break;
+
+    case NX_PTP_CLIENT_CLOCK_PACKET_TS_EXTRACT:
+        t = NET_PTP_DRIVER_STAMPS ? net_ptp_rx_take_ns(packet) : 0;
+        if (t == 0)
+            t = net_ptp_now_ns();
+        net_ptp_from_ns(t, time);
+        break;
+
+    case NX_PTP_CLIENT_CLOCK_PACKET_TS_PREPARE:
+#if NET_PTP_DRIVER_STAMPS
+        /* The MAC stamps it on the way out, net_ptp_tx_timestamp() reports it */
+        net_ptp_tx_pending = packet;
+#else
+        net_ptp_from_ns(net_ptp_now_ns(), time);
+        nx_ptp_client_packet_timestamp_notify(client, packet, time);
+#endif
+        break;
+
+    case NX_PTP_CLIENT_CLOCK_SOFT_TIMER_UPDATE:
+        /* Hardware clock: nothing to advance */
+        break;
+
+    default:
+        return NX_PTP_PARAM_ERROR;
+    }
+    (void)client;
+    return NX_SUCCESS;
+}
+
+static UINT net_ptp_event_cb(NX_PTP_CLIENT *client, UINT event, VOID *event_data, VOID *data)
+{
+    (void)client;
+    (void)event_data;
+    (void)data;
+
+    switch (event)
+    {
+    case NX_PTP_CLIENT_EVENT_MASTER:
+        PRINTF("[PTP] New master, syncing\n");
+        break;
+    case NX_PTP_CLIENT_EVENT_SYNC:
+        net_ptp_sync = true;
+        break;
+    case NX_PTP_CLIENT_EVENT_TIMEOUT:
+        net_ptp_sync = false;
+        net_ptp_stats.timeouts++;
+        PRINTF("[PTP] Master lost, free-running at %ld ppb\n", (long)net_ptp_rate_ppb);
+        break;
+    }
+    return NX_SUCCESS;
+}
+
+/******** Public API *********/
+UINT net_ptp_create(NX_IP *ip, NX_PACKET_POOL *pool)
+{
+    UCHAR identity[NX_PTP_CLOCK_PORT_IDENTITY_SIZE];
+    ULONG msw = ip->nx_ip_interface[0].nx_interface_physical_address_msw;
+    ULONG lsw = ip->nx_ip_interface[0].nx_interface_physical_address_lsw;
+    UINT status;
+
+    /* EUI-64 clock identity from the MAC, port 1 */
+    identity[0] = (UCHAR)(msw >> 8);
+    identity[1] = (UCHAR)msw;
+    identity[2] = (UCHAR)(lsw >> 24);
+    identity[3] = 0xFF;
+    identity[4] = 0xFE;
+    identity[5] = (UCHAR)(lsw >> 16);
+    identity[6] = (UCHAR)(lsw >> 8);
+    identity[7] = (UCHAR)lsw;
+    identity[8] = 0;
+    identity[9] = 1;
+
+    status = nx_ptp_client_create(&net_ptp_client, ip, 0, pool, NET_PTP_PRIORITY,
+                                  (UCHAR *)net_ptp_stack, sizeof(net_ptp_stack),
+                                  net_ptp_clock_cb, NX_NULL);
+    if (status)
+        return status;
+    net_ptp_pool = pool;
+
+    status = tx_timer_create(&net_ptp_rebase_timer, "ptp_rebase", net_ptp_rebase_tick, 0,
+                             NET_PTP_REBASE_TICKS, NET_PTP_REBASE_TICKS, TX_AUTO_ACTIVATE);
+    if (status)
+        return status;
+
+    return nx_ptp_client_start(&net_ptp_client, identity, sizeof(identity), NET_PTP_DOMAIN,
+                               NX_PTP_TRANSPORT_SPECIFIC_NON_802, net_ptp_event_cb, NX_NULL);
+}
+
+int64_t net_ptp_now_ns(void)
+{
+    TX_INTERRUPT_SAVE_AREA
+    int64_t t;
+
+    TX_DISABLE
+    t = net_ptp_map(net_ptp_hw_now());
+    TX_RESTORE
+    return t;
+}
+
+bool net_ptp_synced(void)
+{
+    return net_ptp_sync;
+}
+
+VOID net_ptp_print_stats(VOID)
+{
+    PRINTF("[PTP] %s, offset %ld ns (worst %ld), rate %ld ppb, %lu adjusts %lu sets %lu timeouts, "
+           "stamped rx %lu tx %lu\n",
+           net_ptp_sync ? "synced" : "free-running", net_ptp_stats.last_offset_ns,
+           net_ptp_stats.worst_offset_ns, (long)net_ptp_rate_ppb, net_ptp_stats.adjusts,
+           net_ptp_stats.sets, net_ptp_stats.timeouts, net_ptp_stats.rx_stamped,
+           net_ptp_stats.tx_stamped);
+    net_ptp_stats.worst_offset_ns = 0;
+}
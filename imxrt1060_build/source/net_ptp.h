@@ -0,0 +1,57 @@
+#ifndef NET_PTP_H
+#define NET_PTP_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "tx_api.h"
+#include "nx_api.h"
+
+/* IEEE 1588 slave on the ENET port. The ENET adjustable timer runs free at
+ * its nominal rate and is the hardware timebase; the NetX Duo PTP client
+ * (addons/ptp) disciplines a software model on top of it (offset plus a
+ * rate trim in ppb), so every hardware timestamp can be read out in the
+ * controller's time without ever stepping the counter itself.
+ *
+ * Event packets are stamped by the MAC: the ENET driver port calls
+ * net_ptp_rx_timestamp() with each received frame's enhanced descriptor
+ * timestamp, sets the descriptor's timestamp request for every packet
+ * net_ptp_tx_wanted() accepts, and hands the captured value back through
+ * net_ptp_tx_timestamp(). Built with NET_PTP_DRIVER_STAMPS 0 the stamps are
+ * taken in software when the PTP client asks for them, still on the
+ * hardware timebase. */
+
+#ifndef NET_PTP_DRIVER_STAMPS
+#define NET_PTP_DRIVER_STAMPS   1
+#endif
+
+#define NET_PTP_STACK_SIZE      (2048)
+#define NET_PTP_PRIORITY        13     /* Below the command path: sync loss costs less than late input */
+#define NET_PTP_DOMAIN          0
+#define NET_PTP_MAX_RATE_PPB    500000 /* Trim limit: far beyond any crystal's tolerance */
+#define NET_PTP_REBASE_TICKS    (TX_TIMER_TICKS_PER_SECOND / 4)  /* Must be under a second: ATVR wraps */
+
+/* Start the PTP client on interface 0. Call once the link is up: the clock
+ * identity comes from the MAC address the driver has set by then. The
+ * stamp hooks ignore everything until this has run. */
+UINT net_ptp_create(NX_IP *ip, NX_PACKET_POOL *pool);
+
+/* Current time in the controller's timebase, nanoseconds since the PTP
+ * epoch. Runs on the local clock until the first Sync. */
+int64_t net_ptp_now_ns(void);
+
+/* Hardware receive time of a packet in the controller's timebase, taken
+ * once: a second call, or a packet the driver did not stamp, gives 0. */
+int64_t net_ptp_rx_take_ns(NX_PACKET *packet);
+
+/* True while Sync messages from a master keep arriving */
+bool net_ptp_synced(void);
+
+VOID net_ptp_print_stats(VOID);
+
+/* ENET driver port hooks. ts_ns is the 32-bit descriptor timestamp (ATVR,
+ * which wraps every second); the packet must still be in flight. */
+VOID net_ptp_rx_timestamp(NX_PACKET *packet, ULONG ts_ns);
+bool net_ptp_tx_wanted(NX_PACKET *packet);
+VOID net_ptp_tx_timestamp(NX_PACKET *packet, ULONG ts_ns);
+
+#endif /* NET_PTP_H */
@@ -0,0 +1,464 @@
+#include "rtos_profile.h"
+
+#ifdef SR71_PROFILE
+
+#include "tx_thread.h"
+#include "fsl_common.h"
+#include "fsl_debug_console.h"
+#include "hr_timer.h"
+#include "hot_path.h"
+#include <string.h>
+
+#define PROF_NEST_MAX  16   /* One per NVIC priority level: deeper cannot happen */
+
+typedef struct
+{
+    TX_THREAD *thread;      /* Thread slots; NULL in the last one, which takes the overflow */
+    uint64_t   cycles;
+    ULONG      count;
+    ULONG      run;         /* Cycles in the current run */
+    ULONG      run_max;
+    ULONG      ready_at;    /* DWT stamp (bit 0 set) once the kernel picked it, 0 = not picked */
+    uint64_t   wait_sum;
+    ULONG      waits;
+    ULONG      wait_max;
+} prof_slot_t;
+
+/* Profile build only, so all of it stays in plain (cached OCRAM) statics */
+static prof_slot_t  prof_threads[PROF_MAX_THREADS + 1];
+static prof_slot_t  prof_isrs[NUMBER_OF_INT_VECTORS];   /* By exception number */
+static prof_slot_t  prof_idle;
+static prof_slot_t  prof_start;
+static uint32_t     prof_handlers[NUMBER_OF_INT_VECTORS];
+
+/* Accounting cursor: prof_cur gets every cycle since prof_last */
+static prof_slot_t *prof_cur;
+static prof_slot_t *prof_nest[PROF_NEST_MAX];
+static UINT         prof_depth;
+static ULONG        prof_last;
+static uint64_t     prof_total;
+static uint64_t     prof_window_start;
+
+static struct
+{
+    prof_trace_header_t head;
+    prof_trace_object_t objects[PROF_TRACE_OBJECTS];
+    prof_trace_event_t  events[PROF_TRACE_EVENTS];
+} prof_trace;
+static prof_trace_event_t *prof_trace_next;
+static volatile bool       prof_frozen;
+static hrt_timer_t         prof_thaw_timer;
+
+static struct
+{
+    prof_snap_header_t head;
+    prof_snap_entry_t  entries[PROF_SNAP_ENTRIES];
+} prof_snap;
+static uint32_t prof_snap_len;
+
+/******** Accounting (interrupts masked) *********/
+static HOT_PATH ULONG prof_charge(VOID)
+{
+    ULONG now = DWT->CYCCNT;
+    ULONG d = now - prof_last;
+
+    prof_last = now;
+    prof_total += d;
+    prof_cur->cycles += d;
+    prof_cur->run += d;
+    return now;
+}
+
+static HOT_PATH VOID prof_run_start(prof_slot_t *s)
+{
+    s->count++;
+    s->run = 0;
+    prof_cur = s;
+}
+
+static HOT_PATH VOID prof_run_end(prof_slot_t *s)
+{
+    if (s->run > s->run_max)
+        s->run_max = s->run;
+}
+
+static HOT_PATH prof_slot_t *prof_thread_slot(TX_THREAD *t)
+{
+    UINT i;
+
+    for (i = 0; i < PROF_MAX_THREADS; i++)
+    {
+        if (prof_threads[i].thread == t)
+            return &prof_threads[i];
+        if (prof_threads[i].thread == TX_NULL)
+        {
+            prof_threads[i].thread = t;
+            return &prof_threads[i];
+        }
+    }
+    return &prof_threads[PROF_MAX_THREADS];
+}
+
+/******** Trace (interrupts masked) *********/
+static HOT_PATH VOID prof_trace_put(ULONG event, ULONG time, ULONG info1, ULONG info2, ULONG info3)
+{
+    prof_trace_event_t *e = prof_trace_next;
+    TX_THREAD *t = _tx_thread_current_ptr;
+
+    if (prof_frozen)
+        return;
+    if (prof_depth)
+    {
+        e->thread = PROF_TRACE_IN_ISR;
+        e->priority = (ULONG)t;
+    }
+    else if (prof_cur == &prof_start)
+    {
+        e->thread = PROF_TRACE_IN_INIT;
+        e->priority = 0;
+    }
+    else
+    {
+        e->thread = (ULONG)t;
+        e->priority = t ? t->tx_thread_priority : 0;
+    }
+    e->event = event;
+    e->time = time;
+    e->info[0] = info1;
+    e->info[1] = info2;
+    e->info[2] = info3;
+    e->info[3] = 0;
+
+    if (++e == prof_trace.events + PROF_TRACE_EVENTS)
+        e = prof_trace.events;
+    prof_trace_next = e;
+    prof_trace.head.buffer_current = (ULONG)e;
+}
+
+/* The thread the kernel switches to once the current context gives way:
+ * its dispatch latency runs from here */
+static HOT_PATH VOID prof_mark_ready(ULONG now)
+{
+    TX_THREAD *next = _tx_thread_execute_ptr;
+    prof_slot_t *s;
+
+    if (next == TX_NULL || next == _tx_thread_current_ptr)
+        return;
+    s = prof_thread_slot(next);
+    if (s->ready_at == 0)
+    {
+        s->ready_at = now | 1U;
+        prof_trace_put(PROF_TRACE_THREAD_RESUME, now, (ULONG)next, 0, 0);
+    }
+}
+
+/******** ThreadX hooks (TX_ENABLE_EXECUTION_CHANGE_NOTIFY) *********/
+/* From PendSV, with _tx_thread_current_ptr already the new thread */
+HOT_PATH VOID _tx_execution_thread_enter(VOID)
+{
+    TX_INTERRUPT_SAVE_AREA
+    TX_THREAD *t = _tx_thread_current_ptr;
+    prof_slot_t *s;
+    ULONG now;
+
+    TX_DISABLE
+    now = prof_charge();
+    s = prof_thread_slot(t);
+    if (s->ready_at)
+    {
+        ULONG wait = now - s->ready_at;
+
+        s->ready_at = 0;
+        s->wait_sum += wait;
+        s->waits++;
+        if (wait > s->wait_max)
+            s->wait_max = wait;
+    }
+    prof_run_start(s);
+    prof_trace_put(PROF_TRACE_RUNNING, now, t->tx_thread_run_count, 0, 0);
+    TX_RESTORE
+}
+
+/* From PendSV, before the outgoing thread (if any) is saved */
+HOT_PATH VOID _tx_execution_thread_exit(VOID)
+{
+    TX_INTERRUPT_SAVE_AREA
+    ULONG now;
+
+    TX_DISABLE
+    now = prof_charge();
+    prof_run_end(prof_cur);
+    prof_mark_ready(now);
+    prof_cur = &prof_idle;
+    if (_tx_thread_execute_ptr == TX_NULL)
+    {
+        prof_idle.count++;
+        prof_trace_put(PROF_EV_IDLE, now, 0, 0, 0);
+    }
+    TX_RESTORE
+}
+
+/* Called by the port's _tx_thread_context_save/restore, which nothing on
+ * this port uses; interrupts are counted by prof_isr() */
+VOID _tx_execution_isr_enter(VOID)
+{
+}
+
+VOID _tx_execution_isr_exit(VOID)
+{
+}
+
+/******** Interrupts *********/
+static HOT_PATH VOID prof_isr_enter(uint32_t n)
+{
+    TX_INTERRUPT_SAVE_AREA
+    ULONG now;
+
+    TX_DISABLE
+    now = prof_charge();
+    prof_nest[prof_depth++] = prof_cur;
+    prof_run_start(&prof_isrs[n]);
+    prof_trace_put(PROF_TRACE_ISR_ENTER, now, n - 16U, prof_depth, 0);
+    TX_RESTORE
+}
+
+static HOT_PATH VOID prof_isr_exit(uint32_t n)
+{
+    TX_INTERRUPT_SAVE_AREA
+    ULONG now;
+
+    TX_DISABLE
+    now = prof_charge();
+    prof_run_end(prof_cur);
+    prof_trace_put(PROF_TRACE_ISR_EXIT, now, n - 16U, prof_depth, 0);
+    if (prof_depth == 1)
+        prof_mark_ready(now);
+    prof_cur = prof_nest[--prof_depth];
+    TX_RESTORE
+}
+
+/* In front of every wrapped handler; they are plain C functions, so being
+ * called from here instead of the NVIC makes no difference to them */
+static HOT_PATH_IRQ void prof_isr(void)
+{
+    uint32_t n = __get_IPSR();
+
+    prof_isr_enter(n);
+    ((void (*)(void))prof_handlers[n])();
+    prof_isr_exit(n);
+}
+
+/******** Snapshot *********/
+static VOID prof_slot_clear(prof_slot_t *s)
+{
+    s->cycles = 0;
+    s->count = 0;
+    s->run_max = 0;
+    s->wait_sum = 0;
+    s->waits = 0;
+    s->wait_max = 0;
+}
+
+static const char *prof_isr_name(int32_t irq)
+{
+    switch (irq)
+    {
+    case SysTick_IRQn:   return "SysTick";
+    case USB_OTG1_IRQn:  return "USB_OTG1";
+    case USB_OTG2_IRQn:  return "USB_OTG2";
+    case GPT2_IRQn:      return "GPT2";
+    case ENET_IRQn:      return "ENET";
+    case LPUART1_IRQn:   return "LPUART1";
+    default:             return "";
+    }
+}
+
+/* Append s to the table if it ran in the window, then start it over */
+static VOID prof_snap_add(prof_slot_t *s, uint8_t kind, int16_t irq, const char *name)
+{
+    prof_snap_entry_t *e;
+    UINT n = prof_snap.head.entries;
+
+    if (n < PROF_SNAP_ENTRIES && (s->count || s->cycles))
+    {
+        e = &prof_snap.entries[n];
+        memset(e, 0, sizeof(*e));
+        e->kind = kind;
+        e->irq = irq;
+        if (s->thread)
+        {
+            e->id = (uint32_t)s->thread;
+            e->priority = (uint8_t)s->thread->tx_thread_priority;
+            name = s->thread->tx_thread_name;
+        }
+        e->cycles = s->cycles;
+        e->count = s->count;
+        e->max_cycles = s->run_max;
+        e->wait_cycles = s->wait_sum;
+        e->waits = s->waits;
+        e->wait_max_cycles = s->wait_max;
+        if (name)
+            strncpy(e->name, name, PROF_NAME_LEN - 1);
+        prof_snap.head.entries = (uint16_t)(n + 1);
+    }
+    prof_slot_clear(s);
+}
+
+/* Threads by address for TraceX, refreshed with every snapshot */
+static VOID prof_trace_registry(VOID)
+{
+    TX_THREAD *t = _tx_thread_created_ptr;
+    ULONG left = _tx_thread_created_count;
+    UINT i;
+
+    for (i = 0; i < PROF_TRACE_OBJECTS; i++)
+    {
+        prof_trace_object_t *o = &prof_trace.objects[i];
+
+        memset(o, 0, sizeof(*o));
+        o->available = 1;
+        if (t == TX_NULL || left == 0)
+            continue;
+        o->available = 0;
+        o->type = PROF_TRACE_OBJECT_THREAD;
+        o->object = (uint32_t)t;
+        o->param1 = (uint32_t)t->tx_thread_stack_start;
+        o->param2 = t->tx_thread_stack_size;
+        if (t->tx_thread_name)
+            strncpy((char *)o->name, t->tx_thread_name, PROF_TRACE_NAME_LEN - 1);
+        t = t->tx_thread_created_next;
+        left--;
+    }
+}
+
+static VOID prof_snapshot_take(VOID)
+{
+    TX_INTERRUPT_SAVE_AREA
+    UINT i;
+
+    TX_DISABLE
+    prof_charge();
+    prof_snap.head.magic = PROF_SNAP_MAGIC;
+    prof_snap.head.version = PROF_SNAP_VERSION;
+    prof_snap.head.entries = 0;
+    prof_snap.head.cpu_hz = SystemCoreClock;
+    prof_snap.head.trace_size = sizeof(prof_trace);
+    prof_snap.head.window_cycles = prof_total - prof_window_start;
+    prof_window_start = prof_total;
+
+    prof_snap_add(&prof_start, PROF_KIND_INIT, 0, "start-up");
+    prof_snap_add(&prof_idle, PROF_KIND_IDLE, 0, "idle");
+    for (i = 0; i <= PROF_MAX_THREADS; i++)
+        prof_snap_add(&prof_threads[i], PROF_KIND_THREAD, 0, "other threads");
+    for (i = SysTick_IRQn + 16; i < NUMBER_OF_INT_VECTORS; i++)
+        prof_snap_add(&prof_isrs[i], PROF_KIND_ISR, (int16_t)(i - 16), prof_isr_name((int32_t)i - 16));
+
+    prof_frozen = true;
+    prof_trace_registry();
+    TX_RESTORE
+
+    prof_snap_len = sizeof(prof_snap_header_t) + prof_snap.head.entries * sizeof(prof_snap_entry_t);
+}
+
+static VOID prof_thaw(VOID *ctx)
+{
+    (void)ctx;
+    prof_frozen = false;
+}
+
+uint16_t prof_snapshot_read(uint32_t offset, uint32_t *total, uint8_t *out, uint16_t cap)
+{
+    uint32_t n = 0;
+
+    if (offset == 0)
+        prof_snapshot_take();
+    if (prof_snap_len == 0)
+    {
+        *total = 0;
+        return 0;
+    }
+    *total = prof_snap_len + sizeof(prof_trace);
+    if (offset >= *total)
+        return 0;
+
+    if (offset < prof_snap_len)
+    {
+        n = prof_snap_len - offset;
+        if (n > cap)
+            n = cap;
+        memcpy(out, (const uint8_t *)&prof_snap + offset, n);
+    }
+    if (n < cap && offset + n < *total)
+    {
+        uint32_t at = offset + n - prof_snap_len;
+        uint32_t m = sizeof(prof_trace) - at;
+
+        if (m > cap - n)
+            m = cap - n;
+        memcpy(out + n, (const uint8_t *)&prof_trace + at, m);
+        n += m;
+    }
+
+    /* Record again after the last chunk, or once the reader gives up */
+    if (offset + n >= *total)
+    {
+        hrt_cancel(&prof_thaw_timer);
+        prof_frozen = false;
+    }
+    else
+    {
+        hrt_at(&prof_thaw_timer, hrt_now_us() + PROF_THAW_US, prof_thaw, TX_NULL);
+    }
+    return (uint16_t)n;
+}
+
+/******** Events and setup *********/
+HOT_PATH VOID prof_event(ULONG id, ULONG info1, ULONG info2, ULONG info3)
+{
+    TX_INTERRUPT_SAVE_AREA
+
+    TX_DISABLE
+    prof_trace_put(id, DWT->CYCCNT, info1, info2, info3);
+    TX_RESTORE
+}
+
+VOID prof_init(uint32_t *vectors)
+{
+    prof_trace_header_t *h = &prof_trace.head;
+    uint32_t n;
+
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+
+    h->id = PROF_TRACE_VALID;
+    h->timer_valid_mask = 0xFFFFFFFFUL;
+    h->base = (uint32_t)&prof_trace;
+    h->registry_start = (uint32_t)prof_trace.objects;
+    h->registry_end = (uint32_t)(prof_trace.objects + PROF_TRACE_OBJECTS);
+    h->name_size = PROF_TRACE_NAME_LEN;
+    h->buffer_start = (uint32_t)prof_trace.events;
+    h->buffer_end = (uint32_t)(prof_trace.events + PROF_TRACE_EVENTS);
+    h->buffer_current = h->buffer_start;
+    h->reserved2 = 0xAAAAAAAAUL;
+    h->reserved3 = 0xBBBBBBBBUL;
+    h->reserved4 = 0xCCCCCCCCUL;
+    prof_trace_next = prof_trace.events;
+    prof_trace_registry();
+
+    prof_cur = &prof_start;
+    prof_last = DWT->CYCCNT;
+
+    /* SysTick and every device interrupt; the faults, SVCall and PendSV
+     * keep their own entries */
+    for (n = SysTick_IRQn + 16; n < NUMBER_OF_INT_VECTORS; n++)
+    {
+        prof_handlers[n] = vectors[n];
+        vectors[n] = (uint32_t)prof_isr;
+    }
+    __DSB();
+
+    PRINTF("[PROF] Profile build: %u-event trace at 0x%08lX, snapshot over KMBox NET\n",
+           PROF_TRACE_EVENTS, (ULONG)&prof_trace);
+}
+
+#endif /* SR71_PROFILE */
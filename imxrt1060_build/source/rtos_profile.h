@@ -0,0 +1,56 @@
+#ifndef RTOS_PROFILE_H
+#define RTOS_PROFILE_H
+
+#include "tx_api.h"
+#include "prof_snapshot.h"
+#include <stdint.h>
+
+/* Execution profile and event trace, in the Profile build configuration
+ * (SR71_PROFILE) only; elsewhere the event macro compiles to nothing.
+ *
+ * tx_user.h turns on TX_ENABLE_EXECUTION_CHANGE_NOTIFY there, so the port's
+ * PendSV handler calls the _tx_execution_thread_* hooks on every switch.
+ * Interrupts are counted by a wrapper patched into the relocated vector
+ * table in front of every handler from SysTick up. Between them, every DWT
+ * cycle is charged to exactly one thread, interrupt, the idle loop or
+ * start-up; PendSV and the faults are not wrapped and count towards
+ * whatever they interrupted.
+ *
+ * The same points write a TraceX event buffer: thread switches, interrupt
+ * entry and exit, the thread the kernel picked next, and the PROF_EV_*
+ * events in common/prof_snapshot.h. Kernel-internal events (semaphore
+ * puts, queue sends) need the ThreadX library rebuilt with
+ * TX_ENABLE_EVENT_TRACE and are not there.
+ *
+ * Both are read over KMBox NET as one snapshot (common/prof_snapshot.h,
+ * tools/prof_snapshot converts it). Taking one clears the run-time table
+ * and pauses the trace until the last chunk has been read, or for
+ * PROF_THAW_US if the reader goes away. */
+
+#define PROF_MAX_THREADS      16
+#define PROF_TRACE_EVENTS     1024
+#define PROF_TRACE_OBJECTS    (PROF_MAX_THREADS + 4)
+#define PROF_SNAP_ENTRIES     48      /* Threads, idle, start-up and the interrupts taken */
+#define PROF_THAW_US          1000000
+
+#ifdef SR71_PROFILE
+
+/* Start the cycle counter and put the interrupt wrapper in front of every
+ * handler in vectors (from mem_vectors_relocate()). Call from main() after
+ * the last handler swap and before tx_kernel_enter(). */
+VOID prof_init(uint32_t *vectors);
+
+/* Log an application event from a thread or an ISR */
+VOID prof_event(ULONG id, ULONG info1, ULONG info2, ULONG info3);
+#define PROF_EVENT(id, info1, info2, info3)  prof_event((id), (info1), (info2), (info3))
+
+/* KMBox snapshot handler: see kp_handlers_t.snapshot */
+uint16_t prof_snapshot_read(uint32_t offset, uint32_t *total, uint8_t *out, uint16_t cap);
+
+#else
+
+#define PROF_EVENT(id, info1, info2, info3)
+
+#endif /* SR71_PROFILE */
+
+#endif /* RTOS_PROFILE_H */
@@ -0,0 +1,307 @@
+#include "usb_ctrl_forward.h"
+
+#include "ux_host_stack.h"
+#include "ux_device_stack.h"
+#include "fsl_common.h"
+#include "fsl_debug_console.h"
+#include "hr_timer.h"
+#include "hot_path.h"
+
+extern UINT usbx_host_control_transfer(UX_DEVICE *device,
+                                       ULONG bmRequestType, ULONG bRequest,
+                                       ULONG wValue, ULONG wIndex,
+                                       UCHAR *data_pointer, ULONG requested_length, ULONG *actual_length);
+
+static TX_THREAD    ctrl_fwd_thread;
+static TX_SEMAPHORE ctrl_fwd_sem;
+static hrt_timer_t  ctrl_fwd_poll;
+static ULONG        ctrl_fwd_stack[CTRL_FWD_STACK_SIZE/sizeof(ULONG)];
+
+static UX_DEVICE          *ctrl_fwd_device = UX_NULL;
+static UCHAR               ctrl_fwd_itf = 0;
+static UX_SLAVE_CLASS_HID *ctrl_fwd_pc_hid = UX_NULL;
+static ULONG               ctrl_fwd_idle_seen = 0;
+static ULONG               ctrl_fwd_protocol_seen = UX_DEVICE_CLASS_HID_PROTOCOL_REPORT;
+
+/* Data stage buffer for the physical device: EHCI DMAs straight into it */
+AT_NONCACHEABLE_SECTION_ALIGN(static UCHAR ctrl_fwd_buf[CF_MAX_PAYLOAD + 1], 32);
+
+static const char *const ctrl_fwd_kind_names[CF_KIND_COUNT] = {
+    "SET_REPORT", "GET_REPORT", "SET_IDLE", "SET_PROTOCOL", "OUT_REPORT"
+};
+
+HOT_PATH UX_SLAVE_CLASS_HID *ctrl_fwd_pc_hid_get(VOID)
+{
+    return ctrl_fwd_pc_hid;
+}
+
+/* Two producers share the single-producer queue: the USBX device callbacks
+ * and ctrl_fwd_poll_pc_state() in ctrl_fwd_thread, which the device thread
+ * can preempt. The GET_REPORT cache is written from both threads as well.
+ * Each access is a short copy, so they all run with interrupts off. */
+static VOID ctrl_fwd_cache_store(uint8_t itf, uint8_t report_id, uint8_t report_type,
+                                 const uint8_t *data, uint16_t len)
+{
+    TX_INTERRUPT_SAVE_AREA
+
+    TX_DISABLE
+    cf_cache_store(itf, report_id, report_type, data, len);
+    TX_RESTORE
+}
+
+static uint16_t ctrl_fwd_cache_load(uint8_t itf, uint8_t report_id, uint8_t report_type,
+                                    uint8_t *buf, uint16_t maxlen)
+{
+    TX_INTERRUPT_SAVE_AREA
+    uint16_t n;
+
+    TX_DISABLE
+    n = cf_cache_load(itf, report_id, report_type, buf, maxlen);
+    TX_RESTORE
+    return n;
+}
+
+static VOID ctrl_fwd_submit(cf_request_t *req)
+{
+    TX_INTERRUPT_SAVE_AREA
+    bool queued;
+
+    req->itf = ctrl_fwd_itf;
+    req->stamp_us = hrt_now_us();
+    TX_DISABLE
+    queued = cf_submit(req);
+    TX_RESTORE
+    if (queued)
+        tx_semaphore_ceiling_put(&ctrl_fwd_sem, 1);
+}
+
+/******** PC-facing callbacks (USBX device thread context) *********/
+static VOID ctrl_fwd_pc_activate(VOID *instance)
+{
+    ctrl_fwd_pc_hid = (UX_SLAVE_CLASS_HID *)instance;
+    ctrl_fwd_idle_seen = 0;
+    ctrl_fwd_protocol_seen = UX_DEVICE_CLASS_HID_PROTOCOL_REPORT;
+}
+
+static VOID ctrl_fwd_pc_deactivate(VOID *instance)
+{
+    (void)instance;
+    ctrl_fwd_pc_hid = UX_NULL;
+}
+
+static UINT ctrl_fwd_set_report_cb(UX_SLAVE_CLASS_HID *hid, UX_SLAVE_CLASS_HID_EVENT *event)
+{
+    cf_request_t req;
+    ULONG len = event->ux_device_class_hid_event_length;
+    ULONG off = 0;
+
+    (void)hid;
+    req.kind = CF_KIND_SET_REPORT;
+    req.report_id = (uint8_t)event->ux_device_class_hid_event_report_id;
+    req.report_type = (uint8_t)event->ux_device_class_hid_event_report_type;
+    req.value = 0;
+
+    if (req.report_id && (len == 0 || event->ux_device_class_hid_event_buffer[0] != req.report_id))
+        req.data[off++] = req.report_id;
+    if (len + off > CF_MAX_PAYLOAD)
+        len = CF_MAX_PAYLOAD - off;
+    ux_utility_memory_copy(req.data + off, event->ux_device_class_hid_event_buffer, len);
+    req.len = (uint16_t)(len + off);
+
+    ctrl_fwd_cache_store(ctrl_fwd_itf, req.report_id, req.report_type, req.data + off, (uint16_t)len);
+    ctrl_fwd_submit(&req);
+    return UX_SUCCESS;
+}
+
+static UINT ctrl_fwd_get_report_cb(UX_SLAVE_CLASS_HID *hid, UX_SLAVE_CLASS_HID_EVENT *event)
+{
+    cf_request_t req;
+    uint16_t n;
+
+    (void)hid;
+    req.kind = CF_KIND_GET_REPORT;
+    req.report_id = (uint8_t)event->ux_device_class_hid_event_report_id;
+    req.report_type = (uint8_t)event->ux_device_class_hid_event_report_type;
+    req.value = 0;
+    req.len = (uint16_t)(UX_DEVICE_CLASS_HID_EVENT_BUFFER_LENGTH + (req.report_id ? 1 : 0));
+    if (req.len > CF_MAX_PAYLOAD)
+        req.len = CF_MAX_PAYLOAD;
+
+    /* Answer from the cache now, refresh it from the physical device in the background */
+    n = ctrl_fwd_cache_load(ctrl_fwd_itf, req.report_id, req.report_type,
+                            event->ux_device_class_hid_event_buffer, UX_DEVICE_CLASS_HID_EVENT_BUFFER_LENGTH);
+    event->ux_device_class_hid_event_length = n;
+    ctrl_fwd_submit(&req);
+
+    return n ? UX_SUCCESS : UX_ERROR;
+}
+
+static VOID ctrl_fwd_out_report_cb(UX_SLAVE_CLASS_HID *hid)
+{
+    UX_DEVICE_CLASS_HID_RECEIVED_EVENT event;
+    cf_request_t req;
+
+    while (ux_device_class_hid_receiver_event_get(hid, &event) == UX_SUCCESS)
+    {
+        ULONG len = event.ux_device_class_hid_received_event_length;
+        if (len > CF_MAX_PAYLOAD)
+            len = CF_MAX_PAYLOAD;
+
+        req.kind = CF_KIND_OUT_REPORT;
+        req.report_id = 0;
+        req.report_type = UX_DEVICE_CLASS_HID_REPORT_TYPE_OUTPUT;
+        req.value = 0;
+        req.len = (uint16_t)len;
+        ux_utility_memory_copy(req.data, event.ux_device_class_hid_received_event_data, len);
+        ux_device_class_hid_receiver_event_free(hid);
+
+        ctrl_fwd_submit(&req);
+    }
+}
+
+VOID ctrl_fwd_hid_parameter_init(UX_SLAVE_CLASS_HID_PARAMETER *hid_param)
+{
+    hid_param->ux_slave_class_hid_instance_activate = ctrl_fwd_pc_activate;
+    hid_param->ux_slave_class_hid_instance_deactivate = ctrl_fwd_pc_deactivate;
+    hid_param->ux_device_class_hid_parameter_callback = ctrl_fwd_set_report_cb;
+    hid_param->ux_device_class_hid_parameter_get_callback = ctrl_fwd_get_report_cb;
+#if defined(UX_DEVICE_CLASS_HID_INTERRUPT_OUT_SUPPORT)
+    hid_param->ux_device_class_hid_parameter_receiver_initialize = ux_device_class_hid_receiver_initialize;
+    hid_param->ux_device_class_hid_parameter_receiver_event_max_number = 4;
+    hid_param->ux_device_class_hid_parameter_receiver_event_max_length = CF_MAX_PAYLOAD;
+    hid_param->ux_device_class_hid_parameter_receiver_event_callback = ctrl_fwd_out_report_cb;
+#endif
+}
+
+/* USBX consumes SET_IDLE/SET_PROTOCOL itself; pick the new values up and pass them on. */
+static VOID ctrl_fwd_poll_pc_state(VOID)
+{
+    UX_SLAVE_CLASS_HID *hid = ctrl_fwd_pc_hid;
+    cf_request_t req;
+
+    if (hid == UX_NULL)
+        return;
+
+    if (hid->ux_device_class_hid_event_idle_rate != ctrl_fwd_idle_seen)
+    {
+        ctrl_fwd_idle_seen = hid->ux_device_class_hid_event_idle_rate;
+        req.kind = CF_KIND_SET_IDLE;
+        req.report_id = 0;
+        req.report_type = 0;
+        req.value = (uint16_t)ctrl_fwd_idle_seen;
+        req.len = 0;
+        ctrl_fwd_submit(&req);
+    }
+
+    if (hid->ux_device_class_hid_protocol != ctrl_fwd_protocol_seen)
+    {
+        ctrl_fwd_protocol_seen = hid->ux_device_class_hid_protocol;
+        req.kind = CF_KIND_SET_PROTOCOL;
+        req.report_id = 0;
+        req.report_type = 0;
+        req.value = (uint16_t)ctrl_fwd_protocol_seen;
+        req.len = 0;
+        ctrl_fwd_submit(&req);
+    }
+}
+
+/******** Physical device side *********/
+static UINT ctrl_fwd_execute(const cf_request_t *req)
+{
+    UCHAR setup[8];
+    ULONG actual = 0;
+    ULONG wValue, wIndex, wLength;
+    UINT status;
+
+    cf_build_setup(req, setup);
+    wValue  = (ULONG)(setup[2] | (setup[3] << 8));
+    wIndex  = (ULONG)(setup[4] | (setup[5] << 8));
+    wLength = (ULONG)(setup[6] | (setup[7] << 8));
+
+    if (req->kind == CF_KIND_GET_REPORT)
+        ux_utility_memory_set(ctrl_fwd_buf, 0, sizeof(ctrl_fwd_buf));
+    else if (wLength)
+        ux_utility_memory_copy(ctrl_fwd_buf, (VOID *)req->data, wLength);
+
+    /* Output reports go over EP0 as SET_REPORT(Output): the host HID class keeps no OUT pipe open */
+    status = usbx_host_control_transfer(ctrl_fwd_device, setup[0], setup[1], wValue, wIndex,
+                                        wLength ? ctrl_fwd_buf : UX_NULL, wLength, &actual);
+
+    if (status == UX_SUCCESS && req->kind == CF_KIND_GET_REPORT)
+    {
+        UCHAR *data = ctrl_fwd_buf;
+        if (req->report_id && actual > 0 && data[0] == req->report_id)
+        {
+            data++;
+            actual--;
+        }
+        ctrl_fwd_cache_store(req->itf, req->report_id, req->report_type, data, (uint16_t)actual);
+    }
+    return status;
+}
+
+static VOID ctrl_fwd_dump_stats(VOID)
+{
+    int k;
+    for (k = 0; k < CF_KIND_COUNT; k++)
+    {
+        const cf_kind_stats_t *st = cf_stats((cf_kind_t)k);
+        if (st->submitted == 0)
+            continue;
+        PRINTF("[FWD] %s sub=%lu ok=%lu fail=%lu drop=%lu coal=%lu late=%lu max=%luus (budget %luus)\n",
+               ctrl_fwd_kind_names[k], st->submitted, st->completed, st->failed, st->dropped,
+               st->coalesced, st->over_budget, st->max_us, cf_budget_us((cf_kind_t)k));
+    }
+}
+
+static VOID ctrl_fwd_thread_entry(ULONG arg)
+{
+    cf_request_t req;
+    (void)arg;
+
+    while (1)
+    {
+        /* Submissions wake the thread at once; the poll keeps its own cadence */
+        if (!hrt_pending(&ctrl_fwd_poll))
+            hrt_semaphore_at(&ctrl_fwd_poll, hrt_now_us() + CTRL_FWD_POLL_US, &ctrl_fwd_sem);
+        tx_semaphore_get(&ctrl_fwd_sem, TX_WAIT_FOREVER);
+        ctrl_fwd_poll_pc_state();
+
+        if (ctrl_fwd_device == UX_NULL)
+            continue;
+
+        while (cf_take(&req, hrt_now_us()))
+        {
+            UINT status = ctrl_fwd_execute(&req);
+            cf_complete(&req, status == UX_SUCCESS, hrt_now_us());
+        }
+    }
+}
+
+UINT ctrl_fwd_create(void)
+{
+    UINT status;
+
+    cf_init();
+
+    status = tx_semaphore_create(&ctrl_fwd_sem, "ctrl_fwd", 0);
+    if (status)
+        return status;
+
+    return tx_thread_create(&ctrl_fwd_thread, "ctrl_fwd_thread", ctrl_fwd_thread_entry, 0,
+                            ctrl_fwd_stack, CTRL_FWD_STACK_SIZE,
+                            CTRL_FWD_PRIORITY, CTRL_FWD_PRIORITY, TX_NO_TIME_SLICE, TX_AUTO_START);
+}
+
+VOID ctrl_fwd_attach(UX_DEVICE *device, UCHAR interface_number)
+{
+    ctrl_fwd_itf = interface_number;
+    ctrl_fwd_device = device;
+    PRINTF("Forwarding PC control requests to interface %u\n", interface_number);
+}
+
+VOID ctrl_fwd_detach(VOID)
+{
+    ctrl_fwd_device = UX_NULL;
+    ctrl_fwd_dump_stats();
+}
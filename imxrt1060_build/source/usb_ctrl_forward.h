@@ -0,0 +1,26 @@
+#ifndef USB_CTRL_FORWARD_H
+#define USB_CTRL_FORWARD_H
+
+#include "ux_api.h"
+#include "ux_device_class_hid.h"
+#include "tx_api.h"
+#include "ctrl_forward.h"
+
+#define CTRL_FWD_STACK_SIZE   (2048)
+#define CTRL_FWD_PRIORITY     18     /* Above clone_thread so it is never starved */
+#define CTRL_FWD_POLL_US      20000  /* SET_IDLE/SET_PROTOCOL are only visible by polling */
+
+/* Create the forwarding thread. Call from tx_application_define(). */
+UINT ctrl_fwd_create(void);
+
+/* Physical device that receives the forwarded requests. */
+VOID ctrl_fwd_attach(UX_DEVICE *device, UCHAR interface_number);
+VOID ctrl_fwd_detach(VOID);
+
+/* Hook the PC-facing HID class: fills the SET/GET report callbacks and the interrupt OUT receiver. */
+VOID ctrl_fwd_hid_parameter_init(UX_SLAVE_CLASS_HID_PARAMETER *hid_param);
+
+/* PC-facing HID instance, UX_NULL while the PC has not configured it. */
+UX_SLAVE_CLASS_HID *ctrl_fwd_pc_hid_get(VOID);
+
+#endif /* USB_CTRL_FORWARD_H */
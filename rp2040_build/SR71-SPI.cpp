@@ -2,10 +2,33 @@
 #include <string.h>
 #include "pico/stdlib.h"
 #include "pico/time.h"
+#include "pico/multicore.h"
+#include "pico/mutex.h"
+#include "pico/flash.h"
 #include "hardware/uart.h"
-#include "adafruit_max3421e.h"
+#include "hardware/clocks.h"
+#include "control_forward.h"
+#include "hid_passthrough.h"
+#include "desc_store.h"
+#include "core_util.h"
+#include "spsc_ring.h"
+#include "sched_timer.h"
+#include "usb_descriptors.h"
+#include "placement_bench.h"
+#include "kmbox_control.h"
+#include "net_control.h"
+#include "uart_control.h"
 #include "tusb_config.h"
 #include "tusb.h"
+#include "host_descriptors.h"
+#if SR71_HOST_PIO_USB
+#include "host_pio_usb.h"
+#define HOST_BACKEND_NAME "PIO-USB"
+#else
+#include "adafruit_max3421e.h"
+#include "max3241e_hcd.h"
+#define HOST_BACKEND_NAME "MAX3421E"
+#endif
 
 // Debug UART Configuration
 #define DEBUG_UART_ID uart0
@@ -23,6 +46,41 @@
 #define LED_DELAY_MS 250
 #endif
 
+// Host-side recovery: enumeration gives up after HOST_ENUM_TIMEOUT_MS, and
+// retries back off from HOST_RETRY_MIN_MS to HOST_RETRY_MAX_MS while they
+// keep failing. A device that only needed a second try is back within one
+// USB reset time.
+#define HOST_ENUM_TIMEOUT_MS 5000
+#define HOST_RETRY_MIN_MS    10
+#define HOST_RETRY_MAX_MS    1000
+#define HOST_WAIT_LOG_MS     1000
+
+// Longest core1 sleeps in WFE without an event. Everything it waits for
+// raises an interrupt (MAX3421E INT, the PIO-USB SOF alarm) or an SEV from
+// core0; this only bounds the cost of a missed wake-up.
+#define CORE1_IDLE_MAX_US    1000
+
+// Bench mode: measure MAX3421E SPI throughput at boot, then report the live
+// SPI transaction rate every MAX3421E_BENCH_PERIOD_MS
+#if !defined(MAX3421E_BENCH) || SR71_HOST_PIO_USB
+#undef MAX3421E_BENCH
+#define MAX3421E_BENCH 0
+#endif
+#define MAX3421E_BENCH_PERIOD_MS 5000
+
+// Placement bench: time the per-report path at boot with the XIP cache warm
+// and flushed. Compare builds with SR71_RAM_HOT_PATH ON and OFF.
+#ifndef PLACEMENT_BENCH
+#define PLACEMENT_BENCH 0
+#endif
+
+// Per-core utilization and report timing on the debug UART. Build once per
+// host backend and compare these lines to benchmark one against the other.
+#ifndef CORE_UTIL_REPORT
+#define CORE_UTIL_REPORT 1
+#endif
+#define CORE_UTIL_REPORT_MS 5000
+
 // Global state enum
 typedef enum {
     STATE_WAIT_FOR_DEVICE,
@@ -42,8 +100,55 @@ static char manufacturer[MAX_STRING_LEN] = "Unknown";
 static char product[MAX_STRING_LEN] = "USB Proxy";
 static char serial[MAX_STRING_LEN] = "0001";
 
+#if !SR71_HOST_PIO_USB
 // Temporary buffer for string processing (UTF-16LE data)
 static uint16_t string_buffer[STRING_DESC_BUF_SIZE / 2];
+#endif
+
+// Descriptor cache: a record is staged during enumeration and saved once the
+// HID report descriptor arrives. A cached clone is presented at power-up and
+// checked against the real device when it mounts. Records are keyed by
+// VID/PID/bcdDevice, and only the attached device's own record is ever dropped.
+static dc_record_t staged_record;
+static bool staged_valid = false;
+static const dc_record_t* presented_record = NULL;
+static bool boot_cache_hit = false;
+static bool layout_changed = false;
+static bool presented_stale = false;  // Presented record is the changed device's own
+
+// Core1 owns the MAX3421E, the host stack and the enumeration state machine;
+// core0 owns the device stack. Core1 tells core0 when to (dis)connect from
+// the PC through this ring; reports have their own ring in hid_passthrough.
+typedef enum {
+    CORE_EVENT_DESCRIPTORS_READY = 1,  // Enumeration done: connect to the PC
+    CORE_EVENT_LAYOUT_CHANGED          // Drop off the bus until re-enumerated
+} core_event_t;
+
+#define CORE_EVENT_DEPTH 8
+static uint32_t core_event_buf[CORE_EVENT_DEPTH];
+static spsc_ring_t core_events;
+
+static proxy_state_t state = STATE_WAIT_FOR_DEVICE;   // core1
+static bool host_up = false;                          // core1
+static bool host_started = false;                     // core1
+static bool device_started = false;                   // core0
+
+static core_util_t util_core0;
+static core_util_t util_core1;
+
+// Waits are timer continuations on the owning core's scheduler, run from
+// its main loop. Nothing on either core sleeps.
+static sched_t sched_core0;
+static sched_t sched_core1;
+
+static sched_timer_t led_timer;         // core0
+static sched_timer_t enum_timer;        // core1
+static sched_timer_t retry_timer;       // core1
+static sched_timer_t wait_log_timer;    // core1
+static uint32_t retry_ms = HOST_RETRY_MIN_MS;
+
+// Time-to-first-report instrumentation (microseconds since power-up)
+static uint64_t pc_mount_us = 0;
 
 //-----------------------------------------------------------------
 // Debugging Utilities (UART Only)
@@ -61,6 +166,9 @@ void init_debug_uart() {
     uart_puts(DEBUG_UART_ID, "UART initialized at 115200 baud\n");
 }
 
+// Both cores print; lines are formatted first and only the UART write is serialized
+auto_init_mutex(debug_uart_mutex);
+
 void debug_print(const char* format, ...) {
     char buffer[256];
     va_list args;
@@ -69,11 +177,14 @@ void debug_print(const char* format, ...) {
     va_end(args);
     
     // Print to UART only (not USB)
+    mutex_enter_blocking(&debug_uart_mutex);
     uart_puts(DEBUG_UART_ID, buffer);
+    mutex_exit(&debug_uart_mutex);
 }
 
 void print_hex_dump(const char* label, const uint8_t* data, size_t len) {
     char buffer[64];
+    mutex_enter_blocking(&debug_uart_mutex);
     snprintf(buffer, sizeof(buffer), "[HEX] %s (%d bytes):\n", label, len);
     uart_puts(DEBUG_UART_ID, buffer);
     
@@ -84,6 +195,7 @@ void print_hex_dump(const char* label, const uint8_t* data, size_t len) {
             uart_puts(DEBUG_UART_ID, "\n");
         }
     }
+    mutex_exit(&debug_uart_mutex);
 }
 
 //-----------------------------------------------------------------
@@ -106,6 +218,17 @@ void pico_set_led(bool led_on) {
 #endif
 }
 
+static void led_off(void* ctx) {
+    (void) ctx;
+    pico_set_led(false);
+}
+
+// Light the LED for LED_DELAY_MS without holding up the caller (core0)
+static void pico_blink_led(void) {
+    pico_set_led(true);
+    sched_at(&sched_core0, &led_timer, time_us_32() + LED_DELAY_MS * 1000, led_off, NULL);
+}
+
 // Convert UTF-16LE string descriptor to UTF-8
 static void utf16_to_utf8(const uint16_t *utf16, size_t utf16_len, char *utf8, size_t utf8_size) {
     size_t i, j = 0;
@@ -128,37 +251,564 @@ static void utf16_to_utf8(const uint16_t *utf16, size_t utf16_len, char *utf8, s
     utf8[j] = '\0';
 }
 
-// Process string descriptor from device: read from MAX3421E, convert UTF-16LE to UTF-8.
-static bool process_string_descriptor(Adafruit_MAX3421E &max3421e, uint8_t index, char *buffer, size_t buf_size) {
-    debug_print("Reading string descriptor %d...\n", index);
-    
+//-----------------------------------------------------------------
+// Host controller backend
+//-----------------------------------------------------------------
+// What TinyUSB read while mounting the device (host_descriptors)
+static bool stack_read_descriptors(void) {
+    size_t len;
+    const uint8_t* dev = host_desc_device(&len);
+    device_desc_len = len < sizeof(device_descriptor) ? len : sizeof(device_descriptor);
+    memcpy(device_descriptor, dev, device_desc_len);
+
+    const uint8_t* cfg = host_desc_config(&len);
+    if (len == 0) {
+        debug_print("No configuration descriptor captured!\n");
+        return false;
+    }
+    config_desc_len = len < sizeof(config_descriptor) ? len : sizeof(config_descriptor);
+    memcpy(config_descriptor, cfg, config_desc_len);
+    return true;
+}
+
+static const uint16_t* stack_read_string(dc_string_t slot, uint8_t index) {
+    const uint16_t* desc = host_desc_string((uint8_t)slot);
+    if (!desc) debug_print("String descriptor %d not captured\n", index);
+    return desc;
+}
+
+#if SR71_HOST_PIO_USB
+// Nothing to reset
+static uint32_t host_prepare(void) {
+    return 0;
+}
+
+// TinyUSB enumerates the device itself and host_descriptors keeps what it read
+static bool host_begin(void) {
+    host_pio_usb_init();
+    return true;
+}
+
+static bool host_connected(void) {
+    return host_desc_mounted();
+}
+
+static bool host_descriptors_ready(void) {
+    return host_desc_ready();
+}
+
+static bool host_read_descriptors(void) {
+    return stack_read_descriptors();
+}
+
+static const uint16_t* host_read_string(dc_string_t slot, uint8_t index) {
+    return stack_read_string(slot, index);
+}
+
+// PIO USB runs off its own 1 ms timer interrupt; tuh_task() does the rest
+static bool host_task(void) {
+    return false;
+}
+#else
+static Adafruit_MAX3421E* host_drv = NULL;
+
+// Put the chip in reset; host_begin() runs once the returned time is up
+static uint32_t host_prepare(void) {
+    // Initialize MAX3421E instance with SPI port, CS, INT, and RESET pins.
+    // Done here so its GPIO and DMA interrupts are taken on this core.
+    static Adafruit_MAX3421E max3421e(SPI_PORT, PIN_CS, MAX3421E_INT_PIN, MAX3421E_RESET_PIN);
+    host_drv = &max3421e;
+    max3421e.holdReset();
+    return MAX3421E_RESET_HOLD_US;
+}
+
+static bool host_begin(void) {
+    debug_print("Initializing MAX3421E...\n");
+    debug_print("  SPI Port: %d\n", SPI_PORT);
+    debug_print("  CS Pin: %d\n", PIN_CS);
+    debug_print("  INT Pin: %d\n", MAX3421E_INT_PIN);
+    debug_print("  RESET Pin: %d\n", MAX3421E_RESET_PIN);
+
+    Adafruit_MAX3421E& max3421e = *host_drv;
+    if (max3421e.begin() != MAX3421E_OK) {
+        debug_print("MAX3421E initialization failed!\n");
+        return false;
+    }
+    debug_print("MAX3421E initialized successfully\n");
+    // TinyUSB's host side drives the same chip through this instance
+    max3421e_hcd_bind(&max3421e);
+
+    // begin() already reset the chip; another reset here would drop the
+    // full-duplex SPI and INT configuration it just wrote.
+    debug_print("  SPI clock: %lu Hz\n", max3421e.spiHz());
+    return true;
+}
+
+static bool host_connected(void) {
+    return host_drv->deviceConnected();
+}
+
+// Descriptors are read straight through the chip until TinyUSB owns it.
+// After that a bus reset and raw transfers would put the device back at
+// address 0 behind the stack's back, so they come from the stack instead.
+static bool host_descriptors_ready(void) {
+    return !host_started || host_desc_ready();
+}
+
+static bool host_read_descriptors(void) {
+    if (host_started) return stack_read_descriptors();
+
+    // Step 1: Reset the USB bus via MAX3421E
+    debug_print("Resetting USB bus...\n");
+    if (host_drv->resetBus() != MAX3421E_OK) {
+        debug_print("Bus reset failed!\n");
+        return false;
+    }
+    debug_print("Bus reset successful\n");
+
+    // Step 2: Read device descriptor
+    debug_print("Reading device descriptor...\n");
+    if (host_drv->readDeviceDescriptor(device_descriptor, sizeof(device_descriptor), &device_desc_len) != MAX3421E_OK) {
+        debug_print("Failed to read device descriptor!\n");
+        return false;
+    }
+
+    // Step 3: Read configuration descriptor
+    debug_print("Reading configuration descriptor...\n");
+    if (host_drv->readConfigDescriptor(config_descriptor, sizeof(config_descriptor), &config_desc_len) != MAX3421E_OK) {
+        debug_print("Failed to read configuration descriptor!\n");
+        return false;
+    }
+    return true;
+}
+
+static const uint16_t* host_read_string(dc_string_t slot, uint8_t index) {
+    if (host_started) return stack_read_string(slot, index);
     size_t bytes_read = 0;
-    max3421e_err_t err = max3421e.readStringDescriptor(index, string_buffer, sizeof(string_buffer), &bytes_read);
+    max3421e_err_t err = host_drv->readStringDescriptor(index, string_buffer, sizeof(string_buffer), &bytes_read);
     if (err != MAX3421E_OK) {
         debug_print("Error reading string descriptor %d: %d\n", index, err);
-        return false;
+        return NULL;
     }
     if (bytes_read < 2) {
         debug_print("String descriptor %d too short: %d bytes\n", index, bytes_read);
-        return false;
+        return NULL;
     }
+    return string_buffer;
+}
+
+// Service INT and run the transfers due, through the HCD once TinyUSB owns the chip
+static bool host_task(void) {
+    if (host_started) return max3421e_hcd_task();
+    host_drv->task();
+    return false;
+}
+#endif
+
+// Process string descriptor from device: read it through the backend, convert UTF-16LE to UTF-8.
+// index is the one the device descriptor gives for this slot; 0 means it has none.
+static bool process_string_descriptor(dc_string_t slot, uint8_t index, char *buffer, size_t buf_size) {
+    if (index == 0) return false;
+    debug_print("Reading string descriptor %d...\n", index);
+    
+    const uint16_t* desc = host_read_string(slot, index);
+    if (!desc) return false;
     
     // First 16-bit word holds the total length (in bytes)
-    uint8_t desc_len = string_buffer[0] & 0xFF;
+    uint8_t desc_len = desc[0] & 0xFF;
     if (desc_len < 2 || ((desc_len - 2) / 2) > MAX_STRING_LEN) {
         debug_print("Invalid string descriptor length %d for index %d\n", desc_len, index);
         return false;
     }
     
-    utf16_to_utf8(string_buffer, (desc_len) / 2, buffer, buf_size);
+    utf16_to_utf8(desc, (desc_len) / 2, buffer, buf_size);
     debug_print("String descriptor %d: '%s'\n", index, buffer);
+    if (staged_valid) {
+        dc_set_string(&staged_record, slot, (const uint8_t*)desc, desc_len);
+    }
     return true;
 }
 
 //-----------------------------------------------------------------
-// Main Application
+// Descriptor Cache
+//-----------------------------------------------------------------
+static void start_host_stack(void) {
+    if (host_started) return;
+    // Boot protocol reports would not match the descriptor handed to the PC
+    tuh_hid_set_default_protocol(HID_PROTOCOL_REPORT);
+    tuh_init(BOARD_TUH_RHPORT);
+    host_started = true;
+}
+
+static void start_device_stack(void) {
+    if (device_started) return;
+    tud_init(BOARD_TUD_RHPORT);
+    device_started = true;
+}
+
+// Load the last cloned device from flash so the PC sees it without waiting
+// for the physical device to enumerate.
+static bool present_cached_descriptors(void) {
+    const dc_record_t* rec = desc_store_latest();
+    if (!rec) {
+        debug_print("[CACHE] No cached descriptors, enumerating first\n");
+        return false;
+    }
+
+    memcpy(device_descriptor, rec->device, DC_DEVICE_LEN);
+    device_desc_len = DC_DEVICE_LEN;
+    config_desc_len = rec->hdr.config_len < sizeof(config_descriptor) ? rec->hdr.config_len : sizeof(config_descriptor);
+    memcpy(config_descriptor, rec->config, config_desc_len);
+
+    char* const strings[DC_STRINGS] = { manufacturer, product, serial };
+    for (int i = 0; i < DC_STRINGS; i++) {
+        if (rec->hdr.string_len[i] >= 2) {
+            utf16_to_utf8(reinterpret_cast<const uint16_t*>(rec->strings[i]), rec->hdr.string_len[i] / 2,
+                          strings[i], MAX_STRING_LEN);
+        }
+    }
+    hid_passthrough_preload(rec->report, rec->hdr.report_len);
+    usb_descriptors_clone(rec);
+
+    presented_record = rec;
+    debug_print("[CACHE] Presenting %04x:%04x bcd %04x (%s) from flash\n",
+                rec->hdr.vid, rec->hdr.pid, rec->hdr.bcd_device, product);
+    return true;
+}
+
+// Cached record of the device at dev_addr, or NULL
+static const dc_record_t* descriptor_cache_find(uint8_t dev_addr) {
+    tusb_desc_device_t dev;
+    if (!tuh_descriptor_get_device_local(dev_addr, &dev)) return NULL;
+    return desc_store_find(dev.idVendor, dev.idProduct, dev.bcdDevice);
+}
+
+// Called for the presented HID instance: validate the clone the PC is
+// already using, or finish and save the record staged by enumeration.
+static void descriptor_cache_update(uint8_t dev_addr, uint8_t const* desc_report, uint16_t desc_len) {
+    tusb_desc_device_t dev;
+    if (!tuh_descriptor_get_device_local(dev_addr, &dev)) return;
+
+    if (presented_record) {
+        // A different report layout is caught by hid_passthrough_mount(); a
+        // different device with the same layout keeps the presented identity,
+        // and its own record (if any) is left alone
+        if (descriptor_cache_find(dev_addr) == presented_record) {
+            debug_print("[CACHE] Cached descriptors match the attached device\n");
+        } else {
+            debug_print("[CACHE] Attached %04x:%04x shares the cached report layout, keeping the presented clone\n",
+                        dev.idVendor, dev.idProduct);
+        }
+        return;
+    }
+
+    if (staged_valid) {
+        dc_set_report(&staged_record, desc_report, desc_len);
+        desc_store_save(&staged_record);
+        staged_valid = false;
+    }
+}
+
+//-----------------------------------------------------------------
+// Core1: MAX3421E and host stack
 //-----------------------------------------------------------------
+static void post_core_event(core_event_t ev) {
+    uint32_t e = ev;
+    if (!spsc_push(&core_events, &e)) {
+        debug_print("[CORE] Event %lu lost, core0 not draining\n", e);
+    }
+}
+
+static void enter_state(proxy_state_t next);
+
+static void enum_timeout(void* ctx) {
+    (void) ctx;
+    debug_print("Enumeration timeout after %d ms\n", HOST_ENUM_TIMEOUT_MS);
+    enter_state(STATE_ERROR);
+}
+
+static void retry_host(void* ctx) {
+    (void) ctx;
+    enter_state(STATE_WAIT_FOR_DEVICE);
+}
+
+static void wait_log(void* ctx) {
+    (void) ctx;
+    debug_print("Waiting for device...\n");
+    sched_at(&sched_core1, &wait_log_timer, time_us_32() + HOST_WAIT_LOG_MS * 1000, wait_log, NULL);
+}
+
+// State changes arm and cancel the timers that bound each state, so no
+// state has to poll the clock
+static void enter_state(proxy_state_t next) {
+    uint32_t now = time_us_32();
+    state = next;
+
+    if (next == STATE_ENUMERATE) {
+        sched_at(&sched_core1, &enum_timer, now + HOST_ENUM_TIMEOUT_MS * 1000, enum_timeout, NULL);
+    } else {
+        sched_cancel(&sched_core1, &enum_timer);
+    }
+
+    if (next == STATE_WAIT_FOR_DEVICE) {
+        sched_at(&sched_core1, &wait_log_timer, now + HOST_WAIT_LOG_MS * 1000, wait_log, NULL);
+    } else {
+        sched_cancel(&sched_core1, &wait_log_timer);
+    }
+
+    if (next == STATE_ERROR) {
+        debug_print("Error state entered, retrying in %lu ms\n", retry_ms);
+        sched_at(&sched_core1, &retry_timer, now + retry_ms * 1000, retry_host, NULL);
+        retry_ms = retry_ms * 2 > HOST_RETRY_MAX_MS ? HOST_RETRY_MAX_MS : retry_ms * 2;
+    } else if (next == STATE_PROXY_READY) {
+        retry_ms = HOST_RETRY_MIN_MS;
+    }
+}
+
+// One step of the enumeration state machine. Returns true if it did work.
+static bool host_state_step(void) {
+    static bool clone_pending = false;
+
+    // The PC reads the report descriptor's length out of the configuration,
+    // so it cannot be shown one before the device's report descriptor is in
+    if (clone_pending && hid_passthrough_active()) {
+        clone_pending = false;
+        post_core_event(CORE_EVENT_DESCRIPTORS_READY);
+    }
+
+    if (layout_changed) {
+        // The PC holds a report layout the new device does not speak:
+        // drop the clone and enumerate the new device properly. TinyUSB has
+        // already mounted it, so its descriptors come from the stack. The
+        // record is only wrong if it is the new device's own; another
+        // device's stays cached, and enumeration saves the new one under its
+        // own key.
+        layout_changed = false;
+        if (presented_stale) desc_store_invalidate(presented_record);
+        presented_stale = false;
+        presented_record = NULL;
+        post_core_event(CORE_EVENT_LAYOUT_CHANGED);
+        enter_state(STATE_ENUMERATE);
+    }
+
+    switch (state) {
+        case STATE_WAIT_FOR_DEVICE:
+            if (host_connected() && (presented_record || hid_passthrough_report_descriptor(NULL))) {
+                // The PC already has a clone. Leave it enumerated and let the host
+                // stack attach the device; hid_passthrough_mount() checks the layout
+                debug_print("Device connected detected, reattaching behind the presented clone...\n");
+                enter_state(STATE_PROXY_READY);
+                return true;
+            } else if (host_connected()) {
+                debug_print("Device connected detected, starting enumeration...\n");
+                enter_state(STATE_ENUMERATE);
+                return true;
+            }
+            return false;
+
+        case STATE_ENUMERATE: {
+            // Once the host stack runs it reads them while mounting; wait for that
+            if (!host_descriptors_ready()) return false;
+
+            debug_print("Starting enumeration process...\n");
+            if (!host_read_descriptors()) {
+                enter_state(STATE_ERROR);
+                return true;
+            }
+            print_hex_dump("Device Descriptor", device_descriptor, device_desc_len);
+            dc_begin(&staged_record, device_descriptor, (uint16_t)device_desc_len);
+            staged_valid = true;
+            print_hex_dump("Config Descriptor", config_descriptor, config_desc_len);
+            dc_set_config(&staged_record, config_descriptor, (uint16_t)config_desc_len);
+
+            // Step 4: Read string descriptors (best effort), under the device's own indices
+            debug_print("Reading string descriptors...\n");
+            const tusb_desc_device_t* dev = reinterpret_cast<const tusb_desc_device_t*>(device_descriptor);
+            if (!process_string_descriptor(DC_STRING_MANUFACTURER, dev->iManufacturer, manufacturer, sizeof(manufacturer))) {
+                strcpy(manufacturer, "Unknown");
+            }
+            if (!process_string_descriptor(DC_STRING_PRODUCT, dev->iProduct, product, sizeof(product))) {
+                strcpy(product, "Unknown");
+            }
+            if (!process_string_descriptor(DC_STRING_SERIAL, dev->iSerialNumber, serial, sizeof(serial))) {
+                strcpy(serial, "0000");
+            }
+
+            debug_print("Enumeration complete:\n");
+            debug_print("  Manufacturer: %s\n", manufacturer);
+            debug_print("  Product: %s\n", product);
+            debug_print("  Serial: %s\n", serial);
+
+            // Report descriptor is already known if the host stack mounted the device first
+            if (hid_passthrough_active()) {
+                uint16_t report_len = 0;
+                uint8_t const* report = hid_passthrough_report_descriptor(&report_len);
+                dc_set_report(&staged_record, report, report_len);
+                desc_store_save(&staged_record);
+                staged_valid = false;
+            }
+
+            // Core0 clones the descriptors and connects once the host stack
+            // has the HID report descriptor too (see the top of this function)
+            debug_print("Initializing TinyUSB host stack...\n");
+            start_host_stack();
+            clone_pending = true;
+            enter_state(STATE_PROXY_READY);
+            debug_print("Proxy ready for operation\n");
+            return true;
+        }
+
+        case STATE_PROXY_READY:
+            // If the device is disconnected, go back to waiting for a device.
+            // The presented descriptors are kept so the PC stays enumerated across a swap.
+            if (!host_connected()) {
+                debug_print("Device disconnected, returning to wait state\n");
+                enter_state(STATE_WAIT_FOR_DEVICE);
+                return true;
+            }
+            return false;
+
+        case STATE_ERROR:
+            // retry_timer moves on to STATE_WAIT_FOR_DEVICE
+            return false;
+    }
+    return false;
+}
+
+#if MAX3421E_BENCH
+static sched_timer_t bench_timer;       // core1
+
+static void bench_report(void* ctx) {
+    (void) ctx;
+    const max3421e_stats_t& st = host_drv->stats();
+    debug_print("[BENCH] %lu SPI transactions/s (%lu bytes, %lu DMA, %lu INT edges)\n",
+                st.transactions * 1000 / MAX3421E_BENCH_PERIOD_MS, st.bytes,
+                st.dma_transfers, st.int_edges);
+    max3421e_hcd_print_stats();
+    host_drv->resetStats();
+    sched_at(&sched_core1, &bench_timer, time_us_32() + MAX3421E_BENCH_PERIOD_MS * 1000, bench_report, NULL);
+}
+#endif
+
+// Runs once the controller has been held in reset long enough
+static void host_start(void* ctx) {
+    (void) ctx;
+    if (!host_begin()) return;
+
+#if MAX3421E_BENCH
+    max3421e_bench_t bench;
+    host_drv->bench(1000, &bench);
+    debug_print("[BENCH] SPI %lu Hz: %lu transactions/s, %lu bytes/s\n",
+                bench.spi_hz, bench.transactions_per_s, bench.bytes_per_s);
+    debug_print("[BENCH] HID report: %lu ns SPI time (%u transactions, %u bytes)\n",
+                bench.report_ns, bench.report_transactions, bench.report_bytes);
+    sched_at(&sched_core1, &bench_timer, time_us_32() + MAX3421E_BENCH_PERIOD_MS * 1000, bench_report, NULL);
+#endif
+
+    // The device side is already up from the cache; enumerate in parallel.
+    // The PIO host only learns of a device through the host stack.
+    if (boot_cache_hit || SR71_HOST_PIO_USB) start_host_stack();
+    host_up = true;
+    enter_state(STATE_WAIT_FOR_DEVICE);
+}
+
+// Nothing to do until the next interrupt, SEV or timer. The wait ends at the
+// next core1 timer, or after CORE1_IDLE_MAX_US if none is due sooner; the
+// SDK arms a hardware alarm for the timeout either way.
+static void core1_idle(void) {
+    uint32_t now = time_us_32();
+    uint32_t wait = CORE1_IDLE_MAX_US;
+    uint32_t due;
+    if (sched_next(&sched_core1, &due)) {
+        int32_t left = (int32_t)(due - now);
+        if (left <= 0) return;
+        if ((uint32_t)left < wait) wait = (uint32_t)left;
+    }
+    best_effort_wfe_or_timeout(delayed_by_us(get_absolute_time(), wait));
+}
+
+static sched_timer_t host_start_timer;  // core1
+
+static void core1_main(void) {
+    core_util_init(&util_core1, "core1 (host)");
+    sched_init(&sched_core1);
+
+    debug_print("Host backend: %s\n", HOST_BACKEND_NAME);
+    sched_at(&sched_core1, &host_start_timer, time_us_32() + host_prepare(), host_start, NULL);
+
+    while (true) {
+        uint32_t loop_start = time_us_32();
+        bool busy = false;
+
+        if (host_up) {
+            busy |= host_task();
+
+            if (host_started) {
+                busy |= tuh_task_event_ready();
+                tuh_task();
+
+                // Replay PC control/OUT requests on the physical device
+                control_forward_task();
+            }
+            busy |= hid_passthrough_host_task();
+
+            busy |= host_state_step();
+        }
+
+        busy |= sched_run(&sched_core1, time_us_32());
+        if (!busy) core1_idle();
+
+        core_util_account(&util_core1, loop_start, busy);
+    }
+}
+
+//-----------------------------------------------------------------
+// Core0: device stack and PC-facing reports
+//-----------------------------------------------------------------
+static bool core0_events(void) {
+    uint32_t ev;
+    bool work = false;
+    while (spsc_pop(&core_events, &ev)) {
+        work = true;
+        switch (ev) {
+            case CORE_EVENT_DESCRIPTORS_READY:
+                // Core1 is done with the staged record until the next
+                // enumeration, which disconnects the PC side first
+                usb_descriptors_clone(&staged_record);
+
+                // Initialize TinyUSB device stack
+                debug_print("Initializing TinyUSB device stack...\n");
+                start_device_stack();
+                tud_connect();
+                break;
+            case CORE_EVENT_LAYOUT_CHANGED:
+                if (device_started) tud_disconnect();
+                break;
+        }
+    }
+    return work;
+}
+
+#if CORE_UTIL_REPORT
+static sched_timer_t util_timer;        // core0
+
+static void util_report(void* ctx) {
+    (void) ctx;
+    core_util_print(&util_core0);
+    core_util_print(&util_core1);
+    hid_passthrough_print_timing(HOST_BACKEND_NAME);
+    net_control_print_stats();
+    uart_control_print_stats();
+    kmbox_control_print_stats();
+    sched_at(&sched_core0, &util_timer, time_us_32() + CORE_UTIL_REPORT_MS * 1000, util_report, NULL);
+}
+#endif
+
 int main() {
+#if SR71_HOST_PIO_USB
+    // PIO USB derives its 12 Mbit/s bit clock from the system clock
+    set_sys_clock_khz(120000, true);
+#endif
     // Initialize only UART for debugging (not USB stdio)
     init_debug_uart();
     
@@ -166,141 +816,66 @@ int main() {
     debug_print("Build date: %s %s\n", __DATE__, __TIME__);
     
     pico_led_init();
+    sched_init(&sched_core0);
+    core_util_init(&util_core0, "core0 (device)");
+    spsc_init(&core_events, core_event_buf, sizeof(uint32_t), CORE_EVENT_DEPTH);
+    hid_passthrough_init();
+    control_forward_init();
+    // Control transports: without a W5500 the network task stays idle, the
+    // UART just listens
+    kmbox_control_init();
+    net_control_init(&sched_core0);
+    uart_control_init();
+
+#if PLACEMENT_BENCH
+    // Flushes the XIP cache, so it has to finish before core1 starts
+    placement_bench_run();
+#endif
 
-    // Initialize MAX3421E instance with SPI port, CS, INT, and RESET pins.
-    debug_print("Initializing MAX3421E...\n");
-    debug_print("  SPI Port: %d\n", SPI_PORT);
-    debug_print("  CS Pin: %d\n", PIN_CS);
-    debug_print("  INT Pin: %d\n", MAX3421E_INT_PIN);
-    debug_print("  RESET Pin: %d\n", MAX3421E_RESET_PIN);
-    
-    Adafruit_MAX3421E max3421e(SPI_PORT, PIN_CS, MAX3421E_INT_PIN, MAX3421E_RESET_PIN);
-    if (max3421e.begin() != MAX3421E_OK) {
-        debug_print("MAX3421E initialization failed!\n");
-        return 1;
+    // Bring the device side up from the cache; core1 enumerates in parallel
+    if (present_cached_descriptors()) {
+        boot_cache_hit = true;
+        start_device_stack();
     }
-    debug_print("MAX3421E initialized successfully\n");
 
-    proxy_state_t state = STATE_WAIT_FOR_DEVICE;
-    absolute_time_t last_state_change = get_absolute_time();
-
-    // Initialize the reset pin for the MAX3421E (if used for hardware reset)
-    debug_print("Performing MAX3421E hardware reset...\n");
-    gpio_init(MAX3421E_RESET_PIN);
-    gpio_set_dir(MAX3421E_RESET_PIN, GPIO_OUT);
-    gpio_put(MAX3421E_RESET_PIN, 1); // Keep reset inactive (high)
-    // Perform a hardware reset: drive low, hold, then drive high
-    gpio_put(MAX3421E_RESET_PIN, 0);
-    sleep_ms(50);
-    gpio_put(MAX3421E_RESET_PIN, 1);
-    sleep_ms(50);
-    debug_print("Hardware reset complete\n");
+    // Descriptor cache writes on core1 park this core while flash is busy.
+    // Set up before launch so the first save cannot find it missing.
+    flash_safe_execute_core_init();
+    multicore_launch_core1(core1_main);
 
     debug_print("Entering main loop...\n");
+#if CORE_UTIL_REPORT
+    sched_at(&sched_core0, &util_timer, time_us_32() + CORE_UTIL_REPORT_MS * 1000, util_report, NULL);
+#endif
 
     while (true) {
-        max3421e.task();
-
-        switch (state) {
-            case STATE_WAIT_FOR_DEVICE:
-                if (max3421e.deviceConnected()) {
-                    debug_print("Device connected detected, starting enumeration...\n");
-                    state = STATE_ENUMERATE;
-                    last_state_change = get_absolute_time();
-                } else {
-                    static absolute_time_t last_print = 0;
-                    if (absolute_time_diff_us(last_print, get_absolute_time()) > 1000000) {
-                        debug_print("Waiting for device...\n");
-                        last_print = get_absolute_time();
-                    }
-                }
-                break;
-
-            case STATE_ENUMERATE: {
-                // Timeout if enumeration takes too long (5 seconds)
-                int64_t elapsed = absolute_time_diff_us(last_state_change, get_absolute_time());
-                if (elapsed > 5000000) {
-                    debug_print("Enumeration timeout after %d ms\n", elapsed / 1000);
-                    state = STATE_ERROR;
-                    break;
-                }
-
-                debug_print("Starting enumeration process...\n");
-
-                // Step 1: Reset the USB bus via MAX3421E
-                debug_print("Resetting USB bus...\n");
-                if (max3421e.resetBus() != MAX3421E_OK) {
-                    debug_print("Bus reset failed!\n");
-                    state = STATE_ERROR;
-                    break;
-                }
-                debug_print("Bus reset successful\n");
-
-                // Step 2: Read device descriptor
-                debug_print("Reading device descriptor...\n");
-                if (max3421e.readDeviceDescriptor(device_descriptor, sizeof(device_descriptor), &device_desc_len) != MAX3421E_OK) {
-                    debug_print("Failed to read device descriptor!\n");
-                    state = STATE_ERROR;
-                    break;
-                }
-                print_hex_dump("Device Descriptor", device_descriptor, device_desc_len);
-
-                // Step 3: Read configuration descriptor
-                debug_print("Reading configuration descriptor...\n");
-                if (max3421e.readConfigDescriptor(config_descriptor, sizeof(config_descriptor), &config_desc_len) != MAX3421E_OK) {
-                    debug_print("Failed to read configuration descriptor!\n");
-                    state = STATE_ERROR;
-                    break;
-                }
-                print_hex_dump("Config Descriptor", config_descriptor, config_desc_len);
-
-                // Step 4: Read string descriptors (best effort)
-                debug_print("Reading string descriptors...\n");
-                if (!process_string_descriptor(max3421e, 1, manufacturer, sizeof(manufacturer))) {
-                    strcpy(manufacturer, "Unknown");
-                }
-                if (!process_string_descriptor(max3421e, 2, product, sizeof(product))) {
-                    strcpy(product, "Unknown");
-                }
-                if (!process_string_descriptor(max3421e, 3, serial, sizeof(serial))) {
-                    strcpy(serial, "0000");
-                }
-
-                debug_print("Enumeration complete:\n");
-                debug_print("  Manufacturer: %s\n", manufacturer);
-                debug_print("  Product: %s\n", product);
-                debug_print("  Serial: %s\n", serial);
-
-                // Initialize TinyUSB device stack
-                debug_print("Initializing TinyUSB device stack...\n");
-                tusb_init();
-                state = STATE_PROXY_READY;
-                debug_print("Proxy ready for operation\n");
-                break;
+        uint32_t loop_start = time_us_32();
+        bool busy = core0_events();
+        busy |= net_control_task();
+        busy |= uart_control_task();
+        busy |= kmbox_control_task();
+
+        if (device_started) {
+            busy |= tud_task_event_ready();
+            tud_task();
+
+            // Send whatever core1 has queued for the PC
+            busy |= hid_passthrough_task();
+
+            static bool ttfr_reported = false;
+            if (!ttfr_reported && hid_passthrough_first_report_us()) {
+                ttfr_reported = true;
+                debug_print("[TTFR] PC mount at %lu ms, first report at %lu ms (descriptor cache %s)\n",
+                            (uint32_t)(pc_mount_us / 1000), (uint32_t)(hid_passthrough_first_report_us() / 1000),
+                            boot_cache_hit ? "hit" : "miss");
             }
-
-            case STATE_PROXY_READY:
-                // Process TinyUSB tasks for device mode
-                tud_task();
-                
-                // If the device is disconnected, go back to waiting for a device.
-                if (!max3421e.deviceConnected()) {
-                    debug_print("Device disconnected, returning to wait state\n");
-                    state = STATE_WAIT_FOR_DEVICE;
-                    device_desc_len = 0;
-                    config_desc_len = 0;
-                }
-                break;
-
-            case STATE_ERROR:
-                debug_print("Error state entered, attempting recovery...\n");
-                // Simple error recovery: wait and retry
-                sleep_ms(1000);
-                state = STATE_WAIT_FOR_DEVICE;
-                break;
         }
 
-        sleep_ms(10);
+        // Core0 keeps polling: the UART DMA ring and the W5500 have no
+        // interrupt to wake it
+        busy |= sched_run(&sched_core0, time_us_32());
+
+        core_util_account(&util_core0, loop_start, busy);
     }
 
     return 0;
@@ -309,55 +884,56 @@ int main() {
 //--------------------------------------------------------------------+
 // TinyUSB Callbacks
 //--------------------------------------------------------------------+
+// tuh_* callbacks run from tuh_task() on core1, tud_* from tud_task() on core0
 void tuh_hid_mount_cb(uint8_t dev_addr, uint8_t instance, uint8_t const* desc_report, uint16_t desc_len) {
-    (void)desc_report;
-    (void)desc_len;
     const char* protocol_str[] = { "None", "Keyboard", "Mouse" };
     uint8_t itf_protocol = tuh_hid_interface_protocol(dev_addr, instance);
     uint16_t vid, pid;
     tuh_vid_pid_get(dev_addr, &vid, &pid);
     debug_print("[%04x:%04x][%u] HID Interface%u mounted, Protocol = %s\n",
            vid, pid, dev_addr, instance, protocol_str[itf_protocol]);
-    if (itf_protocol == HID_ITF_PROTOCOL_KEYBOARD || itf_protocol == HID_ITF_PROTOCOL_MOUSE) {
-        if (!tuh_hid_receive_report(dev_addr, instance)) {
-            debug_print("Failed to receive report\n");
-        }
+    // Every interface runs in report protocol, so gamepads and other
+    // non-boot devices are passed through the same way as mice and keyboards
+    pt_mount_result_t mount = hid_passthrough_mount(dev_addr, instance, desc_report, desc_len);
+    if (mount == PT_MOUNT_IGNORED) return;
+
+    control_forward_attach(dev_addr, instance);
+    if (mount == PT_MOUNT_CHANGED) {
+        debug_print("[HID] Report layout changed, PC has to re-enumerate\n");
+        presented_stale = presented_record && descriptor_cache_find(dev_addr) == presented_record;
+        layout_changed = true;
+        return;
     }
+    descriptor_cache_update(dev_addr, desc_report, desc_len);
 }
 
 void tuh_hid_umount_cb(uint8_t dev_addr, uint8_t instance) {
     debug_print("[%u] HID Interface%u is unmounted\n", dev_addr, instance);
+    hid_passthrough_umount(dev_addr, instance);
+    control_forward_detach(dev_addr, instance);
+#if !SR71_HOST_PIO_USB
+    max3421e_hcd_print_stats();
+#endif
 }
 
 void tud_mount_cb(void) {
     debug_print("Device mounted on host\n");
-    pico_set_led(true);
-    sleep_ms(LED_DELAY_MS);
-    pico_set_led(false);
-    sleep_ms(LED_DELAY_MS);
+    if (pc_mount_us == 0) pc_mount_us = time_us_64();
+    pico_blink_led();
 }
 
 void tud_umount_cb(void) {
     debug_print("Device unmounted from host\n");
-    pico_set_led(true);
-    sleep_ms(LED_DELAY_MS);
-    pico_set_led(false);
-    sleep_ms(LED_DELAY_MS);
+    pico_blink_led();
 }
 
 void tud_suspend_cb(bool remote_wakeup_en) {
     (void) remote_wakeup_en;
     debug_print("Device suspended by host\n");
-    pico_set_led(true);
-    sleep_ms(LED_DELAY_MS);
-    pico_set_led(false);
-    sleep_ms(LED_DELAY_MS);
+    pico_blink_led();
 }
 
 void tud_resume_cb(void) {
     debug_print("Device resumed by host\n");
-    pico_set_led(true);
-    sleep_ms(LED_DELAY_MS);
-    pico_set_led(false);
-    sleep_ms(LED_DELAY_MS);
+    pico_blink_led();
 }
\ No newline at end of file
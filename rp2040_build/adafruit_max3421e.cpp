@@ -1,33 +1,67 @@
 #include "adafruit_max3421e.h"
 #include "hardware/spi.h"
+#include "hardware/dma.h"
+#include "hardware/gpio.h"
+#include "hot_path.h"
 #include "pico/stdlib.h"
 #include <string.h>
 
-// Register definitions
+// Control stages may be NAKed for up to 500 ms (USB 2.0, 9.2.6.4)
+#define MAX3421E_CTRL_TIMEOUT_US   500000
+#define MAX3421E_XFER_TIMEOUT_US   50000
+#define MAX3421E_RESET_TIMEOUT_US  100000
+#define MAX3421E_OSC_TIMEOUT_US    20000
+// Frames to run after bus reset before the first request (10 ms minimum)
+#define MAX3421E_RESET_RECOVERY_FRAMES 20
+
+// Sources always routed to the INT pin. FRAMEIRQ is added while the HCD
+// needs a frame count and during bus-reset recovery.
+#define MAX3421E_HIEN_DEFAULT (HIRQ_CONDETIRQ | HIRQ_BUSEVENTIRQ | HIRQ_HXFRDNIRQ)
+#define MAX3421E_MODE_BASE    (MODE_DPPULLDN | MODE_DMPULLDN | MODE_HOST)
+
+Adafruit_MAX3421E* Adafruit_MAX3421E::s_irq_owner = nullptr;
 
 Adafruit_MAX3421E::Adafruit_MAX3421E(spi_inst_t* spi_port, uint cs_pin, uint int_pin, uint reset_pin)
     : _spi(spi_port), _cs_pin(cs_pin), _int_pin(int_pin), _reset_pin(reset_pin),
-      _initialized(false), _device_connected(false), _device_speed(MAX3421E_FULL_SPEED) {
+      _initialized(false), _device_connected(false), _device_speed(MAX3421E_FULL_SPEED),
+      _spi_hz(0), _dma_tx(-1), _dma_rx(-1), _last_status(0), _ep0_size(8),
+      _hien(MAX3421E_HIEN_DEFAULT), _peraddr(0), _conn_changed(false), _frame(0), _frame_us(0),
+      _toggle_in(0), _toggle_out(0) {
+    memset(&_stats, 0, sizeof(_stats));
     // Initialize reset pin only (SPI gets initialized in begin())
     gpio_init(_reset_pin);
     gpio_set_dir(_reset_pin, GPIO_OUT);
     gpio_put(_reset_pin, 1);  // Active low, start inactive
 }
 
+//--------------------------------------------------------------------
+// Interrupt pin
+//--------------------------------------------------------------------
+// INT runs level-triggered, so the pin itself says whether anything is
+// pending. The edge IRQ only exists to wake waitForInterrupt() out of WFE.
+HOT_PATH_IRQ void Adafruit_MAX3421E::gpioIrq(uint gpio, uint32_t events) {
+    (void) events;
+    if (s_irq_owner && gpio == s_irq_owner->_int_pin) {
+        s_irq_owner->_stats.int_edges++;
+    }
+}
+
+void Adafruit_MAX3421E::holdReset() {
+    gpio_put(_reset_pin, 0);  // Active low
+}
+
 max3421e_err_t Adafruit_MAX3421E::begin() {
     if (_initialized) return MAX3421E_OK;
 
-    // Initialize SPI pins
-    uint baudrate = 1000 * 1000; // 1 MHz
     uint sck_pin, mosi_pin, miso_pin;
-    
+
     if (_spi == spi0) {
         sck_pin = 18; mosi_pin = 19; miso_pin = 16; // Default SPI0 pins
     } else {
         sck_pin = 10; mosi_pin = 11; miso_pin = 8;  // Default SPI1 pins
     }
 
-    spi_init(_spi, baudrate);
+    _spi_hz = spi_init(_spi, MAX3421E_SPI_HZ);
     gpio_set_function(sck_pin, GPIO_FUNC_SPI);
     gpio_set_function(mosi_pin, GPIO_FUNC_SPI);
     gpio_set_function(miso_pin, GPIO_FUNC_SPI);
@@ -42,11 +76,32 @@ max3421e_err_t Adafruit_MAX3421E::begin() {
     gpio_set_dir(_int_pin, GPIO_IN);
     gpio_pull_up(_int_pin); // INT is active low
 
-    // Hardware reset sequence
-    gpio_put(_reset_pin, 0);   // Assert reset (active low)
-    sleep_ms(20);              // Hold for 20ms
-    gpio_put(_reset_pin, 1);   // Release reset
-    sleep_ms(100);             // Wait for stabilization
+    // FIFO traffic goes through DMA when two channels are free; otherwise
+    // everything is clocked out by the CPU.
+    if (_dma_tx < 0) _dma_tx = dma_claim_unused_channel(false);
+    if (_dma_rx < 0) _dma_rx = dma_claim_unused_channel(false);
+    if (_dma_tx < 0 || _dma_rx < 0) {
+        if (_dma_tx >= 0) dma_channel_unclaim(_dma_tx);
+        if (_dma_rx >= 0) dma_channel_unclaim(_dma_rx);
+        _dma_tx = _dma_rx = -1;
+    }
+
+    // End the hardware reset if holdReset() started one. Nothing to wait
+    // for: the SPI side is up straight away and the oscillator is checked
+    // after CHIPRES below.
+    gpio_put(_reset_pin, 1);
+
+    // Full-duplex SPI first: the chip powers up with MISO tri-stated and
+    // writes are all it can take until this is set. INT goes level, active low.
+    writeRegister(MAX3421E_PINCTL, PINCTL_FDUPSPI | PINCTL_INTLEVEL);
+
+    // Chip reset, then wait for the oscillator (USBIRQ is not routed to INT)
+    writeRegister(MAX3421E_USBCTL, USBCTL_CHIPRES);
+    writeRegister(MAX3421E_USBCTL, 0);
+    if (waitForInterrupt(MAX3421E_USBIRQ, USBIRQ_OSCOKIRQ,
+                         make_timeout_time_us(MAX3421E_OSC_TIMEOUT_US)) != MAX3421E_OK) {
+        return MAX3421E_ERR_SPI;
+    }
 
     // Verify communication
     uint8_t rev = readRegister(MAX3421E_REVISION);
@@ -55,32 +110,97 @@ max3421e_err_t Adafruit_MAX3421E::begin() {
     }
 
     // Configure host mode
-    writeRegister(MAX3421E_MODE, MODE_HOST);
-    writeRegister(MAX3421E_HIEN, HIRQ_DONEI | HIRQ_RCVDAVI);
-    writeRegister(MAX3421E_USBIEN, USBIRQ_URESI | USBIRD_SPEEDI);
+    writeRegister(MAX3421E_MODE, MAX3421E_MODE_BASE);
+    writeRegister(MAX3421E_HIRQ, 0xFF);
+    writeRegister(MAX3421E_HIEN, _hien);
+    writeRegister(MAX3421E_PERADDR, 0);
+    writeRegister(MAX3421E_USBIEN, 0);
+
+    s_irq_owner = this;
+    gpio_set_irq_enabled_with_callback(_int_pin, GPIO_IRQ_EDGE_FALL, true, &Adafruit_MAX3421E::gpioIrq);
+    writeRegister(MAX3421E_CPUCTL, CPUCTL_IE);
 
     _initialized = true;
+
+    // A device plugged in before power-up never raises CONDETIRQ
+    sampleBus();
     return MAX3421E_OK;
 }
 
-void Adafruit_MAX3421E::task() {
-    if (!_initialized) return;
+HOT_PATH void Adafruit_MAX3421E::task() {
+    // No SPI traffic at all unless the chip is asking for attention
+    if (!_initialized || !interruptPending()) return;
 
-    // Check for USB events
-    uint8_t usbirq = readRegister(MAX3421E_USBIRQ);
-    if (usbirq & USBIRQ_URESI) {
-        _device_connected = false;
-        writeRegister(MAX3421E_USBIRQ, USBIRQ_URESI); // Clear interrupt
+    uint8_t hirq = serviceIrq(readRegister(MAX3421E_HIRQ));
+    // Transfer completions are consumed synchronously; anything left is stale
+    hirq &= _hien;
+    if (hirq) writeRegister(MAX3421E_HIRQ, hirq);
+}
+
+// Handle the sources that can turn up at any time: attach/detach and SOF.
+// Returns the bits still pending.
+HOT_PATH uint8_t Adafruit_MAX3421E::serviceIrq(uint8_t hirq) {
+    uint8_t done = 0;
+    if ((hirq & HIRQ_FRAMEIRQ) && (_hien & HIRQ_FRAMEIRQ)) {
+        // Only one FRAMEIRQ latches however many SOFs went by
+        uint64_t now = time_us_64();
+        uint32_t frames = (uint32_t)((now - _frame_us + 500) / 1000);
+        _frame += frames ? frames : 1;
+        _frame_us = now;
+        done |= HIRQ_FRAMEIRQ;
     }
-    if (usbirq & USBIRD_SPEEDI) {
-        _device_speed = (readRegister(MAX3421E_MODE) & MODE_LOWSPEED) ? 
-                       MAX3421E_LOW_SPEED : MAX3421E_FULL_SPEED;
-        writeRegister(MAX3421E_USBIRQ, USBIRD_SPEEDI); // Clear interrupt
+    if (hirq & HIRQ_CONDETIRQ) {
+        done |= HIRQ_CONDETIRQ;
     }
-    if (usbirq & USBIRQ_URESDNI) {
-        _device_connected = true;
-        writeRegister(MAX3421E_USBIRQ, USBIRQ_URESDNI); // Clear interrupt
+    if (done) writeRegister(MAX3421E_HIRQ, done);
+    if (done & HIRQ_CONDETIRQ) sampleBus();
+    return hirq & (uint8_t)~done;
+}
+
+HOT_PATH uint32_t Adafruit_MAX3421E::frameNumber() const {
+    if (!(_hien & HIRQ_FRAMEIRQ)) return _frame;
+    return _frame + (uint32_t)((time_us_64() - _frame_us) / 1000);
+}
+
+void Adafruit_MAX3421E::setFrameIrq(bool enable) {
+    uint8_t hien = enable ? (_hien | HIRQ_FRAMEIRQ) : (uint8_t)(_hien & ~HIRQ_FRAMEIRQ);
+    if (hien == _hien) return;
+    _hien = hien;
+    _frame_us = time_us_64();
+    writeRegister(MAX3421E_HIRQ, HIRQ_FRAMEIRQ);
+    writeRegister(MAX3421E_HIEN, _hien);
+}
+
+bool Adafruit_MAX3421E::takeConnectionChange() {
+    bool changed = _conn_changed;
+    _conn_changed = false;
+    return changed;
+}
+
+// Latch J/K and work out attach state and speed. A low-speed device idles
+// in K while the chip is in full-speed mode, and vice versa.
+void Adafruit_MAX3421E::sampleBus() {
+    writeRegister(MAX3421E_HCTL, HCTL_SAMPLEBUS);
+    while (readRegister(MAX3421E_HCTL) & HCTL_SAMPLEBUS) {
+        tight_loop_contents();
+    }
+
+    uint8_t jk = readRegister(MAX3421E_HRSL) & (HRSL_JSTATUS | HRSL_KSTATUS);
+    bool was_low = (readRegister(MAX3421E_MODE) & MODE_LOWSPEED) != 0;
+
+    if (jk == 0 || jk == (HRSL_JSTATUS | HRSL_KSTATUS)) {
+        // SE0 (or illegal SE1): nothing attached
+        if (_device_connected) _conn_changed = true;
+        _device_connected = false;
+        writeRegister(MAX3421E_MODE, MAX3421E_MODE_BASE);
+        return;
     }
+
+    bool low = ((jk & HRSL_KSTATUS) != 0) != was_low;
+    _device_speed = low ? MAX3421E_LOW_SPEED : MAX3421E_FULL_SPEED;
+    if (!_device_connected) _conn_changed = true;
+    _device_connected = true;
+    writeRegister(MAX3421E_MODE, MAX3421E_MODE_BASE | MODE_SOFKAENAB | (low ? MODE_LOWSPEED : 0));
 }
 
 bool Adafruit_MAX3421E::deviceConnected() {
@@ -90,18 +210,40 @@ bool Adafruit_MAX3421E::deviceConnected() {
 max3421e_err_t Adafruit_MAX3421E::resetBus() {
     if (!_initialized) return MAX3421E_ERR_STATE;
 
-    writeRegister(MAX3421E_USBCTL, USBCTL_BUSRST);
-    sleep_ms(50); // Reset duration
-    writeRegister(MAX3421E_USBCTL, 0);
-    sleep_ms(100); // Recovery time
+    // The chip times the 50 ms reset itself and raises BUSEVENTIRQ at the end
+    writeRegister(MAX3421E_HIRQ, HIRQ_BUSEVENTIRQ);
+    writeRegister(MAX3421E_HCTL, HCTL_BUSRST);
+    max3421e_err_t err = waitForInterrupt(MAX3421E_HIRQ, HIRQ_BUSEVENTIRQ,
+                                          make_timeout_time_us(MAX3421E_RESET_TIMEOUT_US));
+    if (err != MAX3421E_OK) return err;
+
+    sampleBus();
+    if (!_device_connected) return MAX3421E_ERR_NOT_CONNECTED;
 
-    return waitForInterrupt(USBIRQ_URESDNI, 500);
+    // Recovery: count SOFs instead of sleeping
+    bool frame_irq = (_hien & HIRQ_FRAMEIRQ) != 0;
+    setFrameIrq(true);
+    uint32_t until = frameNumber() + MAX3421E_RESET_RECOVERY_FRAMES;
+    absolute_time_t deadline = make_timeout_time_us(MAX3421E_RESET_RECOVERY_FRAMES * 2000);
+    while ((int32_t)(_frame - until) < 0) {
+        if (interruptPending()) {
+            serviceIrq(readRegister(MAX3421E_HIRQ));
+        } else if (best_effort_wfe_or_timeout(deadline)) {
+            err = MAX3421E_ERR_TIMEOUT;
+            break;
+        }
+    }
+    setFrameIrq(frame_irq);
+
+    setPeripheralAddress(0);
+    _ep0_size = 8;
+    return err;
 }
 
 max3421e_err_t Adafruit_MAX3421E::enumerateDevice() {
     if (!_device_connected) return MAX3421E_ERR_NOT_CONNECTED;
 
-    writeRegister(MAX3421E_PERADDR, 0); // Default address
+    setPeripheralAddress(0); // Default address
 
     uint8_t dev_desc[18];
     size_t bytes_read;
@@ -113,159 +255,368 @@ max3421e_err_t Adafruit_MAX3421E::enumerateDevice() {
     return MAX3421E_OK;
 }
 
+void Adafruit_MAX3421E::setPeripheralAddress(uint8_t addr) {
+    selectAddress(addr);
+    _toggle_in = _toggle_out = 0;
+}
+
+HOT_PATH void Adafruit_MAX3421E::selectAddress(uint8_t addr) {
+    if (addr == _peraddr) return;
+    writeRegister(MAX3421E_PERADDR, addr);
+    _peraddr = addr;
+}
+
 max3421e_err_t Adafruit_MAX3421E::readDeviceDescriptor(uint8_t* buffer, size_t bufsize, size_t* bytes_read) {
-    uint8_t setup_pkt[8] = {
-        0x80, 0x06, 0x00, 0x01, 0x00, 0x00, 0x12, 0x00
-    };
+    uint16_t len = (bufsize < 18) ? bufsize : 18;
+    uint16_t actual = 0;
 
-    max3421e_err_t err = sendSetupPacket(setup_pkt);
+    max3421e_err_t err = controlTransfer(0x80, 0x06, 0x0100, 0, buffer, len, &actual);
+    *bytes_read = actual;
     if (err != MAX3421E_OK) return err;
 
-    return readFIFO(buffer, (bufsize < 18) ? bufsize : 18,  bytes_read);
+    // bMaxPacketSize0 decides where the data stage of later requests ends
+    if (actual >= 8 && buffer[7] >= 8) _ep0_size = buffer[7];
+    return MAX3421E_OK;
 }
 
 max3421e_err_t Adafruit_MAX3421E::readConfigDescriptor(uint8_t* buffer, size_t bufsize, size_t* bytes_read) {
-    uint8_t setup_pkt[8] = {
-        0x80, 0x06, 0x00, 0x02, 0x00, 0x00, 0x09, 0x00
-    };
+    uint8_t header[9];
+    uint16_t actual = 0;
 
-    max3421e_err_t err = sendSetupPacket(setup_pkt);
+    *bytes_read = 0;
+    max3421e_err_t err = controlTransfer(0x80, 0x06, 0x0200, 0, header, sizeof(header), &actual);
     if (err != MAX3421E_OK) return err;
-
-    uint8_t header[9];
-    err = readFIFO(header, sizeof(header), bytes_read);
-    if (err != MAX3421E_OK || *bytes_read != 9) return MAX3421E_ERR_DESCRIPTOR;
+    if (actual != 9) return MAX3421E_ERR_DESCRIPTOR;
 
     uint16_t total_length = header[2] | (header[3] << 8);
     if (total_length > bufsize) total_length = bufsize;
 
-    if (*bytes_read >= total_length) {
-        memcpy(buffer, header, total_length);
-        return MAX3421E_OK;
-    }
-
-    memcpy(buffer, header, 9);
-    return readFIFO(buffer + 9, total_length - 9, bytes_read);
+    err = controlTransfer(0x80, 0x06, 0x0200, 0, buffer, total_length, &actual);
+    *bytes_read = actual;
+    return err;
 }
 
 max3421e_err_t Adafruit_MAX3421E::readStringDescriptor(uint8_t index, uint16_t* buffer, size_t bufsize, size_t* bytes_read) {
-    uint8_t setup_pkt[8] = {
-        0x80, 0x06, 0x00, 0x03, index, 0x00, 0xFF, 0x00
-    };
+    uint8_t* byte_buf = reinterpret_cast<uint8_t*>(buffer);
+    uint16_t len = (bufsize > 255) ? 255 : bufsize;
+    uint16_t actual = 0;
 
-    max3421e_err_t err = sendSetupPacket(setup_pkt);
+    // Index 0 is the LANGID table; everything else in US English
+    max3421e_err_t err = controlTransfer(0x80, 0x06, 0x0300 | index, index ? 0x0409 : 0,
+                                         byte_buf, len, &actual);
+    *bytes_read = actual;
     if (err != MAX3421E_OK) return err;
+    if (actual < 2 || byte_buf[1] != 0x03) return MAX3421E_ERR_DESCRIPTOR;
+    return MAX3421E_OK;
+}
+
+//--------------------------------------------------------------------
+// SPI
+//--------------------------------------------------------------------
+// One CS frame: command byte, then len data bytes. In full-duplex mode the
+// chip shifts HIRQ out while the command byte goes in, so every access also
+// samples the interrupt status at no cost.
+HOT_PATH uint8_t Adafruit_MAX3421E::spiFrame(uint8_t cmd, const uint8_t* tx, uint8_t* rx, size_t len) {
+    uint8_t status = 0;
 
-    uint8_t header[2];
-    err = readFIFO(header, sizeof(header), bytes_read);
-    if (err != MAX3421E_OK || *bytes_read != 2) return MAX3421E_ERR_DESCRIPTOR;
+    gpio_put(_cs_pin, 0);
+    spi_write_read_blocking(_spi, &cmd, &status, 1);
+    if (len >= MAX3421E_DMA_MIN_LEN && _dma_tx >= 0) {
+        spiDma(tx, rx, len);
+    } else if (rx) {
+        spi_read_blocking(_spi, 0, rx, len);
+    } else if (len) {
+        spi_write_blocking(_spi, tx, len);
+    }
+    gpio_put(_cs_pin, 1);
 
-    uint8_t length = header[0];
-    if (header[1] != 0x03) return MAX3421E_ERR_DESCRIPTOR;
+    _last_status = status;
+    _stats.transactions++;
+    _stats.bytes += len + 1;
+    return status;
+}
 
-    uint8_t* byte_buf = reinterpret_cast<uint8_t*>(buffer);
-    size_t to_read = (length > bufsize * 2) ? bufsize * 2 : length;
-    
-    err = readFIFO(byte_buf, to_read, bytes_read);
-    *bytes_read += 2; // Include header
-    
-    return err;
+// Both channels run for every transfer: the PL022 only clocks when the TX
+// FIFO has data, and RX has to be drained or it stalls the TX side.
+HOT_PATH void Adafruit_MAX3421E::spiDma(const uint8_t* tx, uint8_t* rx, size_t len) {
+    static uint8_t dummy_tx = 0;
+    static uint8_t dummy_rx;
+
+    dma_channel_config c = dma_channel_get_default_config(_dma_tx);
+    channel_config_set_transfer_data_size(&c, DMA_SIZE_8);
+    channel_config_set_dreq(&c, spi_get_dreq(_spi, true));
+    channel_config_set_read_increment(&c, tx != nullptr);
+    channel_config_set_write_increment(&c, false);
+    dma_channel_configure(_dma_tx, &c, &spi_get_hw(_spi)->dr, tx ? tx : &dummy_tx, len, false);
+
+    c = dma_channel_get_default_config(_dma_rx);
+    channel_config_set_transfer_data_size(&c, DMA_SIZE_8);
+    channel_config_set_dreq(&c, spi_get_dreq(_spi, false));
+    channel_config_set_read_increment(&c, false);
+    channel_config_set_write_increment(&c, rx != nullptr);
+    dma_channel_configure(_dma_rx, &c, rx ? rx : &dummy_rx, &spi_get_hw(_spi)->dr, len, false);
+
+    dma_start_channel_mask((1u << _dma_tx) | (1u << _dma_rx));
+    dma_channel_wait_for_finish_blocking(_dma_rx);
+    _stats.dma_transfers++;
 }
 
-uint8_t Adafruit_MAX3421E::readRegister(uint8_t reg) {
-    uint8_t cmd = reg & 0x7F;
+HOT_PATH uint8_t Adafruit_MAX3421E::readRegister(uint8_t reg) {
     uint8_t data = 0;
-    
-    gpio_put(_cs_pin, 0);
-    spi_write_blocking(_spi, &cmd, 1);
-    spi_read_blocking(_spi, 0, &data, 1);
-    gpio_put(_cs_pin, 1);
-    
+    spiFrame((uint8_t)(reg << 3), nullptr, &data, 1);
     return data;
 }
 
-void Adafruit_MAX3421E::writeRegister(uint8_t reg, uint8_t value) {
-    uint8_t cmd = reg | 0x80;
-    uint8_t buf[2] = {cmd, value};
-    
-    gpio_put(_cs_pin, 0);
-    spi_write_blocking(_spi, buf, 2);
-    gpio_put(_cs_pin, 1);
+HOT_PATH void Adafruit_MAX3421E::writeRegister(uint8_t reg, uint8_t value) {
+    spiFrame((uint8_t)((reg << 3) | MAX3421E_DIR_WRITE), &value, nullptr, 1);
 }
 
-max3421e_err_t Adafruit_MAX3421E::writeFIFO(const uint8_t* data, size_t len, size_t* bytes_written) {
-    gpio_put(_cs_pin, 0);
-    uint8_t cmd = MAX3421E_EP0_FIFO | 0x80;
-    spi_write_blocking(_spi, &cmd, 1);
-    spi_write_blocking(_spi, data, len);
-    gpio_put(_cs_pin, 1);
-    return MAX3421E_OK;
+HOT_PATH void Adafruit_MAX3421E::writeFIFO(uint8_t reg, const uint8_t* data, size_t len) {
+    spiFrame((uint8_t)((reg << 3) | MAX3421E_DIR_WRITE), data, nullptr, len);
 }
 
-max3421e_err_t Adafruit_MAX3421E::readFIFO(uint8_t* data, size_t len, size_t* bytes_read) {
-    gpio_put(_cs_pin, 0);
-    uint8_t cmd = MAX3421E_EP0_FIFO & 0x7F;
-    spi_write_blocking(_spi, &cmd, 1);
-    *bytes_read = spi_read_blocking(_spi, 0, data, len);
-    gpio_put(_cs_pin, 1);
-    return (*bytes_read == len) ? MAX3421E_OK : MAX3421E_ERR_SPI;
+HOT_PATH void Adafruit_MAX3421E::readFIFO(uint8_t reg, uint8_t* data, size_t len) {
+    spiFrame((uint8_t)(reg << 3), nullptr, data, len);
+}
+
+void Adafruit_MAX3421E::resetStats() {
+    memset(&_stats, 0, sizeof(_stats));
+}
+
+//--------------------------------------------------------------------
+// Transfers
+//--------------------------------------------------------------------
+// HIRQ sources sleep in WFE until INT drops; USBIRQ ones are polled.
+HOT_PATH max3421e_err_t Adafruit_MAX3421E::waitForInterrupt(uint8_t reg, uint8_t int_bit, absolute_time_t deadline) {
+    bool irq_driven = _initialized && reg == MAX3421E_HIRQ;
+
+    while (true) {
+        if (!irq_driven || interruptPending()) {
+            uint8_t irq = readRegister(reg);
+            if (irq & int_bit) {
+                writeRegister(reg, int_bit);
+                return MAX3421E_OK;
+            }
+            if (irq_driven && (irq & (HIRQ_CONDETIRQ | HIRQ_FRAMEIRQ))) {
+                serviceIrq(irq);
+                if ((irq & HIRQ_CONDETIRQ) && !_device_connected) return MAX3421E_ERR_NOT_CONNECTED;
+            }
+        }
+        if (time_reached(deadline)) return MAX3421E_ERR_TIMEOUT;
+        if (irq_driven) best_effort_wfe_or_timeout(deadline);
+    }
 }
 
-max3421e_err_t Adafruit_MAX3421E::waitForInterrupt(uint8_t int_bit, uint32_t timeout_ms) {
-    uint32_t start = to_ms_since_boot(get_absolute_time());
-    
-    while ((to_ms_since_boot(get_absolute_time()) - start) < timeout_ms) {
-        uint8_t irq = readRegister(MAX3421E_USBIRQ);
-        if (irq & int_bit) {
-            writeRegister(MAX3421E_USBIRQ, int_bit);
-            return MAX3421E_OK;
+// Launch one token and wait for the handshake. NAKs are reissued until the
+// deadline when retry_nak is set.
+HOT_PATH max3421e_err_t Adafruit_MAX3421E::hostTransfer(uint8_t token, uint8_t ep, absolute_time_t deadline,
+                                                        bool retry_nak, uint8_t* hrsl) {
+    while (true) {
+        writeRegister(MAX3421E_HXFR, token | (ep & 0x0F));
+        max3421e_err_t err = waitForInterrupt(MAX3421E_HIRQ, HIRQ_HXFRDNIRQ, deadline);
+        if (err != MAX3421E_OK) return err;
+
+        uint8_t status = readRegister(MAX3421E_HRSL);
+        if (hrsl) *hrsl = status;
+        switch (status & HRSL_RESULT_MASK) {
+            case HRSLT_SUCCESS:
+                return MAX3421E_OK;
+            case HRSLT_NAK:
+                if (retry_nak && !time_reached(deadline)) continue;
+                return MAX3421E_ERR_NAK;
+            case HRSLT_STALL:
+                return MAX3421E_ERR_STALL;
+            case HRSLT_TIMEOUT:
+                return MAX3421E_ERR_TIMEOUT;
+            default:
+                return MAX3421E_ERR_XFER;
         }
-        sleep_ms(1);
     }
-    return MAX3421E_ERR_TIMEOUT;
 }
 
-max3421e_err_t Adafruit_MAX3421E::sendSetupPacket(const uint8_t* setup_pkt) {
-    max3421e_err_t err = writeFIFO(setup_pkt, 8, nullptr);
+HOT_PATH max3421e_err_t Adafruit_MAX3421E::packetIn(uint8_t ep, uint8_t* buffer, uint16_t length, uint16_t* actual,
+                                                    bool* toggle, absolute_time_t deadline, bool retry_nak) {
+    uint8_t hrsl = 0;
+    *actual = 0;
+
+    writeRegister(MAX3421E_HCTL, *toggle ? HCTL_RCVTOG1 : HCTL_RCVTOG0);
+    max3421e_err_t err = hostTransfer(HXFR_IN, ep, deadline, retry_nak, &hrsl);
     if (err != MAX3421E_OK) return err;
-    
-    writeRegister(MAX3421E_HCTL, 0x01); // HSNAK
-    writeRegister(MAX3421E_HXFR, 0x10); // SETUP token
-    
-    return waitForInterrupt(HIRQ_DONEI, 100);
+
+    *toggle = (hrsl & HRSL_RCVTOGRD) != 0;
+
+    uint8_t count = readRegister(MAX3421E_RCVBC);
+    uint16_t take = (count < length) ? count : length;
+    if (take) readFIFO(MAX3421E_RCVFIFO, buffer, take);
+    // Acking RCVDAVIRQ hands the buffer back, including any overflow bytes
+    writeRegister(MAX3421E_HIRQ, HIRQ_RCVDAVIRQ);
+
+    *actual = take;
+    return (count > length) ? MAX3421E_ERR_XFER : MAX3421E_OK;
 }
 
-max3421e_err_t Adafruit_MAX3421E::controlTransfer(uint8_t bmRequestType, uint8_t bRequest, 
-    uint16_t wValue, uint16_t wIndex, uint8_t* data, uint16_t wLength) {
+HOT_PATH max3421e_err_t Adafruit_MAX3421E::packetOut(uint8_t ep, const uint8_t* buffer, uint16_t length,
+                                                     bool* toggle, absolute_time_t deadline, bool retry_nak) {
+    uint8_t hrsl = 0;
+    max3421e_err_t err;
+
+    writeRegister(MAX3421E_HCTL, *toggle ? HCTL_SNDTOG1 : HCTL_SNDTOG0);
+    while (true) {
+        if (length) writeFIFO(MAX3421E_SNDFIFO, buffer, length);
+        writeRegister(MAX3421E_SNDBC, (uint8_t)length);
+        err = hostTransfer(HXFR_OUT, ep, deadline, false, &hrsl);
+        if (err == MAX3421E_ERR_NAK) {
+            // A NAKed packet has to be reloaded before it can go again
+            writeRegister(MAX3421E_SNDBC, 0);
+            if (retry_nak && !time_reached(deadline)) continue;
+        }
+        break;
+    }
+    if (err != MAX3421E_OK) return err;
+
+    *toggle = (hrsl & HRSL_SNDTOGRD) != 0;
+    return MAX3421E_OK;
+}
+
+max3421e_err_t Adafruit_MAX3421E::controlTransfer(uint8_t bmRequestType, uint8_t bRequest,
+    uint16_t wValue, uint16_t wIndex, uint8_t* data, uint16_t wLength, uint16_t* actual) {
     uint8_t setup_pkt[8] = {
         bmRequestType, bRequest,
         (uint8_t)(wValue & 0xFF), (uint8_t)(wValue >> 8),
         (uint8_t)(wIndex & 0xFF), (uint8_t)(wIndex >> 8),
         (uint8_t)(wLength & 0xFF), (uint8_t)(wLength >> 8)
     };
+    uint16_t done = 0;
+    bool dir_in = (bmRequestType & 0x80) != 0;
 
-    if (sendSetupPacket(setup_pkt) != MAX3421E_OK) {
-        return MAX3421E_ERR_ENUMERATION;
-    }
+    if (actual) *actual = 0;
+    if (!_device_connected) return MAX3421E_ERR_NOT_CONNECTED;
+    if (wLength > 0 && !data) return MAX3421E_ERR_STATE;
 
-    if (wLength > 0) {
-        size_t bytes_read;
-        if (bmRequestType & 0x80) {
-            return readFIFO(data, wLength, &bytes_read);
+    // Setup stage: the chip always sends SETUP as DATA0
+    writeFIFO(MAX3421E_SUDFIFO, setup_pkt, sizeof(setup_pkt));
+    max3421e_err_t err = hostTransfer(HXFR_SETUP, 0, make_timeout_time_us(MAX3421E_CTRL_TIMEOUT_US), false);
+    if (err != MAX3421E_OK) return err;
+
+    // Data stage starts on DATA1 and ends on a short packet or wLength
+    absolute_time_t deadline = make_timeout_time_us(MAX3421E_CTRL_TIMEOUT_US);
+    bool toggle = true;
+    while (done < wLength) {
+        uint16_t chunk = wLength - done;
+        if (dir_in) {
+            // bMaxPacketSize0 may still be unknown, so accept up to the rest
+            uint16_t got = 0;
+            err = packetIn(0, data + done, chunk, &got, &toggle, deadline, true);
+            if (err != MAX3421E_OK) return err;
+            done += got;
+            if (got < _ep0_size) break;
         } else {
-            return writeFIFO(data, wLength, &bytes_read);
+            if (chunk > _ep0_size) chunk = _ep0_size;
+            err = packetOut(0, data + done, chunk, &toggle, deadline, true);
+            if (err != MAX3421E_OK) return err;
+            done += chunk;
         }
     }
+    if (actual) *actual = done;
 
-    return MAX3421E_OK;
+    // Status stage runs opposite to the data direction
+    uint8_t status_token = (dir_in && wLength > 0) ? HXFR_HS_OUT : HXFR_HS_IN;
+    return hostTransfer(status_token, 0, make_timeout_time_us(MAX3421E_CTRL_TIMEOUT_US), true);
 }
 
-max3421e_err_t Adafruit_MAX3421E::bulkTransfer(uint8_t ep_addr, uint8_t* buffer, uint16_t length) {
-    size_t bytes_read;
+max3421e_err_t Adafruit_MAX3421E::bulkTransfer(uint8_t ep_addr, uint8_t* buffer, uint16_t length, uint16_t* actual) {
+    uint8_t ep = ep_addr & 0x0F;
+    uint16_t bit = (uint16_t)(1u << ep);
+    absolute_time_t deadline = make_timeout_time_us(MAX3421E_XFER_TIMEOUT_US);
+    uint16_t got = 0;
+    max3421e_err_t err;
+
+    if (!_device_connected) return MAX3421E_ERR_NOT_CONNECTED;
     if (ep_addr & 0x80) {
-        return readFIFO(buffer, length, &bytes_read);
+        bool toggle = (_toggle_in & bit) != 0;
+        err = packetIn(ep, buffer, length, &got, &toggle, deadline, false);
+        _toggle_in = toggle ? (_toggle_in | bit) : (_toggle_in & ~bit);
     } else {
-        return writeFIFO(buffer, length, nullptr);
+        bool toggle = (_toggle_out & bit) != 0;
+        err = packetOut(ep, buffer, length, &toggle, deadline, false);
+        _toggle_out = toggle ? (_toggle_out | bit) : (_toggle_out & ~bit);
+        if (err == MAX3421E_OK) got = length;
     }
+    if (actual) *actual = got;
+    return err;
 }
 
+max3421e_err_t Adafruit_MAX3421E::interruptTransfer(uint8_t ep_addr, uint8_t* buffer, uint16_t length, uint16_t* actual) {
+    // Same packet on the wire; the caller owns the polling interval
+    return bulkTransfer(ep_addr, buffer, length, actual);
+}
+
+HOT_PATH max3421e_err_t Adafruit_MAX3421E::setupPacket(uint8_t addr, const uint8_t* setup) {
+    if (!_device_connected) return MAX3421E_ERR_NOT_CONNECTED;
+    selectAddress(addr);
+    writeFIFO(MAX3421E_SUDFIFO, setup, 8);
+    return hostTransfer(HXFR_SETUP, 0, make_timeout_time_us(MAX3421E_XFER_TIMEOUT_US), false);
+}
+
+HOT_PATH max3421e_err_t Adafruit_MAX3421E::inPacket(uint8_t addr, uint8_t ep, uint8_t* buffer, uint16_t length,
+                                                    uint16_t* actual, bool* toggle) {
+    if (!_device_connected) return MAX3421E_ERR_NOT_CONNECTED;
+    selectAddress(addr);
+    return packetIn(ep & 0x0F, buffer, length, actual, toggle,
+                    make_timeout_time_us(MAX3421E_XFER_TIMEOUT_US), false);
+}
+
+HOT_PATH max3421e_err_t Adafruit_MAX3421E::outPacket(uint8_t addr, uint8_t ep, const uint8_t* buffer, uint16_t length,
+                                                     bool* toggle) {
+    if (!_device_connected) return MAX3421E_ERR_NOT_CONNECTED;
+    selectAddress(addr);
+    return packetOut(ep & 0x0F, buffer, length, toggle,
+                     make_timeout_time_us(MAX3421E_XFER_TIMEOUT_US), false);
+}
+
+HOT_PATH max3421e_err_t Adafruit_MAX3421E::handshakePacket(uint8_t addr, bool dir_in) {
+    if (!_device_connected) return MAX3421E_ERR_NOT_CONNECTED;
+    selectAddress(addr);
+    return hostTransfer(dir_in ? HXFR_HS_IN : HXFR_HS_OUT, 0,
+                        make_timeout_time_us(MAX3421E_XFER_TIMEOUT_US), false);
+}
+
+//--------------------------------------------------------------------
+// Bench
+//--------------------------------------------------------------------
+void Adafruit_MAX3421E::bench(uint32_t duration_ms, max3421e_bench_t* out) {
+    uint8_t report[8];
+    uint32_t half_us = duration_ms * 500;
+
+    memset(out, 0, sizeof(*out));
+    out->spi_hz = _spi_hz;
+
+    // Raw throughput: back-to-back register reads
+    resetStats();
+    uint64_t start = time_us_64();
+    uint64_t elapsed;
+    do {
+        readRegister(MAX3421E_REVISION);
+        elapsed = time_us_64() - start;
+    } while (elapsed < half_us);
+    out->transactions_per_s = (uint32_t)((uint64_t)_stats.transactions * 1000000 / elapsed);
+    out->bytes_per_s = (uint32_t)((uint64_t)_stats.bytes * 1000000 / elapsed);
+
+    // What one interrupt IN report costs on the SPI side
+    resetStats();
+    uint32_t reports = 0;
+    start = time_us_64();
+    do {
+        readRegister(MAX3421E_HIRQ);
+        readRegister(MAX3421E_HRSL);
+        readRegister(MAX3421E_RCVBC);
+        readFIFO(MAX3421E_RCVFIFO, report, sizeof(report));
+        writeRegister(MAX3421E_HIRQ, HIRQ_RCVDAVIRQ);
+        reports++;
+        elapsed = time_us_64() - start;
+    } while (elapsed < half_us);
+    out->report_ns = (uint32_t)(elapsed * 1000 / reports);
+    out->report_transactions = (uint8_t)(_stats.transactions / reports);
+    out->report_bytes = (uint8_t)(_stats.bytes / reports);
+    resetStats();
+}
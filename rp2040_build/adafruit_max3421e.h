@@ -5,38 +5,34 @@
 #include "hardware/spi.h"
 #include <string.h>
 #include <stdlib.h>
-#define MAX3421E_EP0_FIFO     0x00
-#define MAX3421E_EP1_FIFO     0x01
-#define MAX3421E_EP2_FIFO     0x02
-#define MAX3421E_EP3_FIFO     0x03
-#define MAX3421E_EP0_BC       0x04
-#define MAX3421E_EP1_BC       0x05
-#define MAX3421E_EP2_BC       0x06
-#define MAX3421E_EP3_BC       0x07
-#define MAX3421E_EP_STAT      0x08
-#define MAX3421E_EP_IRQ       0x09
-#define MAX3421E_USBCTL       0x0A
-#define MAX3421E_CPUCTL       0x0B
-#define MAX3421E_PINCTL       0x0C
-#define MAX3421E_REVISION     0x0D
-#define MAX3421E_FNADDR       0x0E
-#define MAX3421E_IOPINS       0x0F
-#define MAX3421E_GPINIRQ      0x10
-#define MAX3421E_GPINEN       0x11
-#define MAX3421E_GPINPOL      0x12
-#define MAX3421E_HIRQ         0x13
-#define MAX3421E_HIEN         0x14
-#define MAX3421E_MODE         0x15
-#define MAX3421E_PERADDR      0x16
-#define MAX3421E_HCTL         0x17
-#define MAX3421E_HXFR         0x18
-#define MAX3421E_HRSL         0x19
-#define MAX3421E_HCDATA       0x1A
-#define MAX3421E_HCBC         0x1B
-#define MAX3421E_USBIRQ       0x1C
-#define MAX3421E_USBIEN       0x1D
-#define MAX3421E_USBSTAT      0x1E
-#define MAX3421E_FRAME        0x1F
+
+// Host-mode register numbers (MAX3421E datasheet, table 3). The SPI command
+// byte is (reg << 3) | MAX3421E_DIR_WRITE for writes.
+#define MAX3421E_RCVFIFO      1
+#define MAX3421E_SNDFIFO      2
+#define MAX3421E_SUDFIFO      4
+#define MAX3421E_RCVBC        6
+#define MAX3421E_SNDBC        7
+#define MAX3421E_USBIRQ       13
+#define MAX3421E_USBIEN       14
+#define MAX3421E_USBCTL       15
+#define MAX3421E_CPUCTL       16
+#define MAX3421E_PINCTL       17
+#define MAX3421E_REVISION     18
+#define MAX3421E_IOPINS1      20
+#define MAX3421E_IOPINS2      21
+#define MAX3421E_GPINIRQ      22
+#define MAX3421E_GPINIEN      23
+#define MAX3421E_GPINPOL      24
+#define MAX3421E_HIRQ         25
+#define MAX3421E_HIEN         26
+#define MAX3421E_MODE         27
+#define MAX3421E_PERADDR      28
+#define MAX3421E_HCTL         29
+#define MAX3421E_HXFR         30
+#define MAX3421E_HRSL         31
+
+#define MAX3421E_DIR_WRITE    0x02
 // SPI Defines
 #define SPI_PORT spi0
 #define PIN_MISO 16
@@ -46,22 +42,91 @@
 #define MAX3421E_INT_PIN  9
 #define MAX3421E_RESET_PIN 14  // Example – use any free GPIO pin
 
+// Requested SPI clock. The chip tops out at 26 MHz; the PL022 divides
+// clk_peri by an even prescaler, so spi_init() settles on the nearest rate
+// at or below this (20.8 MHz from 125 MHz).
+#ifndef MAX3421E_SPI_HZ
+#define MAX3421E_SPI_HZ       (26 * 1000 * 1000)
+#endif
+
+// RES low time used between holdReset() and begin(). The oscillator start
+// after release is waited for on OSCOKIRQ, not timed.
+#define MAX3421E_RESET_HOLD_US 1000
+
+// FIFO accesses at least this long go through DMA; shorter ones are cheaper
+// to clock out by hand than to set up two channels for.
+#ifndef MAX3421E_DMA_MIN_LEN
+#define MAX3421E_DMA_MIN_LEN  8
+#endif
+
+// USBIRQ bits
+#define USBIRQ_OSCOKIRQ       (1 << 0)
+#define USBIRQ_NOVBUSIRQ      (1 << 5)
+#define USBIRQ_VBUSIRQ        (1 << 6)
+
 // USBCTL bits
-#define USBCTL_CHIPRES        (1 << 0)
-#define USBCTL_BUSRST         (1 << 5)
+#define USBCTL_PWRDOWN        (1 << 4)
+#define USBCTL_CHIPRES        (1 << 5)
+
+// CPUCTL bits
+#define CPUCTL_IE             (1 << 0)
+
+// PINCTL bits
+#define PINCTL_GPXA           (1 << 0)
+#define PINCTL_GPXB           (1 << 1)
+#define PINCTL_POSINT         (1 << 2)
+#define PINCTL_INTLEVEL       (1 << 3)
+#define PINCTL_FDUPSPI        (1 << 4)
+
+// HIRQ / HIEN bits
+#define HIRQ_BUSEVENTIRQ      (1 << 0)
+#define HIRQ_RWUIRQ           (1 << 1)
+#define HIRQ_RCVDAVIRQ        (1 << 2)
+#define HIRQ_SNDBAVIRQ        (1 << 3)
+#define HIRQ_SUSDNIRQ         (1 << 4)
+#define HIRQ_CONDETIRQ        (1 << 5)
+#define HIRQ_FRAMEIRQ         (1 << 6)
+#define HIRQ_HXFRDNIRQ        (1 << 7)
 
 // MODE bits
 #define MODE_HOST             (1 << 0)
 #define MODE_LOWSPEED         (1 << 1)
+#define MODE_HUBPRE           (1 << 2)
+#define MODE_SOFKAENAB        (1 << 3)
+#define MODE_SEPIRQ           (1 << 4)
+#define MODE_DELAYISO         (1 << 5)
+#define MODE_DMPULLDN         (1 << 6)
+#define MODE_DPPULLDN         (1 << 7)
 
-// HIRQ bits
-#define HIRQ_DONEI            (1 << 0)
-#define HIRQ_RCVDAVI          (1 << 3)
+// HCTL bits
+#define HCTL_BUSRST           (1 << 0)
+#define HCTL_FRMRST           (1 << 1)
+#define HCTL_SAMPLEBUS        (1 << 2)
+#define HCTL_SIGRSM           (1 << 3)
+#define HCTL_RCVTOG0          (1 << 4)
+#define HCTL_RCVTOG1          (1 << 5)
+#define HCTL_SNDTOG0          (1 << 6)
+#define HCTL_SNDTOG1          (1 << 7)
+
+// HXFR tokens, OR'd with the endpoint number
+#define HXFR_SETUP            0x10
+#define HXFR_IN               0x00
+#define HXFR_OUT              0x20
+#define HXFR_HS_IN            0x80
+#define HXFR_HS_OUT           0xA0
+
+// HRSL fields
+#define HRSL_RESULT_MASK      0x0F
+#define HRSL_RCVTOGRD         (1 << 4)
+#define HRSL_SNDTOGRD         (1 << 5)
+#define HRSL_KSTATUS          (1 << 6)
+#define HRSL_JSTATUS          (1 << 7)
+
+#define HRSLT_SUCCESS         0x00
+#define HRSLT_NAK             0x04
+#define HRSLT_STALL           0x05
+#define HRSLT_TIMEOUT         0x0E
 
-// USBIRQ bits
-#define USBIRQ_URESI          (1 << 0)
-#define USBIRQ_URESDNI        (1 << 1)
-#define USBIRD_SPEEDI         (1 << 2)
 // Error codes
 typedef enum {
     MAX3421E_OK = 0,
@@ -70,7 +135,10 @@ typedef enum {
     MAX3421E_ERR_NOT_CONNECTED,
     MAX3421E_ERR_ENUMERATION,
     MAX3421E_ERR_DESCRIPTOR,
-    MAX3421E_ERR_STATE
+    MAX3421E_ERR_STATE,
+    MAX3421E_ERR_NAK,
+    MAX3421E_ERR_STALL,
+    MAX3421E_ERR_XFER
 } max3421e_err_t;
 
 // USB speeds
@@ -79,12 +147,33 @@ typedef enum {
     MAX3421E_FULL_SPEED = 1
 } max3421e_speed_t;
 
+// SPI traffic since the last resetStats(). A transaction is one CS frame.
+typedef struct {
+    uint32_t transactions;
+    uint32_t bytes;
+    uint32_t dma_transfers;
+    uint32_t int_edges;        // Falling edges seen on the INT pin
+} max3421e_stats_t;
+
+typedef struct {
+    uint32_t spi_hz;           // Clock actually achieved
+    uint32_t transactions_per_s;
+    uint32_t bytes_per_s;
+    uint32_t report_ns;        // SPI cost of servicing one HID report
+    uint8_t  report_transactions;
+    uint8_t  report_bytes;
+} max3421e_bench_t;
+
 class Adafruit_MAX3421E {
 public:
     // Constructor: spi_port is a pointer to the SPI instance,
     // cs_pin is the chip-select pin number, and int_pin is the interrupt pin.
-    Adafruit_MAX3421E(spi_inst_t* spi_port, uint cs_pin, uint int_pin, uint reset_pin);    
+    Adafruit_MAX3421E(spi_inst_t* spi_port, uint cs_pin, uint int_pin, uint reset_pin);
     // Public API functions
+    // Hardware reset is split so the caller can time the pulse without
+    // sleeping: holdReset(), then begin() at least MAX3421E_RESET_HOLD_US
+    // later. begin() on its own skips the pin reset and relies on CHIPRES.
+    void holdReset();
     max3421e_err_t begin();
     void task();
     bool deviceConnected();
@@ -94,34 +183,99 @@ public:
     max3421e_err_t readConfigDescriptor(uint8_t* buffer, size_t bufsize, size_t* bytes_read);
     max3421e_err_t readStringDescriptor(uint8_t index, uint16_t* buffer, size_t bufsize, size_t* bytes_read);
     max3421e_speed_t deviceSpeed() const { return _device_speed; }
-    
-    max3421e_err_t controlTransfer(uint8_t bmRequestType, uint8_t bRequest, 
-                                  uint16_t wValue, uint16_t wIndex, 
-                                  uint8_t* data, uint16_t wLength);
-    
-    max3421e_err_t bulkTransfer(uint8_t ep_addr, uint8_t* buffer, uint16_t length);
-    max3421e_err_t interruptTransfer(uint8_t ep_addr, uint8_t* buffer, uint16_t length);
-    
-    // Register operations
+
+    max3421e_err_t controlTransfer(uint8_t bmRequestType, uint8_t bRequest,
+                                  uint16_t wValue, uint16_t wIndex,
+                                  uint8_t* data, uint16_t wLength,
+                                  uint16_t* actual = nullptr);
+
+    // Single packet on a non-control endpoint. IN returns MAX3421E_ERR_NAK
+    // when the device has nothing to send.
+    max3421e_err_t bulkTransfer(uint8_t ep_addr, uint8_t* buffer, uint16_t length, uint16_t* actual = nullptr);
+    max3421e_err_t interruptTransfer(uint8_t ep_addr, uint8_t* buffer, uint16_t length, uint16_t* actual = nullptr);
+
+    void setPeripheralAddress(uint8_t addr);
+
+    // Packet-level access for the TinyUSB HCD. Each call puts exactly one
+    // token on the bus, so a NAK comes back as MAX3421E_ERR_NAK and the
+    // caller decides when to retry. toggle is the DATA PID to send/expect
+    // and is advanced on success.
+    max3421e_err_t setupPacket(uint8_t addr, const uint8_t* setup);
+    max3421e_err_t inPacket(uint8_t addr, uint8_t ep, uint8_t* buffer, uint16_t length,
+                            uint16_t* actual, bool* toggle);
+    max3421e_err_t outPacket(uint8_t addr, uint8_t ep, const uint8_t* buffer, uint16_t length, bool* toggle);
+    max3421e_err_t handshakePacket(uint8_t addr, bool dir_in);
+
+    // SOFs counted from FRAMEIRQ while enabled. The MAX3421E has no
+    // readable frame counter in host mode, so this is the HCD's timebase.
+    // Frames between serviced FRAMEIRQs are filled in from the 1 ms period.
+    void setFrameIrq(bool enable);
+    uint32_t frameNumber() const;
+
+    // True once after every attach or detach seen by sampleBus()
+    bool takeConnectionChange();
+
+    // Register operations. Each is one CS frame: command byte plus data.
     uint8_t readRegister(uint8_t reg);
     void writeRegister(uint8_t reg, uint8_t value);
-    
+
+    // HIRQ as clocked out during the command byte of the last access
+    uint8_t lastStatus() const { return _last_status; }
+    // INT is level-triggered and active low: nothing to service while it is high
+    bool interruptPending() const { return !gpio_get(_int_pin); }
+
+    const max3421e_stats_t& stats() const { return _stats; }
+    void resetStats();
+    uint32_t spiHz() const { return _spi_hz; }
+
+    // Measures raw SPI throughput and the register traffic of one HID report
+    // (HIRQ, HRSL, RCVBC, 8-byte RCVFIFO, HIRQ ack) for duration_ms. Touches
+    // no bus state, so it can run with or without a device attached.
+    void bench(uint32_t duration_ms, max3421e_bench_t* out);
+
 private:
     spi_inst_t* _spi; // SPI instance pointer
     uint _cs_pin;
     uint _int_pin;
     uint _reset_pin;  // Added
-    max3421e_speed_t _device_speed;  // Added
     bool _initialized;
     bool _device_connected;
+    max3421e_speed_t _device_speed;  // Added
+    uint32_t _spi_hz;
+    int _dma_tx;
+    int _dma_rx;
+    uint8_t _last_status;
+    uint8_t _ep0_size;
+    uint8_t _hien;
+    uint8_t _peraddr;
+    bool _conn_changed;
+    uint32_t _frame;
+    uint64_t _frame_us;
+    uint16_t _toggle_in;   // DATA1 expected next, one bit per endpoint
+    uint16_t _toggle_out;
+    max3421e_stats_t _stats;
+
+    uint8_t spiFrame(uint8_t cmd, const uint8_t* tx, uint8_t* rx, size_t len);
+    void spiDma(const uint8_t* tx, uint8_t* rx, size_t len);
 
     // FIFO operations
-    max3421e_err_t writeFIFO(const uint8_t* data, size_t len, size_t* bytes_written);
-    max3421e_err_t readFIFO(uint8_t* data, size_t len, size_t* bytes_read);
-    
+    void writeFIFO(uint8_t reg, const uint8_t* data, size_t len);
+    void readFIFO(uint8_t reg, uint8_t* data, size_t len);
+
     // Helper functions
-    max3421e_err_t waitForInterrupt(uint8_t int_bit, uint32_t timeout_ms);
-    max3421e_err_t sendSetupPacket(const uint8_t* setup_pkt);
+    max3421e_err_t waitForInterrupt(uint8_t reg, uint8_t int_bit, absolute_time_t deadline);
+    max3421e_err_t hostTransfer(uint8_t token, uint8_t ep, absolute_time_t deadline, bool retry_nak,
+                                uint8_t* hrsl = nullptr);
+    max3421e_err_t packetIn(uint8_t ep, uint8_t* buffer, uint16_t length, uint16_t* actual,
+                            bool* toggle, absolute_time_t deadline, bool retry_nak);
+    max3421e_err_t packetOut(uint8_t ep, const uint8_t* buffer, uint16_t length,
+                             bool* toggle, absolute_time_t deadline, bool retry_nak);
+    void selectAddress(uint8_t addr);
+    uint8_t serviceIrq(uint8_t hirq);
+    void sampleBus();
+
+    static void gpioIrq(uint gpio, uint32_t events);
+    static Adafruit_MAX3421E* s_irq_owner;
 };
 
 #endif // ADAFRUIT_MAX3421E_H
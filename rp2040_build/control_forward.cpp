@@ -0,0 +1,219 @@
+#include "tusb.h"
+#include "pico/stdlib.h"
+#include "pico/critical_section.h"
+#include "control_forward.h"
+#include <string.h>
+
+void debug_print(const char* format, ...);
+
+//-----------------------------------------------------------------
+// State
+//-----------------------------------------------------------------
+static bool    fwd_attached = false;
+static uint8_t fwd_dev_addr = 0;
+static uint8_t fwd_instance = 0;
+static uint8_t fwd_itf = 0;
+
+// One request in flight on the physical device at a time. The buffer has to
+// outlive tuh_control_xfer(), so it is static rather than on the stack.
+static volatile bool fwd_busy = false;
+static cf_request_t  fwd_inflight;
+static uint8_t       fwd_xfer_buf[CF_MAX_PAYLOAD + 1];
+
+// The queue is SPSC (core0 submits, core1 takes), but attach resets it from
+// core1 and the report cache is written by both cores. Those paths and the
+// submit they could race with go through this lock.
+static critical_section_t fwd_lock;
+
+static const char* const fwd_kind_names[CF_KIND_COUNT] = {
+    "SET_REPORT", "GET_REPORT", "SET_IDLE", "SET_PROTOCOL", "OUT_REPORT"
+};
+
+static void fwd_dump_stats() {
+    for (int k = 0; k < CF_KIND_COUNT; k++) {
+        const cf_kind_stats_t* st = cf_stats((cf_kind_t)k);
+        if (st->submitted == 0) continue;
+        debug_print("[FWD] %-12s sub=%lu ok=%lu fail=%lu drop=%lu coal=%lu late=%lu max=%luus (budget %luus)\n",
+                    fwd_kind_names[k], st->submitted, st->completed, st->failed, st->dropped,
+                    st->coalesced, st->over_budget, st->max_us, cf_budget_us((cf_kind_t)k));
+    }
+}
+
+static void fwd_cache_store(uint8_t itf, uint8_t report_id, uint8_t report_type,
+                            const uint8_t* data, uint16_t len) {
+    critical_section_enter_blocking(&fwd_lock);
+    cf_cache_store(itf, report_id, report_type, data, len);
+    critical_section_exit(&fwd_lock);
+}
+
+void control_forward_init(void) {
+    critical_section_init(&fwd_lock);
+}
+
+//-----------------------------------------------------------------
+// Host side
+//-----------------------------------------------------------------
+void control_forward_attach(uint8_t dev_addr, uint8_t instance) {
+    tuh_itf_info_t info;
+    fwd_itf = 0;
+    if (tuh_hid_itf_get_info(dev_addr, instance, &info)) {
+        fwd_itf = info.desc.bInterfaceNumber;
+    }
+    fwd_dev_addr = dev_addr;
+    fwd_instance = instance;
+    fwd_busy = false;
+    critical_section_enter_blocking(&fwd_lock);
+    cf_init();
+    critical_section_exit(&fwd_lock);
+    fwd_attached = true;
+    debug_print("[FWD] Forwarding control requests to dev %u itf %u\n", dev_addr, fwd_itf);
+}
+
+void control_forward_detach(uint8_t dev_addr, uint8_t instance) {
+    if (!fwd_attached || dev_addr != fwd_dev_addr || instance != fwd_instance) return;
+    fwd_attached = false;
+    fwd_busy = false;
+    fwd_dump_stats();
+}
+
+static void fwd_finish(bool ok) {
+    cf_complete(&fwd_inflight, ok, time_us_32());
+    fwd_busy = false;
+}
+
+static void fwd_control_complete(tuh_xfer_t* xfer) {
+    bool ok = (xfer->result == XFER_RESULT_SUCCESS);
+    if (ok && fwd_inflight.kind == CF_KIND_GET_REPORT) {
+        const uint8_t* data = fwd_xfer_buf;
+        uint16_t len = (uint16_t)xfer->actual_len;
+        if (fwd_inflight.report_id && len > 0 && data[0] == fwd_inflight.report_id) {
+            data++;
+            len--;
+        }
+        fwd_cache_store(fwd_inflight.itf, fwd_inflight.report_id, fwd_inflight.report_type, data, len);
+    }
+    fwd_finish(ok);
+}
+
+static bool fwd_issue_control(const cf_request_t* req) {
+    static tusb_control_request_t setup;
+    cf_build_setup(req, reinterpret_cast<uint8_t*>(&setup));
+
+    if (req->kind == CF_KIND_GET_REPORT) {
+        memset(fwd_xfer_buf, 0, sizeof(fwd_xfer_buf));
+    } else if (setup.wLength) {
+        memcpy(fwd_xfer_buf, req->data, req->len);
+    }
+
+    tuh_xfer_t xfer = {};
+    xfer.daddr = fwd_dev_addr;
+    xfer.ep_addr = 0;
+    xfer.setup = &setup;
+    xfer.buffer = setup.wLength ? fwd_xfer_buf : NULL;
+    xfer.complete_cb = fwd_control_complete;
+    xfer.user_data = 0;
+    return tuh_control_xfer(&xfer);
+}
+
+void control_forward_task(void) {
+    if (!fwd_attached || fwd_busy) return;
+
+    uint32_t now = time_us_32();
+    if (!cf_take(&fwd_inflight, now)) return;
+
+    bool issued;
+    fwd_busy = true;
+    if (fwd_inflight.kind == CF_KIND_OUT_REPORT) {
+        // Prefer the interrupt OUT endpoint; fall back to SET_REPORT(Output) on EP0
+        issued = tuh_hid_send_report(fwd_dev_addr, fwd_instance, 0, fwd_inflight.data, fwd_inflight.len) ||
+                 fwd_issue_control(&fwd_inflight);
+    } else {
+        issued = fwd_issue_control(&fwd_inflight);
+    }
+
+    if (!issued) {
+        fwd_finish(false);
+    }
+}
+
+void tuh_hid_report_sent_cb(uint8_t dev_addr, uint8_t idx, uint8_t const* report, uint16_t len) {
+    (void)report;
+    (void)len;
+    if (fwd_busy && dev_addr == fwd_dev_addr && idx == fwd_instance &&
+        fwd_inflight.kind == CF_KIND_OUT_REPORT) {
+        fwd_finish(true);
+    }
+}
+
+//-----------------------------------------------------------------
+// Device side
+//-----------------------------------------------------------------
+static void fwd_submit(const cf_request_t* req) {
+    critical_section_enter_blocking(&fwd_lock);
+    cf_submit(req);
+    critical_section_exit(&fwd_lock);
+    // Core1 may be idling in WFE
+    __sev();
+}
+
+static void fwd_fill(cf_request_t* req, cf_kind_t kind, uint8_t report_id, uint8_t report_type) {
+    req->kind = kind;
+    req->itf = fwd_itf;
+    req->report_id = report_id;
+    req->report_type = report_type;
+    req->value = 0;
+    req->len = 0;
+    req->stamp_us = time_us_32();
+}
+
+void control_forward_set_report(uint8_t report_id, uint8_t report_type,
+                                uint8_t const* buffer, uint16_t len) {
+    cf_request_t req;
+
+    if (report_type == HID_REPORT_TYPE_INVALID) {
+        // Interrupt OUT endpoint data, report ID (if any) is still in the buffer
+        fwd_fill(&req, CF_KIND_OUT_REPORT, 0, HID_REPORT_TYPE_OUTPUT);
+        req.len = (len > CF_MAX_PAYLOAD) ? CF_MAX_PAYLOAD : len;
+        memcpy(req.data, buffer, req.len);
+    } else {
+        // TinyUSB strips the report ID from control SET_REPORT data; the device expects it back
+        fwd_fill(&req, CF_KIND_SET_REPORT, report_id, report_type);
+        uint16_t off = 0;
+        if (report_id) req.data[off++] = report_id;
+        uint16_t n = (uint16_t)(len + off > CF_MAX_PAYLOAD ? CF_MAX_PAYLOAD - off : len);
+        memcpy(req.data + off, buffer, n);
+        req.len = (uint16_t)(n + off);
+        fwd_cache_store(fwd_itf, report_id, report_type, buffer, n);
+    }
+    fwd_submit(&req);
+}
+
+uint16_t control_forward_get_report(uint8_t report_id, uint8_t report_type,
+                                    uint8_t* buffer, uint16_t reqlen) {
+    critical_section_enter_blocking(&fwd_lock);
+    uint16_t n = cf_cache_load(fwd_itf, report_id, report_type, buffer, reqlen);
+    critical_section_exit(&fwd_lock);
+
+    cf_request_t req;
+    fwd_fill(&req, CF_KIND_GET_REPORT, report_id, report_type);
+    req.len = (uint16_t)((reqlen + (report_id ? 1 : 0)) > CF_MAX_PAYLOAD ? CF_MAX_PAYLOAD
+                                                                          : reqlen + (report_id ? 1 : 0));
+    fwd_submit(&req);
+
+    // Zero length stalls the request; the PC retries and gets the refreshed copy
+    return n;
+}
+
+void control_forward_set_idle(uint8_t idle_rate) {
+    cf_request_t req;
+    fwd_fill(&req, CF_KIND_SET_IDLE, 0, 0);
+    req.value = idle_rate;
+    fwd_submit(&req);
+}
+
+void control_forward_set_protocol(uint8_t protocol) {
+    cf_request_t req;
+    fwd_fill(&req, CF_KIND_SET_PROTOCOL, 0, 0);
+    req.value = protocol;
+    fwd_submit(&req);
+}
@@ -0,0 +1,25 @@
+#ifndef CONTROL_FORWARD_H
+#define CONTROL_FORWARD_H
+
+#include <stdint.h>
+#include "ctrl_forward.h"
+
+// Set up the lock shared by the two cores. Call before launching core1.
+void control_forward_init(void);
+
+// Host-side (core1) HID instance that receives forwarded requests.
+void control_forward_attach(uint8_t dev_addr, uint8_t instance);
+void control_forward_detach(uint8_t dev_addr, uint8_t instance);
+
+// Device-side (core0) entry points (called from the tud_hid_* callbacks).
+void control_forward_set_report(uint8_t report_id, uint8_t report_type,
+                                uint8_t const* buffer, uint16_t len);
+uint16_t control_forward_get_report(uint8_t report_id, uint8_t report_type,
+                                    uint8_t* buffer, uint16_t reqlen);
+void control_forward_set_idle(uint8_t idle_rate);
+void control_forward_set_protocol(uint8_t protocol);
+
+// Issue the next queued request if the physical device is idle (core1). Never blocks.
+void control_forward_task(void);
+
+#endif // CONTROL_FORWARD_H
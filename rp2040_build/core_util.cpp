@@ -0,0 +1,38 @@
+#include "pico/stdlib.h"
+#include "core_util.h"
+#include "hot_path.h"
+#include <string.h>
+
+void debug_print(const char* format, ...);
+
+void core_util_init(core_util_t* u, const char* name) {
+    memset(u, 0, sizeof(*u));
+    u->name = name;
+    u->window_start_us = time_us_32();
+}
+
+HOT_PATH void core_util_account(core_util_t* u, uint32_t loop_start_us, bool busy) {
+    uint32_t now = time_us_32();
+    uint32_t dt = now - loop_start_us;
+
+    u->loops++;
+    if (busy) u->busy_us += dt;
+    if (dt > u->max_loop_us) u->max_loop_us = dt;
+
+    uint32_t window = now - u->window_start_us;
+    if (window < CORE_UTIL_WINDOW_US) return;
+
+    u->busy_permille = (uint32_t)(u->busy_us * 1000u / window);
+    u->loops_per_s = (uint32_t)((uint64_t)u->loops * 1000000u / window);
+    u->worst_loop_us = u->max_loop_us;
+    u->busy_us = 0;
+    u->loops = 0;
+    u->max_loop_us = 0;
+    u->window_start_us = now;
+}
+
+void core_util_print(const core_util_t* u) {
+    uint32_t pm = u->busy_permille;
+    debug_print("[CORE] %s: %lu.%lu%% busy, %lu loops/s, worst loop %lu us\n",
+                u->name, pm / 10, pm % 10, u->loops_per_s, u->worst_loop_us);
+}
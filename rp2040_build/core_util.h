@@ -0,0 +1,33 @@
+#ifndef CORE_UTIL_H
+#define CORE_UTIL_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Per-core loop accounting. Each core owns one of these and is the only
+// writer; the published fields are single words so the other core can read
+// them for the report without a lock.
+typedef struct {
+    const char* name;
+    uint32_t window_start_us;
+    uint64_t busy_us;
+    uint32_t loops;
+    uint32_t max_loop_us;
+
+    // Last closed window
+    volatile uint32_t busy_permille;
+    volatile uint32_t loops_per_s;
+    volatile uint32_t worst_loop_us;
+} core_util_t;
+
+#define CORE_UTIL_WINDOW_US 1000000u
+
+void core_util_init(core_util_t* u, const char* name);
+
+// Call once per loop iteration with the time the iteration started and
+// whether it found anything to do. Closes the window once a second.
+void core_util_account(core_util_t* u, uint32_t loop_start_us, bool busy);
+
+void core_util_print(const core_util_t* u);
+
+#endif // CORE_UTIL_H
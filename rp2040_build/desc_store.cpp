@@ -0,0 +1,113 @@
+#include "pico/stdlib.h"
+#include "hardware/flash.h"
+#include "pico/flash.h"
+#include "desc_store.h"
+#include <string.h>
+
+void debug_print(const char* format, ...);
+
+#define DESC_STORE_OFFSET  (PICO_FLASH_SIZE_BYTES - DESC_STORE_SLOTS * FLASH_SECTOR_SIZE)
+#define DESC_STORE_PROGRAM_LEN \
+    ((sizeof(dc_record_t) + FLASH_PAGE_SIZE - 1) / FLASH_PAGE_SIZE * FLASH_PAGE_SIZE)
+
+static_assert(DESC_STORE_PROGRAM_LEN <= FLASH_SECTOR_SIZE, "descriptor record must fit in one sector");
+
+// flash_range_program() wants whole pages from RAM
+static uint8_t store_page_buf[DESC_STORE_PROGRAM_LEN] __attribute__((aligned(4)));
+
+static const dc_record_t* slot_record(int slot) {
+    return reinterpret_cast<const dc_record_t*>(XIP_BASE + DESC_STORE_OFFSET + slot * FLASH_SECTOR_SIZE);
+}
+
+static uint32_t slot_offset(int slot) {
+    return DESC_STORE_OFFSET + (uint32_t)slot * FLASH_SECTOR_SIZE;
+}
+
+const dc_record_t* desc_store_latest(void) {
+    const dc_record_t* best = NULL;
+    for (int i = 0; i < DESC_STORE_SLOTS; i++) {
+        const dc_record_t* rec = slot_record(i);
+        if (dc_valid(rec) && (!best || rec->hdr.sequence > best->hdr.sequence)) best = rec;
+    }
+    return best;
+}
+
+const dc_record_t* desc_store_find(uint16_t vid, uint16_t pid, uint16_t bcd_device) {
+    for (int i = 0; i < DESC_STORE_SLOTS; i++) {
+        const dc_record_t* rec = slot_record(i);
+        if (dc_valid(rec) && dc_key_matches(rec, vid, pid, bcd_device)) return rec;
+    }
+    return NULL;
+}
+
+typedef struct {
+    int         slot;
+    const void* data;
+    size_t      len;
+} store_write_t;
+
+static void store_write_locked(void* param) {
+    const store_write_t* w = static_cast<const store_write_t*>(param);
+    flash_range_erase(slot_offset(w->slot), FLASH_SECTOR_SIZE);
+    if (w->data) flash_range_program(slot_offset(w->slot), static_cast<const uint8_t*>(w->data), w->len);
+}
+
+// XIP is off while the sector is rewritten, so the other core is parked in
+// RAM for the duration as well as interrupts on this one
+static void store_write_slot(int slot, const void* data, size_t len) {
+    store_write_t w = { slot, data, len };
+    int rc = flash_safe_execute(store_write_locked, &w, 100);
+    if (rc != PICO_OK) debug_print("[CACHE] Flash write to slot %d not done (%d)\n", slot, rc);
+}
+
+bool desc_store_save(dc_record_t* rec) {
+    int target = -1;
+    int oldest = 0;
+    uint32_t newest_seq = 0;
+    uint32_t oldest_seq = UINT32_MAX;
+
+    for (int i = 0; i < DESC_STORE_SLOTS; i++) {
+        const dc_record_t* cur = slot_record(i);
+        if (!dc_valid(cur)) {
+            // Free slot: best place for a new key
+            if (oldest_seq != 0) {
+                oldest = i;
+                oldest_seq = 0;
+            }
+            continue;
+        }
+        if (cur->hdr.sequence > newest_seq) newest_seq = cur->hdr.sequence;
+        if (cur->hdr.sequence < oldest_seq) {
+            oldest = i;
+            oldest_seq = cur->hdr.sequence;
+        }
+        if (dc_key_matches(cur, rec->hdr.vid, rec->hdr.pid, rec->hdr.bcd_device)) target = i;
+    }
+
+    if (target >= 0 && dc_same_content(slot_record(target), rec)) {
+        // Already stored; only bump it to newest if another device was used since
+        if (slot_record(target)->hdr.sequence == newest_seq) return true;
+    }
+    if (target < 0) target = oldest;
+
+    dc_seal(rec, newest_seq + 1);
+    memset(store_page_buf, 0xFF, sizeof(store_page_buf));
+    memcpy(store_page_buf, rec, sizeof(*rec));
+    store_write_slot(target, store_page_buf, sizeof(store_page_buf));
+
+    bool ok = dc_valid(slot_record(target));
+    debug_print("[CACHE] %04x:%04x bcd %04x saved to slot %d (seq %lu)%s\n",
+                rec->hdr.vid, rec->hdr.pid, rec->hdr.bcd_device, target,
+                rec->hdr.sequence, ok ? "" : " - VERIFY FAILED");
+    return ok;
+}
+
+void desc_store_invalidate(const dc_record_t* rec) {
+    for (int i = 0; i < DESC_STORE_SLOTS; i++) {
+        if (slot_record(i) == rec) {
+            store_write_slot(i, NULL, 0);
+            debug_print("[CACHE] Slot %d invalidated\n", i);
+            return;
+        }
+    }
+}
@@ -0,0 +1,25 @@
+#ifndef DESC_STORE_H
+#define DESC_STORE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "desc_cache.h"
+
+// Descriptor records live in the last DESC_STORE_SLOTS flash sectors, one per sector.
+#define DESC_STORE_SLOTS 4
+
+// Most recently saved valid record, read straight from XIP flash. NULL if none.
+const dc_record_t* desc_store_latest(void);
+
+// Record for a specific device, or NULL.
+const dc_record_t* desc_store_find(uint16_t vid, uint16_t pid, uint16_t bcd_device);
+
+// Write a record, replacing the slot with the same key (or the oldest one).
+// Skips the flash write if an identical record is already stored. Interrupts
+// are off for the erase/program, so call it outside of any latency-sensitive window.
+bool desc_store_save(dc_record_t* rec);
+
+// Drop a record that no longer matches its device.
+void desc_store_invalidate(const dc_record_t* rec);
+
+#endif // DESC_STORE_H
@@ -0,0 +1,475 @@
+#include "tusb.h"
+#include "pico/stdlib.h"
+#include "hid_passthrough.h"
+#include "spsc_ring.h"
+#include "hot_path.h"
+#include <string.h>
+
+void debug_print(const char* format, ...);
+
+#define PT_DESC_MAX 512
+#define PT_RING_DEPTH 16   // Reports in flight from core1 to core0
+
+//-----------------------------------------------------------------
+// State
+//-----------------------------------------------------------------
+// Only one host instance is presented to the PC; its descriptor is kept so
+// the device side can hand the same report layout back. Owned by core1 (host
+// side); core0 reads desc only while the PC enumerates.
+static struct {
+    bool      active;
+    uint8_t   dev_addr;
+    uint8_t   instance;
+    uint16_t  desc_len;
+    uint8_t   desc[PT_DESC_MAX];
+    hp_plan_t plan;
+} pt_src;
+
+// Host side -> device side messages. Reports are classified into their plan
+// slot on core1 and patched/sent on core0, which owns the override.
+typedef enum {
+    PT_MSG_REPORT = 0,
+    PT_MSG_PLAN,    // A new plan is waiting in pt_plan_ring
+    PT_MSG_RESUME,  // Compatible device reattached, plan unchanged
+    PT_MSG_UMOUNT   // Presented device gone: release held buttons
+} pt_msg_kind_t;
+
+typedef struct {
+    uint8_t  kind;
+    uint8_t  slot;
+    uint16_t len;
+    uint32_t rx_us;   // time_us_32() when the host stack handed the report over
+    uint8_t  data[CFG_TUH_HID_BUFSIZE];
+} pt_msg_t;
+
+static pt_msg_t    pt_ring_buf[PT_RING_DEPTH];
+static hp_plan_t   pt_plan_buf[2];
+static spsc_ring_t pt_ring;
+static spsc_ring_t pt_plan_ring;
+
+// Device side (core0) copy of the plan and the override applied to it
+static hp_plan_t pt_plan;
+static hp_override_t pt_override;
+
+// Latest report per plan slot (slot 0 = ID unknown to the plan). State
+// reports supersede each other, so a busy endpoint only ever costs the
+// intermediate reports of the same ID.
+typedef struct {
+    bool     valid;
+    bool     synthetic;  // Made up on core0 to carry injected input
+    uint16_t len;
+    uint32_t rx_us;
+    uint8_t  data[CFG_TUH_HID_BUFSIZE];
+} pt_pending_t;
+
+static pt_pending_t pt_pending[HP_MAX_REPORTS + 1];
+
+static volatile uint32_t pt_reports = 0;  // core1
+static uint32_t pt_patched = 0;           // core0 from here on
+static uint32_t pt_sent = 0;
+static uint32_t pt_superseded = 0;
+static uint64_t pt_first_report_us = 0;
+
+// Injected input the PC has not seen yet (core0)
+static hp_delta_t pt_delta;
+static bool       pt_refresh = false;  // Override changed: send a report even if the device is quiet
+static uint32_t   pt_inject_us = 0;    // Arrival of the oldest command still waiting, 0 = none
+static uint32_t   pt_synthesized = 0;
+
+// Report timing window (core0): spacing of reports out of the host
+// controller, and how long each took from there to the device endpoint
+static struct {
+    uint32_t last_rx_us;
+    uint32_t gaps;
+    uint64_t gap_sum_us;
+    uint32_t gap_max_us;
+    uint32_t sent;
+    uint64_t lat_sum_us;
+    uint32_t lat_max_us;
+    uint32_t injected;
+    uint64_t inj_sum_us;
+    uint32_t inj_max_us;
+} pt_timing;
+
+// Hot-swap timing: unplug -> compatible mount -> first report to the PC
+static uint64_t pt_umount_us = 0;           // core1
+static uint64_t pt_resume_us = 0;
+
+// Lifecycle messages core0 has not been handed yet because pt_ring was full
+// (core1). They go out in this order ahead of any further report, so core0
+// never patches a report with another layout's plan or keeps buttons held.
+static bool pt_umount_pending = false;
+static bool pt_plan_pending = false;
+static bool pt_resume_pending = false;
+
+static inline bool pt_lifecycle_pending(void) {
+    return pt_umount_pending || pt_plan_pending || pt_resume_pending;
+}
+
+void hid_passthrough_init(void) {
+    spsc_init(&pt_ring, pt_ring_buf, sizeof(pt_msg_t), PT_RING_DEPTH);
+    spsc_init(&pt_plan_ring, pt_plan_buf, sizeof(hp_plan_t), 2);
+}
+
+static bool pt_post(uint8_t kind) {
+    pt_msg_t* m = (pt_msg_t*)spsc_claim(&pt_ring);
+    if (!m) return false;
+    m->kind = kind;
+    m->slot = 0;
+    m->len = 0;
+    m->rx_us = time_us_32();
+    spsc_publish(&pt_ring);
+    return true;
+}
+
+// The plan and its message go out together or not at all: every plan in
+// pt_plan_ring has exactly one PLAN message behind it
+static bool pt_post_plan(void) {
+    pt_msg_t* m = (pt_msg_t*)spsc_claim(&pt_ring);
+    if (!m) return false;
+    if (!spsc_push(&pt_plan_ring, &pt_src.plan)) return false;
+    m->kind = PT_MSG_PLAN;
+    m->slot = 0;
+    m->len = 0;
+    m->rx_us = time_us_32();
+    spsc_publish(&pt_ring);
+    return true;
+}
+
+// Hand core0 whatever lifecycle messages are still waiting. Returns false
+// while any are.
+static bool pt_flush_lifecycle(void) {
+    if (pt_umount_pending) {
+        if (!pt_post(PT_MSG_UMOUNT)) return false;
+        pt_umount_pending = false;
+    }
+    if (pt_plan_pending) {
+        if (!pt_post_plan()) return false;
+        pt_plan_pending = false;
+    }
+    if (pt_resume_pending) {
+        if (!pt_post(PT_MSG_RESUME)) return false;
+        pt_resume_pending = false;
+    }
+    return true;
+}
+
+//-----------------------------------------------------------------
+// Host side
+//-----------------------------------------------------------------
+pt_mount_result_t hid_passthrough_mount(uint8_t dev_addr, uint8_t instance,
+                                        uint8_t const* desc_report, uint16_t desc_len) {
+    if (pt_src.active) {
+        debug_print("[HID] dev %u inst %u not presented, passthrough already bound to dev %u inst %u\n",
+                    dev_addr, instance, pt_src.dev_addr, pt_src.instance);
+        return PT_MOUNT_IGNORED;
+    }
+
+    if (desc_len > PT_DESC_MAX) {
+        debug_print("[HID] Report descriptor truncated (%u > %u bytes)\n", desc_len, PT_DESC_MAX);
+        desc_len = PT_DESC_MAX;
+    }
+    bool had_layout = pt_src.desc_len > 0;
+    bool same_layout = had_layout && pt_src.desc_len == desc_len &&
+                       memcmp(pt_src.desc, desc_report, desc_len) == 0;
+
+    pt_src.dev_addr = dev_addr;
+    pt_src.instance = instance;
+    pt_reports = 0;
+
+    if (same_layout && pt_src.plan.valid) {
+        // Compatible replacement: plan and PC-side enumeration both still hold.
+        // A plan still waiting for core0 resets it the same way.
+        if (!pt_plan_pending) pt_resume_pending = true;
+        pt_flush_lifecycle();
+        pt_src.active = true;
+        debug_print("[HID] Compatible device attached %lu ms after unplug, resuming\n",
+                    pt_umount_us ? (uint32_t)((time_us_64() - pt_umount_us) / 1000) : 0);
+        if (!tuh_hid_receive_report(dev_addr, instance)) {
+            debug_print("Failed to receive report\n");
+        }
+        return PT_MOUNT_RESUMED;
+    }
+
+    memcpy(pt_src.desc, desc_report, desc_len);
+    pt_src.desc_len = desc_len;
+
+    if (hp_compile(&pt_src.plan, pt_src.desc, pt_src.desc_len)) {
+        debug_print("[HID] Plan: %u input report(s)%s, axes=0x%03x buttons=0x%08lx\n",
+                    pt_src.plan.report_count, pt_src.plan.uses_report_id ? " with IDs" : "",
+                    pt_src.plan.axis_any, pt_src.plan.button_any);
+    } else {
+        debug_print("[HID] No input fields found, forwarding reports unmodified\n");
+    }
+    // Core0 swaps its copy in when it reaches the PLAN message, so reports
+    // queued under the previous plan are still patched with it
+    pt_plan_pending = true;
+    pt_resume_pending = false;
+    if (!pt_flush_lifecycle()) {
+        debug_print("[HID] Device side not draining, plan update deferred\n");
+    }
+
+    pt_src.active = true;
+
+    if (!tuh_hid_receive_report(dev_addr, instance)) {
+        debug_print("Failed to receive report\n");
+    }
+    if (!had_layout) return PT_MOUNT_NEW;
+    return same_layout ? PT_MOUNT_RESUMED : PT_MOUNT_CHANGED;
+}
+
+void hid_passthrough_umount(uint8_t dev_addr, uint8_t instance) {
+    if (!pt_src.active || dev_addr != pt_src.dev_addr || instance != pt_src.instance) return;
+    pt_src.active = false;
+    pt_umount_us = time_us_64();
+    // The device side releases whatever the device was holding
+    pt_umount_pending = true;
+    pt_flush_lifecycle();
+}
+
+bool hid_passthrough_host_task(void) {
+    if (!pt_lifecycle_pending()) return false;
+    return !pt_flush_lifecycle();
+}
+
+bool hid_passthrough_active(void) {
+    return pt_src.active;
+}
+
+void hid_passthrough_preload(uint8_t const* desc_report, uint16_t desc_len) {
+    if (pt_src.active) return;
+    if (desc_len > PT_DESC_MAX) desc_len = PT_DESC_MAX;
+    memcpy(pt_src.desc, desc_report, desc_len);
+    pt_src.desc_len = desc_len;
+}
+
+HOT_PATH void tuh_hid_report_received_cb(uint8_t dev_addr, uint8_t instance,
+                                         uint8_t const* report, uint16_t len) {
+    if (!pt_src.active || dev_addr != pt_src.dev_addr || instance != pt_src.instance) return;
+
+    // A full ring means core0 is stalled; the report is counted as dropped.
+    // One whose plan has not reached core0 yet is dropped as well.
+    pt_msg_t* m = NULL;
+    if (!pt_lifecycle_pending() || pt_flush_lifecycle()) m = (pt_msg_t*)spsc_claim(&pt_ring);
+    if (m) {
+        uint8_t slot = 0;
+        if (len > 0 && pt_src.plan.valid) {
+            slot = pt_src.plan.index_by_id[pt_src.plan.uses_report_id ? report[0] : 0];
+        }
+        if (len > sizeof(m->data)) len = sizeof(m->data);
+        m->kind = PT_MSG_REPORT;
+        m->slot = slot;
+        m->len = len;
+        m->rx_us = time_us_32();
+        memcpy(m->data, report, len);
+        spsc_publish(&pt_ring);
+    }
+    pt_reports++;
+
+    tuh_hid_receive_report(dev_addr, instance);
+}
+
+//-----------------------------------------------------------------
+// Device side
+//-----------------------------------------------------------------
+// Fold everything core1 has queued into the per-slot pending reports
+static HOT_PATH bool pt_drain(void) {
+    bool work = false;
+    const pt_msg_t* m;
+    while ((m = (const pt_msg_t*)spsc_peek(&pt_ring)) != NULL) {
+        work = true;
+        switch (m->kind) {
+            case PT_MSG_REPORT: {
+                pt_pending_t* p = &pt_pending[m->slot];
+                if (p->valid) pt_superseded++;
+                memcpy(p->data, m->data, m->len);
+                p->len = m->len;
+                p->rx_us = m->rx_us;
+                p->valid = true;
+                p->synthetic = false;
+
+                if (pt_timing.last_rx_us) {
+                    uint32_t gap = m->rx_us - pt_timing.last_rx_us;
+                    pt_timing.gaps++;
+                    pt_timing.gap_sum_us += gap;
+                    if (gap > pt_timing.gap_max_us) pt_timing.gap_max_us = gap;
+                }
+                pt_timing.last_rx_us = m->rx_us;
+                if (hp_override_active(&pt_plan, &pt_override) &&
+                    hp_apply(&pt_plan, &pt_override, p->data, p->len)) {
+                    pt_patched++;
+                }
+                break;
+            }
+            case PT_MSG_PLAN:
+                spsc_pop(&pt_plan_ring, &pt_plan);
+                // fall through
+            case PT_MSG_RESUME:
+                memset(pt_pending, 0, sizeof(pt_pending));
+                pt_patched = pt_sent = pt_superseded = 0;
+                pt_resume_us = m->kind == PT_MSG_RESUME ? time_us_64() : 0;
+                break;
+            case PT_MSG_UMOUNT:
+                // The PC stays enumerated, so let go of whatever the device was holding.
+                // Each slot still has the last report of its ID; send it with buttons up.
+                for (uint8_t s = 0; s <= HP_MAX_REPORTS; s++) {
+                    pt_pending_t* p = &pt_pending[s];
+                    if (p->len > 0 && hp_release(&pt_plan, p->data, p->len)) {
+                        p->valid = true;
+                        p->rx_us = m->rx_us;
+                    }
+                }
+                pt_resume_us = 0;
+                pt_timing.last_rx_us = 0;
+                debug_print("[HID] Passthrough stats: rx=%lu patched=%lu tx=%lu superseded=%lu dropped=%lu ring=%lu\n",
+                            pt_reports, pt_patched, pt_sent, pt_superseded, pt_ring.dropped, pt_ring.high_water);
+                break;
+        }
+        spsc_release(&pt_ring);
+    }
+    return work;
+}
+
+// Injected input needs a report to ride on. Use the device's pending one if
+// there is one, otherwise repeat its last report with nothing new in it.
+static HOT_PATH void pt_synthesize(void) {
+    for (uint8_t s = 1; s <= pt_plan.report_count; s++) {
+        const hp_report_plan_t* rp = &pt_plan.reports[s - 1];
+        bool carries = (rp->axis_relative & pt_delta.axis_mask) != 0 ||
+                       (pt_refresh && ((rp->button_present & pt_override.button_mask) != 0 ||
+                                       (rp->axis_present & pt_override.axis_mask) != 0));
+        if (!carries) continue;
+
+        pt_pending_t* p = &pt_pending[s];
+        if (!p->valid) {
+            if (p->len == 0) {
+                // Nothing from the device yet: all buttons up, all axes zero
+                uint16_t len = (uint16_t)(rp->size_bytes + (pt_plan.uses_report_id ? 1 : 0));
+                p->len = len < sizeof(p->data) ? len : sizeof(p->data);
+                memset(p->data, 0, p->len);
+                if (pt_plan.uses_report_id) p->data[0] = rp->report_id;
+            } else {
+                hp_idle(&pt_plan, p->data, p->len);
+            }
+            if (hp_override_active(&pt_plan, &pt_override)) hp_apply(&pt_plan, &pt_override, p->data, p->len);
+            p->rx_us = pt_inject_us;
+            p->valid = true;
+            p->synthetic = true;
+            pt_synthesized++;
+        }
+        break;
+    }
+    pt_refresh = false;
+}
+
+HOT_PATH bool hid_passthrough_task(void) {
+    bool work = pt_drain();
+
+    // Release reports still go out while no device is attached
+    if (!tud_hid_ready()) return work;
+
+    if (pt_plan.valid && (pt_delta.axis_mask || pt_refresh)) pt_synthesize();
+
+    for (uint8_t s = 0; s <= HP_MAX_REPORTS; s++) {
+        pt_pending_t* p = &pt_pending[s];
+        if (!p->valid) continue;
+
+        if (pt_delta.axis_mask) hp_add_delta(&pt_plan, &pt_delta, p->data, p->len);
+
+        bool sent;
+        if (pt_plan.uses_report_id && p->len > 0) {
+            sent = tud_hid_report(p->data[0], p->data + 1, (uint16_t)(p->len - 1));
+        } else {
+            sent = tud_hid_report(0, p->data, p->len);
+        }
+        if (sent) {
+            uint32_t now = time_us_32();
+            uint32_t lat = now - p->rx_us;
+            p->valid = false;
+            pt_sent++;
+            if (!p->synthetic) {
+                pt_timing.sent++;
+                pt_timing.lat_sum_us += lat;
+                if (lat > pt_timing.lat_max_us) pt_timing.lat_max_us = lat;
+            }
+            if (pt_inject_us && !pt_delta.axis_mask && !pt_refresh) {
+                // Everything injected so far is on its way to the PC
+                uint32_t inj = now - pt_inject_us;
+                pt_timing.injected++;
+                pt_timing.inj_sum_us += inj;
+                if (inj > pt_timing.inj_max_us) pt_timing.inj_max_us = inj;
+                pt_inject_us = 0;
+            }
+            if (pt_first_report_us == 0) pt_first_report_us = time_us_64();
+            if (pt_resume_us) {
+                debug_print("[HID] Forwarding resumed %lu us after reattach\n",
+                            (uint32_t)(time_us_64() - pt_resume_us));
+                pt_resume_us = 0;
+            }
+        }
+        // One report per endpoint slot; the rest go out on the next call
+        return true;
+    }
+    return work;
+}
+
+void hid_passthrough_print_timing(const char* backend) {
+    if (pt_timing.sent == 0 && pt_timing.injected == 0) return;
+    if (pt_timing.sent) {
+        uint32_t gap_avg = pt_timing.gaps ? (uint32_t)(pt_timing.gap_sum_us / pt_timing.gaps) : 0;
+        debug_print("[BENCH] %s: %lu reports, interval avg %lu max %lu us, host->PC avg %lu max %lu us\n",
+                    backend, pt_timing.sent, gap_avg, pt_timing.gap_max_us,
+                    (uint32_t)(pt_timing.lat_sum_us / pt_timing.sent), pt_timing.lat_max_us);
+    }
+    if (pt_timing.injected) {
+        debug_print("[BENCH] injected: %lu commands, command->PC avg %lu max %lu us (%lu reports made up)\n",
+                    pt_timing.injected, (uint32_t)(pt_timing.inj_sum_us / pt_timing.injected),
+                    pt_timing.inj_max_us, pt_synthesized);
+    }
+    uint32_t last_rx = pt_timing.last_rx_us;
+    memset(&pt_timing, 0, sizeof(pt_timing));
+    pt_timing.last_rx_us = last_rx;
+}
+
+uint64_t hid_passthrough_first_report_us(void) {
+    return pt_first_report_us;
+}
+
+uint8_t const* hid_passthrough_report_descriptor(uint16_t* len) {
+    if (pt_src.desc_len == 0) return NULL;
+    if (len) *len = pt_src.desc_len;
+    return pt_src.desc;
+}
+
+HOT_PATH void hid_passthrough_set_override(const hp_override_t* ovr) {
+    pt_override = *ovr;
+    pt_refresh = true;
+    if (!pt_inject_us) pt_inject_us = time_us_32();
+}
+
+HOT_PATH bool hid_passthrough_override_pending(void) {
+    return pt_refresh;
+}
+
+void hid_passthrough_clear_override(void) {
+    memset(&pt_override, 0, sizeof(pt_override));
+    pt_refresh = true;
+}
+
+HOT_PATH void hid_passthrough_inject(const hp_delta_t* d, uint32_t stamp_us) {
+    uint16_t axes = d->axis_mask;
+    while (axes) {
+        uint8_t a = (uint8_t)__builtin_ctz(axes);
+        axes &= (uint16_t)(axes - 1);
+        int64_t sum = (int64_t)pt_delta.axis[a] + d->axis[a];
+        if (sum > INT32_MAX) sum = INT32_MAX;
+        if (sum < INT32_MIN) sum = INT32_MIN;
+        pt_delta.axis[a] = (int32_t)sum;
+        if (sum) {
+            pt_delta.axis_mask |= (uint16_t)(1u << a);
+        } else {
+            pt_delta.axis_mask &= (uint16_t)~(1u << a);
+        }
+    }
+    if (!pt_inject_us) pt_inject_us = stamp_us ? stamp_us : 1;
+}
@@ -0,0 +1,63 @@
+#ifndef HID_PASSTHROUGH_H
+#define HID_PASSTHROUGH_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "hid_plan.h"
+
+typedef enum {
+    PT_MOUNT_IGNORED = 0,  // Another instance is already presented
+    PT_MOUNT_NEW,          // No layout presented to the PC before this device
+    PT_MOUNT_RESUMED,      // Same report layout as before: the PC keeps its enumeration
+    PT_MOUNT_CHANGED       // Different layout: the PC has to re-enumerate to see it
+} pt_mount_result_t;
+
+// Set up the core1 -> core0 report rings. Call before either core touches them.
+void hid_passthrough_init(void);
+
+// Host-side (core1) HID instance lifecycle (called from tuh_hid_mount_cb/umount_cb).
+// The first instance mounted is the one presented to the PC.
+pt_mount_result_t hid_passthrough_mount(uint8_t dev_addr, uint8_t instance,
+                           uint8_t const* desc_report, uint16_t desc_len);
+void hid_passthrough_umount(uint8_t dev_addr, uint8_t instance);
+bool hid_passthrough_active(void);
+
+// Core1 loop: retry handing core0 a mount or unmount that found the report
+// ring full. Returns true while one is still waiting.
+bool hid_passthrough_host_task(void);
+
+// Present a report descriptor before any device has mounted (descriptor cache).
+void hid_passthrough_preload(uint8_t const* desc_report, uint16_t desc_len);
+
+// Report descriptor of the presented instance, or NULL before one has mounted.
+// Kept across unplug so the PC-facing layout does not change under it.
+uint8_t const* hid_passthrough_report_descriptor(uint16_t* len);
+
+// Replace the active axis/button overrides (network injection). Core0 only.
+// Takes effect on the next report.
+void hid_passthrough_set_override(const hp_override_t* ovr);
+void hid_passthrough_clear_override(void);
+
+// True while the last override change has not ridden out on a report yet,
+// so a second change now would replace it unseen. Core0 only.
+bool hid_passthrough_override_pending(void);
+
+// Add relative motion (network injection, counts in the device's own units)
+// to the next report. If the device has nothing to send, its last report is
+// repeated with the motion in it, so injected input does not wait for the
+// physical device. stamp_us is the time_us_32() the command arrived, for the
+// command->PC timing. Core0 only.
+void hid_passthrough_inject(const hp_delta_t* d, uint32_t stamp_us);
+
+// Core0: print report spacing and host->PC latency since the last call, then
+// start a new window. Prints nothing if no report went out.
+void hid_passthrough_print_timing(const char* backend);
+
+// time_us_64() when the first report reached the PC, 0 until then.
+uint64_t hid_passthrough_first_report_us(void);
+
+// Device side (core0): drain reports queued by core1, patch them and send the
+// next pending one to the PC. Never blocks. Returns true if it did any work.
+bool hid_passthrough_task(void);
+
+#endif // HID_PASSTHROUGH_H
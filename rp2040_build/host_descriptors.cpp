@@ -0,0 +1,122 @@
+#include "tusb.h"
+#include "host_descriptors.h"
+#include <string.h>
+
+void debug_print(const char* format, ...);
+
+#define HOST_DESC_CONFIG_BUF_SIZE  256
+#define HOST_DESC_STRING_BUF_SIZE  128
+#define HOST_DESC_STRINGS          3     // Manufacturer, product, serial
+#define HOST_DESC_LANGID_EN_US     0x0409
+
+//-----------------------------------------------------------------
+// State
+//-----------------------------------------------------------------
+// Only the first device mounted is cloned; anything behind it is ignored
+static struct {
+    bool     mounted;
+    bool     ready;
+    uint8_t  dev_addr;
+    uint8_t  string_index[HOST_DESC_STRINGS];
+    uint16_t config_len;
+    tusb_desc_device_t device;
+    uint8_t  config[HOST_DESC_CONFIG_BUF_SIZE];
+    uint16_t strings[HOST_DESC_STRINGS][HOST_DESC_STRING_BUF_SIZE / 2];
+} hd_dev;
+
+//-----------------------------------------------------------------
+// Descriptor capture
+//-----------------------------------------------------------------
+static void fetch_string(uint8_t slot);
+
+static void string_complete(tuh_xfer_t* xfer) {
+    uint8_t slot = (uint8_t)xfer->user_data;
+    if (!hd_dev.mounted || xfer->daddr != hd_dev.dev_addr) return;
+    if (xfer->result != XFER_RESULT_SUCCESS) {
+        debug_print("[HOST] String %u not read (%d)\n", hd_dev.string_index[slot], xfer->result);
+        hd_dev.strings[slot][0] = 0;
+    }
+    fetch_string((uint8_t)(slot + 1));
+}
+
+// Walk the three identity strings one at a time; EP0 takes one request
+static void fetch_string(uint8_t slot) {
+    for (; slot < HOST_DESC_STRINGS; slot++) {
+        if (hd_dev.string_index[slot] == 0) continue;
+        if (tuh_descriptor_get_string(hd_dev.dev_addr, hd_dev.string_index[slot], HOST_DESC_LANGID_EN_US,
+                                      hd_dev.strings[slot], sizeof(hd_dev.strings[slot]),
+                                      string_complete, slot)) {
+            return;
+        }
+        debug_print("[HOST] String %u request refused\n", hd_dev.string_index[slot]);
+    }
+    hd_dev.ready = true;
+    debug_print("[HOST] Descriptors of dev %u captured\n", hd_dev.dev_addr);
+}
+
+static void config_complete(tuh_xfer_t* xfer) {
+    if (!hd_dev.mounted || xfer->daddr != hd_dev.dev_addr) return;
+    if (xfer->result != XFER_RESULT_SUCCESS) {
+        debug_print("[HOST] Configuration descriptor not read (%d)\n", xfer->result);
+        hd_dev.config_len = 0;
+    } else {
+        const tusb_desc_configuration_t* cfg = (const tusb_desc_configuration_t*)hd_dev.config;
+        hd_dev.config_len = tu_min16(tu_le16toh(cfg->wTotalLength), (uint16_t)xfer->actual_len);
+    }
+    fetch_string(0);
+}
+
+void tuh_mount_cb(uint8_t dev_addr) {
+    if (hd_dev.mounted) return;
+    if (!tuh_descriptor_get_device_local(dev_addr, &hd_dev.device)) return;
+
+    memset(hd_dev.strings, 0, sizeof(hd_dev.strings));
+    hd_dev.dev_addr = dev_addr;
+    hd_dev.string_index[0] = hd_dev.device.iManufacturer;
+    hd_dev.string_index[1] = hd_dev.device.iProduct;
+    hd_dev.string_index[2] = hd_dev.device.iSerialNumber;
+    hd_dev.config_len = 0;
+    hd_dev.ready = false;
+    hd_dev.mounted = true;
+    debug_print("[HOST] Dev %u mounted (%04x:%04x), reading descriptors\n",
+                dev_addr, hd_dev.device.idVendor, hd_dev.device.idProduct);
+
+    if (!tuh_descriptor_get_configuration(dev_addr, 0, hd_dev.config, sizeof(hd_dev.config),
+                                          config_complete, 0)) {
+        debug_print("[HOST] Configuration request refused\n");
+        fetch_string(0);
+    }
+}
+
+void tuh_umount_cb(uint8_t dev_addr) {
+    if (!hd_dev.mounted || dev_addr != hd_dev.dev_addr) return;
+    hd_dev.mounted = false;
+    hd_dev.ready = false;
+    debug_print("[HOST] Dev %u unmounted\n", dev_addr);
+}
+
+//-----------------------------------------------------------------
+// Public API
+//-----------------------------------------------------------------
+bool host_desc_mounted(void) {
+    return hd_dev.mounted;
+}
+
+bool host_desc_ready(void) {
+    return hd_dev.mounted && hd_dev.ready;
+}
+
+const uint8_t* host_desc_device(size_t* len) {
+    *len = sizeof(hd_dev.device);
+    return (const uint8_t*)&hd_dev.device;
+}
+
+const uint8_t* host_desc_config(size_t* len) {
+    *len = hd_dev.config_len;
+    return hd_dev.config;
+}
+
+const uint16_t* host_desc_string(uint8_t slot) {
+    if (slot >= HOST_DESC_STRINGS || (hd_dev.strings[slot][0] & 0xFF) < 2) return NULL;
+    return hd_dev.strings[slot];
+}
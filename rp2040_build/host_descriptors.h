@@ -0,0 +1,28 @@
+#ifndef HOST_DESCRIPTORS_H
+#define HOST_DESCRIPTORS_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+// Descriptors of the device TinyUSB has mounted, read through the host stack
+// when it mounts. Once the stack owns the host controller, this is the only
+// way to get at them: a raw reset and control transfers would knock the
+// device out from under TinyUSB. Every backend uses it then; the PIO host
+// has nothing else. Everything here runs on core1.
+
+// A device is mounted.
+bool host_desc_mounted(void);
+
+// Device, configuration and string descriptors of the mounted device have
+// all arrived. Cleared again on unmount.
+bool host_desc_ready(void);
+
+const uint8_t* host_desc_device(size_t* len);
+const uint8_t* host_desc_config(size_t* len);
+
+// Raw UTF-16LE string descriptor for slot 0..2 (manufacturer, product,
+// serial), header included. NULL if the device has none.
+const uint16_t* host_desc_string(uint8_t slot);
+
+#endif // HOST_DESCRIPTORS_H
@@ -0,0 +1,20 @@
+#include "tusb.h"
+#include "pio_usb.h"
+#include "hardware/dma.h"
+#include "host_pio_usb.h"
+
+void debug_print(const char* format, ...);
+
+//-----------------------------------------------------------------
+// Public API
+//-----------------------------------------------------------------
+void host_pio_usb_init(void) {
+    // The PIO bit clocks need a 12 MHz multiple; main() sets 120 MHz
+    static pio_usb_configuration_t pio_cfg = PIO_USB_DEFAULT_CONFIG;
+    pio_cfg.pin_dp = PIO_USB_DP_PIN;
+    // The default TX channel (0) is not claimed, so core0's W5500 and UART
+    // drivers could take it first; claim one like they do
+    pio_cfg.tx_ch = (uint8_t)dma_claim_unused_channel(true);
+    tuh_configure(BOARD_TUH_RHPORT, TUH_CFGID_RPI_PIO_USB_CONFIGURATION, &pio_cfg);
+    debug_print("[PIO] USB host on D+ GPIO%d / D- GPIO%d\n", PIO_USB_DP_PIN, PIO_USB_DP_PIN + 1);
+}
@@ -0,0 +1,15 @@
+#ifndef HOST_PIO_USB_H
+#define HOST_PIO_USB_H
+
+#include <stdint.h>
+
+// Native full/low-speed USB host on two RP2040 GPIOs (Pico-PIO-USB), used in
+// place of the MAX3421E when the build sets SR71_HOST_BACKEND=PIO_USB.
+// TinyUSB's hcd_pio_usb drives the bus and this module configures it; there
+// is no separate chip to read descriptors through, so they always come from
+// host_descriptors. Runs on core1.
+
+// Hand the PIO/pin configuration to TinyUSB. Must be called before tuh_init().
+void host_pio_usb_init(void);
+
+#endif // HOST_PIO_USB_H
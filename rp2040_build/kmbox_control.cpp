@@ -0,0 +1,279 @@
+#include "pico/stdlib.h"
+#include "pico/unique_id.h"
+#include "hardware/watchdog.h"
+#include "hot_path.h"
+#include "hid_passthrough.h"
+#include "kmbox_control.h"
+#include "cmd_wheel.h"
+#include "jitter_buf.h"
+#include "spsc_ring.h"
+#include <string.h>
+
+void debug_print(const char* format, ...);
+
+static uint32_t kc_arrival_us = 0;
+static bool kc_reboot = false;
+
+// Software side of the mouse: buttons the client holds and inputs it masked
+static uint8_t kc_buttons = 0;
+static uint32_t kc_mask = 0;
+
+// Scheduled commands: the wheel holds them until their execute-at time,
+// then they queue in order for the report composer
+static cw_wheel_t kc_wheel;
+static kp_mouse_t kc_ready_buf[KC_READY_DEPTH];
+static spsc_ring_t kc_ready;
+static uint32_t kc_held_since = 0;  // A button change is waiting for the last one to go out
+
+// Per transport session: the handlers' ctx
+typedef struct {
+    const char* name;
+    jb_t        jb;      // Playout buffer, off until the client asks for it
+} kc_session_t;
+
+static kc_session_t kc_sessions[KC_SESSIONS];
+static uint8_t kc_session_count = 0;
+
+static struct {
+    uint32_t on_time;
+    uint32_t late;
+    uint32_t dropped;
+    uint32_t too_far;      // Refused: beyond KC_AT_MAX_AHEAD_US
+    uint32_t overflow;     // Wheel or queue full, run on arrival
+    uint32_t err_max_us;   // Release after the execute-at time, on-time ones
+    uint64_t err_sum_us;
+    uint32_t late_max_us;
+} kc_sched;
+
+//--------------------------------------------------------------------
+// Handlers
+//--------------------------------------------------------------------
+// Buttons the client holds or has masked are forced to its state; the rest
+// pass through from the physical device. Masked axes are held at rest so
+// only injected motion gets through.
+static HOT_PATH void kc_update_override(void) {
+    hp_override_t ovr;
+    memset(&ovr, 0, sizeof(ovr));
+    ovr.button_mask = (kc_buttons | (kc_mask & KP_MASK_BUTTONS)) & KP_MASK_BUTTONS;
+    ovr.buttons = kc_buttons;
+    if (kc_mask & KP_MASK_X) ovr.axis_mask |= 1u << HP_AXIS_X;
+    if (kc_mask & KP_MASK_Y) ovr.axis_mask |= 1u << HP_AXIS_Y;
+    if (kc_mask & KP_MASK_WHEEL) ovr.axis_mask |= 1u << HP_AXIS_WHEEL;
+    hid_passthrough_set_override(&ovr);
+}
+
+// Apply one command to the next report. stamp_us is where the command->PC
+// timing starts: arrival for immediate commands, release for scheduled ones.
+static HOT_PATH void kc_execute(const kp_mouse_t* m, uint32_t stamp_us) {
+    hp_delta_t d;
+    memset(&d, 0, sizeof(d));
+
+    switch (m->kind) {
+        case KP_MOUSE_BUTTONS:
+            if (m->buttons != kc_buttons) {
+                kc_buttons = m->buttons;
+                kc_update_override();
+            }
+            return;
+        case KP_MOUSE_WHEEL:
+            d.axis[HP_AXIS_WHEEL] = m->wheel;
+            d.axis_mask = 1u << HP_AXIS_WHEEL;
+            break;
+        default:
+            // Auto and Bezier moves land in one go; only the end point is used
+            d.axis[HP_AXIS_X] = m->x;
+            d.axis[HP_AXIS_Y] = m->y;
+            d.axis_mask = (1u << HP_AXIS_X) | (1u << HP_AXIS_Y);
+            break;
+    }
+    hid_passthrough_inject(&d, stamp_us);
+}
+
+static HOT_PATH void kc_queue(const kp_mouse_t* m) {
+    if (!spsc_push(&kc_ready, m)) {
+        kc_sched.overflow++;
+        kc_execute(m, time_us_32());
+    }
+}
+
+static HOT_PATH void kc_late(const kp_mouse_t* m, uint64_t now) {
+    uint32_t late = (uint32_t)(now - m->at_us);
+    kc_sched.late++;
+    if (late > kc_sched.late_max_us) kc_sched.late_max_us = late;
+    switch (m->late) {
+        case KP_LATE_DROP:
+            kc_sched.dropped++;
+            break;
+        case KP_LATE_COMPRESS:
+            // Straight into the composer: late motion sums into one report
+            // and only the last button state survives
+            kc_execute(m, (uint32_t)now);
+            break;
+        default:
+            kc_queue(m);
+            break;
+    }
+}
+
+static HOT_PATH void kc_due(void* ctx, const kp_mouse_t* m, uint64_t now) {
+    (void) ctx;
+    uint32_t err = (uint32_t)(now - m->at_us);
+    if (err > KC_LATE_SLACK_US) {
+        kc_late(m, now);
+        return;
+    }
+    kc_sched.on_time++;
+    kc_sched.err_sum_us += err;
+    if (err > kc_sched.err_max_us) kc_sched.err_max_us = err;
+    kc_queue(m);
+}
+
+static HOT_PATH void kc_play(void* ctx, const kp_mouse_t* m) {
+    (void) ctx;
+    kc_queue(m);
+}
+
+static HOT_PATH bool kc_mouse(void* ctx, const kp_mouse_t* m) {
+    kc_session_t* sess = (kc_session_t*)ctx;
+    if (!m->at_us) {
+        if (sess && jb_enabled(&sess->jb)) {
+            jb_push(&sess->jb, m, kc_arrival_us, kc_play, sess);
+        } else {
+            kc_execute(m, kc_arrival_us);
+        }
+        return true;
+    }
+
+    uint64_t now = time_us_64();
+    if (m->at_us > now + KC_AT_MAX_AHEAD_US) {
+        kc_sched.too_far++;
+        return false;
+    }
+    if (m->at_us <= now) {
+        kc_late(m, now);
+    } else if (!cw_add(&kc_wheel, m)) {
+        kc_sched.overflow++;
+        kc_execute(m, kc_arrival_us);
+    }
+    return true;
+}
+
+static bool kc_playout_cb(void* ctx, uint32_t max_delay_us) {
+    kc_session_t* sess = (kc_session_t*)ctx;
+    if (!sess) return false;
+    jb_flush(&sess->jb, time_us_32(), kc_play, sess);
+    jb_init(&sess->jb, max_delay_us);
+    debug_print("[KMBOX] %s: playout buffer %s (up to %lu us)\n", sess->name,
+                jb_enabled(&sess->jb) ? "on" : "off", sess->jb.max_delay_us);
+    return true;
+}
+
+static uint64_t kc_now_us(void* ctx) {
+    (void) ctx;
+    return time_us_64();
+}
+
+static bool kc_mask_cb(void* ctx, uint32_t mask) {
+    (void) ctx;
+    kc_mask = mask;
+    kc_update_override();
+    return true;
+}
+
+static bool kc_reboot_cb(void* ctx) {
+    (void) ctx;
+    kc_reboot = true;  // After the reply is out
+    return true;
+}
+
+//--------------------------------------------------------------------
+// Public API
+//--------------------------------------------------------------------
+uint32_t kmbox_control_uuid(void) {
+    pico_unique_board_id_t id;
+    pico_get_unique_board_id(&id);
+    const uint8_t* u = id.id;
+    const int n = PICO_UNIQUE_BOARD_ID_SIZE_BYTES;
+    return ((uint32_t)u[n - 4] << 24) | ((uint32_t)u[n - 3] << 16) |
+           ((uint32_t)u[n - 2] << 8) | u[n - 1];
+}
+
+void kmbox_control_session_init(kp_session_t* s, const char* name) {
+    kp_handlers_t h;
+    memset(&h, 0, sizeof(h));
+    if (kc_session_count < KC_SESSIONS) {
+        kc_session_t* sess = &kc_sessions[kc_session_count++];
+        sess->name = name;
+        jb_init(&sess->jb, 0);
+        h.ctx = sess;
+        h.playout = kc_playout_cb;
+    }
+    h.mouse = kc_mouse;
+    h.mask = kc_mask_cb;
+    h.reboot = kc_reboot_cb;
+    h.now_us = kc_now_us;
+    kp_init(s, kmbox_control_uuid(), &h);
+}
+
+void kmbox_control_init(void) {
+    cw_init(&kc_wheel, time_us_64());
+    spsc_init(&kc_ready, kc_ready_buf, sizeof(kp_mouse_t), KC_READY_DEPTH);
+}
+
+HOT_PATH bool kmbox_control_task(void) {
+    bool work = cw_advance(&kc_wheel, time_us_64(), kc_due, NULL);
+    for (uint8_t i = 0; i < kc_session_count; i++) {
+        if (kc_sessions[i].jb.count) work |= jb_poll(&kc_sessions[i].jb, time_us_32(), kc_play, &kc_sessions[i]);
+    }
+
+    const kp_mouse_t* m;
+    while ((m = (const kp_mouse_t*)spsc_peek(&kc_ready)) != NULL) {
+        // One button change per report, so a click released together with
+        // its press still reaches the PC as a click. A composer with no
+        // device to report through is only waited on for so long.
+        if (m->kind == KP_MOUSE_BUTTONS && m->buttons != kc_buttons && hid_passthrough_override_pending()) {
+            uint32_t now = time_us_32();
+            if (!kc_held_since) kc_held_since = now | 1;
+            if (now - kc_held_since < KC_BUTTON_HOLD_MAX_US) break;
+        }
+        kc_held_since = 0;
+        kc_execute(m, time_us_32());
+        spsc_release(&kc_ready);
+        work = true;
+    }
+    return work;
+}
+
+void kmbox_control_print_stats(void) {
+    for (uint8_t i = 0; i < kc_session_count; i++) {
+        jb_t* jb = &kc_sessions[i].jb;
+        if (!jb_enabled(jb) || jb->stats.played == 0) continue;
+        debug_print("[PLAYOUT] %s: delay target %lu us (max %lu), interval %lu jitter %lu us, %lu moves held "
+                    "avg %lu max %lu us, %lu underruns %lu overruns %lu restarts\n",
+                    kc_sessions[i].name, jb->delay_us, jb->max_delay_us, jb_interval_us(jb), jb_jitter_us(jb),
+                    jb->stats.played, (uint32_t)(jb->stats.delay_sum_us / jb->stats.played),
+                    jb->stats.delay_max_us, jb->stats.underruns, jb->stats.overruns, jb->stats.restarts);
+        memset(&jb->stats, 0, sizeof(jb->stats));
+    }
+
+    if (kc_wheel.stats.scheduled == 0 && kc_sched.late == 0 && kc_sched.too_far == 0) return;
+    uint32_t err_avg = kc_sched.on_time ? (uint32_t)(kc_sched.err_sum_us / kc_sched.on_time) : 0;
+    debug_print("[SCHED] %lu on time (release error avg %lu max %lu us), %lu late (max %lu us, %lu dropped), "
+                "%lu too far ahead, %lu overflow, wheel high water %lu\n",
+                kc_sched.on_time, err_avg, kc_sched.err_max_us, kc_sched.late, kc_sched.late_max_us,
+                kc_sched.dropped, kc_sched.too_far, kc_sched.overflow, kc_wheel.stats.high_water);
+    memset(&kc_sched, 0, sizeof(kc_sched));
+    kc_wheel.stats.high_water = kc_wheel.count;
+    kc_wheel.stats.scheduled = 0;
+}
+
+HOT_PATH void kmbox_control_set_arrival(uint32_t us) {
+    kc_arrival_us = us;
+}
+
+HOT_PATH void kmbox_control_reply_sent(void) {
+    if (!kc_reboot) return;
+    debug_print("[KMBOX] Reboot requested\n");
+    watchdog_reboot(0, 0, 10);
+    while (true) tight_loop_contents();
+}
@@ -0,0 +1,51 @@
+#ifndef KMBOX_CONTROL_H
+#define KMBOX_CONTROL_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "kmbox_proto.h"
+
+// KMBox command handlers shared by every control transport (W5500 UDP,
+// UART). There is one mouse, so held buttons and masks are common state;
+// each transport keeps its own session (connect state, counters). Core0 only.
+//
+// Mouse commands with an execute-at time (kmbox_proto) wait in a timer
+// wheel and are released into the report composer when time_us_64()
+// reaches it; clients line their clock up with KP_CMD_TIME_SYNC. A command
+// whose time has passed by more than KC_LATE_SLACK_US follows its late
+// policy: run in order, drop, or fold into the next report.
+//
+// Each session can also turn on a playout buffer (KP_CMD_PLAYOUT) that
+// evens out bursty arrival of streamed moves at the cost of a bounded,
+// adaptive delay; [PLAYOUT] reports what it is costing.
+
+#define KC_LATE_SLACK_US      250       // Two wheel ticks
+#define KC_AT_MAX_AHEAD_US    1000000   // Further out is refused
+#define KC_READY_DEPTH        16        // Released, waiting for the composer
+#define KC_BUTTON_HOLD_MAX_US 4000      // Longest a button change waits for the previous one
+#define KC_SESSIONS           2         // One per transport
+
+// UUID clients connect with: the low four bytes of the flash unique id
+uint32_t kmbox_control_uuid(void);
+
+// Set up the command scheduler. Call before any session is initialised.
+void kmbox_control_init(void);
+
+// Core0: release due commands into the report composer. Returns true if it
+// did any work.
+bool kmbox_control_task(void);
+
+void kmbox_control_print_stats(void);
+
+// kp_init() the session with the shared handlers and the board UUID. name
+// labels its stats.
+void kmbox_control_session_init(kp_session_t* s, const char* name);
+
+// Arrival time of the command about to go through kp_handle(), used for the
+// command->PC latency in [BENCH]
+void kmbox_control_set_arrival(uint32_t us);
+
+// Call once the reply to a command has been sent. Reboots if it asked to.
+void kmbox_control_reply_sent(void);
+
+#endif // KMBOX_CONTROL_H
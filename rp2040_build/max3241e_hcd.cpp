@@ -1,11 +1,243 @@
 #include "tusb.h"
+#include "host/hcd.h"
 #include "adafruit_max3421e.h"
+#include "max3241e_hcd.h"
+#include "hot_path.h"
 #include "hardware/spi.h"
 #include "pico/stdlib.h"
 #include <string.h>
-// Create a static instance of the MAX3421E driver.
-// Using SPI0, CS=17, INT=9, RESET=12.
-static Adafruit_MAX3421E max3421(spi0, 17, 9, 12); 
+
+void debug_print(const char* format, ...);
+
+// Control endpoints for address 0 and the enumerated device, plus a
+// keyboard/mouse composite's worth of interrupt and bulk endpoints
+#define HCD_MAX_EP            8
+// IN tokens an interrupt endpoint may burn on NAKs before it waits for its
+// next interval. Bounded so one idle endpoint cannot hold the chip for the
+// whole frame.
+#define HCD_NAK_RETRIES       4
+// Async (control/bulk) NAKs get the same treatment per pass
+#define HCD_ASYNC_NAK_RETRIES 4
+
+typedef struct {
+    bool     used;
+    bool     busy;
+    bool     setup;          // Busy with a SETUP rather than a data stage
+    bool     toggle;
+    uint8_t  dev_addr;
+    uint8_t  ep_addr;
+    uint8_t  xfer_addr;      // ep_addr with the direction of the queued stage (EP0)
+    uint8_t  type;           // TUSB_XFER_*
+    uint16_t mps;
+    uint8_t  interval;       // Frames; 0 for control/bulk
+    uint32_t next_frame;
+    bool     polled;         // Already tried in the frame next_frame names
+    uint8_t* buffer;
+    uint16_t length;
+    uint16_t done;
+    uint8_t  setup_pkt[8];
+    max3421e_hcd_ep_stats_t stats;
+} hcd_ep_t;
+
+static Adafruit_MAX3421E* hcd_drv = nullptr;
+static hcd_ep_t hcd_ep[HCD_MAX_EP];
+static uint8_t hcd_rr = 0;   // Round-robin start for interrupt endpoints
+
+//--------------------------------------------------------------------
+// Endpoint table
+//--------------------------------------------------------------------
+static HOT_PATH hcd_ep_t* ep_find(uint8_t dev_addr, uint8_t ep_addr) {
+    // Control endpoints are bidirectional: 0x00 and 0x80 share a slot
+    if (tu_edpt_number(ep_addr) == 0) ep_addr = 0;
+    for (uint8_t i = 0; i < HCD_MAX_EP; i++) {
+        hcd_ep_t* ep = &hcd_ep[i];
+        if (ep->used && ep->dev_addr == dev_addr && ep->ep_addr == ep_addr) return ep;
+    }
+    return nullptr;
+}
+
+static hcd_ep_t* ep_alloc(uint8_t dev_addr, uint8_t ep_addr) {
+    if (tu_edpt_number(ep_addr) == 0) ep_addr = 0;
+    hcd_ep_t* ep = ep_find(dev_addr, ep_addr);
+    for (uint8_t i = 0; !ep && i < HCD_MAX_EP; i++) {
+        if (!hcd_ep[i].used) ep = &hcd_ep[i];
+    }
+    if (!ep) return nullptr;
+
+    memset(ep, 0, sizeof(*ep));
+    ep->used = true;
+    ep->dev_addr = dev_addr;
+    ep->ep_addr = ep_addr;
+    ep->stats.dev_addr = dev_addr;
+    ep->stats.ep_addr = ep_addr;
+    return ep;
+}
+
+static HOT_PATH void ep_complete(hcd_ep_t* ep, uint8_t ep_addr, xfer_result_t result) {
+    uint16_t len = ep->setup ? 8 : ep->done;
+    ep->busy = false;
+    ep->setup = false;
+    if (result == XFER_RESULT_SUCCESS) {
+        ep->stats.xfers++;
+        ep->stats.bytes += len;
+    } else if (result == XFER_RESULT_STALLED) {
+        ep->stats.stalls++;
+    } else {
+        ep->stats.errors++;
+    }
+    hcd_event_xfer_complete(ep->dev_addr, ep_addr, len, result, false);
+}
+
+//--------------------------------------------------------------------
+// Transfer engine
+//--------------------------------------------------------------------
+static HOT_PATH xfer_result_t result_of(max3421e_err_t err) {
+    if (err == MAX3421E_OK) return XFER_RESULT_SUCCESS;
+    if (err == MAX3421E_ERR_STALL) return XFER_RESULT_STALLED;
+    return XFER_RESULT_FAILED;
+}
+
+// Move ep's current transfer forward by at most nak_budget NAKs. Returns
+// true once the transfer has completed (successfully or not).
+static HOT_PATH bool ep_run(hcd_ep_t* ep, uint8_t nak_budget) {
+    bool dir_in = (ep->xfer_addr & TUSB_DIR_IN_MASK) != 0;
+    uint8_t num = tu_edpt_number(ep->ep_addr);
+    max3421e_err_t err;
+
+    if (ep->setup) {
+        ep->stats.polls++;
+        err = hcd_drv->setupPacket(ep->dev_addr, ep->setup_pkt);
+        // Data and status stages both start on DATA1
+        ep->toggle = true;
+        ep_complete(ep, 0x00, result_of(err));
+        return true;
+    }
+
+    while (true) {
+        uint64_t t0 = time_us_64();
+        uint16_t got = 0;
+        ep->stats.polls++;
+
+        if (num == 0 && ep->length == 0) {
+            // Zero-length control status stage
+            err = hcd_drv->handshakePacket(ep->dev_addr, dir_in);
+        } else if (dir_in) {
+            uint16_t room = ep->length - ep->done;
+            err = hcd_drv->inPacket(ep->dev_addr, num, ep->buffer + ep->done,
+                                    room < ep->mps ? room : ep->mps, &got, &ep->toggle);
+        } else {
+            uint16_t chunk = ep->length - ep->done;
+            if (chunk > ep->mps) chunk = ep->mps;
+            err = hcd_drv->outPacket(ep->dev_addr, num, ep->buffer + ep->done, chunk, &ep->toggle);
+            if (err == MAX3421E_OK) got = chunk;
+        }
+
+        if (err == MAX3421E_ERR_NAK) {
+            ep->stats.naks++;
+            if (nak_budget-- == 0) return false;
+            continue;
+        }
+        if (err != MAX3421E_OK) {
+            ep_complete(ep, ep->xfer_addr, result_of(err));
+            return true;
+        }
+
+        uint32_t dt = (uint32_t)(time_us_64() - t0);
+        if (dt > ep->stats.max_poll_us) ep->stats.max_poll_us = dt;
+        ep->done += got;
+        // Short packet or everything asked for ends the transfer
+        if (ep->done >= ep->length || got < ep->mps) {
+            ep_complete(ep, ep->xfer_addr, XFER_RESULT_SUCCESS);
+            return true;
+        }
+    }
+}
+
+static void hcd_abort_all(void) {
+    for (uint8_t i = 0; i < HCD_MAX_EP; i++) {
+        hcd_ep[i].busy = false;
+        hcd_ep[i].setup = false;
+    }
+}
+
+void max3421e_hcd_bind(Adafruit_MAX3421E* drv) {
+    hcd_drv = drv;
+}
+
+HOT_PATH bool max3421e_hcd_task(void) {
+    if (!hcd_drv) return false;
+
+    bool work = false;
+    hcd_drv->task();
+    if (hcd_drv->takeConnectionChange()) {
+        work = true;
+        if (hcd_drv->deviceConnected()) {
+            hcd_event_device_attach(BOARD_TUH_RHPORT, false);
+        } else {
+            hcd_abort_all();
+            hcd_event_device_remove(BOARD_TUH_RHPORT, false);
+        }
+    }
+    if (!hcd_drv->deviceConnected()) return work;
+
+    // Control and bulk go first: enumeration and forwarded requests are
+    // waiting on them, and they do not have a frame slot to miss
+    for (uint8_t i = 0; i < HCD_MAX_EP; i++) {
+        hcd_ep_t* ep = &hcd_ep[i];
+        if (ep->used && ep->busy && ep->interval == 0) {
+            ep_run(ep, HCD_ASYNC_NAK_RETRIES);
+            work = true;
+        }
+    }
+
+    // Interrupt endpoints whose interval has come round. A NAK moves the
+    // endpoint on to the next one; it gets retried within this frame only.
+    uint32_t frame = hcd_drv->frameNumber();
+    for (uint8_t n = 0; n < HCD_MAX_EP; n++) {
+        hcd_ep_t* ep = &hcd_ep[(hcd_rr + n) % HCD_MAX_EP];
+        if (!ep->used || !ep->busy || ep->interval == 0) continue;
+        if ((int32_t)(frame - ep->next_frame) < 0) continue;
+
+        if (ep->polled && frame != ep->next_frame) {
+            // Its frame ran out on NAKs: the next poll is an interval on
+            ep->polled = false;
+            ep->next_frame += ep->interval;
+            if ((int32_t)(frame - ep->next_frame) < 0) continue;
+        }
+        if (!ep->polled && frame != ep->next_frame) {
+            ep->stats.late++;
+            ep->next_frame = frame;
+        }
+        ep->polled = true;
+        work = true;
+        if (ep_run(ep, HCD_NAK_RETRIES)) {
+            ep->polled = false;
+            ep->next_frame = frame + ep->interval;
+        }
+    }
+    hcd_rr = (uint8_t)((hcd_rr + 1) % HCD_MAX_EP);
+    return work;
+}
+
+bool max3421e_hcd_ep_stats(uint8_t i, max3421e_hcd_ep_stats_t* out) {
+    for (uint8_t k = 0; k < HCD_MAX_EP; k++) {
+        if (!hcd_ep[k].used) continue;
+        if (i-- == 0) {
+            *out = hcd_ep[k].stats;
+            return true;
+        }
+    }
+    return false;
+}
+
+void max3421e_hcd_print_stats(void) {
+    max3421e_hcd_ep_stats_t st;
+    for (uint8_t i = 0; max3421e_hcd_ep_stats(i, &st); i++) {
+        debug_print("[HCD] dev %u ep %02x int %u: polls=%lu nak=%lu xfer=%lu bytes=%lu stall=%lu err=%lu late=%lu max=%lu us\n",
+                    st.dev_addr, st.ep_addr, st.interval, st.polls, st.naks, st.xfers, st.bytes,
+                    st.stalls, st.errors, st.late, st.max_poll_us);
+    }
+}
 
 //--------------------------------------------------------------------
 // HCD Implementation
@@ -13,68 +245,139 @@ static Adafruit_MAX3421E max3421(spi0, 17, 9, 12);
 extern "C" {
 
 bool hcd_init(uint8_t rhport) {
-    return max3421.begin() == MAX3421E_OK;
+    (void) rhport;
+    if (!hcd_drv || hcd_drv->begin() != MAX3421E_OK) return false;
+
+    memset(hcd_ep, 0, sizeof(hcd_ep));
+    hcd_drv->setFrameIrq(true);
+    // A device that was already enumerated by the proxy before the stack
+    // came up never produces a connection change
+    hcd_drv->takeConnectionChange();
+    if (hcd_drv->deviceConnected()) hcd_event_device_attach(rhport, false);
+    return true;
 }
 
 void hcd_int_enable(uint8_t rhport) {
-    // Enable interrupts for the MAX3421E.
-    max3421.writeRegister(MAX3421E_USBIEN, USBIRQ_URESI | USBIRD_SPEEDI);
+    (void) rhport;
+    // Enable the MAX3421E INT pin; the sources are set up in begin().
+    if (hcd_drv) hcd_drv->writeRegister(MAX3421E_CPUCTL, CPUCTL_IE);
 }
 
 void hcd_int_disable(uint8_t rhport) {
-    // Disable interrupts for the MAX3421E.
-    max3421.writeRegister(MAX3421E_USBIEN, 0);
+    (void) rhport;
+    // Disable the MAX3421E INT pin.
+    if (hcd_drv) hcd_drv->writeRegister(MAX3421E_CPUCTL, 0);
+}
+
+void hcd_int_handler(uint8_t rhport, bool in_isr) {
+    (void) rhport;
+    (void) in_isr;
+    // SPI cannot be used from the GPIO ISR; the main loop calls the task
+}
+
+HOT_PATH uint32_t hcd_frame_number(uint8_t rhport) {
+    (void) rhport;
+    return hcd_drv ? hcd_drv->frameNumber() : 0;
 }
 
 bool hcd_port_connect_status(uint8_t rhport) {
-    
-    return max3421.deviceConnected();
+    (void) rhport;
+    return hcd_drv && hcd_drv->deviceConnected();
 }
 
 tusb_speed_t hcd_port_speed_get(uint8_t rhport) {
-    // Ensure your class has an accessor 'deviceSpeed()'
-    return (max3421.deviceSpeed() == MAX3421E_FULL_SPEED) ? TUSB_SPEED_FULL : TUSB_SPEED_LOW;
+    (void) rhport;
+    return (hcd_drv && hcd_drv->deviceSpeed() == MAX3421E_LOW_SPEED) ? TUSB_SPEED_LOW : TUSB_SPEED_FULL;
 }
 
 void hcd_port_reset(uint8_t rhport) {
-    // Reset the USB bus using the MAX3421E.
-    max3421.resetBus();
+    (void) rhport;
+    hcd_abort_all();
+    hcd_drv->resetBus();
 }
 
 void hcd_port_reset_end(uint8_t rhport) {
-    // No action required here; reset completion is handled internally.
+    (void) rhport;
+    // resetBus() already waited out the reset and the recovery frames
 }
 
 bool hcd_edpt_open(uint8_t rhport, uint8_t dev_addr, tusb_desc_endpoint_t const *ep_desc) {
-    // Endpoint opening is handled internally by the MAX3421E.
+    (void) rhport;
+    hcd_ep_t* ep = ep_alloc(dev_addr, ep_desc->bEndpointAddress);
+    if (!ep) return false;
+
+    ep->type = ep_desc->bmAttributes.xfer;
+    ep->mps = tu_edpt_packet_size(ep_desc);
+    if (ep->type == TUSB_XFER_INTERRUPT) {
+        // Full/low speed bInterval is already in frames
+        ep->interval = ep_desc->bInterval ? ep_desc->bInterval : 1;
+        ep->next_frame = hcd_drv->frameNumber();
+    }
+    ep->stats.interval = ep->interval;
     return true;
 }
 
-bool hcd_setup_send(uint8_t rhport, uint8_t dev_addr, uint8_t const *setup_pkt) {
-    // Construct and send a control transfer via the MAX3421E.
-    // The setup packet format is assumed to follow the USB spec.
-    return max3421.controlTransfer(
-        setup_pkt[0],                 // bmRequestType
-        setup_pkt[1],                 // bRequest
-        setup_pkt[2] | (setup_pkt[3] << 8), // wValue
-        setup_pkt[4] | (setup_pkt[5] << 8), // wIndex
-        NULL,                         // No data stage (for IN or OUT with no data)
-        setup_pkt[6] | (setup_pkt[7] << 8)  // wLength
-    ) == MAX3421E_OK;
+HOT_PATH bool hcd_setup_send(uint8_t rhport, uint8_t dev_addr, uint8_t const *setup_pkt) {
+    (void) rhport;
+    hcd_ep_t* ep = ep_find(dev_addr, 0);
+    if (!ep) {
+        // Address 0 is used before TinyUSB opens anything
+        ep = ep_alloc(dev_addr, 0);
+        if (!ep) return false;
+        ep->type = TUSB_XFER_CONTROL;
+        ep->mps = 8;
+    }
+    if (ep->busy) return false;
+
+    memcpy(ep->setup_pkt, setup_pkt, 8);
+    ep->setup = true;
+    ep->busy = true;
+    return true;
 }
 
-bool hcd_edpt_xfer(uint8_t rhport, uint8_t dev_addr, uint8_t ep_addr, uint8_t *buffer, uint16_t total_bytes) {
-    // For bulk transfers, use the MAX3421E bulkTransfer.
-    return max3421.bulkTransfer(ep_addr, buffer, total_bytes) == MAX3421E_OK;
+HOT_PATH bool hcd_edpt_xfer(uint8_t rhport, uint8_t dev_addr, uint8_t ep_addr, uint8_t *buffer, uint16_t total_bytes) {
+    (void) rhport;
+    hcd_ep_t* ep = ep_find(dev_addr, ep_addr);
+    if (!ep || ep->busy) return false;
+
+    ep->buffer = buffer;
+    ep->length = total_bytes;
+    ep->done = 0;
+    ep->xfer_addr = ep_addr;
+    ep->polled = false;
+    if (ep->interval) {
+        // An endpoint TinyUSB left idle is due now, not late
+        uint32_t frame = hcd_drv->frameNumber();
+        if ((int32_t)(frame - ep->next_frame) > 0) ep->next_frame = frame;
+    }
+    ep->busy = true;
+    return true;
 }
 
 bool hcd_edpt_abort_xfer(uint8_t rhport, uint8_t dev_addr, uint8_t ep_addr) {
-    // Abort transfer is not implemented in the basic MAX3421E driver.
-    return false;
+    (void) rhport;
+    hcd_ep_t* ep = ep_find(dev_addr, ep_addr);
+    if (!ep) return false;
+    // Tokens never outlive a max3421e_hcd_task() call, so dropping the
+    // transfer is all an abort takes
+    ep->busy = false;
+    ep->setup = false;
+    return true;
+}
+
+bool hcd_edpt_clear_stall(uint8_t rhport, uint8_t dev_addr, uint8_t ep_addr) {
+    (void) rhport;
+    hcd_ep_t* ep = ep_find(dev_addr, ep_addr);
+    if (!ep) return false;
+    ep->toggle = false;
+    return true;
 }
 
 void hcd_device_close(uint8_t rhport, uint8_t dev_addr) {
-    // Device disconnection is handled internally by the MAX3421E.
+    (void) rhport;
+    for (uint8_t i = 0; i < HCD_MAX_EP; i++) {
+        if (hcd_ep[i].used && hcd_ep[i].dev_addr == dev_addr) hcd_ep[i].used = false;
+    }
 }
 
 } // extern "C"
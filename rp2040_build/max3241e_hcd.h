@@ -0,0 +1,37 @@
+#ifndef MAX3241E_HCD_H
+#define MAX3241E_HCD_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+class Adafruit_MAX3421E;
+
+// Per-endpoint counters, reset when the endpoint is opened
+typedef struct {
+    uint8_t  dev_addr;
+    uint8_t  ep_addr;
+    uint8_t  interval;        // Frames between interrupt polls (0 = async)
+    uint32_t polls;           // Tokens issued
+    uint32_t naks;
+    uint32_t xfers;           // Completions handed to TinyUSB
+    uint32_t bytes;
+    uint32_t stalls;
+    uint32_t errors;
+    uint32_t late;            // Interrupt polls that missed their frame
+    uint32_t max_poll_us;     // Longest successful token, SPI included
+} max3421e_hcd_ep_stats_t;
+
+// Share the application's driver instance with the HCD. Must be called
+// before tusb_init(); hcd_init() only finishes bringing it up.
+void max3421e_hcd_bind(Adafruit_MAX3421E* drv);
+
+// Service INT, post attach/detach and run whatever transfers are due this
+// frame. Called from the core1 loop before tuh_task(). Returns true if it
+// touched the bus.
+bool max3421e_hcd_task(void);
+
+// Copy out the stats of open endpoint slot i. False past the last one.
+bool max3421e_hcd_ep_stats(uint8_t i, max3421e_hcd_ep_stats_t* out);
+void max3421e_hcd_print_stats(void);
+
+#endif // MAX3241E_HCD_H
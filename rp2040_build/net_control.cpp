@@ -0,0 +1,102 @@
+#include "pico/stdlib.h"
+#include "pico/unique_id.h"
+#include "hot_path.h"
+#include "net_udp.h"
+#include "kmbox_proto.h"
+#include "kmbox_control.h"
+#include "w5500.h"
+#include "sched_timer.h"
+#include "net_control.h"
+#include <string.h>
+
+void debug_print(const char* format, ...);
+
+// Bound the work per call so a flood cannot starve tud_task()
+#define NET_FRAMES_PER_CALL 4
+
+static bool net_up = false;
+static nu_iface_t net_if;
+static kp_session_t net_kp;
+static uint8_t net_rx[NU_FRAME_MAX];
+static uint8_t net_tx[NU_FRAME_MAX];
+static sched_t* net_sched;
+static sched_timer_t net_timer;
+
+//--------------------------------------------------------------------
+// Datagram handler
+//--------------------------------------------------------------------
+static HOT_PATH uint16_t net_datagram(void* ctx, const nu_peer_t* from, const uint8_t* data, uint16_t len,
+                                      uint8_t* reply, uint16_t reply_cap) {
+    (void) ctx;
+    (void) from;
+    return kp_handle(&net_kp, data, len, reply, reply_cap);
+}
+
+//--------------------------------------------------------------------
+// Public API
+//--------------------------------------------------------------------
+// Bring-up runs as timer continuations so core0 keeps servicing USB while
+// the W5500 sits in reset and its PLL locks
+static void net_bringup(void* ctx) {
+    (void) ctx;
+    static uint8_t step = 0;
+    switch (step++) {
+        case 0:
+            w5500_reset_assert();
+            sched_at(net_sched, &net_timer, time_us_32() + W5500_RESET_HOLD_US, net_bringup, NULL);
+            return;
+        case 1:
+            w5500_reset_release();
+            sched_at(net_sched, &net_timer, time_us_32() + W5500_RESET_SETTLE_US, net_bringup, NULL);
+            return;
+        default:
+            break;
+    }
+
+    // The address comes from the flash chip's unique id, like the UUID
+    pico_unique_board_id_t id;
+    pico_get_unique_board_id(&id);
+    const uint8_t* u = id.id;
+    const int n = PICO_UNIQUE_BOARD_ID_SIZE_BYTES;
+    uint8_t mac[6] = { 0x10, 0xA0, 0x69, u[n - 3], u[n - 2], u[n - 1] };
+    uint8_t ip[4] = { NET_IP_ADDR };
+
+    if (!w5500_init(mac)) return;
+
+    kmbox_control_session_init(&net_kp, "net");
+    nu_init(&net_if, mac, ip, KP_DEFAULT_PORT, net_datagram, NULL);
+
+    net_up = true;
+    debug_print("[NET] KMBox NET on %u.%u.%u.%u:%u, UUID %08lX\n",
+                ip[0], ip[1], ip[2], ip[3], KP_DEFAULT_PORT, net_kp.uuid);
+}
+
+void net_control_init(sched_t* sched) {
+    net_sched = sched;
+    net_bringup(NULL);
+}
+
+HOT_PATH bool net_control_task(void) {
+    if (!net_up || !w5500_rx_pending()) return false;
+
+    for (int i = 0; i < NET_FRAMES_PER_CALL; i++) {
+        kmbox_control_set_arrival(time_us_32());
+        uint16_t len = w5500_recv(net_rx, sizeof(net_rx));
+        if (len == 0) break;
+
+        uint16_t out = nu_input(&net_if, net_rx, len, net_tx, sizeof(net_tx));
+        if (out) w5500_send(net_tx, out);
+        kmbox_control_reply_sent();
+    }
+    return true;
+}
+
+void net_control_print_stats(void) {
+    if (!net_up) return;
+    const w5500_stats_t* w = w5500_get_stats();
+    debug_print("[NET] frames rx %lu tx %lu (rx errors %lu, tx full %lu), arp %lu, udp %lu, "
+                "cmds %lu rejected %lu unsupported %lu, link %s\n",
+                w->rx_frames, w->tx_frames, w->rx_errors, w->tx_full, net_if.stats.arp_replies,
+                net_if.stats.udp_rx, net_kp.stats.accepted, net_kp.stats.rejected,
+                net_kp.stats.unsupported, w5500_link_up() ? "up" : "down");
+}
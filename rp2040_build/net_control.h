@@ -0,0 +1,27 @@
+#ifndef NET_CONTROL_H
+#define NET_CONTROL_H
+
+#include <stdbool.h>
+#include "sched_timer.h"
+
+// KMBox NET control path: a W5500 in MACRAW mode and the common ARP/UDP
+// responder, feeding the shared KMBox handlers (kmbox_control). Everything
+// runs on core0 next to the device stack, so a command reaches the next
+// report without crossing cores.
+
+#ifndef NET_IP_ADDR
+#define NET_IP_ADDR  192, 168, 1, 177
+#endif
+
+// Start bringing up the W5500 on core0's scheduler. Once the chip is out of
+// reset this prints the address and the UUID clients connect with; if no
+// chip answers the task stays idle.
+void net_control_init(sched_t* sched);
+
+// Core0: answer every frame the W5500 has waiting. Never blocks on the
+// network. Returns true if it did any work.
+bool net_control_task(void);
+
+void net_control_print_stats(void);
+
+#endif // NET_CONTROL_H
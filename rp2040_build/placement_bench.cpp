@@ -0,0 +1,131 @@
+#include "pico/stdlib.h"
+#include "hardware/sync.h"
+#include "hardware/clocks.h"
+#include "hardware/structs/systick.h"
+#include "hardware/structs/xip_ctrl.h"
+#include "hid_plan.h"
+#include "spsc_ring.h"
+#include "placement_bench.h"
+#include <string.h>
+
+void debug_print(const char* format, ...);
+
+#define PB_ITERATIONS  1000
+#define PB_RING_DEPTH  4
+#define PB_REPORT_LEN  7
+
+#ifdef HOT_PATH_SECTION
+#define PB_PLACEMENT "SRAM"
+#else
+#define PB_PLACEMENT "flash"
+#endif
+
+// Mouse with report ID 1: 5 buttons, 16-bit X/Y, 8-bit wheel
+static const uint8_t pb_mouse_desc[] = {
+    0x05, 0x01, 0x09, 0x02, 0xA1, 0x01, 0x85, 0x01,
+    0x09, 0x01, 0xA1, 0x00,
+    0x05, 0x09, 0x19, 0x01, 0x29, 0x05, 0x15, 0x00, 0x25, 0x01,
+    0x95, 0x05, 0x75, 0x01, 0x81, 0x02,
+    0x95, 0x01, 0x75, 0x03, 0x81, 0x01,
+    0x05, 0x01, 0x09, 0x30, 0x09, 0x31, 0x16, 0x01, 0x80, 0x26, 0xFF, 0x7F,
+    0x75, 0x10, 0x95, 0x02, 0x81, 0x06,
+    0x09, 0x38, 0x15, 0x81, 0x25, 0x7F, 0x75, 0x08, 0x95, 0x01, 0x81, 0x06,
+    0xC0, 0xC0
+};
+
+typedef struct {
+    uint16_t len;
+    uint8_t  data[PB_REPORT_LEN];
+} pb_msg_t;
+
+typedef struct {
+    uint32_t min;
+    uint32_t max;
+    uint64_t sum;
+} pb_stats_t;
+
+static hp_plan_t pb_plan;
+static hp_override_t pb_override;
+static spsc_ring_t pb_ring;
+static pb_msg_t pb_ring_buf[PB_RING_DEPTH];
+static uint8_t pb_out[PB_REPORT_LEN];
+
+// What one report costs the two cores between the HCD handing it over and
+// tud_hid_report(): push on core1, pop, override check and patch on core0.
+// Kept in RAM itself so only the placement of the code it calls varies.
+static uint32_t __no_inline_not_in_flash_func(pb_report_once)(const uint8_t* report) {
+    uint32_t start = systick_hw->cvr;
+
+    pb_msg_t* m = (pb_msg_t*)spsc_claim(&pb_ring);
+    m->len = PB_REPORT_LEN;
+    memcpy(m->data, report, PB_REPORT_LEN);
+    spsc_publish(&pb_ring);
+
+    const pb_msg_t* r = (const pb_msg_t*)spsc_peek(&pb_ring);
+    memcpy(pb_out, r->data, r->len);
+    if (hp_override_active(&pb_plan, &pb_override)) {
+        hp_apply(&pb_plan, &pb_override, pb_out, r->len);
+    }
+    spsc_release(&pb_ring);
+
+    // SysTick counts down through 24 bits
+    return (start - systick_hw->cvr) & 0x00FFFFFFu;
+}
+
+static void pb_measure(bool flush, pb_stats_t* st) {
+    uint8_t report[PB_REPORT_LEN] = { 0x01, 0x01, 0x10, 0x00, 0xF0, 0xFF, 0x00 };
+
+    st->min = UINT32_MAX;
+    st->max = 0;
+    st->sum = 0;
+    for (uint32_t i = 0; i < PB_ITERATIONS; i++) {
+        report[2] = (uint8_t)i;
+        uint32_t irq = save_and_disable_interrupts();
+        if (flush) {
+            // The read stalls until the flush has completed
+            xip_ctrl_hw->flush = 1;
+            (void)xip_ctrl_hw->flush;
+        }
+        uint32_t cycles = pb_report_once(report);
+        restore_interrupts(irq);
+
+        if (cycles < st->min) st->min = cycles;
+        if (cycles > st->max) st->max = cycles;
+        st->sum += cycles;
+    }
+}
+
+static void pb_print(const char* label, const pb_stats_t* st, uint32_t mhz) {
+    uint32_t avg = (uint32_t)(st->sum / PB_ITERATIONS);
+    debug_print("[PLACE] %s: min %lu avg %lu max %lu cycles (%lu/%lu/%lu ns), jitter %lu ns\n",
+                label, st->min, avg, st->max,
+                st->min * 1000 / mhz, avg * 1000 / mhz, st->max * 1000 / mhz,
+                (st->max - st->min) * 1000 / mhz);
+}
+
+void placement_bench_run(void) {
+    if (!hp_compile(&pb_plan, pb_mouse_desc, sizeof(pb_mouse_desc))) {
+        debug_print("[PLACE] Bench descriptor did not compile\n");
+        return;
+    }
+    memset(&pb_override, 0, sizeof(pb_override));
+    pb_override.axis_mask = (1u << HP_AXIS_X) | (1u << HP_AXIS_Y);
+    pb_override.axis[HP_AXIS_X] = 1000;
+    pb_override.axis[HP_AXIS_Y] = -1000;
+    pb_override.button_mask = 0x1;
+    pb_override.buttons = 0x1;
+    spsc_init(&pb_ring, pb_ring_buf, sizeof(pb_msg_t), PB_RING_DEPTH);
+
+    systick_hw->rvr = 0x00FFFFFFu;
+    systick_hw->cvr = 0;
+    systick_hw->csr = 0x5;  // Enabled, processor clock, no interrupt
+
+    uint32_t mhz = clock_get_hz(clk_sys) / 1000000;
+    pb_stats_t warm, cold;
+    pb_measure(false, &warm);
+    pb_measure(true, &cold);
+
+    debug_print("[PLACE] Report path in %s, %u iterations at %lu MHz\n", PB_PLACEMENT, PB_ITERATIONS, mhz);
+    pb_print("cache warm", &warm, mhz);
+    pb_print("XIP flushed", &cold, mhz);
+}
@@ -0,0 +1,12 @@
+#ifndef PLACEMENT_BENCH_H
+#define PLACEMENT_BENCH_H
+
+// Boot-time timing of the per-report CPU work (ring hand-off, override
+// check, report patching) with the XIP cache warm and freshly flushed.
+// Build once with SR71_RAM_HOT_PATH=ON and once with OFF and compare the
+// [PLACE] lines: the flushed numbers are what an unlucky report costs when
+// flash-resident code has been evicted. SPI wire time is not included.
+// Core0 only, before core1 is launched.
+void placement_bench_run(void);
+
+#endif // PLACEMENT_BENCH_H
@@ -33,17 +33,33 @@ extern "C" {
 // Enable device stack (we're acting as a USB device to the host computer)
 #define CFG_TUD_ENABLED       1
 
-// Enable host stack with MAX3421E (we're acting as a USB host to the connected device)
+// Enable host stack (we're acting as a USB host to the connected device).
+// The host controller is a MAX3421E over SPI unless the build selects the
+// RP2040's own PIO USB host (SR71_HOST_BACKEND=PIO_USB in CMake).
 #define CFG_TUH_ENABLED       1
+#ifndef SR71_HOST_PIO_USB
+#define SR71_HOST_PIO_USB     0
+#endif
+
+#if SR71_HOST_PIO_USB
+#define CFG_TUH_RPI_PIO_USB   1
+
+// D+ on PIO_USB_DP_PIN, D- on the next pin up
+#define PIO_USB_DP_PIN        16
+#else
 #define CFG_TUH_MAX3421       1
 
 // Configuration
 #define MAX3421E_CS_PIN       PIN_CS
 #define MAX3421E_INT_PIN       9
 #define MAX3421E_POLL_MS      10
+#endif
 // TinyUSB Board Configuration
-#define BOARD_TUH_RHPORT       1  // MAX3421 is on port 1
+#define BOARD_TUD_RHPORT       0  // Native USB, serviced on core0
+#define BOARD_TUH_RHPORT       1  // MAX3421 or PIO USB is on port 1, serviced on core1
+#if !SR71_HOST_PIO_USB
 #define BOARD_TUH_MAX3421_INT  MAX3421E_INT_PIN
+#endif
 
 //--------------------------------------------------------------------
 // DEVICE CONFIGURATION
@@ -0,0 +1,149 @@
+#include "pico/stdlib.h"
+#include "hardware/uart.h"
+#include "hardware/dma.h"
+#include "hardware/gpio.h"
+#include "hot_path.h"
+#include "serial_frame.h"
+#include "kmbox_proto.h"
+#include "kmbox_control.h"
+#include "uart_control.h"
+#include <string.h>
+
+void debug_print(const char* format, ...);
+
+// Replies are a 16-byte header; room for anything kp_handle() writes
+#define UC_REPLY_MAX 64
+
+static struct {
+    bool     up;
+    uint32_t baud;
+    int      dma_rx;        // UART -> ring, wraps forever
+    int      dma_rearm;     // Reloads dma_rx's count when it runs out
+    int      dma_tx;
+    uint32_t tail;          // Next ring byte to decode
+    uint8_t  tx_sel;        // Which tx buffer the next reply uses
+    uint32_t tx_frames;
+    uint32_t tx_waits;      // Previous reply still going out
+} uc;
+
+static uint8_t uc_ring[UART_CTRL_RING] __attribute__((aligned(UART_CTRL_RING)));
+static const uint32_t uc_rearm_count = UART_CTRL_RING;
+
+// Two so a reply can be encoded while the previous one is on the wire
+static uint8_t uc_tx[2][SF_ENCODED_MAX(UC_REPLY_MAX)];
+
+static sf_decoder_t uc_dec;
+static kp_session_t uc_kp;
+
+//--------------------------------------------------------------------
+// Frames
+//--------------------------------------------------------------------
+static HOT_PATH void uc_send(const uint8_t* payload, uint16_t len) {
+    uint8_t* buf = uc_tx[uc.tx_sel];
+    uint16_t n = sf_encode(payload, len, buf, sizeof(uc_tx[0]));
+    if (n == 0) return;
+
+    if (dma_channel_is_busy(uc.dma_tx)) {
+        uc.tx_waits++;
+        dma_channel_wait_for_finish_blocking(uc.dma_tx);
+    }
+    dma_channel_transfer_from_buffer_now(uc.dma_tx, buf, n);
+    uc.tx_sel ^= 1;
+    uc.tx_frames++;
+}
+
+static HOT_PATH void uc_frame(void* ctx, const uint8_t* payload, uint16_t len) {
+    (void) ctx;
+    uint8_t reply[UC_REPLY_MAX];
+    uint16_t n = kp_handle(&uc_kp, payload, len, reply, sizeof(reply));
+    if (n) uc_send(reply, n);
+    kmbox_control_reply_sent();
+}
+
+//--------------------------------------------------------------------
+// Public API
+//--------------------------------------------------------------------
+bool uart_control_init(void) {
+    uc.dma_rx = dma_claim_unused_channel(false);
+    uc.dma_rearm = dma_claim_unused_channel(false);
+    uc.dma_tx = dma_claim_unused_channel(false);
+    if (uc.dma_rx < 0 || uc.dma_rearm < 0 || uc.dma_tx < 0) {
+        if (uc.dma_rx >= 0) dma_channel_unclaim(uc.dma_rx);
+        if (uc.dma_rearm >= 0) dma_channel_unclaim(uc.dma_rearm);
+        if (uc.dma_tx >= 0) dma_channel_unclaim(uc.dma_tx);
+        debug_print("[UART] No DMA channels, control UART off\n");
+        return false;
+    }
+
+    // uart_init() also turns on both DREQs
+    uc.baud = uart_init(UART_CTRL_ID, UART_CTRL_BAUD);
+    gpio_set_function(UART_CTRL_TX_PIN, GPIO_FUNC_UART);
+    gpio_set_function(UART_CTRL_RX_PIN, GPIO_FUNC_UART);
+    gpio_pull_up(UART_CTRL_RX_PIN);  // Idle high with nothing attached
+    uart_set_fifo_enabled(UART_CTRL_ID, true);
+    volatile void* dr = &uart_get_hw(UART_CTRL_ID)->dr;
+
+    // RX: byte-wide into the ring, write address wrapping on its size. When
+    // the count runs out it chains to the re-arm channel, which writes the
+    // count back through the trigger alias; the write address carries on
+    // where it was. The 32-byte UART FIFO covers the gap.
+    dma_channel_config c = dma_channel_get_default_config(uc.dma_rx);
+    channel_config_set_transfer_data_size(&c, DMA_SIZE_8);
+    channel_config_set_read_increment(&c, false);
+    channel_config_set_write_increment(&c, true);
+    channel_config_set_ring(&c, true, UART_CTRL_RING_BITS);
+    channel_config_set_dreq(&c, uart_get_dreq(UART_CTRL_ID, false));
+    channel_config_set_chain_to(&c, uc.dma_rearm);
+    dma_channel_configure(uc.dma_rx, &c, uc_ring, dr, UART_CTRL_RING, false);
+
+    c = dma_channel_get_default_config(uc.dma_rearm);
+    channel_config_set_transfer_data_size(&c, DMA_SIZE_32);
+    channel_config_set_read_increment(&c, false);
+    channel_config_set_write_increment(&c, false);
+    dma_channel_configure(uc.dma_rearm, &c, &dma_hw->ch[uc.dma_rx].al1_transfer_count_trig,
+                          &uc_rearm_count, 1, false);
+
+    c = dma_channel_get_default_config(uc.dma_tx);
+    channel_config_set_transfer_data_size(&c, DMA_SIZE_8);
+    channel_config_set_read_increment(&c, true);
+    channel_config_set_write_increment(&c, false);
+    channel_config_set_dreq(&c, uart_get_dreq(UART_CTRL_ID, true));
+    dma_channel_configure(uc.dma_tx, &c, dr, uc_tx[0], 0, false);
+
+    sf_decoder_init(&uc_dec);
+    kmbox_control_session_init(&uc_kp, "uart");
+    uc.tail = 0;
+    dma_channel_start(uc.dma_rx);
+
+    uc.up = true;
+    debug_print("[UART] KMBox over UART%d TX %d RX %d at %lu baud, UUID %08lX\n",
+                uart_get_index(UART_CTRL_ID), UART_CTRL_TX_PIN, UART_CTRL_RX_PIN, uc.baud, uc_kp.uuid);
+    return true;
+}
+
+HOT_PATH bool uart_control_task(void) {
+    if (!uc.up) return false;
+
+    uint32_t write = dma_channel_hw_addr(uc.dma_rx)->write_addr;
+    uint32_t head = (write - (uint32_t)(uintptr_t)uc_ring) & (UART_CTRL_RING - 1);
+    if (head == uc.tail) return false;
+
+    // Every frame completed by these bytes arrived no later than now
+    kmbox_control_set_arrival(time_us_32());
+    if (head < uc.tail) {
+        sf_feed(&uc_dec, uc_ring + uc.tail, UART_CTRL_RING - uc.tail, uc_frame, NULL);
+        uc.tail = 0;
+    }
+    sf_feed(&uc_dec, uc_ring + uc.tail, head - uc.tail, uc_frame, NULL);
+    uc.tail = head;
+    return true;
+}
+
+void uart_control_print_stats(void) {
+    if (!uc.up) return;
+    const sf_stats_t* s = &uc_dec.stats;
+    debug_print("[UART] rx %lu bytes, frames %lu (crc %lu, malformed %lu, too long %lu), "
+                "tx %lu (waited %lu), cmds %lu rejected %lu unsupported %lu\n",
+                s->bytes, s->frames, s->crc_errors, s->malformed, s->too_long, uc.tx_frames,
+                uc.tx_waits, uc_kp.stats.accepted, uc_kp.stats.rejected, uc_kp.stats.unsupported);
+}
@@ -0,0 +1,43 @@
+#ifndef UART_CONTROL_H
+#define UART_CONTROL_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// KMBox commands over a UART, for boards without the W5500 or hosts that
+// would rather use a USB-serial adapter. Each datagram the UDP path would
+// carry is sent as one COBS frame with a CRC-16 (common/serial_frame), and
+// the acknowledgement comes back the same way. The handlers are the shared
+// kmbox_control ones.
+//
+// Receive is DMA into a 1 KB ring that never stops: a second channel
+// re-arms it each time it wraps, so the CPU only looks at the DMA write
+// pointer. Replies go out by DMA too. Core0 only.
+
+// UART1 on GPIO 4/5, clear of the debug UART, both SPI buses and PIO-USB
+#define UART_CTRL_ID       uart1
+#define UART_CTRL_TX_PIN   4
+#define UART_CTRL_RX_PIN   5
+
+// The PL011 tops out at clk_peri / 16 (7.8 Mbaud at 125 MHz). 3 Mbaud is
+// the highest rate common USB-serial adapters (CP2102N, CH343, FT232H) all
+// reach exactly.
+#ifndef UART_CTRL_BAUD
+#define UART_CTRL_BAUD     3000000
+#endif
+
+// Must be a power of two (DMA ring wrap). 1 KB holds ~3.4 ms at 3 Mbaud.
+#define UART_CTRL_RING_BITS 10
+#define UART_CTRL_RING      (1u << UART_CTRL_RING_BITS)
+
+// Set up the UART and both DMA paths. Returns false if no DMA channels are
+// free.
+bool uart_control_init(void);
+
+// Core0: decode whatever the ring gained since the last call and answer
+// each complete command. Returns true if it did any work.
+bool uart_control_task(void);
+
+void uart_control_print_stats(void);
+
+#endif // UART_CONTROL_H
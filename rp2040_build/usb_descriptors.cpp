@@ -1,13 +1,60 @@
 #include "tusb.h"
 #include "pico/stdlib.h"
-#include "adafruit_max3421e.h"
+#include "control_forward.h"
+#include "hid_passthrough.h"
+#include "usb_descriptors.h"
+#include <string.h>
+
+void debug_print(const char* format, ...);
+
+#define CLONE_CONFIG_MAX  128   // Config header + one HID interface and its endpoints
+#define CLONE_EP_MPS_MAX  64    // Full-speed interrupt endpoints
+
+//--------------------------------------------------------------------
+// HID Report Descriptor (Example for simple keyboard)
+//--------------------------------------------------------------------
+// Only presented if nothing has been cloned yet
+uint8_t const hid_report_descriptor[] = {
+    0x05, 0x01,  // Usage Page (Generic Desktop)
+    0x09, 0x06,  // Usage (Keyboard)
+    0xA1, 0x01,  // Collection (Application)
+    0x05, 0x07,  // Usage Page (Key Codes)
+    0x19, 0xE0,  // Usage Minimum (224)
+    0x29, 0xE7,  // Usage Maximum (231)
+    0x15, 0x00,  // Logical Minimum (0)
+    0x25, 0x01,  // Logical Maximum (1)
+    0x75, 0x01,  // Report Size (1)
+    0x95, 0x08,  // Report Count (8)
+    0x81, 0x02,  // Input (Data, Variable, Absolute)
+    0x95, 0x01,  // Report Count (1)
+    0x75, 0x08,  // Report Size (8)
+    0x81, 0x01,  // Input (Constant)
+    0x95, 0x05,  // Report Count (5)
+    0x75, 0x01,  // Report Size (1)
+    0x05, 0x08,  // Usage Page (LEDs)
+    0x19, 0x01,  // Usage Minimum (1)
+    0x29, 0x05,  // Usage Maximum (5)
+    0x91, 0x02,  // Output (Data, Variable, Absolute)
+    0x95, 0x01,  // Report Count (1)
+    0x75, 0x03,  // Report Size (3)
+    0x91, 0x01,  // Output (Constant)
+    0x95, 0x06,  // Report Count (6)
+    0x75, 0x08,  // Report Size (8)
+    0x15, 0x00,  // Logical Minimum (0)
+    0x25, 0x65,  // Logical Maximum (101)
+    0x05, 0x07,  // Usage Page (Key Codes)
+    0x19, 0x00,  // Usage Minimum (0)
+    0x29, 0x65,  // Usage Maximum (101)
+    0x81, 0x00,  // Input (Data, Array)
+    0xC0         // End Collection
+};
 
 //--------------------------------------------------------------------
 // Device Descriptor
 //--------------------------------------------------------------------
 uint8_t const desc_device[] = {
     // Size, Type, USB Version, Class, Subclass, Protocol, EP0 Size
-    18, 0x01, 0x00, 0x02, 0x00, 0x00, 0x00, 0x40,
+    18, 0x01, 0x00, 0x02, 0x00, 0x00, 0x00, CFG_TUD_ENDPOINT0_SIZE,
     // Vendor ID, Product ID, Device Version
     0xC0, 0x16, 0xDC, 0x27, 0x00, 0x01,
     // Strings, Configurations
@@ -17,39 +64,14 @@ uint8_t const desc_device[] = {
 //--------------------------------------------------------------------
 // Configuration Descriptor
 //--------------------------------------------------------------------
+#define FALLBACK_CONFIG_LEN (TUD_CONFIG_DESC_LEN + TUD_HID_DESC_LEN)
+
 uint8_t const desc_configuration[] = {
-    // Config header
-    9, 0x02, 32, 0, 1, 1, 0, 0x80, 50,
-    
-    // Interface Association (for CDC)
-    8, 0x0B, 0, 2, 0x02, 0x02, 0x00, 0,
-    
-    // CDC Control Interface
-    9, 0x04, 0, 0, 1, 0x02, 0x02, 0x01, 0,
-    
-    // CDC Header
-    5, 0x24, 0x00, 0x10, 0x01,
-    
-    // CDC Call Management
-    5, 0x24, 0x01, 0x00, 0x01,
-    
-    // CDC ACM
-    4, 0x24, 0x02, 0x02,
-    
-    // CDC Union
-    5, 0x24, 0x06, 0x00, 0x01,
-    
-    // Endpoint Notification
-    7, 0x05, 0x81, 0x03, 0x08, 0x00, 0xFF,
-    
-    // CDC Data Interface
-    9, 0x04, 1, 0, 2, 0x0A, 0x00, 0x00, 0,
-    
-    // Endpoint In
-    7, 0x05, 0x82, 0x02, 0x40, 0x00, 0x00,
-    
-    // Endpoint Out
-    7, 0x05, 0x02, 0x02, 0x40, 0x00, 0x00
+    // Config number, interface count, string index, total length, attribute, power in mA
+    TUD_CONFIG_DESCRIPTOR(1, 1, 0, FALLBACK_CONFIG_LEN, 0x80, 100),
+
+    // Interface number, string index, protocol, report descriptor len, EP In address, size & polling interval
+    TUD_HID_DESCRIPTOR(0, 0, HID_ITF_PROTOCOL_KEYBOARD, sizeof(hid_report_descriptor), 0x81, 8, 10)
 };
 
 //--------------------------------------------------------------------
@@ -60,20 +82,133 @@ static char const* string_desc_arr[] = {
     "Raspberry Pi",                // 1: Manufacturer
     "Pico MAX3421E Host",          // 2: Product
     "123456",                      // 3: Serial
-    "MAX3421E CDC",                // 4: CDC Interface
-    "MAX3421E Data"                // 5: CDC Data Interface
 };
 
+//--------------------------------------------------------------------
+// Cloned Descriptors
+//--------------------------------------------------------------------
+// What the PC is shown once a device has been cloned. TinyUSB only has a
+// driver for one HID interface, so the configuration is cut down to the
+// interface hid_passthrough presents; everything the PC's HID driver sees
+// (boot protocol, endpoint addresses, sizes, bInterval) is the device's own.
+static struct {
+    bool     valid;
+    uint8_t  device[DC_DEVICE_LEN];
+    uint8_t  config[CLONE_CONFIG_MAX];
+    uint8_t  in_interval;   // bInterval of the interrupt IN endpoint
+    uint16_t string_index[DC_STRINGS];
+    uint16_t strings[DC_STRINGS][DC_STRING_MAX / 2];
+} clone;
+
+// Copy the first HID interface (alternate setting 0) with its HID and
+// endpoint descriptors behind a config header. Returns the total length.
+static uint16_t clone_config(const uint8_t* src, uint16_t src_len, uint8_t* dst, uint16_t report_len) {
+    if (src_len < 9 || src[1] != TUSB_DESC_CONFIGURATION) return 0;
+    uint16_t total = (uint16_t)(src[2] | (src[3] << 8));
+    if (total < src_len) src_len = total;
+
+    memcpy(dst, src, 9);
+    uint16_t out = 9;
+    uint8_t* itf = NULL;
+    bool copying = false;
+
+    for (uint16_t off = src[0]; off + 2 <= src_len; off += src[off]) {
+        const uint8_t* d = src + off;
+        uint8_t len = d[0];
+        if (len < 2 || off + len > src_len) break;
+
+        if (d[1] == TUSB_DESC_INTERFACE || d[1] == TUSB_DESC_INTERFACE_ASSOCIATION) {
+            if (itf) break;   // Past the interface being cloned
+            copying = d[1] == TUSB_DESC_INTERFACE && len >= 9 &&
+                      d[5] == TUSB_CLASS_HID && d[3] == 0;
+        } else if (!copying || (d[1] != HID_DESC_TYPE_HID && d[1] != TUSB_DESC_ENDPOINT)) {
+            continue;
+        }
+        if (!copying) continue;
+        if (out + len > CLONE_CONFIG_MAX) return 0;
+
+        uint8_t* o = dst + out;
+        memcpy(o, d, len);
+        out += len;
+
+        if (d[1] == TUSB_DESC_INTERFACE) {
+            itf = o;
+            o[2] = 0;      // Only interface of the clone
+            o[4] = 0;      // Endpoints counted as they are copied
+            o[8] = 0;      // No interface string on this side
+        } else if (d[1] == HID_DESC_TYPE_HID) {
+            // The report descriptor served may differ in length from the
+            // device's (truncated to what hid_passthrough keeps)
+            if (len >= 9 && o[6] == HID_DESC_TYPE_REPORT) {
+                o[7] = (uint8_t)(report_len & 0xFF);
+                o[8] = (uint8_t)(report_len >> 8);
+            }
+        } else {
+            uint16_t mps = (uint16_t)(o[4] | (o[5] << 8)) & 0x7FF;
+            if (mps > CLONE_EP_MPS_MAX) mps = CLONE_EP_MPS_MAX;
+            o[4] = (uint8_t)(mps & 0xFF);
+            o[5] = (uint8_t)(mps >> 8);
+            if (o[2] & TUSB_DIR_IN_MASK) clone.in_interval = o[6];
+            itf[4]++;
+        }
+    }
+    if (!itf) return 0;
+
+    dst[2] = (uint8_t)(out & 0xFF);
+    dst[3] = (uint8_t)(out >> 8);
+    dst[4] = 1;   // bNumInterfaces
+    dst[6] = 0;   // iConfiguration
+    return out;
+}
+
+bool usb_descriptors_clone(const dc_record_t* rec) {
+    uint16_t report_len = 0;
+    if (!hid_passthrough_report_descriptor(&report_len)) report_len = sizeof(hid_report_descriptor);
+
+    uint8_t config[CLONE_CONFIG_MAX];
+    clone.valid = false;
+    clone.in_interval = 0;
+    uint16_t config_len = clone_config(rec->config, rec->hdr.config_len, config, report_len);
+    if (config_len == 0) {
+        debug_print("[DESC] No HID interface in the cloned configuration, presenting the fallback descriptors\n");
+        return false;
+    }
+
+    memcpy(clone.device, rec->device, DC_DEVICE_LEN);
+    tusb_desc_device_t* dev = (tusb_desc_device_t*)clone.device;
+    dev->bMaxPacketSize0 = CFG_TUD_ENDPOINT0_SIZE;   // Our EP0, not the device's
+    dev->bNumConfigurations = 1;
+    memcpy(clone.config, config, config_len);
+
+    clone.string_index[DC_STRING_MANUFACTURER] = dev->iManufacturer;
+    clone.string_index[DC_STRING_PRODUCT] = dev->iProduct;
+    clone.string_index[DC_STRING_SERIAL] = dev->iSerialNumber;
+    for (int i = 0; i < DC_STRINGS; i++) {
+        uint16_t len = rec->hdr.string_len[i];
+        memset(clone.strings[i], 0, sizeof(clone.strings[i]));
+        if (len >= 2 && len <= DC_STRING_MAX) {
+            memcpy(clone.strings[i], rec->strings[i], len);
+            // Header rebuilt from the stored length in case the device's was off
+            clone.strings[i][0] = (uint16_t)((TUSB_DESC_STRING << 8) | len);
+        }
+    }
+    clone.valid = true;
+
+    debug_print("[DESC] Presenting %04x:%04x, HID protocol %u, %u endpoint(s), IN interval %u\n",
+                dev->idVendor, dev->idProduct, clone.config[9 + 7], clone.config[9 + 4], clone.in_interval);
+    return true;
+}
+
 //--------------------------------------------------------------------
 // TinyUSB Callbacks
 //--------------------------------------------------------------------
 uint8_t const* tud_descriptor_device_cb(void) {
-    return desc_device;
+    return clone.valid ? clone.device : desc_device;
 }
 
 uint8_t const* tud_descriptor_configuration_cb(uint8_t index) {
     (void)index; // for multiple configurations
-    return desc_configuration;
+    return clone.valid ? clone.config : desc_configuration;
 }
 
 uint16_t const* tud_descriptor_string_cb(uint8_t index, uint16_t langid) {
@@ -81,6 +216,14 @@ uint16_t const* tud_descriptor_string_cb(uint8_t index, uint16_t langid) {
     static uint16_t desc_str[32];
     uint8_t chr_count;
 
+    if (clone.valid && index != 0) {
+        // The device's own UTF-16LE strings, under the indices its device descriptor uses
+        for (int i = 0; i < DC_STRINGS; i++) {
+            if (clone.string_index[i] == index && clone.strings[i][0]) return clone.strings[i];
+        }
+        return NULL;
+    }
+
     if (index == 0) {
         memcpy(&desc_str[1], string_desc_arr[0], 2);
         chr_count = 1;
@@ -102,65 +245,44 @@ uint16_t const* tud_descriptor_string_cb(uint8_t index, uint16_t langid) {
     return desc_str;
 }
 
-//--------------------------------------------------------------------
-// HID Report Descriptor (Example for simple keyboard)
-//--------------------------------------------------------------------
-uint8_t const hid_report_descriptor[] = {
-    0x05, 0x01,  // Usage Page (Generic Desktop)
-    0x09, 0x06,  // Usage (Keyboard)
-    0xA1, 0x01,  // Collection (Application)
-    0x05, 0x07,  // Usage Page (Key Codes)
-    0x19, 0xE0,  // Usage Minimum (224)
-    0x29, 0xE7,  // Usage Maximum (231)
-    0x15, 0x00,  // Logical Minimum (0)
-    0x25, 0x01,  // Logical Maximum (1)
-    0x75, 0x01,  // Report Size (1)
-    0x95, 0x08,  // Report Count (8)
-    0x81, 0x02,  // Input (Data, Variable, Absolute)
-    0x95, 0x01,  // Report Count (1)
-    0x75, 0x08,  // Report Size (8)
-    0x81, 0x01,  // Input (Constant)
-    0x95, 0x05,  // Report Count (5)
-    0x75, 0x01,  // Report Size (1)
-    0x05, 0x08,  // Usage Page (LEDs)
-    0x19, 0x01,  // Usage Minimum (1)
-    0x29, 0x05,  // Usage Maximum (5)
-    0x91, 0x02,  // Output (Data, Variable, Absolute)
-    0x95, 0x01,  // Report Count (1)
-    0x75, 0x03,  // Report Size (3)
-    0x91, 0x01,  // Output (Constant)
-    0x95, 0x06,  // Report Count (6)
-    0x75, 0x08,  // Report Size (8)
-    0x15, 0x00,  // Logical Minimum (0)
-    0x25, 0x65,  // Logical Maximum (101)
-    0x05, 0x07,  // Usage Page (Key Codes)
-    0x19, 0x00,  // Usage Minimum (0)
-    0x29, 0x65,  // Usage Maximum (101)
-    0x81, 0x00,  // Input (Data, Array)
-    0xC0         // End Collection
-};
-
 //--------------------------------------------------------------------
 // HID Callbacks
 //--------------------------------------------------------------------
 // Invoked when received GET HID REPORT DESCRIPTOR request
 uint8_t const* tud_hid_descriptor_report_cb(uint8_t instance) {
-    return hid_report_descriptor;
+    (void)instance;
+    // Present the physical device's own report layout once it is known
+    uint8_t const* desc = hid_passthrough_report_descriptor(NULL);
+    return desc ? desc : hid_report_descriptor;
 }
 
 // Invoked when received GET_REPORT control request
 uint16_t tud_hid_get_report_cb(uint8_t instance, uint8_t report_id, 
                               hid_report_type_t report_type, uint8_t* buffer, 
                               uint16_t reqlen) {
-    // TODO: Implement if needed
-    return 0;
+    (void)instance;
+    return control_forward_get_report(report_id, report_type, buffer, reqlen);
 }
 
-// Invoked when received SET_REPORT control request
+// Invoked when received SET_REPORT control request or data on the OUT endpoint
 void tud_hid_set_report_cb(uint8_t instance, uint8_t report_id, 
                           hid_report_type_t report_type, uint8_t const* buffer, 
                           uint16_t bufsize) {
-    // TODO: Implement if needed
+    (void)instance;
+    control_forward_set_report(report_id, report_type, buffer, bufsize);
+}
+
+// Invoked when received SET_IDLE control request
+bool tud_hid_set_idle_cb(uint8_t instance, uint8_t idle_rate) {
+    (void)instance;
+    control_forward_set_idle(idle_rate);
+    return true;
+}
+
+// Invoked when received SET_PROTOCOL control request
+void tud_hid_set_protocol_cb(uint8_t instance, uint8_t protocol) {
+    (void)instance;
+    control_forward_set_protocol(protocol);
 }
 
 
@@ -173,15 +295,6 @@ bool tud_msc_test_unit_ready_cb(uint8_t lun) {
     return true; // Ready
 }
 
-//--------------------------------------------------------------------
-// HID Host Callbacks
-//--------------------------------------------------------------------
-
-void tuh_hid_report_received_cb(uint8_t dev_addr, uint8_t instance, 
-                               uint8_t const* report, uint16_t len) {
-    // TODO: Handle received HID reports
-}
-
 int32_t tud_msc_scsi_cb(uint8_t lun, uint8_t const scsi_cmd[16], 
     void* buffer, uint16_t bufsize) {
 // TODO: Implement SCSI commands
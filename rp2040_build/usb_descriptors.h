@@ -0,0 +1,17 @@
+#ifndef USB_DESCRIPTORS_H
+#define USB_DESCRIPTORS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "desc_cache.h"
+
+// Build the descriptors presented to the PC from a cloned device: its device
+// descriptor, identity strings and the first HID interface of its
+// configuration with the endpoint sizes and polling intervals unchanged. The
+// HID report descriptor comes from hid_passthrough, so preload or mount that
+// first. Core0 only, while the device side is disconnected.
+// Returns false (and falls back to the built-in keyboard) if the
+// configuration has no HID interface.
+bool usb_descriptors_clone(const dc_record_t* rec);
+
+#endif // USB_DESCRIPTORS_H
@@ -0,0 +1,318 @@
+#include "pico/stdlib.h"
+#include "hardware/spi.h"
+#include "hardware/dma.h"
+#include "hardware/gpio.h"
+#include "hot_path.h"
+#include "w5500.h"
+#include <string.h>
+
+void debug_print(const char* format, ...);
+
+// Control byte: block select, read/write, variable-length data phase
+#define W5500_BSB_COMMON   0x00
+#define W5500_BSB_S0_REG   0x01
+#define W5500_BSB_S0_TX    0x02
+#define W5500_BSB_S0_RX    0x03
+#define W5500_BSB_SOCKET(n, blk) ((uint8_t)((n) * 4 + (blk)))
+#define W5500_CTRL_WRITE   0x04
+
+// Common registers
+#define W5500_MR           0x0000
+#define W5500_SHAR         0x0009
+#define W5500_IMR          0x0016
+#define W5500_SIMR         0x0018
+#define W5500_PHYCFGR      0x002E
+#define W5500_VERSIONR     0x0039
+
+// Socket registers
+#define W5500_Sn_MR        0x0000
+#define W5500_Sn_CR        0x0001
+#define W5500_Sn_IR        0x0002
+#define W5500_Sn_SR        0x0003
+#define W5500_Sn_RXBUF_SIZE 0x001E
+#define W5500_Sn_TXBUF_SIZE 0x001F
+#define W5500_Sn_TX_FSR    0x0020  // FSR, TX_RD and TX_WR are contiguous
+#define W5500_Sn_TX_WR     0x0024
+#define W5500_Sn_RX_RSR    0x0026  // RX_RSR and RX_RD are contiguous
+#define W5500_Sn_RX_RD     0x0028
+#define W5500_Sn_IMR       0x002C
+
+#define W5500_MR_RST       0x80
+#define W5500_PHY_LNK      0x01
+#define W5500_VERSION      0x04
+
+// MACRAW with the MAC filter on, multicast and IPv6 blocked
+#define W5500_Sn_MR_MACRAW 0xB4
+#define W5500_Sn_CR_OPEN   0x01
+#define W5500_Sn_CR_CLOSE  0x10
+#define W5500_Sn_CR_SEND   0x20
+#define W5500_Sn_CR_RECV   0x40
+#define W5500_Sn_IR_RECV   0x04
+#define W5500_Sn_IR_SENDOK 0x10
+#define W5500_SOCK_MACRAW  0x42
+
+#define W5500_BUF_KB       16
+#define W5500_CMD_TIMEOUT_US   1000
+#define W5500_SEND_TIMEOUT_US  200    // A full-size frame is 123 us at 100 Mbit/s
+
+static struct {
+    bool     up;
+    bool     tx_busy;     // SEND issued, SENDOK not seen yet
+    uint16_t rx_left;     // Bytes still in the RX buffer after the last read
+    int      dma_tx;
+    int      dma_rx;
+    uint8_t  mac[6];
+} w5;
+
+static w5500_stats_t w5_stats;
+
+//--------------------------------------------------------------------
+// SPI
+//--------------------------------------------------------------------
+// Both channels run for every transfer: the PL022 only clocks when the TX
+// FIFO has data, and RX has to be drained or it stalls the TX side.
+static HOT_PATH void w5_dma(const uint8_t* tx, uint8_t* rx, size_t len) {
+    static uint8_t dummy_tx = 0;
+    static uint8_t dummy_rx;
+
+    dma_channel_config c = dma_channel_get_default_config(w5.dma_tx);
+    channel_config_set_transfer_data_size(&c, DMA_SIZE_8);
+    channel_config_set_dreq(&c, spi_get_dreq(W5500_SPI, true));
+    channel_config_set_read_increment(&c, tx != nullptr);
+    channel_config_set_write_increment(&c, false);
+    dma_channel_configure(w5.dma_tx, &c, &spi_get_hw(W5500_SPI)->dr, tx ? tx : &dummy_tx, len, false);
+
+    c = dma_channel_get_default_config(w5.dma_rx);
+    channel_config_set_transfer_data_size(&c, DMA_SIZE_8);
+    channel_config_set_dreq(&c, spi_get_dreq(W5500_SPI, false));
+    channel_config_set_read_increment(&c, false);
+    channel_config_set_write_increment(&c, rx != nullptr);
+    dma_channel_configure(w5.dma_rx, &c, rx ? rx : &dummy_rx, &spi_get_hw(W5500_SPI)->dr, len, false);
+
+    dma_start_channel_mask((1u << w5.dma_tx) | (1u << w5.dma_rx));
+    dma_channel_wait_for_finish_blocking(w5.dma_rx);
+    w5_stats.dma_transfers++;
+}
+
+// One CS frame: 16-bit address, control byte, then len data bytes
+static HOT_PATH void w5_frame(uint16_t addr, uint8_t ctrl, const uint8_t* tx, uint8_t* rx, size_t len) {
+    uint8_t hdr[3] = { (uint8_t)(addr >> 8), (uint8_t)addr, ctrl };
+
+    gpio_put(W5500_CS_PIN, 0);
+    spi_write_blocking(W5500_SPI, hdr, sizeof(hdr));
+    if (len >= W5500_DMA_MIN_LEN && w5.dma_tx >= 0) {
+        w5_dma(tx, rx, len);
+    } else if (rx) {
+        spi_read_blocking(W5500_SPI, 0, rx, len);
+    } else if (len) {
+        spi_write_blocking(W5500_SPI, tx, len);
+    }
+    gpio_put(W5500_CS_PIN, 1);
+}
+
+static HOT_PATH void w5_read(uint8_t bsb, uint16_t addr, uint8_t* buf, size_t len) {
+    w5_frame(addr, (uint8_t)(bsb << 3), nullptr, buf, len);
+}
+
+static HOT_PATH void w5_write(uint8_t bsb, uint16_t addr, const uint8_t* buf, size_t len) {
+    w5_frame(addr, (uint8_t)((bsb << 3) | W5500_CTRL_WRITE), buf, nullptr, len);
+}
+
+static HOT_PATH uint8_t w5_read8(uint8_t bsb, uint16_t addr) {
+    uint8_t v = 0;
+    w5_read(bsb, addr, &v, 1);
+    return v;
+}
+
+static HOT_PATH void w5_write8(uint8_t bsb, uint16_t addr, uint8_t v) {
+    w5_write(bsb, addr, &v, 1);
+}
+
+static HOT_PATH void w5_write16(uint8_t bsb, uint16_t addr, uint16_t v) {
+    uint8_t b[2] = { (uint8_t)(v >> 8), (uint8_t)v };
+    w5_write(bsb, addr, b, 2);
+}
+
+// Sn_CR clears itself once the chip has taken the command
+static HOT_PATH bool w5_command(uint8_t cmd) {
+    w5_write8(W5500_BSB_S0_REG, W5500_Sn_CR, cmd);
+    absolute_time_t deadline = make_timeout_time_us(W5500_CMD_TIMEOUT_US);
+    while (w5_read8(W5500_BSB_S0_REG, W5500_Sn_CR) != 0) {
+        if (time_reached(deadline)) return false;
+    }
+    return true;
+}
+
+static bool w5_open_macraw(void) {
+    w5_command(W5500_Sn_CR_CLOSE);
+    w5_write8(W5500_BSB_S0_REG, W5500_Sn_IR, 0xFF);
+    w5_write8(W5500_BSB_S0_REG, W5500_Sn_MR, W5500_Sn_MR_MACRAW);
+    w5_write8(W5500_BSB_S0_REG, W5500_Sn_IMR, W5500_Sn_IR_RECV);
+    if (!w5_command(W5500_Sn_CR_OPEN)) return false;
+    w5.rx_left = 0;
+    w5.tx_busy = false;
+    return w5_read8(W5500_BSB_S0_REG, W5500_Sn_SR) == W5500_SOCK_MACRAW;
+}
+
+//--------------------------------------------------------------------
+// Public API
+//--------------------------------------------------------------------
+void w5500_reset_assert(void) {
+    memset(&w5_stats, 0, sizeof(w5_stats));
+    w5.up = false;
+
+    w5_stats.spi_hz = spi_init(W5500_SPI, W5500_SPI_HZ);
+    gpio_set_function(W5500_SCK_PIN, GPIO_FUNC_SPI);
+    gpio_set_function(W5500_MOSI_PIN, GPIO_FUNC_SPI);
+    gpio_set_function(W5500_MISO_PIN, GPIO_FUNC_SPI);
+
+    gpio_init(W5500_CS_PIN);
+    gpio_set_dir(W5500_CS_PIN, GPIO_OUT);
+    gpio_put(W5500_CS_PIN, 1);
+
+    gpio_init(W5500_INT_PIN);
+    gpio_set_dir(W5500_INT_PIN, GPIO_IN);
+    gpio_pull_up(W5500_INT_PIN);  // INTn is open drain, active low
+
+    gpio_init(W5500_RESET_PIN);
+    gpio_set_dir(W5500_RESET_PIN, GPIO_OUT);
+
+    // Frame data goes through DMA when two channels are free
+    w5.dma_tx = dma_claim_unused_channel(false);
+    w5.dma_rx = dma_claim_unused_channel(false);
+    if (w5.dma_tx < 0 || w5.dma_rx < 0) {
+        if (w5.dma_tx >= 0) dma_channel_unclaim(w5.dma_tx);
+        if (w5.dma_rx >= 0) dma_channel_unclaim(w5.dma_rx);
+        w5.dma_tx = w5.dma_rx = -1;
+    }
+
+    gpio_put(W5500_RESET_PIN, 0);
+}
+
+void w5500_reset_release(void) {
+    gpio_put(W5500_RESET_PIN, 1);
+}
+
+bool w5500_init(const uint8_t mac[6]) {
+    memcpy(w5.mac, mac, 6);
+    uint8_t version = w5_read8(W5500_BSB_COMMON, W5500_VERSIONR);
+    if (version != W5500_VERSION) {
+        debug_print("[W5500] Not found (VERSIONR 0x%02x)\n", version);
+        return false;
+    }
+
+    w5_write8(W5500_BSB_COMMON, W5500_MR, W5500_MR_RST);
+    absolute_time_t deadline = make_timeout_time_us(W5500_CMD_TIMEOUT_US);
+    while (w5_read8(W5500_BSB_COMMON, W5500_MR) & W5500_MR_RST) {
+        if (time_reached(deadline)) return false;
+    }
+
+    w5_write(W5500_BSB_COMMON, W5500_SHAR, mac, 6);
+    // Only socket 0 can do MACRAW; give it all the buffer memory
+    for (uint8_t n = 0; n < 8; n++) {
+        uint8_t kb = n == 0 ? W5500_BUF_KB : 0;
+        w5_write8(W5500_BSB_SOCKET(n, 1), W5500_Sn_RXBUF_SIZE, kb);
+        w5_write8(W5500_BSB_SOCKET(n, 1), W5500_Sn_TXBUF_SIZE, kb);
+    }
+    w5_write8(W5500_BSB_COMMON, W5500_IMR, 0);
+    w5_write8(W5500_BSB_COMMON, W5500_SIMR, 0x01);
+
+    if (!w5_open_macraw()) {
+        debug_print("[W5500] MACRAW socket did not open\n");
+        return false;
+    }
+
+    w5.up = true;
+    debug_print("[W5500] MACRAW up, SPI %lu Hz, %s, link %s\n", w5_stats.spi_hz,
+                w5.dma_tx >= 0 ? "DMA" : "no DMA", w5500_link_up() ? "up" : "down");
+    return true;
+}
+
+bool w5500_link_up(void) {
+    return w5.up && (w5_read8(W5500_BSB_COMMON, W5500_PHYCFGR) & W5500_PHY_LNK);
+}
+
+HOT_PATH bool w5500_rx_pending(void) {
+    return w5.up && (w5.rx_left || !gpio_get(W5500_INT_PIN));
+}
+
+HOT_PATH uint16_t w5500_recv(uint8_t* buf, uint16_t cap) {
+    if (!w5.up) return 0;
+
+    // Ack first so a frame landing while this one is read raises INT again
+    if (!gpio_get(W5500_INT_PIN)) w5_write8(W5500_BSB_S0_REG, W5500_Sn_IR, W5500_Sn_IR_RECV);
+
+    // RSR can change between its two bytes; read until two reads agree
+    uint8_t r[4], again[4];
+    w5_read(W5500_BSB_S0_REG, W5500_Sn_RX_RSR, r, sizeof(r));
+    do {
+        memcpy(again, r, sizeof(r));
+        w5_read(W5500_BSB_S0_REG, W5500_Sn_RX_RSR, r, sizeof(r));
+    } while (r[0] != again[0] || r[1] != again[1]);
+
+    uint16_t rsr = (uint16_t)((r[0] << 8) | r[1]);
+    uint16_t rd = (uint16_t)((r[2] << 8) | r[3]);
+    w5.rx_left = 0;
+    if (rsr < 2) return 0;
+
+    // MACRAW prefixes each frame with its length, header included
+    uint8_t hdr[2];
+    w5_read(W5500_BSB_S0_RX, rd, hdr, 2);
+    uint16_t flen = (uint16_t)((hdr[0] << 8) | hdr[1]);
+    if (flen < 2 + 14 || flen > rsr) {
+        // Lost sync with the buffer; start over with an empty one
+        w5_stats.rx_errors++;
+        w5_open_macraw();
+        return 0;
+    }
+
+    uint16_t len = (uint16_t)(flen - 2);
+    if (len <= cap) w5_read(W5500_BSB_S0_RX, (uint16_t)(rd + 2), buf, len);
+    w5_write16(W5500_BSB_S0_REG, W5500_Sn_RX_RD, (uint16_t)(rd + flen));
+    w5_command(W5500_Sn_CR_RECV);
+    w5.rx_left = (uint16_t)(rsr - flen);
+
+    if (len > cap) {
+        w5_stats.rx_errors++;
+        return 0;
+    }
+    w5_stats.rx_frames++;
+    w5_stats.rx_bytes += len;
+    return len;
+}
+
+HOT_PATH bool w5500_send(const uint8_t* frame, uint16_t len) {
+    if (!w5.up) return false;
+
+    // One SEND at a time; small frames are long gone by the next call
+    if (w5.tx_busy) {
+        absolute_time_t deadline = make_timeout_time_us(W5500_SEND_TIMEOUT_US);
+        while (!(w5_read8(W5500_BSB_S0_REG, W5500_Sn_IR) & W5500_Sn_IR_SENDOK)) {
+            if (time_reached(deadline)) break;
+        }
+        w5_write8(W5500_BSB_S0_REG, W5500_Sn_IR, W5500_Sn_IR_SENDOK);
+        w5.tx_busy = false;
+    }
+
+    uint8_t t[6];
+    w5_read(W5500_BSB_S0_REG, W5500_Sn_TX_FSR, t, sizeof(t));
+    uint16_t fsr = (uint16_t)((t[0] << 8) | t[1]);
+    uint16_t wr = (uint16_t)((t[4] << 8) | t[5]);
+    if (fsr < len) {
+        w5_stats.tx_full++;
+        return false;
+    }
+
+    w5_write(W5500_BSB_S0_TX, wr, frame, len);
+    w5_write16(W5500_BSB_S0_REG, W5500_Sn_TX_WR, (uint16_t)(wr + len));
+    if (!w5_command(W5500_Sn_CR_SEND)) return false;
+    w5.tx_busy = true;
+
+    w5_stats.tx_frames++;
+    w5_stats.tx_bytes += len;
+    return true;
+}
+
+const w5500_stats_t* w5500_get_stats(void) {
+    return &w5_stats;
+}
@@ -0,0 +1,72 @@
+#ifndef W5500_H
+#define W5500_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// WIZnet W5500 used as a plain Ethernet MAC: socket 0 in MACRAW mode with
+// all 16 KB of RX and TX buffer, every other socket off. Frames are moved
+// with SPI DMA and the chip is only read once its INT line says a frame has
+// arrived, so an idle link costs one GPIO read per loop. Core0 only.
+
+// SPI1, clear of the MAX3421E on SPI0 and the PIO-USB pins
+#define W5500_SPI         spi1
+#define W5500_SCK_PIN     10
+#define W5500_MOSI_PIN    11
+#define W5500_MISO_PIN    12
+#define W5500_CS_PIN      13
+#define W5500_RESET_PIN   20
+#define W5500_INT_PIN     21
+
+// The chip is rated to 80 MHz; spi_init() settles on clk_peri / 4 (31.25 MHz
+// from 125 MHz), which is what the board layout is good for anyway.
+#ifndef W5500_SPI_HZ
+#define W5500_SPI_HZ      (33 * 1000 * 1000)
+#endif
+
+// Buffer accesses at least this long go through DMA
+#ifndef W5500_DMA_MIN_LEN
+#define W5500_DMA_MIN_LEN 16
+#endif
+
+typedef struct {
+    uint32_t spi_hz;        // Clock actually achieved
+    uint32_t rx_frames;
+    uint32_t rx_bytes;
+    uint32_t rx_errors;     // Bad length header; socket reopened
+    uint32_t tx_frames;
+    uint32_t tx_bytes;
+    uint32_t tx_full;       // Dropped, TX buffer had no room
+    uint32_t dma_transfers;
+} w5500_stats_t;
+
+// Reset has to be held for at least 500 us, and the PLL needs 1 ms to lock
+// after release. The caller times both (no sleeps in here).
+#define W5500_RESET_HOLD_US   1000
+#define W5500_RESET_SETTLE_US 2000
+
+// Set up the pins, SPI and DMA and put the chip in reset
+void w5500_reset_assert(void);
+
+void w5500_reset_release(void);
+
+// Once the chip has settled: load the MAC address and open socket 0 in
+// MACRAW mode with the MAC filter on (own address and broadcast only).
+// Returns false if no W5500 answers.
+bool w5500_init(const uint8_t mac[6]);
+
+bool w5500_link_up(void);
+
+// A frame is waiting: INT is asserted or the last read left data behind.
+bool w5500_rx_pending(void);
+
+// Copy the next frame (without the MACRAW length header) into buf. Returns
+// its length, 0 if there is none. Frames longer than cap are dropped.
+uint16_t w5500_recv(uint8_t* buf, uint16_t cap);
+
+// Queue one frame for transmission. Returns false if the TX buffer is full.
+bool w5500_send(const uint8_t* frame, uint16_t len);
+
+const w5500_stats_t* w5500_get_stats(void);
+
+#endif // W5500_H
@@ -0,0 +1,206 @@
+#!/usr/bin/env python3
+"""List where the RP2040 firmware's functions ended up: XIP flash, striped
+SRAM or one of the scratch banks.
+
+Run by the rp2040_build POST_BUILD step, or by hand:
+
+    placement_report.py --nm arm-none-eabi-nm build/SR71-SPI.elf
+
+The report-forwarding path is checked by name; anything on it still
+executing from flash is marked with '!'. With SR71_RAM_HOT_PATH=OFF all of
+it is expected to be in flash.
+"""
+
+import argparse
+import subprocess
+import sys
+
+REGIONS = [
+    # name, start, end (exclusive)
+    ("FLASH", 0x10000000, 0x11000000),
+    ("SRAM", 0x20000000, 0x20040000),
+    ("SCRATCH_X", 0x20040000, 0x20041000),
+    ("SCRATCH_Y", 0x20041000, 0x20042000),
+]
+
+# Functions tagged HOT_PATH / HOT_PATH_IRQ, plus SDK and TinyUSB code the
+# same path calls into. Missing ones belong to the other host backend.
+HOT_PATH = [
+    "Adafruit_MAX3421E::gpioIrq",
+    "Adafruit_MAX3421E::task",
+    "Adafruit_MAX3421E::serviceIrq",
+    "Adafruit_MAX3421E::frameNumber",
+    "Adafruit_MAX3421E::spiFrame",
+    "Adafruit_MAX3421E::spiDma",
+    "Adafruit_MAX3421E::readRegister",
+    "Adafruit_MAX3421E::writeRegister",
+    "Adafruit_MAX3421E::readFIFO",
+    "Adafruit_MAX3421E::writeFIFO",
+    "Adafruit_MAX3421E::waitForInterrupt",
+    "Adafruit_MAX3421E::hostTransfer",
+    "Adafruit_MAX3421E::packetIn",
+    "Adafruit_MAX3421E::packetOut",
+    "Adafruit_MAX3421E::selectAddress",
+    "Adafruit_MAX3421E::setupPacket",
+    "Adafruit_MAX3421E::inPacket",
+    "Adafruit_MAX3421E::outPacket",
+    "Adafruit_MAX3421E::handshakePacket",
+    "ep_find",
+    "ep_complete",
+    "result_of",
+    "ep_run",
+    "max3421e_hcd_task",
+    "hcd_frame_number",
+    "hcd_setup_send",
+    "hcd_edpt_xfer",
+    "tuh_hid_report_received_cb",
+    "pt_drain",
+    "hid_passthrough_task",
+    "hid_passthrough_set_override",
+    "hp_apply",
+    "hp_override_active",
+    "hp_put_bits",
+    "hp_scale",
+    "spsc_claim",
+    "spsc_publish",
+    "spsc_push",
+    "spsc_peek",
+    "spsc_release",
+    "spsc_pop",
+    "core_util_account",
+    "hid_passthrough_inject",
+    "pt_synthesize",
+    "hp_add_delta",
+    "hp_idle",
+    "net_control_task",
+    "net_datagram",
+    "w5500_rx_pending",
+    "w5500_recv",
+    "w5500_send",
+    "w5_frame",
+    "w5_dma",
+    "nu_input",
+    "kp_handle",
+    "kc_mouse",
+    "kc_update_override",
+    "kc_execute",
+    "kc_queue",
+    "kc_late",
+    "kc_due",
+    "kc_play",
+    "kmbox_control_task",
+    "hid_passthrough_override_pending",
+    "kmbox_control_set_arrival",
+    "kmbox_control_reply_sent",
+    "uart_control_task",
+    "uc_frame",
+    "uc_send",
+    "sf_feed",
+    "sf_end",
+    "sf_encode",
+    "sf_crc16",
+    "sched_run",
+    "sched_next",
+    "cw_add",
+    "cw_advance",
+    "cw_release",
+    "jb_push",
+    "jb_poll",
+    "jb_release",
+    "jb_enqueue",
+    "jb_estimate",
+    # Not ours, listed so the report shows what is left in flash
+    "spi_write_read_blocking",
+    "spi_read_blocking",
+    "spi_write_blocking",
+    "tuh_task_ext",
+    "tud_task_ext",
+    "tud_hid_n_report",
+]
+
+
+def region_of(addr):
+    for name, start, end in REGIONS:
+        if start <= addr < end:
+            return name
+    return "OTHER"
+
+
+def read_functions(nm, elf):
+    out = subprocess.run([nm, "-S", "-C", "--defined-only", elf],
+                         check=True, capture_output=True, text=True).stdout
+    funcs = []
+    for line in out.splitlines():
+        parts = line.split(None, 3)
+        if len(parts) != 4 or parts[2] not in ("T", "t", "W"):
+            continue
+        # Thumb function symbols carry bit 0
+        addr = int(parts[0], 16) & ~1
+        size = int(parts[1], 16)
+        name = parts[3]
+        funcs.append((name, addr, size))
+    return funcs
+
+
+def base_name(name):
+    return name.split("(", 1)[0]
+
+
+def report(funcs, elf):
+    lines = ["Placement of %s" % elf, ""]
+
+    totals = {}
+    for _, addr, size in funcs:
+        r = region_of(addr)
+        count, nbytes = totals.get(r, (0, 0))
+        totals[r] = (count + 1, nbytes + size)
+    lines.append("%-10s %9s %10s" % ("region", "functions", "bytes"))
+    for name, _, _ in REGIONS + [("OTHER", 0, 0)]:
+        if name in totals:
+            lines.append("%-10s %9d %10d" % (name, totals[name][0], totals[name][1]))
+    lines.append("")
+
+    by_name = {}
+    for name, addr, size in funcs:
+        by_name.setdefault(base_name(name), []).append((addr, size))
+
+    in_flash = 0
+    lines.append("Report path:")
+    for name in HOT_PATH:
+        for addr, size in by_name.get(name, []):
+            r = region_of(addr)
+            flag = "!" if r == "FLASH" else " "
+            if r == "FLASH":
+                in_flash += 1
+            lines.append(" %s %-10s 0x%08x %6d  %s" % (flag, r, addr, size, name))
+    lines.append("")
+
+    lines.append("Everything outside flash:")
+    for name, addr, size in sorted(funcs, key=lambda f: f[1]):
+        r = region_of(addr)
+        if r != "FLASH":
+            lines.append("   %-10s 0x%08x %6d  %s" % (r, addr, size, name))
+    lines.append("")
+    lines.append("%d report-path function(s) execute from flash" % in_flash)
+    return "\n".join(lines) + "\n"
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("elf")
+    parser.add_argument("--nm", default="arm-none-eabi-nm")
+    parser.add_argument("--out", help="write the report here instead of stdout")
+    args = parser.parse_args()
+
+    text = report(read_functions(args.nm, args.elf), args.elf)
+    if args.out:
+        with open(args.out, "w") as f:
+            f.write(text)
+        # One line in the build log; the details are in the file
+        print(text.rstrip().splitlines()[-1])
+    else:
+        sys.stdout.write(text)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,144 @@
+#define _GNU_SOURCE
+#include "bench_common.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "kmbox_proto.h"
+
+uint64_t bench_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static int cmp_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+void bench_print_stats(const char *label, uint64_t *ns, size_t n) {
+    if (n == 0) {
+        printf("%-24s no samples\n", label);
+        return;
+    }
+    qsort(ns, n, sizeof(ns[0]), cmp_u64);
+    uint64_t sum = 0;
+    for (size_t i = 0; i < n; i++) sum += ns[i];
+    printf("%-24s n=%zu  min %.2f  avg %.2f  p50 %.2f  p99 %.2f  max %.2f us\n", label, n,
+           ns[0] / 1000.0, (double)sum / n / 1000.0, ns[n / 2] / 1000.0, ns[(n * 99) / 100] / 1000.0,
+           ns[n - 1] / 1000.0);
+}
+
+uint16_t bench_build_move(uint8_t *out, uint16_t cap, uint32_t uuid, uint32_t index, uint32_t cmd) {
+    kp_mouse_t m;
+    uint8_t body[KP_MOUSE_LEN];
+    memset(&m, 0, sizeof(m));
+    m.x = (int32_t)(index % 7) - 3;
+    m.y = 1;
+    kp_build_mouse(body, &m);
+    return kp_build(out, cap, uuid, index, cmd, 0, body, sizeof(body));
+}
+
+//--------------------------------------------------------------------
+// Kernel UDP loopback
+//--------------------------------------------------------------------
+static kp_session_t server_kp;
+static volatile int server_stop;
+
+static bool server_mouse(void *ctx, const kp_mouse_t *m) {
+    (void)ctx;
+    (void)m;
+    return true;
+}
+
+static void *server_main(void *arg) {
+    int fd = *(int *)arg;
+    uint8_t buf[2048], reply[64];
+    while (!server_stop) {
+        struct sockaddr_in from;
+        socklen_t flen = sizeof(from);
+        ssize_t n = recvfrom(fd, buf, sizeof(buf), 0, (struct sockaddr *)&from, &flen);
+        if (n <= 0) continue;
+        uint16_t r = kp_handle(&server_kp, buf, (uint16_t)n, reply, sizeof(reply));
+        if (r) sendto(fd, reply, r, 0, (struct sockaddr *)&from, flen);
+    }
+    return NULL;
+}
+
+static int client_socket(void) {
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    struct timeval tv = { 0, 200000 };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    return fd;
+}
+
+int bench_udp_client(const char *label, const struct sockaddr_in *dst, uint32_t uuid, uint32_t iterations) {
+    int fd = client_socket();
+    uint8_t pkt[256], reply[256];
+    uint16_t plen = kp_build(pkt, sizeof(pkt), uuid, 0, KP_CMD_CONNECT, 0, NULL, 0);
+    sendto(fd, pkt, plen, 0, (const struct sockaddr *)dst, sizeof(*dst));
+    if (recv(fd, reply, sizeof(reply), 0) < KP_HEAD_LEN) {
+        fprintf(stderr, "%s: no answer to connect (wrong address or UUID?)\n", label);
+        close(fd);
+        return 1;
+    }
+
+    uint64_t *rtt = calloc(iterations, sizeof(uint64_t));
+    size_t n = 0;
+    uint32_t lost = 0;
+    for (uint32_t i = 1; i <= iterations; i++) {
+        plen = bench_build_move(pkt, sizeof(pkt), uuid, i, KP_CMD_MOUSE_MOVE);
+        uint64_t t0 = bench_now_ns();
+        sendto(fd, pkt, plen, 0, (const struct sockaddr *)dst, sizeof(*dst));
+        ssize_t r = recv(fd, reply, sizeof(reply), 0);
+        uint64_t t1 = bench_now_ns();
+        if (r < KP_HEAD_LEN || memcmp(reply + 8, pkt + 8, 8) != 0) {
+            lost++;
+            continue;
+        }
+        rtt[n++] = t1 - t0;
+    }
+    printf("%s: %u commands, %u lost\n", label, iterations, lost);
+    bench_print_stats("  command -> ack RTT", rtt, n);
+    free(rtt);
+    close(fd);
+    return 0;
+}
+
+int bench_udp_loopback(uint32_t iterations) {
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(BENCH_SOCKET_PORT);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        fprintf(stderr, "socket: bind: %s\n", strerror(errno));
+        return 1;
+    }
+    struct timeval tv = { 0, 100000 };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+    kp_handlers_t h;
+    memset(&h, 0, sizeof(h));
+    h.mouse = server_mouse;
+    kp_init(&server_kp, BENCH_UUID, &h);
+
+    pthread_t th;
+    pthread_create(&th, NULL, server_main, &fd);
+    int rc = bench_udp_client("socket (127.0.0.1)", &addr, BENCH_UUID, iterations);
+    server_stop = 1;
+    pthread_join(th, NULL);
+    close(fd);
+    return rc;
+}
@@ -0,0 +1,32 @@
+/*
+ * Pieces the host-side latency benches share: timing, percentile summary,
+ * KMBox command building and the kernel UDP loopback baseline every
+ * transport is compared against.
+ */
+#ifndef BENCH_COMMON_H
+#define BENCH_COMMON_H
+
+#include <netinet/in.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define BENCH_UUID        0x12345678u
+#define BENCH_SOCKET_PORT 18888
+
+uint64_t bench_now_ns(void);
+
+// Sorts ns in place and prints min/avg/p50/p99/max in microseconds
+void bench_print_stats(const char *label, uint64_t *ns, size_t n);
+
+// A mouse command with a small varying move, the same one every bench sends
+uint16_t bench_build_move(uint8_t *out, uint16_t cap, uint32_t uuid, uint32_t index, uint32_t cmd);
+
+// Connect, then time iterations of move -> acknowledgement against a UDP
+// KMBox endpoint
+int bench_udp_client(const char *label, const struct sockaddr_in *dst, uint32_t uuid, uint32_t iterations);
+
+// The protocol core behind a kernel UDP socket on 127.0.0.1, timed with
+// bench_udp_client()
+int bench_udp_loopback(uint32_t iterations);
+
+#endif // BENCH_COMMON_H
@@ -0,0 +1,162 @@
+/*
+ * KMBox NET latency bench for the RP2040 network path, run on Linux.
+ *
+ *   model   Feed client frames straight through the firmware's own
+ *           responder (common/net_udp.c + common/kmbox_proto.c) and time
+ *           frame -> command handler -> reply frame. Also prints what the
+ *           W5500 SPI traffic for one command costs at a given clock, so the
+ *           device numbers can be split into wire time and CPU time.
+ *   socket  Same protocol core behind a kernel UDP socket on 127.0.0.1:
+ *           the software loopback baseline.
+ *   target  Round trip to a real device (-H/-u), for comparison
+ *           with the two above.
+ *
+ * Build with `make` in this directory.
+ */
+#define _GNU_SOURCE
+#include <arpa/inet.h>
+#include <getopt.h>
+#include <netinet/in.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "bench_common.h"
+#include "kmbox_proto.h"
+#include "net_udp.h"
+
+//--------------------------------------------------------------------
+// Model: the firmware responder, in process
+//--------------------------------------------------------------------
+static kp_session_t model_kp;
+static uint64_t model_handler_ns;
+
+static bool model_mouse(void *ctx, const kp_mouse_t *m) {
+    (void)ctx;
+    (void)m;
+    model_handler_ns = bench_now_ns();
+    return true;
+}
+
+static uint16_t model_datagram(void *ctx, const nu_peer_t *from, const uint8_t *data, uint16_t len,
+                               uint8_t *reply, uint16_t reply_cap) {
+    (void)ctx;
+    (void)from;
+    return kp_handle(&model_kp, data, len, reply, reply_cap);
+}
+
+// SPI bytes the firmware moves for one command frame of len bytes and its
+// 58-byte reply (w5500.cpp: 3-byte header on every access)
+static uint32_t w5500_spi_bytes(uint16_t len, uint16_t reply_len) {
+    uint32_t rx = 4 + 2 * 7 + 5 + (3 + len) + 5 + 4 + 4;        // IR ack, RSR x2, length, frame, RX_RD, RECV
+    uint32_t tx = 4 + 4 + 9 + (3 + reply_len) + 5 + 4 + 4;      // SENDOK check/ack, FSR..WR, frame, TX_WR, SEND
+    return rx + tx;
+}
+
+static int run_model(uint32_t iterations, uint32_t spi_hz) {
+    static const nu_peer_t dev = { { 0x10, 0xA0, 0x69, 0x00, 0x00, 0x01 }, { 192, 168, 1, 177 }, KP_DEFAULT_PORT };
+    static const nu_peer_t cli = { { 0x02, 0x00, 0x00, 0x00, 0x00, 0x02 }, { 192, 168, 1, 10 }, 50000 };
+    nu_iface_t nif;
+    kp_handlers_t h;
+    memset(&h, 0, sizeof(h));
+    h.mouse = model_mouse;
+    kp_init(&model_kp, BENCH_UUID, &h);
+    nu_init(&nif, dev.mac, dev.ip, dev.port, model_datagram, NULL);
+
+    uint8_t pkt[256], frame[NU_FRAME_MAX], out[NU_FRAME_MAX];
+    uint16_t plen = kp_build(pkt, sizeof(pkt), BENCH_UUID, 0, KP_CMD_CONNECT, 0, NULL, 0);
+    uint16_t flen = nu_build_udp(frame, sizeof(frame), &cli, &dev, 0, pkt, plen);
+    if (nu_input(&nif, frame, flen, out, sizeof(out)) == 0) {
+        fprintf(stderr, "model: connect not answered\n");
+        return 1;
+    }
+
+    uint64_t *to_handler = calloc(iterations, sizeof(uint64_t));
+    uint64_t *to_reply = calloc(iterations, sizeof(uint64_t));
+    size_t n = 0;
+    uint16_t last_len = 0, last_reply = 0;
+    for (uint32_t i = 1; i <= iterations; i++) {
+        plen = bench_build_move(pkt, sizeof(pkt), BENCH_UUID, i, KP_CMD_MOUSE_MOVE);
+        flen = nu_build_udp(frame, sizeof(frame), &cli, &dev, (uint16_t)i, pkt, plen);
+
+        model_handler_ns = 0;
+        uint64_t t0 = bench_now_ns();
+        uint16_t olen = nu_input(&nif, frame, flen, out, sizeof(out));
+        uint64_t t1 = bench_now_ns();
+        if (olen < NU_UDP_OFFSET + KP_HEAD_LEN || !model_handler_ns ||
+            memcmp(out + NU_UDP_OFFSET + 8, pkt + 8, 8) != 0) {
+            fprintf(stderr, "model: bad reply to command %u\n", i);
+            return 1;
+        }
+        to_handler[n] = model_handler_ns - t0;
+        to_reply[n] = t1 - t0;
+        n++;
+        last_len = flen;
+        last_reply = olen;
+    }
+
+    printf("model: %u commands through net_udp + kmbox_proto (%u-byte frames)\n", iterations, last_len);
+    bench_print_stats("  frame -> handler", to_handler, n);
+    bench_print_stats("  frame -> reply frame", to_reply, n);
+    if (spi_hz) {
+        uint32_t bytes = w5500_spi_bytes(last_len, last_reply);
+        printf("  W5500 SPI at %.2f MHz: %u bytes per command, %.2f us on the wire\n", spi_hz / 1e6, bytes,
+               bytes * 8.0 * 1e6 / spi_hz);
+    }
+    printf("  stats: frames %u udp %u bad %u, cmds %u rejected %u\n", nif.stats.frames, nif.stats.udp_rx,
+           nif.stats.bad, model_kp.stats.accepted, model_kp.stats.rejected);
+    free(to_handler);
+    free(to_reply);
+    return 0;
+}
+
+//--------------------------------------------------------------------
+// Main
+//--------------------------------------------------------------------
+static void usage(const char *argv0) {
+    fprintf(stderr,
+            "usage: %s [-m model|socket|target|all] [-n iterations] [-s spi_hz]\n"
+            "          [-H host] [-p port] [-u uuid_hex]\n", argv0);
+}
+
+int main(int argc, char **argv) {
+    const char *mode = "all";
+    const char *host = "192.168.1.177";
+    uint32_t iterations = 10000;
+    uint32_t spi_hz = 31250000;
+    uint16_t port = KP_DEFAULT_PORT;
+    uint32_t uuid = 0;
+    int c;
+
+    while ((c = getopt(argc, argv, "m:n:s:H:p:u:h")) != -1) {
+        switch (c) {
+            case 'm': mode = optarg; break;
+            case 'n': iterations = (uint32_t)strtoul(optarg, NULL, 0); break;
+            case 's': spi_hz = (uint32_t)strtoul(optarg, NULL, 0); break;
+            case 'H': host = optarg; break;
+            case 'p': port = (uint16_t)strtoul(optarg, NULL, 0); break;
+            case 'u': uuid = (uint32_t)strtoul(optarg, NULL, 16); break;
+            default: usage(argv[0]); return 2;
+        }
+    }
+    if (iterations == 0) iterations = 1;
+
+    int rc = 0;
+    bool all = strcmp(mode, "all") == 0;
+    if (all || strcmp(mode, "model") == 0) rc |= run_model(iterations, spi_hz);
+    if (all || strcmp(mode, "socket") == 0) rc |= bench_udp_loopback(iterations);
+    if (strcmp(mode, "target") == 0) {
+        struct sockaddr_in dst;
+        memset(&dst, 0, sizeof(dst));
+        dst.sin_family = AF_INET;
+        dst.sin_port = htons(port);
+        if (inet_pton(AF_INET, host, &dst.sin_addr) != 1) {
+            fprintf(stderr, "bad host %s\n", host);
+            return 2;
+        }
+        rc |= bench_udp_client("target", &dst, uuid, iterations);
+    }
+    return rc;
+}
@@ -0,0 +1,463 @@
+/*
+ * Profile snapshot reader for the i.MX RT1060 Profile build, run on Linux.
+ *
+ * Reads the snapshot (common/prof_snapshot.h) over KMBox NET, or from a
+ * dump saved earlier, and prints the run-time table. Optionally writes:
+ *
+ *   -o  the raw snapshot, to read again later with -i
+ *   -x  the TraceX part on its own, for TraceX (File > Open, .trx)
+ *   -j  the trace as Chrome trace JSON: open it at ui.perfetto.dev. One
+ *       track per thread with its run slices and the moments the kernel
+ *       picked it, one per interrupt with its handler slices, and the
+ *       firmware's own events as instants on whatever track logged them.
+ *
+ * Build with `make` in this directory.
+ */
+#define _GNU_SOURCE
+#include <arpa/inet.h>
+#include <getopt.h>
+#include <netinet/in.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include "kmbox_proto.h"
+#include "prof_snapshot.h"
+
+#define FETCH_RETRIES  5
+#define ISR_TID_BASE   1000   // Interrupt tracks after the threads
+#define MAX_TRACKS     64
+#define MAX_NEST       16
+
+//--------------------------------------------------------------------
+// Fetch
+//--------------------------------------------------------------------
+// One request and its matching reply, resent on timeout
+static int fetch_request(int fd, const struct sockaddr_in *dst, uint8_t *pkt, uint16_t plen,
+                         uint8_t *reply, size_t cap) {
+    for (int attempt = 0; attempt < FETCH_RETRIES; attempt++) {
+        sendto(fd, pkt, plen, 0, (const struct sockaddr *)dst, sizeof(*dst));
+        for (;;) {
+            ssize_t r = recv(fd, reply, cap, 0);
+            if (r < 0) break;
+            // A late answer to an earlier attempt or request is skipped
+            if (r >= KP_HEAD_LEN && memcmp(reply + 8, pkt + 8, 8) == 0) return (int)r;
+        }
+    }
+    return -1;
+}
+
+static uint8_t *fetch(const struct sockaddr_in *dst, uint32_t uuid, size_t *len) {
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    struct timeval tv = { 0, 300000 };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+    uint8_t pkt[64], reply[2048];
+    uint32_t index = 0;
+    uint16_t plen = kp_build(pkt, sizeof(pkt), uuid, index++, KP_CMD_CONNECT, 0, NULL, 0);
+    if (fetch_request(fd, dst, pkt, plen, reply, sizeof(reply)) < 0) {
+        fprintf(stderr, "no answer to connect (wrong address or UUID?)\n");
+        close(fd);
+        return NULL;
+    }
+
+    uint8_t *buf = NULL;
+    uint32_t total = 0, offset = 0;
+    do {
+        plen = kp_build(pkt, sizeof(pkt), uuid, index++, KP_CMD_SNAPSHOT, offset, NULL, 0);
+        int r = fetch_request(fd, dst, pkt, plen, reply, sizeof(reply));
+        uint32_t got_total, got_offset;
+        const uint8_t *data;
+        uint16_t n;
+        if (r < 0) {
+            fprintf(stderr, "snapshot: no answer at offset %u\n", offset);
+            break;
+        }
+        if (!kp_parse_snapshot(reply, (uint16_t)r, &got_total, &got_offset, &data, &n) || got_total == 0) {
+            fprintf(stderr, "snapshot: not available (firmware is not a Profile build?)\n");
+            break;
+        }
+        if (buf == NULL) {
+            total = got_total;
+            buf = malloc(total);
+        } else if (got_total != total || got_offset != offset) {
+            fprintf(stderr, "snapshot: changed while reading (another reader?)\n");
+            break;
+        }
+        if (n == 0 || offset + n > total) {
+            fprintf(stderr, "snapshot: bad chunk at offset %u\n", offset);
+            break;
+        }
+        memcpy(buf + offset, data, n);
+        offset += n;
+    } while (offset < total);
+    close(fd);
+
+    if (buf == NULL || offset < total) {
+        free(buf);
+        return NULL;
+    }
+    *len = total;
+    return buf;
+}
+
+//--------------------------------------------------------------------
+// Files
+//--------------------------------------------------------------------
+static uint8_t *read_file(const char *path, size_t *len) {
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        perror(path);
+        return NULL;
+    }
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    uint8_t *buf = size > 0 ? malloc((size_t)size) : NULL;
+    if (buf == NULL || fread(buf, 1, (size_t)size, f) != (size_t)size) {
+        fprintf(stderr, "%s: read failed\n", path);
+        free(buf);
+        buf = NULL;
+    }
+    fclose(f);
+    *len = (size_t)size;
+    return buf;
+}
+
+static int write_file(const char *path, const void *data, size_t len) {
+    FILE *f = fopen(path, "wb");
+    if (!f || fwrite(data, 1, len, f) != len) {
+        perror(path);
+        if (f) fclose(f);
+        return 1;
+    }
+    fclose(f);
+    return 0;
+}
+
+//--------------------------------------------------------------------
+// Snapshot
+//--------------------------------------------------------------------
+typedef struct {
+    const prof_snap_header_t *head;
+    const prof_snap_entry_t *entries;
+    const uint8_t *trace;      // TraceX dump
+    uint32_t trace_size;
+} snapshot_t;
+
+static bool snapshot_parse(const uint8_t *buf, size_t len, snapshot_t *s) {
+    const prof_snap_header_t *h = (const prof_snap_header_t *)buf;
+    if (len < sizeof(*h) || h->magic != PROF_SNAP_MAGIC || h->version != PROF_SNAP_VERSION) {
+        fprintf(stderr, "not a profile snapshot (or another version)\n");
+        return false;
+    }
+    size_t table = sizeof(*h) + (size_t)h->entries * sizeof(prof_snap_entry_t);
+    if (len < table + h->trace_size || h->cpu_hz == 0) {
+        fprintf(stderr, "snapshot truncated\n");
+        return false;
+    }
+    s->head = h;
+    s->entries = (const prof_snap_entry_t *)(buf + sizeof(*h));
+    s->trace = buf + table;
+    s->trace_size = h->trace_size;
+    return true;
+}
+
+static const char *kind_name(uint8_t kind) {
+    switch (kind) {
+        case PROF_KIND_THREAD: return "thread";
+        case PROF_KIND_ISR: return "isr";
+        case PROF_KIND_IDLE: return "idle";
+        case PROF_KIND_INIT: return "init";
+        default: return "?";
+    }
+}
+
+static void print_table(const snapshot_t *s) {
+    double per_us = s->head->cpu_hz / 1e6;
+    double window = (double)s->head->window_cycles;
+    printf("window %.1f ms at %u MHz, %u entries\n", window / per_us / 1000.0,
+           s->head->cpu_hz / 1000000u, s->head->entries);
+    printf("%-6s %-24s %4s %6s %10s %8s %9s %9s %9s\n", "kind", "name", "prio", "cpu%", "ms", "runs",
+           "max us", "wait avg", "wait max");
+    for (uint16_t i = 0; i < s->head->entries; i++) {
+        const prof_snap_entry_t *e = &s->entries[i];
+        char name[PROF_NAME_LEN + 16];
+        if (e->kind == PROF_KIND_ISR && e->name[0] == '\0')
+            snprintf(name, sizeof(name), "IRQ %d", e->irq);
+        else
+            snprintf(name, sizeof(name), "%.*s", PROF_NAME_LEN, e->name);
+        printf("%-6s %-24s ", kind_name(e->kind), name);
+        if (e->kind == PROF_KIND_THREAD) printf("%4u ", e->priority);
+        else printf("%4s ", "");
+        printf("%6.2f %10.3f %8u %9.2f", window > 0 ? 100.0 * e->cycles / window : 0.0,
+               e->cycles / per_us / 1000.0, e->count, e->max_cycles / per_us);
+        if (e->waits)
+            printf(" %9.2f %9.2f", (double)e->wait_cycles / e->waits / per_us, e->wait_max_cycles / per_us);
+        printf("\n");
+    }
+}
+
+//--------------------------------------------------------------------
+// Chrome trace JSON
+//--------------------------------------------------------------------
+typedef struct {
+    uint32_t thread;           // Device address, PROF_TRACE_IN_ISR for interrupts
+    int irq;
+    int tid;
+    char name[48];
+} track_t;
+
+typedef struct {
+    FILE *out;
+    double per_us;
+    uint64_t t0;
+    bool first;
+    track_t tracks[MAX_TRACKS];
+    int n_tracks;
+} json_t;
+
+static void json_sep(json_t *j) {
+    fprintf(j->out, j->first ? "\n  " : ",\n  ");
+    j->first = false;
+}
+
+static void json_name(FILE *out, const char *s) {
+    fputc('"', out);
+    for (; *s; s++) {
+        if (*s == '"' || *s == '\\') fputc('\\', out);
+        if ((unsigned char)*s >= 0x20) fputc(*s, out);
+    }
+    fputc('"', out);
+}
+
+static track_t *track_find(json_t *j, uint32_t thread, int irq) {
+    for (int i = 0; i < j->n_tracks; i++)
+        if (j->tracks[i].thread == thread && j->tracks[i].irq == irq) return &j->tracks[i];
+    return NULL;
+}
+
+// Tracks are named from the TraceX registry and the run-time table
+static track_t *track_get(json_t *j, const snapshot_t *s, uint32_t thread, int irq) {
+    track_t *t = track_find(j, thread, irq);
+    if (t || j->n_tracks == MAX_TRACKS) return t;
+    t = &j->tracks[j->n_tracks++];
+    t->thread = thread;
+    t->irq = irq;
+    t->name[0] = '\0';
+    if (thread == PROF_TRACE_IN_ISR) {
+        t->tid = ISR_TID_BASE + irq;
+        for (uint16_t i = 0; i < s->head->entries; i++)
+            if (s->entries[i].kind == PROF_KIND_ISR && s->entries[i].irq == irq && s->entries[i].name[0])
+                snprintf(t->name, sizeof(t->name), "%.*s", PROF_NAME_LEN, s->entries[i].name);
+        if (t->name[0] == '\0') snprintf(t->name, sizeof(t->name), "IRQ %d", irq);
+    } else {
+        const prof_trace_header_t *h = (const prof_trace_header_t *)s->trace;
+        const prof_trace_object_t *o = (const prof_trace_object_t *)(s->trace + (h->registry_start - h->base));
+        const prof_trace_object_t *end = (const prof_trace_object_t *)(s->trace + (h->registry_end - h->base));
+        t->tid = j->n_tracks;
+        for (; o < end; o++)
+            if (!o->available && o->object == thread)
+                snprintf(t->name, sizeof(t->name), "%.*s", PROF_TRACE_NAME_LEN, (const char *)o->name);
+        if (t->name[0] == '\0') snprintf(t->name, sizeof(t->name), "thread 0x%08x", thread);
+    }
+    json_sep(j);
+    fprintf(j->out, "{\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"name\":\"thread_name\",\"args\":{\"name\":", t->tid);
+    json_name(j->out, t->name);
+    fprintf(j->out, "}}");
+    json_sep(j);
+    fprintf(j->out, "{\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"name\":\"thread_sort_index\",\"args\":{\"sort_index\":%d}}",
+            t->tid, t->tid);
+    return t;
+}
+
+static double json_ts(const json_t *j, uint64_t t) {
+    return (double)(t - j->t0) / j->per_us;
+}
+
+static void json_slice(json_t *j, const track_t *t, const char *name, uint64_t begin, uint64_t end) {
+    if (t == NULL) return;
+    json_sep(j);
+    fprintf(j->out, "{\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"name\":", t->tid);
+    json_name(j->out, name);
+    fprintf(j->out, ",\"ts\":%.3f,\"dur\":%.3f}", json_ts(j, begin), (double)(end - begin) / j->per_us);
+}
+
+static void json_instant(json_t *j, const track_t *t, const char *name, uint64_t at, const uint32_t *info) {
+    if (t == NULL) return;
+    json_sep(j);
+    fprintf(j->out, "{\"ph\":\"i\",\"s\":\"t\",\"pid\":1,\"tid\":%d,\"name\":", t->tid);
+    json_name(j->out, name);
+    fprintf(j->out, ",\"ts\":%.3f,\"args\":{\"info1\":%u,\"info2\":%u,\"info3\":%u}}", json_ts(j, at),
+            info[0], info[1], info[2]);
+}
+
+static const char *event_name(uint32_t id) {
+    switch (id) {
+        case PROF_EV_HOST_REPORT: return "host report";
+        case PROF_EV_PC_REPORT: return "PC report";
+        case PROF_EV_NET_CMD: return "net command";
+        case PROF_TRACE_THREAD_RESUME: return "picked";
+        default: return "event";
+    }
+}
+
+static int write_json(const char *path, const snapshot_t *s) {
+    const prof_trace_header_t *h = (const prof_trace_header_t *)s->trace;
+    if (s->trace_size < sizeof(*h) || h->id != PROF_TRACE_VALID) {
+        fprintf(stderr, "snapshot carries no TraceX dump\n");
+        return 1;
+    }
+    const prof_trace_event_t *start = (const prof_trace_event_t *)(s->trace + (h->buffer_start - h->base));
+    const prof_trace_event_t *end = (const prof_trace_event_t *)(s->trace + (h->buffer_end - h->base));
+    const prof_trace_event_t *cur = (const prof_trace_event_t *)(s->trace + (h->buffer_current - h->base));
+    if ((const uint8_t *)end > s->trace + s->trace_size || start > cur || cur > end) {
+        fprintf(stderr, "TraceX dump pointers out of range\n");
+        return 1;
+    }
+
+    json_t j;
+    memset(&j, 0, sizeof(j));
+    j.out = fopen(path, "w");
+    if (!j.out) {
+        perror(path);
+        return 1;
+    }
+    j.per_us = s->head->cpu_hz / 1e6;
+    j.first = true;
+    fprintf(j.out, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+
+    // Oldest first: from the write position once the buffer has wrapped
+    size_t n = (size_t)(end - start);
+    size_t first = (cur < end && cur->event != 0) ? (size_t)(cur - start) : 0;
+    bool have_time = false;
+    uint32_t last = 0;
+    uint64_t now = 0;
+    track_t *running = NULL;
+    uint64_t running_since = 0;
+    struct { track_t *t; uint64_t since; } isr[MAX_NEST];
+    int depth = 0;
+    size_t events = 0;
+
+    for (size_t k = 0; k < n; k++) {
+        const prof_trace_event_t *e = &start[(first + k) % n];
+        if (e->event == 0) continue;
+        // The cycle counter wraps every few seconds; SysTick alone logs far
+        // more often than that, so consecutive stamps are never a wrap apart
+        if (!have_time) {
+            j.t0 = e->time;
+            now = e->time;
+            have_time = true;
+        } else {
+            now += (uint32_t)(e->time - last);
+        }
+        last = e->time;
+        events++;
+
+        track_t *ctx = e->thread == PROF_TRACE_IN_ISR ? (depth ? isr[depth - 1].t : NULL)
+                     : (e->thread && e->thread != PROF_TRACE_IN_INIT) ? track_get(&j, s, e->thread, 0) : NULL;
+        switch (e->event) {
+            case PROF_TRACE_RUNNING:
+                if (running) json_slice(&j, running, "running", running_since, now);
+                running = track_get(&j, s, e->thread, 0);
+                running_since = now;
+                break;
+            case PROF_EV_IDLE:
+                if (running) json_slice(&j, running, "running", running_since, now);
+                running = NULL;
+                break;
+            case PROF_TRACE_ISR_ENTER:
+                if (depth < MAX_NEST) {
+                    isr[depth].t = track_get(&j, s, PROF_TRACE_IN_ISR, (int32_t)e->info[0]);
+                    isr[depth].since = now;
+                }
+                depth++;
+                break;
+            case PROF_TRACE_ISR_EXIT:
+                // An exit with no entry started before the oldest event
+                if (depth == 0) break;
+                depth--;
+                if (depth < MAX_NEST && isr[depth].t)
+                    json_slice(&j, isr[depth].t, isr[depth].t->name, isr[depth].since, now);
+                break;
+            case PROF_TRACE_THREAD_RESUME:
+                json_instant(&j, track_get(&j, s, e->info[0], 0), event_name(e->event), now, e->info);
+                break;
+            default:
+                json_instant(&j, ctx, event_name(e->event), now, e->info);
+                break;
+        }
+    }
+    if (running) json_slice(&j, running, "running", running_since, now);
+
+    fprintf(j.out, "\n]}\n");
+    fclose(j.out);
+    printf("%zu trace events, %.3f ms, %d tracks -> %s\n", events,
+           have_time ? json_ts(&j, now) / 1000.0 : 0.0, j.n_tracks, path);
+    return 0;
+}
+
+//--------------------------------------------------------------------
+// Main
+//--------------------------------------------------------------------
+static void usage(const char *argv0) {
+    fprintf(stderr,
+            "usage: %s [-H host] [-p port] [-u uuid_hex] | [-i dump.bin]\n"
+            "          [-o dump.bin] [-x trace.trx] [-j trace.json]\n", argv0);
+}
+
+int main(int argc, char **argv) {
+    const char *host = "192.168.1.177";
+    const char *in = NULL, *out = NULL, *trx = NULL, *json = NULL;
+    uint16_t port = KP_DEFAULT_PORT;
+    uint32_t uuid = 0;
+    int c;
+
+    while ((c = getopt(argc, argv, "H:p:u:i:o:x:j:h")) != -1) {
+        switch (c) {
+            case 'H': host = optarg; break;
+            case 'p': port = (uint16_t)strtoul(optarg, NULL, 0); break;
+            case 'u': uuid = (uint32_t)strtoul(optarg, NULL, 16); break;
+            case 'i': in = optarg; break;
+            case 'o': out = optarg; break;
+            case 'x': trx = optarg; break;
+            case 'j': json = optarg; break;
+            default: usage(argv[0]); return 2;
+        }
+    }
+
+    uint8_t *buf;
+    size_t len = 0;
+    if (in) {
+        buf = read_file(in, &len);
+    } else {
+        struct sockaddr_in dst;
+        memset(&dst, 0, sizeof(dst));
+        dst.sin_family = AF_INET;
+        dst.sin_port = htons(port);
+        if (inet_pton(AF_INET, host, &dst.sin_addr) != 1) {
+            fprintf(stderr, "bad host %s\n", host);
+            return 2;
+        }
+        buf = fetch(&dst, uuid, &len);
+    }
+    if (buf == NULL) return 1;
+
+    int rc = 0;
+    snapshot_t s;
+    if (out) rc |= write_file(out, buf, len);
+    if (!snapshot_parse(buf, len, &s)) {
+        free(buf);
+        return 1;
+    }
+    print_table(&s);
+    if (trx) rc |= write_file(trx, s.trace, s.trace_size);
+    if (json) rc |= write_json(json, &s);
+    free(buf);
+    return rc;
+}
@@ -0,0 +1,344 @@
+/*
+ * KMBox over UART: Linux client and latency bench for the RP2040 control
+ * UART (rp2040_build/uart_control.cpp).
+ *
+ *   model   Commands through the firmware's framing and protocol core in
+ *           process (common/serial_frame.c + common/kmbox_proto.c): encode,
+ *           decode, handle, encode the reply, decode it. Also prints the
+ *           wire time of one command and its reply at the given baud rate,
+ *           which is what dominates on real hardware.
+ *   pty     The same core as a device on the far side of a pseudo-terminal,
+ *           timed from the client end, next to the kernel UDP loopback on
+ *           127.0.0.1. Both are software-only, so the difference is the
+ *           tty layer against the socket layer.
+ *   target  Round trip to a real device through a serial adapter
+ *           (-d/-b/-u).
+ *
+ * Build with `make` in this directory.
+ */
+#define _GNU_SOURCE
+#include <asm/termbits.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <linux/serial.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+#include "bench_common.h"
+#include "kmbox_proto.h"
+#include "serial_frame.h"
+
+#define REPLY_TIMEOUT_MS 200
+
+// Bits on the wire per byte at 8N1
+#define UART_BITS_PER_BYTE 10
+
+//--------------------------------------------------------------------
+// Serial port
+//--------------------------------------------------------------------
+// Raw 8N1 at any rate the driver can do (termios2/BOTHER), and the low
+// latency flag for USB-serial drivers that batch reads otherwise (the FTDI
+// default holds bytes for up to 16 ms).
+static int serial_setup(int fd, uint32_t baud) {
+    struct termios2 tio;
+    if (ioctl(fd, TCGETS2, &tio) != 0) return -1;
+    tio.c_iflag &= ~(IGNBRK | BRKINT | PARMRK | ISTRIP | INLCR | IGNCR | ICRNL | IXON | IXOFF);
+    tio.c_oflag &= ~OPOST;
+    tio.c_lflag &= ~(ECHO | ECHONL | ICANON | ISIG | IEXTEN);
+    tio.c_cflag &= ~(CSIZE | PARENB | CSTOPB | CRTSCTS | CBAUD);
+    tio.c_cflag |= CS8 | CLOCAL | CREAD | BOTHER;
+    tio.c_ispeed = baud;
+    tio.c_ospeed = baud;
+    tio.c_cc[VMIN] = 1;
+    tio.c_cc[VTIME] = 0;
+    if (ioctl(fd, TCSETS2, &tio) != 0) return -1;
+
+    struct serial_struct ss;
+    if (ioctl(fd, TIOCGSERIAL, &ss) == 0) {
+        ss.flags |= ASYNC_LOW_LATENCY;
+        ioctl(fd, TIOCSSERIAL, &ss);  // Not every driver has it
+    }
+    ioctl(fd, TCFLSH, TCIOFLUSH);
+    return 0;
+}
+
+static bool write_all(int fd, const uint8_t *p, size_t len) {
+    while (len) {
+        ssize_t n = write(fd, p, len);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        p += n;
+        len -= (size_t)n;
+    }
+    return true;
+}
+
+//--------------------------------------------------------------------
+// Client
+//--------------------------------------------------------------------
+typedef struct {
+    sf_decoder_t dec;
+    uint8_t      reply[SF_MAX_PAYLOAD];
+    uint16_t     reply_len;
+    bool         have_reply;
+} client_t;
+
+static void client_frame(void *ctx, const uint8_t *payload, uint16_t len) {
+    client_t *c = ctx;
+    memcpy(c->reply, payload, len);
+    c->reply_len = len;
+    c->have_reply = true;
+}
+
+// Send one command and wait for a frame back
+static bool client_roundtrip(client_t *c, int fd, const uint8_t *pkt, uint16_t len) {
+    uint8_t frame[SF_ENCODED_MAX(SF_MAX_PAYLOAD)], buf[256];
+    uint16_t n = sf_encode(pkt, len, frame, sizeof(frame));
+    if (n == 0 || !write_all(fd, frame, n)) return false;
+
+    c->have_reply = false;
+    struct pollfd pfd = { fd, POLLIN, 0 };
+    while (!c->have_reply) {
+        if (poll(&pfd, 1, REPLY_TIMEOUT_MS) <= 0) return false;
+        ssize_t r = read(fd, buf, sizeof(buf));
+        if (r <= 0) return false;
+        sf_feed(&c->dec, buf, (uint32_t)r, client_frame, c);
+    }
+    return c->reply_len >= KP_HEAD_LEN && memcmp(c->reply + 8, pkt + 8, 8) == 0;
+}
+
+// Connect, then time iterations of move -> acknowledgement
+static int serial_client(const char *label, int fd, uint32_t uuid, uint32_t iterations) {
+    client_t c;
+    memset(&c, 0, sizeof(c));
+    sf_decoder_init(&c.dec);
+
+    uint8_t pkt[256];
+    uint16_t plen = kp_build(pkt, sizeof(pkt), uuid, 0, KP_CMD_CONNECT, 0, NULL, 0);
+    if (!client_roundtrip(&c, fd, pkt, plen)) {
+        fprintf(stderr, "%s: no answer to connect (wrong port, baud or UUID?)\n", label);
+        return 1;
+    }
+
+    uint64_t *rtt = calloc(iterations, sizeof(uint64_t));
+    size_t n = 0;
+    uint32_t lost = 0;
+    for (uint32_t i = 1; i <= iterations; i++) {
+        plen = bench_build_move(pkt, sizeof(pkt), uuid, i, KP_CMD_MOUSE_MOVE);
+        uint64_t t0 = bench_now_ns();
+        bool ok = client_roundtrip(&c, fd, pkt, plen);
+        uint64_t t1 = bench_now_ns();
+        if (!ok) {
+            lost++;
+            continue;
+        }
+        rtt[n++] = t1 - t0;
+    }
+    printf("%s: %u commands, %u lost, frames crc %u malformed %u\n", label, iterations, lost,
+           c.dec.stats.crc_errors, c.dec.stats.malformed);
+    bench_print_stats("  command -> ack RTT", rtt, n);
+    free(rtt);
+    return 0;
+}
+
+//--------------------------------------------------------------------
+// Device: the firmware's receive side, for model and pty
+//--------------------------------------------------------------------
+typedef struct {
+    sf_decoder_t dec;
+    kp_session_t kp;
+    int          fd;           // pty: where replies go
+    uint8_t      out[SF_ENCODED_MAX(SF_MAX_PAYLOAD)];
+    uint16_t     out_len;      // model: last encoded reply
+    uint64_t     handler_ns;
+} device_t;
+
+static bool device_mouse(void *ctx, const kp_mouse_t *m) {
+    device_t *d = ctx;
+    (void)m;
+    d->handler_ns = bench_now_ns();
+    return true;
+}
+
+static void device_frame(void *ctx, const uint8_t *payload, uint16_t len) {
+    device_t *d = ctx;
+    uint8_t reply[64];
+    uint16_t r = kp_handle(&d->kp, payload, len, reply, sizeof(reply));
+    d->out_len = r ? sf_encode(reply, r, d->out, sizeof(d->out)) : 0;
+    if (d->out_len && d->fd >= 0) write_all(d->fd, d->out, d->out_len);
+}
+
+static void device_init(device_t *d, int fd) {
+    memset(d, 0, sizeof(*d));
+    sf_decoder_init(&d->dec);
+    kp_handlers_t h;
+    memset(&h, 0, sizeof(h));
+    h.mouse = device_mouse;
+    h.ctx = d;
+    kp_init(&d->kp, BENCH_UUID, &h);
+    d->fd = fd;
+}
+
+//--------------------------------------------------------------------
+// Model
+//--------------------------------------------------------------------
+static int run_model(uint32_t iterations, uint32_t baud) {
+    device_t dev;
+    client_t cli;
+    device_init(&dev, -1);
+    memset(&cli, 0, sizeof(cli));
+    sf_decoder_init(&cli.dec);
+
+    uint8_t pkt[256], frame[SF_ENCODED_MAX(SF_MAX_PAYLOAD)];
+    uint16_t plen = kp_build(pkt, sizeof(pkt), BENCH_UUID, 0, KP_CMD_CONNECT, 0, NULL, 0);
+    uint16_t flen = sf_encode(pkt, plen, frame, sizeof(frame));
+    sf_feed(&dev.dec, frame, flen, device_frame, &dev);
+    if (dev.out_len == 0) {
+        fprintf(stderr, "model: connect not answered\n");
+        return 1;
+    }
+
+    uint64_t *to_handler = calloc(iterations, sizeof(uint64_t));
+    uint64_t *to_reply = calloc(iterations, sizeof(uint64_t));
+    size_t n = 0;
+    for (uint32_t i = 1; i <= iterations; i++) {
+        plen = bench_build_move(pkt, sizeof(pkt), BENCH_UUID, i, KP_CMD_MOUSE_MOVE);
+
+        dev.handler_ns = 0;
+        cli.have_reply = false;
+        uint64_t t0 = bench_now_ns();
+        flen = sf_encode(pkt, plen, frame, sizeof(frame));
+        sf_feed(&dev.dec, frame, flen, device_frame, &dev);
+        sf_feed(&cli.dec, dev.out, dev.out_len, client_frame, &cli);
+        uint64_t t1 = bench_now_ns();
+        if (!cli.have_reply || !dev.handler_ns || memcmp(cli.reply + 8, pkt + 8, 8) != 0) {
+            fprintf(stderr, "model: bad reply to command %u\n", i);
+            return 1;
+        }
+        to_handler[n] = dev.handler_ns - t0;
+        to_reply[n] = t1 - t0;
+        n++;
+    }
+
+    printf("model: %u commands through serial_frame + kmbox_proto (%u-byte command frames)\n",
+           iterations, flen);
+    bench_print_stats("  encode -> handler", to_handler, n);
+    bench_print_stats("  encode -> reply back", to_reply, n);
+    if (baud) {
+        uint32_t bits = (flen + dev.out_len) * UART_BITS_PER_BYTE;
+        printf("  UART at %.3f Mbaud: %u + %u bytes per command, %.2f us on the wire (%.2f us to the handler)\n",
+               baud / 1e6, flen, dev.out_len, bits * 1e6 / baud, flen * UART_BITS_PER_BYTE * 1e6 / baud);
+    }
+    printf("  stats: frames %u crc %u malformed %u, cmds %u rejected %u\n", dev.dec.stats.frames,
+           dev.dec.stats.crc_errors, dev.dec.stats.malformed, dev.kp.stats.accepted, dev.kp.stats.rejected);
+    free(to_handler);
+    free(to_reply);
+    return 0;
+}
+
+//--------------------------------------------------------------------
+// Pty loopback
+//--------------------------------------------------------------------
+static volatile int pty_stop;
+
+static void *pty_device(void *arg) {
+    device_t *d = arg;
+    uint8_t buf[256];
+    struct pollfd pfd = { d->fd, POLLIN, 0 };
+    while (!pty_stop) {
+        if (poll(&pfd, 1, 100) <= 0) continue;
+        ssize_t n = read(d->fd, buf, sizeof(buf));
+        if (n <= 0) continue;
+        sf_feed(&d->dec, buf, (uint32_t)n, device_frame, d);
+    }
+    return NULL;
+}
+
+static int run_pty(uint32_t iterations) {
+    int master = posix_openpt(O_RDWR | O_NOCTTY);
+    if (master < 0 || grantpt(master) != 0 || unlockpt(master) != 0) {
+        fprintf(stderr, "pty: %s\n", strerror(errno));
+        return 1;
+    }
+    int slave = open(ptsname(master), O_RDWR | O_NOCTTY);
+    // The line discipline sits on the slave side; raw there covers both directions
+    if (slave < 0 || serial_setup(slave, 3000000) != 0) {
+        fprintf(stderr, "pty: %s\n", strerror(errno));
+        close(master);
+        return 1;
+    }
+
+    device_t *dev = malloc(sizeof(*dev));
+    device_init(dev, master);
+    pthread_t th;
+    pthread_create(&th, NULL, pty_device, dev);
+    int rc = serial_client("pty", slave, BENCH_UUID, iterations);
+    pty_stop = 1;
+    pthread_join(th, NULL);
+    printf("  device: frames %u crc %u malformed %u, cmds %u\n", dev->dec.stats.frames,
+           dev->dec.stats.crc_errors, dev->dec.stats.malformed, dev->kp.stats.accepted);
+    free(dev);
+    close(slave);
+    close(master);
+    return rc;
+}
+
+//--------------------------------------------------------------------
+// Main
+//--------------------------------------------------------------------
+static void usage(const char *argv0) {
+    fprintf(stderr,
+            "usage: %s [-m model|pty|target|all] [-n iterations] [-b baud]\n"
+            "          [-d device] [-u uuid_hex]\n", argv0);
+}
+
+int main(int argc, char **argv) {
+    const char *mode = "all";
+    const char *device = "/dev/ttyUSB0";
+    uint32_t iterations = 10000;
+    uint32_t baud = 3000000;
+    uint32_t uuid = 0;
+    int c;
+
+    while ((c = getopt(argc, argv, "m:n:b:d:u:h")) != -1) {
+        switch (c) {
+            case 'm': mode = optarg; break;
+            case 'n': iterations = (uint32_t)strtoul(optarg, NULL, 0); break;
+            case 'b': baud = (uint32_t)strtoul(optarg, NULL, 0); break;
+            case 'd': device = optarg; break;
+            case 'u': uuid = (uint32_t)strtoul(optarg, NULL, 16); break;
+            default: usage(argv[0]); return 2;
+        }
+    }
+    if (iterations == 0) iterations = 1;
+
+    int rc = 0;
+    bool all = strcmp(mode, "all") == 0;
+    if (all || strcmp(mode, "model") == 0) rc |= run_model(iterations, baud);
+    if (all || strcmp(mode, "pty") == 0) {
+        rc |= run_pty(iterations);
+        rc |= bench_udp_loopback(iterations);
+    }
+    if (strcmp(mode, "target") == 0) {
+        int fd = open(device, O_RDWR | O_NOCTTY);
+        if (fd < 0 || serial_setup(fd, baud) != 0) {
+            fprintf(stderr, "%s: %s\n", device, strerror(errno));
+            return 2;
+        }
+        char label[64];
+        snprintf(label, sizeof(label), "target (%s at %u baud)", device, baud);
+        rc |= serial_client(label, fd, uuid, iterations);
+        close(fd);
+    }
+    return rc;
+}